@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "alloc.h"
+
+#define BLOCK_MIN_BYTES 256
+#define BLOCK_MIN_SHIFT 8
+#define BLOCK_CLASS_STEPS 4
+#define BLOCK_NUM_CLASSES ((64 - BLOCK_MIN_SHIFT) * BLOCK_CLASS_STEPS + 1)
+#define BLOCK_DEFAULT_CACHE_LIMIT ((size_t)256 << 20)
+
+/* A cached block stores the free-list link in its own first bytes */
+typedef struct Free_block {
+	struct Free_block* next;
+}Free_block_t;
+
+static struct {
+	pthread_mutex_t lock;
+	Free_block_t* free_lists[BLOCK_NUM_CLASSES];
+	size_t cached_bytes;
+	size_t limit;
+}cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.limit = BLOCK_DEFAULT_CACHE_LIMIT,
+};
+
+/*
+ * PURPOSE: Map a request size to its size class
+ * INPUTS:
+ *      Requested size in bytes, bytes
+ *      Destination for the rounded class size, class_bytes
+ * RETURN:
+ *      Index of the class
+ **/
+static size_t size_class (size_t bytes, size_t* class_bytes) {
+	if (bytes <= BLOCK_MIN_BYTES) {
+		*class_bytes = BLOCK_MIN_BYTES;
+		return 0;
+	}
+	/* bytes lies in (2^lg, 2^(lg + 1)], split into BLOCK_CLASS_STEPS equal steps */
+	const unsigned int lg = 63 - __builtin_clzll((unsigned long long)(bytes - 1));
+	const size_t base = (size_t)1 << lg;
+	const size_t step = base / BLOCK_CLASS_STEPS;
+	const size_t k = (bytes - base + step - 1) / step;
+	*class_bytes = base + k * step;
+	return (lg - BLOCK_MIN_SHIFT) * BLOCK_CLASS_STEPS + k;
+}// end size_class
+
+/*
+ * PURPOSE: Inverse of size_class, the block size of a class index
+ * INPUTS:
+ *      Index of the class, idx
+ * RETURN:
+ *      Size in bytes of every block in the class
+ **/
+static size_t class_size (size_t idx) {
+	if (idx == 0) {
+		return BLOCK_MIN_BYTES;
+	}
+	const size_t base = (size_t)1 << ((idx - 1) / BLOCK_CLASS_STEPS + BLOCK_MIN_SHIFT);
+	return base + ((idx - 1) % BLOCK_CLASS_STEPS + 1) * (base / BLOCK_CLASS_STEPS);
+}// end class_size
+
+/*
+ * PURPOSE: Get a block of at least bytes bytes, aligned to BLOCK_ALIGN
+ * INPUTS:
+ *      Requested size, bytes
+ *      Destination for the real block size to hand back to block_free, block_bytes
+ *      Destination flag, set when the block is known to be zero filled, zeroed
+ * RETURN:
+ *      The block, or NULL when memory is exhausted
+ **/
+void* block_alloc (size_t bytes, size_t* block_bytes, bool* zeroed) {
+	if (!block_bytes || !zeroed || bytes > SIZE_MAX / 2) {
+		return NULL;
+	}
+	size_t class_bytes;
+	const size_t idx = size_class(bytes, &class_bytes);
+
+	pthread_mutex_lock(&cache.lock);
+	Free_block_t* block = cache.free_lists[idx];
+	if (block) {
+		cache.free_lists[idx] = block->next;
+		cache.cached_bytes -= class_bytes;
+	}
+	pthread_mutex_unlock(&cache.lock);
+
+	*block_bytes = class_bytes;
+	if (block) {
+		*zeroed = false;
+		return block;
+	}
+
+	if (class_bytes >= BLOCK_MMAP_MIN) {
+		void* p = mmap(NULL, class_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			return NULL;
+		}
+		*zeroed = true;
+		return p;
+	}
+
+	void* p = NULL;
+	if (posix_memalign(&p, BLOCK_ALIGN, class_bytes) != 0) {
+		return NULL;
+	}
+	*zeroed = false;
+	return p;
+}// end block_alloc
+
+/*
+ * PURPOSE: Release a block to the OS
+ * INPUTS:
+ *      Block from block_alloc, block
+ *      Size reported by block_alloc, block_bytes
+ * RETURN:
+ *      void
+ **/
+static void release_block (void* block, size_t block_bytes) {
+	if (block_bytes >= BLOCK_MMAP_MIN) {
+		munmap(block, block_bytes);
+	}
+	else {
+		free(block);
+	}
+}// end release_block
+
+/*
+ * PURPOSE: Return a block, caching it for reuse while the cache has room
+ * INPUTS:
+ *      Block from block_alloc, block
+ *      Size reported by block_alloc, block_bytes
+ * RETURN:
+ *      void
+ **/
+void block_free (void* block, size_t block_bytes) {
+	if (!block) {
+		return;
+	}
+	size_t class_bytes;
+	const size_t idx = size_class(block_bytes, &class_bytes);
+
+	pthread_mutex_lock(&cache.lock);
+	if (class_bytes == block_bytes && cache.cached_bytes + class_bytes <= cache.limit) {
+		Free_block_t* node = block;
+		node->next = cache.free_lists[idx];
+		cache.free_lists[idx] = node;
+		cache.cached_bytes += class_bytes;
+		block = NULL;
+	}
+	pthread_mutex_unlock(&cache.lock);
+
+	if (block) {
+		release_block(block, block_bytes);
+	}
+}// end block_free
+
+/*
+ * PURPOSE: Release every cached block to the OS
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      void
+ **/
+void block_cache_trim (void) {
+	pthread_mutex_lock(&cache.lock);
+	for (size_t idx = 0; idx < BLOCK_NUM_CLASSES; ++idx) {
+		Free_block_t* node = cache.free_lists[idx];
+		cache.free_lists[idx] = NULL;
+		while (node) {
+			Free_block_t* next = node->next;
+			release_block(node, class_size(idx));
+			node = next;
+		}
+	}
+	cache.cached_bytes = 0;
+	pthread_mutex_unlock(&cache.lock);
+}// end block_cache_trim
+
+/*
+ * PURPOSE: Report how many bytes sit in the free lists
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      Cached bytes
+ **/
+size_t block_cache_bytes (void) {
+	pthread_mutex_lock(&cache.lock);
+	const size_t bytes = cache.cached_bytes;
+	pthread_mutex_unlock(&cache.lock);
+	return bytes;
+}// end block_cache_bytes
+
+/*
+ * PURPOSE: Change the byte budget of the free lists, trimming if it shrank
+ * INPUTS:
+ *      New budget in bytes, bytes
+ * RETURN:
+ *      void
+ **/
+void block_cache_set_limit (size_t bytes) {
+	pthread_mutex_lock(&cache.lock);
+	cache.limit = bytes;
+	const bool over = cache.cached_bytes > bytes;
+	pthread_mutex_unlock(&cache.lock);
+	if (over) {
+		block_cache_trim();
+	}
+}// end block_cache_set_limit
@@ -0,0 +1,25 @@
+#ifndef _ALLOC_H_
+#define _ALLOC_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Every block handed out is aligned to at least this many bytes */
+#define BLOCK_ALIGN 64
+
+/*
+ * Size-class block allocator behind create_matrix/destroy_matrix. Requests
+ * are rounded up to one of four classes per power of two; freed blocks are
+ * kept on per-class free lists (up to a global byte budget) so short-lived
+ * result matrices reuse warm, already-faulted memory. Blocks from
+ * BLOCK_MMAP_MIN up are taken straight from mmap and arrive zero filled.
+ */
+#define BLOCK_MMAP_MIN (1u << 20)
+
+void* block_alloc (size_t bytes, size_t* block_bytes, bool* zeroed);
+void block_free (void* block, size_t block_bytes);
+void block_cache_trim (void);
+size_t block_cache_bytes (void);
+void block_cache_set_limit (size_t bytes);
+
+#endif
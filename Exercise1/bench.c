@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "matrix.h"
+#include "kernels.h"
+#include "pool.h"
+#include "alloc.h"
+
+/*
+ * Benchmark driver for the matrix.c entry points. For every operation and
+ * every size in a powers-of-four sweep it repeats the call until roughly
+ * --budget-ms of samples are collected, then reports latency percentiles,
+ * ns per element and effective bandwidth from the bytes the call must touch.
+ */
+
+#define BENCH_MAX_SAMPLES 1000
+#define BENCH_MIN_SAMPLES 3
+
+typedef enum {
+	FORMAT_TABLE,
+	FORMAT_CSV,
+	FORMAT_JSON
+}Format_t;
+
+typedef struct {
+	size_t min_bytes;
+	size_t max_bytes;
+	unsigned int threads;
+	double budget_ms;
+	Format_t format;
+	const char* ops;
+	const char* file;
+}Bench_options_t;
+
+/* Matrices shared by the operations for one size; a is random, b = a, c scratch */
+typedef struct {
+	Matrix_t* a;
+	Matrix_t* b;
+	Matrix_t* c;
+	const char* file;
+	const char* packed_file;	/* a written by write_matrix_packed, for unpack */
+}Bench_state_t;
+
+typedef struct {
+	const char* name;
+	unsigned int bytes_per_element;	/* memory traffic per element, for GB/s */
+	bool (*run) (Bench_state_t* st);
+}Bench_op_t;
+
+static bool run_create (Bench_state_t* st) {
+	Matrix_t* m = NULL;
+	if (!create_matrix(&m, "bench_create", st->a->rows, st->a->cols)) {
+		return false;
+	}
+	destroy_matrix(&m);
+	return true;
+}
+
+static bool run_add (Bench_state_t* st) {
+	return add_matrices(st->a, st->b, st->c);
+}
+
+static bool run_shift (Bench_state_t* st) {
+	return bitwise_shift_matrix(st->c, 'r', 1);
+}
+
+static bool run_duplicate (Bench_state_t* st) {
+	return duplicate_matrix(st->a, st->c);
+}
+
+static bool run_equal (Bench_state_t* st) {
+	return equal_matrices(st->a, st->b);
+}
+
+/* drops the cached aggregates first, so every run times the full pass */
+static bool run_sum (Bench_state_t* st) {
+	uint64_t sum;
+	st->a->buffer->aggregated = false;
+	return sum_matrix(st->a, &sum);
+}
+
+/* drops the cached hash first, so every run times the full pass */
+static bool run_hash (Bench_state_t* st) {
+	uint64_t hash;
+	st->a->buffer->hashed = false;
+	return hash_matrix(st->a, &hash);
+}
+
+static bool run_transpose (Bench_state_t* st) {
+	return transpose_matrix(st->a, st->c);
+}
+
+static bool run_random (Bench_state_t* st) {
+	return random_matrix(st->c, 0, 1000);
+}
+
+static bool run_write (Bench_state_t* st) {
+	return write_matrix(st->file, st->a);
+}
+
+/* read maps the file, so sum it as well to charge for actually touching the data */
+static bool run_read (Bench_state_t* st) {
+	Matrix_t* m = NULL;
+	uint64_t sum;
+	if (!read_matrix(st->file, &m)) {
+		return false;
+	}
+	const bool ok = sum_matrix(m, &sum);
+	destroy_matrix(&m);
+	return ok;
+}
+
+static bool run_pack (Bench_state_t* st) {
+	return write_matrix_packed(st->packed_file, st->a, WRITE_POLICY_BUFFERED, PACK_MODE_FOR);
+}
+
+static bool run_unpack (Bench_state_t* st) {
+	Matrix_t* m = NULL;
+	if (!read_matrix(st->packed_file, &m)) {
+		return false;
+	}
+	destroy_matrix(&m);
+	return true;
+}
+
+static const Bench_op_t bench_ops[] = {
+	{ "create",    0,  run_create },	/* an empty CSR matrix, only the row offsets are written */
+	{ "add",       12, run_add },
+	{ "shift",     8,  run_shift },
+	{ "duplicate", 0,  run_duplicate },	/* shares a's buffer, no element traffic */
+	{ "equal",     8,  run_equal },
+	{ "sum",       4,  run_sum },
+	{ "hash",      4,  run_hash },
+	{ "transpose", 8,  run_transpose },
+	{ "random",    4,  run_random },
+	{ "write",     4,  run_write },
+	{ "read",      4,  run_read },
+	{ "pack",      4,  run_pack },	/* GB/s of uncompressed elements */
+	{ "unpack",    4,  run_unpack },
+};
+
+/*
+ * PURPOSE: Read the monotonic clock
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      Nanoseconds since an arbitrary epoch
+ **/
+static uint64_t now_ns (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}// end now_ns
+
+static int compare_u64 (const void* a, const void* b) {
+	const uint64_t x = *(const uint64_t*)a;
+	const uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * PURPOSE: Pick the p-th percentile of sorted samples (nearest rank)
+ * INPUTS:
+ *      Sorted samples, samples
+ *      Number of samples, n
+ *      Percentile between 0 and 100, p
+ * RETURN:
+ *      The sample at that rank
+ **/
+static uint64_t percentile (const uint64_t* samples, size_t n, double p) {
+	size_t rank = (size_t)(p / 100.0 * n + 0.999999);
+	if (rank == 0) {
+		rank = 1;
+	}
+	return samples[(rank > n ? n : rank) - 1];
+}// end percentile
+
+/*
+ * PURPOSE: Check whether an operation was selected with --ops
+ * INPUTS:
+ *      Comma separated list or NULL for all, ops
+ *      Operation name, name
+ * RETURN:
+ *      If the operation should run, return true.
+ *      Else, return false.
+ **/
+static bool op_selected (const char* ops, const char* name) {
+	if (!ops) {
+		return true;
+	}
+	const size_t len = strlen(name);
+	for (const char* p = ops; *p; ) {
+		const char* end = strchr(p, ',');
+		const size_t tok = end ? (size_t)(end - p) : strlen(p);
+		if (tok == len && strncmp(p, name, len) == 0) {
+			return true;
+		}
+		p += tok + (end ? 1 : 0);
+	}
+	return false;
+}// end op_selected
+
+static void usage (const char* prog) {
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  --min-bytes N    smallest matrix in bytes (default 4096)\n"
+		"  --max-bytes N    largest matrix in bytes, K/M/G suffixes allowed (default 256M)\n"
+		"  --threads N      worker threads (default all CPUs)\n"
+		"  --budget-ms N    time spent sampling each op and size (default 200)\n"
+		"  --format F       table, csv or json (default table)\n"
+		"  --ops a,b,...    only run these ops (%s", prog, bench_ops[0].name);
+	for (size_t i = 1; i < sizeof(bench_ops) / sizeof(bench_ops[0]); ++i) {
+		fprintf(stderr, ",%s", bench_ops[i].name);
+	}
+	fprintf(stderr, ")\n  --file PATH      scratch file for read/write (default bench_matrix.tmp)\n");
+}
+
+/*
+ * PURPOSE: Parse a byte count with an optional K, M or G suffix
+ * INPUTS:
+ *      Text to parse, text
+ *      Destination, out
+ * RETURN:
+ *      If the text is not a valid size, return false.
+ *      Else, return true.
+ **/
+static bool parse_bytes (const char* text, size_t* out) {
+	char* end = NULL;
+	unsigned long long v = strtoull(text, &end, 10);
+	switch (*end) {
+		case 'G': case 'g': v <<= 10; /* fall through */
+		case 'M': case 'm': v <<= 10; /* fall through */
+		case 'K': case 'k': v <<= 10; ++end; break;
+		default: break;
+	}
+	if (end == text || *end != '\0') {
+		return false;
+	}
+	*out = v;
+	return true;
+}// end parse_bytes
+
+static bool parse_options (int argc, char** argv, Bench_options_t* opts) {
+	static const struct option long_opts[] = {
+		{ "min-bytes", required_argument, NULL, 'n' },
+		{ "max-bytes", required_argument, NULL, 'x' },
+		{ "threads",   required_argument, NULL, 't' },
+		{ "budget-ms", required_argument, NULL, 'b' },
+		{ "format",    required_argument, NULL, 'F' },
+		{ "ops",       required_argument, NULL, 'o' },
+		{ "file",      required_argument, NULL, 'f' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+		switch (c) {
+			case 'n': if (!parse_bytes(optarg, &opts->min_bytes)) return false; break;
+			case 'x': if (!parse_bytes(optarg, &opts->max_bytes)) return false; break;
+			case 't': opts->threads = strtoul(optarg, NULL, 10); break;
+			case 'b': opts->budget_ms = strtod(optarg, NULL); break;
+			case 'o': opts->ops = optarg; break;
+			case 'f': opts->file = optarg; break;
+			case 'F':
+				if (strcmp(optarg, "table") == 0) opts->format = FORMAT_TABLE;
+				else if (strcmp(optarg, "csv") == 0) opts->format = FORMAT_CSV;
+				else if (strcmp(optarg, "json") == 0) opts->format = FORMAT_JSON;
+				else return false;
+				break;
+			default:
+				return false;
+		}
+	}
+	return opts->min_bytes >= 16 && opts->min_bytes <= opts->max_bytes && opts->budget_ms > 0;
+}
+
+int main (int argc, char** argv) {
+	Bench_options_t opts = {
+		.min_bytes = 4096,
+		.max_bytes = (size_t)256 << 20,
+		.threads = 0,
+		.budget_ms = 200,
+		.format = FORMAT_TABLE,
+		.ops = NULL,
+		.file = "bench_matrix.tmp",
+	};
+	if (!parse_options(argc, argv, &opts)) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (!pool_init(opts.threads)) {
+		return 1;
+	}
+
+	uint64_t* samples = malloc(sizeof(uint64_t) * BENCH_MAX_SAMPLES);
+	char* packed_file = malloc(strlen(opts.file) + sizeof(".packed"));
+	if (!samples || !packed_file) {
+		return 1;
+	}
+	strcpy(packed_file, opts.file);
+	strcat(packed_file, ".packed");
+
+	if (opts.format == FORMAT_TABLE) {
+		printf("# isa=%s threads=%u\n", kernel_isa_name(), pool_size());
+		printf("%-10s %12s %10s %10s %10s %10s %10s %8s %9s\n",
+			"op", "elements", "samples", "min_us", "p50_us", "p90_us", "p99_us", "ns/elem", "GB/s");
+	}
+	else if (opts.format == FORMAT_CSV) {
+		printf("op,rows,cols,elements,bytes,samples,min_ns,p50_ns,p90_ns,p99_ns,max_ns,ns_per_element,gb_per_s,isa,threads\n");
+	}
+	else {
+		printf("{\"isa\":\"%s\",\"threads\":%u,\"results\":[", kernel_isa_name(), pool_size());
+	}
+
+	bool first_json = true;
+	int rc = 0;
+	for (size_t bytes = opts.min_bytes; bytes <= opts.max_bytes && rc == 0; bytes *= 4) {
+		/* square matrices whose size is the nearest power of four elements */
+		unsigned int side = 1;
+		while ((size_t)side * side * 4 * sizeof(unsigned int) <= bytes) {
+			side *= 2;
+		}
+		const size_t elements = (size_t)side * side;
+
+		Bench_state_t st = { .file = opts.file, .packed_file = packed_file };
+		/* the ops measure the dense kernels, so c is expanded up front like a and b */
+		if (!create_matrix(&st.a, "bench_a", side, side) || !create_matrix(&st.b, "bench_b", side, side)
+			|| !create_matrix(&st.c, "bench_c", side, side) || !densify_matrix(st.c, true)) {
+			fprintf(stderr, "cannot allocate %u x %u matrices\n", side, side);
+			rc = 1;
+		}
+		else {
+			random_matrix(st.a, 0, 1000);
+			/* b needs its own copy, or equal would short-circuit on the shared buffer */
+			duplicate_matrix(st.a, st.b);
+			unshare_matrix(st.b, true);
+			write_matrix(st.file, st.a);
+			write_matrix_packed(st.packed_file, st.a, WRITE_POLICY_BUFFERED, PACK_MODE_FOR);
+		}
+
+		for (size_t op = 0; op < sizeof(bench_ops) / sizeof(bench_ops[0]) && rc == 0; ++op) {
+			if (!op_selected(opts.ops, bench_ops[op].name)) {
+				continue;
+			}
+			size_t n = 0;
+			uint64_t spent = 0;
+			const uint64_t budget = (uint64_t)(opts.budget_ms * 1e6);
+			/* one untimed warm-up call to fault pages in and settle the caches */
+			bench_ops[op].run(&st);
+			while (n < BENCH_MAX_SAMPLES && (n < BENCH_MIN_SAMPLES || spent < budget)) {
+				const uint64_t t0 = now_ns();
+				if (!bench_ops[op].run(&st)) {
+					fprintf(stderr, "%s failed at %zu elements\n", bench_ops[op].name, elements);
+					rc = 1;
+					break;
+				}
+				samples[n] = now_ns() - t0;
+				spent += samples[n++];
+			}
+			if (rc) {
+				break;
+			}
+			qsort(samples, n, sizeof(uint64_t), compare_u64);
+			const uint64_t p50 = percentile(samples, n, 50);
+			const double ns_per_elem = (double)p50 / elements;
+			const double gbps = (double)elements * bench_ops[op].bytes_per_element / (double)p50;
+
+			if (opts.format == FORMAT_TABLE) {
+				printf("%-10s %12zu %10zu %10.1f %10.1f %10.1f %10.1f %8.3f %9.2f\n",
+					bench_ops[op].name, elements, n, samples[0] / 1e3, p50 / 1e3,
+					percentile(samples, n, 90) / 1e3, percentile(samples, n, 99) / 1e3, ns_per_elem, gbps);
+			}
+			else if (opts.format == FORMAT_CSV) {
+				printf("%s,%u,%u,%zu,%zu,%zu,%llu,%llu,%llu,%llu,%llu,%.4f,%.3f,%s,%u\n",
+					bench_ops[op].name, side, side, elements, elements * sizeof(unsigned int), n,
+					(unsigned long long)samples[0], (unsigned long long)p50,
+					(unsigned long long)percentile(samples, n, 90), (unsigned long long)percentile(samples, n, 99),
+					(unsigned long long)samples[n - 1], ns_per_elem, gbps, kernel_isa_name(), pool_size());
+			}
+			else {
+				printf("%s{\"op\":\"%s\",\"rows\":%u,\"cols\":%u,\"elements\":%zu,\"samples\":%zu,"
+					"\"min_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu,"
+					"\"ns_per_element\":%.4f,\"gb_per_s\":%.3f}",
+					first_json ? "" : ",", bench_ops[op].name, side, side, elements, n,
+					(unsigned long long)samples[0], (unsigned long long)p50,
+					(unsigned long long)percentile(samples, n, 90), (unsigned long long)percentile(samples, n, 99),
+					(unsigned long long)samples[n - 1], ns_per_elem, gbps);
+				first_json = false;
+			}
+			fflush(stdout);
+		}
+
+		destroy_matrix(&st.a);
+		destroy_matrix(&st.b);
+		destroy_matrix(&st.c);
+		block_cache_trim();
+		unlink(opts.file);
+		unlink(packed_file);
+	}
+
+	if (opts.format == FORMAT_JSON) {
+		printf("]}\n");
+	}
+	free(samples);
+	free(packed_file);
+	pool_destroy();
+	return rc;
+}
@@ -5,68 +5,43 @@
 
 #include "command.h"
 
-#define MAX_CMD_COUNT 50
-#define MAX_CMD_LEN 25
-
 /*
- * PURPOSE: Interprets input and creates a command
+ * PURPOSE: Split input into whitespace separated tokens in place. Separators
+ *      are overwritten with NUL and cmd->cmds points at the start of each token.
  * INPUTS:
- *      User input to analyze, input
+ *      User input to analyze, modified in place, input
  *      Command to populate, cmd
  * RETURN:
- *      If there is an error parsing input, return false.
+ *      If there is an error parsing input (too many tokens), return false.
  *      Else, return true.
  **/
-bool parse_user_input (const char* input, Commands_t** cmd) {
+bool parse_user_input (char* input, Commands_t* cmd) {
 	
     if(!input || !cmd ){
         perror("parse_user_input: bad input\n");
         return false;
     }
 
-	char *string = strdup(input);
-	
-	*cmd = calloc (1,sizeof(Commands_t));
-	(*cmd)->cmds = calloc(MAX_CMD_COUNT,sizeof(char*));
-
-	unsigned int i = 0;
-	char *token;
-	token = strtok(string, " \n");
-	for (; token != NULL && i < MAX_CMD_COUNT; ++i) {
-		(*cmd)->cmds[i] = calloc(MAX_CMD_LEN,sizeof(char));
-		if (!(*cmd)->cmds[i]) {
-			perror("Allocation Error\n");
+	cmd->num_cmds = 0;
+	char* p = input;
+	for (;;) {
+		while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+			++p;
+		}
+		if (*p == '\0') {
+			return true;
+		}
+		if (cmd->num_cmds == MAX_CMD_COUNT) {
+			printf("More than %d tokens on one line\n", MAX_CMD_COUNT);
 			return false;
-		}	
-		strncpy((*cmd)->cmds[i],token, strlen(token) + 1);
-		(*cmd)->num_cmds++;
-		token = strtok(NULL, " \n");
+		}
+		cmd->cmds[cmd->num_cmds++] = p;
+		while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+			++p;
+		}
+		if (*p == '\0') {
+			return true;
+		}
+		*p++ = '\0';
 	}
-	free(string);
-	return true;
 }// end parse_user_input
-
-/*
- * PURPOSE: Free up cmds
- * INPUTS:
- *      Command master-list to free, cmd
- * RETURN:
- *      void
- **/
-void destroy_commands(Commands_t** cmd) {
-
-    if(!cmd || !*(cmd)){
-        perror("destroy_commands: bad input");
-        return;
-    }
-
-	for (int i = 0; i < (*cmd)->num_cmds; ++i) {
-//        if((*cmd)->cmds[i]){
-            free((*cmd)->cmds[i]);
-//        }
-	}
-//	free((*cmd)->cmds);
-//	free((*cmd));
-	*cmd = NULL;
-}// end destroy_commands
-
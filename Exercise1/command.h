@@ -1,12 +1,20 @@
 #ifndef _COMMAND_H_
 #define _COMMAND_H_
 
+#include <stdbool.h>
+
+#define MAX_CMD_COUNT 50
+
+/*
+ * Tokens of one command line. cmds[i] point into the line handed to
+ * parse_user_input, which is split in place, so the line must outlive
+ * the Commands_t and nothing needs freeing.
+ */
 typedef struct {
 	unsigned int num_cmds;
-	char** cmds;
+	char* cmds[MAX_CMD_COUNT];
 }Commands_t;
 
-bool parse_user_input (const char* input, Commands_t** cmd);
-void destroy_commands(Commands_t** cmd);
+bool parse_user_input (char* input, Commands_t* cmd);
 
 #endif
@@ -0,0 +1,1050 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+#include "dispatch.h"
+#include "matrix.h"
+#include "stats.h"
+#include "expr.h"
+#include "io.h"
+#include "workspace.h"
+#include "stream.h"
+
+/*
+ * A command handler receives the whole token list (cmds[0] is the command
+ * name) after its arity has been checked against the table.
+ */
+typedef bool (*Command_handler_t) (Commands_t* cmd, Registry_t* reg);
+
+typedef struct {
+	const char* name;
+	unsigned int min_tokens;
+	unsigned int max_tokens;
+	Command_handler_t handler;
+	const char* usage;
+}Command_entry_t;
+
+/* set by dispatch_set_quiet, silences progress messages but not results or errors */
+static bool quiet = false;
+
+/* set by dispatch_set_workspace, NULL when the session has no workspace file */
+static Workspace_t* workspace = NULL;
+
+/*
+ * PURPOSE: Print a progress message unless quiet mode is on
+ * INPUTS:
+ *      printf format and arguments, fmt
+ * RETURN:
+ *      void
+ **/
+static void chatter (const char* fmt, ...) {
+	if (quiet) {
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}// end chatter
+
+/*
+ * PURPOSE: Look up a matrix for a command, reporting when it is missing
+ * INPUTS:
+ *      Registry to search, reg
+ *      Name of the matrix, name
+ * RETURN:
+ *      The matrix, or NULL after printing a message
+ **/
+static Matrix_t* require_matrix (Registry_t* reg, const char* name) {
+	Matrix_t* m = registry_find(reg, name);
+	if (!m) {
+		printf("Matrix (%s) doesn't exist\n", name);
+	}
+	return m;
+}// end require_matrix
+
+/*
+ * PURPOSE: Parse a non-negative number argument, reporting when it is malformed
+ * INPUTS:
+ *      Argument text, text
+ *      Largest value allowed, max
+ *      Destination for the value, value
+ * RETURN:
+ *      If the text is not a number up to max, return false after printing a message.
+ *      Else, return true.
+ **/
+static bool parse_number (const char* text, unsigned long long max, unsigned long long* value) {
+	char* end = NULL;
+	*value = strtoull(text, &end, 0);
+	if (!end || end == text || *end != '\0' || text[0] == '-' || *value > max) {
+		printf("Invalid number %s\n", text);
+		return false;
+	}
+	return true;
+}// end parse_number
+
+/*
+ * PURPOSE: Hand a freshly built matrix to the registry, destroying it on failure
+ * INPUTS:
+ *      Registry to update, reg
+ *      Matrix to register, m
+ * RETURN:
+ *      If the registry could not take the matrix, return false.
+ *      Else, return true.
+ **/
+static bool register_matrix (Registry_t* reg, Matrix_t* m) {
+	if (!registry_insert(reg, m)) {
+		printf("Failure on adding matrix %s to the registry\n", m->name);
+		destroy_matrix(&m);
+		return false;
+	}
+	return true;
+}// end register_matrix
+
+/*
+ * Command handlers. Each returns true when the command did its work and
+ * false (after printing why) when it failed.
+ */
+
+/* display <name> [<n>]: print a matrix, or only its first and last n rows and columns */
+static bool cmd_display (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* m = require_matrix(reg, cmd->cmds[1]);
+	unsigned long long window = 0;
+	if (!m || (cmd->num_cmds == 3 && !parse_number(cmd->cmds[2], SIZE_MAX / 2, &window))) {
+		return false;
+	}
+	display_matrix(m, window);
+	return true;
+}
+
+/* add <a> <b> <result>: element-wise sum into a new matrix */
+static bool cmd_add (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* mat1 = require_matrix(reg, cmd->cmds[1]);
+	Matrix_t* mat2 = require_matrix(reg, cmd->cmds[2]);
+	if (!mat1 || !mat2) {
+		return false;
+	}
+	/* starts as an empty CSR matrix; add_matrices picks the result's format */
+	Matrix_t* c = NULL;
+	if (!create_matrix(&c, cmd->cmds[3], mat1->rows, mat1->cols)) {
+		printf("Failure to create the result Matrix (%s)\n", cmd->cmds[3]);
+		return false;
+	}
+	if (!add_matrices(mat1, mat2, c)) {
+		printf("Failure to add %s with %s into %s\n", mat1->name, mat2->name, c->name);
+		destroy_matrix(&c);
+		return false;
+	}
+	return register_matrix(reg, c);
+}
+
+/* eval <result> = <expression>: fused element-wise expression, e.g. (a + b) << 2 + c */
+static bool cmd_eval (Commands_t* cmd, Registry_t* reg) {
+	if (strcmp(cmd->cmds[2], "=") != 0) {
+		printf("usage: eval <result> = <expression>\n");
+		return false;
+	}
+	/* the tokenizer split the expression on blanks; glue it back together for the parser */
+	size_t len = 1;
+	for (unsigned int i = 3; i < cmd->num_cmds; ++i) {
+		len += strlen(cmd->cmds[i]) + 1;
+	}
+	char* text = malloc(len);
+	if (!text) {
+		perror("cmd_eval: allocation error\n");
+		return false;
+	}
+	char* pos = text;
+	for (unsigned int i = 3; i < cmd->num_cmds; ++i) {
+		const size_t n = strlen(cmd->cmds[i]);
+		memcpy(pos, cmd->cmds[i], n);
+		pos += n;
+		*pos++ = ' ';
+	}
+	*pos = '\0';
+
+	Expr_t expr;
+	const bool parsed = parse_expression(text, reg, &expr);
+	free(text);
+	if (!parsed) {
+		return false;
+	}
+
+	/* an existing u32 result of the right shape is overwritten in place, with no allocation */
+	Matrix_t* dest = registry_find(reg, cmd->cmds[1]);
+	if (dest && dest->rows == expr.rows && dest->cols == expr.cols && dest->type == MATRIX_TYPE_U32) {
+		if (!evaluate_expression(&expr, dest)) {
+			printf("Failure to evaluate into %s\n", dest->name);
+			return false;
+		}
+	}
+	else {
+		dest = NULL;
+		if (!create_matrix_uninit(&dest, cmd->cmds[1], expr.rows, expr.cols)) {
+			printf("Failure to create the result Matrix (%s)\n", cmd->cmds[1]);
+			return false;
+		}
+		if (!evaluate_expression(&expr, dest)) {
+			printf("Failure to evaluate into %s\n", dest->name);
+			destroy_matrix(&dest);
+			return false;
+		}
+		if (!register_matrix(reg, dest)) {
+			return false;
+		}
+	}
+	chatter("Matrix (%s) evaluated\n", cmd->cmds[1]);
+	return true;
+}
+
+/* mul <a> <b> <result>: matrix product into a new matrix */
+static bool cmd_mul (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* mat1 = require_matrix(reg, cmd->cmds[1]);
+	Matrix_t* mat2 = require_matrix(reg, cmd->cmds[2]);
+	if (!mat1 || !mat2) {
+		return false;
+	}
+	Matrix_t* c = NULL;
+	if (!create_matrix_uninit(&c, cmd->cmds[3], mat1->rows, mat2->cols)) {
+		printf("Failure to create the result Matrix (%s)\n", cmd->cmds[3]);
+		return false;
+	}
+	if (!multiply_matrices(mat1, mat2, c)) {
+		printf("Failure to multiply %s with %s into %s\n", mat1->name, mat2->name, c->name);
+		destroy_matrix(&c);
+		return false;
+	}
+	if (!register_matrix(reg, c)) {
+		return false;
+	}
+	chatter("Matrix (%s) is the product of %s and %s\n", cmd->cmds[3], cmd->cmds[1], cmd->cmds[2]);
+	return true;
+}
+
+/* transpose <src> <result>: rows become columns, in src's format */
+static bool cmd_transpose (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* src = require_matrix(reg, cmd->cmds[1]);
+	if (!src) {
+		return false;
+	}
+	Matrix_t* dest = NULL;
+	if (!create_matrix(&dest, cmd->cmds[2], src->cols, src->rows)) {
+		printf("Failure to create the result Matrix (%s)\n", cmd->cmds[2]);
+		return false;
+	}
+	if (!transpose_matrix(src, dest)) {
+		printf("Failure to transpose %s into %s\n", src->name, dest->name);
+		destroy_matrix(&dest);
+		return false;
+	}
+	return register_matrix(reg, dest);
+}
+
+/* cast <src> <result> <type>: copy a matrix converting its elements to another type */
+static bool cmd_cast (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* src = require_matrix(reg, cmd->cmds[1]);
+	if (!src) {
+		return false;
+	}
+	Matrix_type_t type;
+	if (!parse_matrix_type(cmd->cmds[3], &type)) {
+		printf("usage: cast <src> <result> u8|u16|u32|u64|f32|f64\n");
+		return false;
+	}
+	Matrix_t* dest = NULL;
+	if (!cast_matrix(src, cmd->cmds[2], type, &dest)) {
+		printf("Failure to cast %s to %s\n", src->name, cmd->cmds[3]);
+		return false;
+	}
+	if (!register_matrix(reg, dest)) {
+		return false;
+	}
+	chatter("Matrix (%s) is %s cast to %s\n", dest->name, src->name, matrix_type_name(type));
+	return true;
+}
+
+/* sum <name>: print the 64-bit sum of the elements, or the double sum of float ones */
+static bool cmd_sum (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* m = require_matrix(reg, cmd->cmds[1]);
+	if (m && matrix_type_is_real(m->type)) {
+		double real = 0;
+		if (!sum_matrix_real(m, &real)) {
+			printf("Sum Failed\n");
+			return false;
+		}
+		printf("Sum of %s is %.17g\n", m->name, real);
+		return true;
+	}
+	uint64_t sum = 0;
+	if (!m || !sum_matrix(m, &sum)) {
+		printf("Sum Failed\n");
+		return false;
+	}
+	printf("Sum of %s is %llu\n", m->name, (unsigned long long)sum);
+	return true;
+}
+
+/* summary <name>: sum, min, max and non-zero count, O(1) while the cached aggregates hold */
+static bool cmd_summary (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* m = require_matrix(reg, cmd->cmds[1]);
+	Matrix_aggregates_t aggregates;
+	if (!m || !aggregate_matrix(m, &aggregates)) {
+		printf("Summary Failed\n");
+		return false;
+	}
+	printf("Matrix (%s): sum %llu, min %u, max %u, %llu of %llu non-zero\n", m->name,
+		(unsigned long long)aggregates.sum, aggregates.min, aggregates.max,
+		(unsigned long long)aggregates.nonzero, (unsigned long long)m->rows * m->cols);
+	return true;
+}
+
+/* duplicate <src> <dest>: copy a matrix under a new name, sharing its data until either is written */
+static bool cmd_duplicate (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* mat1 = require_matrix(reg, cmd->cmds[1]);
+	if (!mat1) {
+		printf("Duplication Failed\n");
+		return false;
+	}
+	Matrix_t* dup_mat = NULL;
+	if (!share_matrix(mat1, cmd->cmds[2], &dup_mat)) {
+		printf("Failure on duplicate\n");
+		return false;
+	}
+	if (!register_matrix(reg, dup_mat)) {
+		return false;
+	}
+	chatter("Duplication of %s into %s finished\n", cmd->cmds[1], cmd->cmds[2]);
+	return true;
+}
+
+/* equal <a> <b>: compare dimensions and contents */
+static bool cmd_equal (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* mat1 = require_matrix(reg, cmd->cmds[1]);
+	Matrix_t* mat2 = require_matrix(reg, cmd->cmds[2]);
+	if (!mat1 || !mat2) {
+		printf("Equal Failed\n");
+		return false;
+	}
+	if (equal_matrices(mat1, mat2)) {
+		printf("SAME DATA IN BOTH\n");
+	}
+	else {
+		printf("DIFFERENT DATA IN BOTH\n");
+	}
+	return true;
+}
+
+/* A registered matrix and its content hash, sorted so identical matrices are adjacent and in name order */
+typedef struct {
+	Matrix_t* m;
+	uint64_t hash;
+}Hashed_matrix_t;
+
+static int compare_hashed (const void* a, const void* b) {
+	const Hashed_matrix_t* x = a;
+	const Hashed_matrix_t* y = b;
+	if (x->m->rows != y->m->rows) {
+		return x->m->rows < y->m->rows ? -1 : 1;
+	}
+	if (x->m->cols != y->m->cols) {
+		return x->m->cols < y->m->cols ? -1 : 1;
+	}
+	if (x->hash != y->hash) {
+		return x->hash < y->hash ? -1 : 1;
+	}
+	return strcmp(x->m->name, y->m->name);
+}
+
+/* Whether two sorted entries could hold the same elements */
+static bool same_shape_and_hash (const Hashed_matrix_t* x, const Hashed_matrix_t* y) {
+	return x->m->rows == y->m->rows && x->m->cols == y->m->cols && x->hash == y->hash;
+}
+
+/* dedup [share]: list groups of matrices holding the same elements; share makes each group share one copy */
+static bool cmd_dedup (Commands_t* cmd, Registry_t* reg) {
+	const bool share = cmd->num_cmds == 2;
+	if (share && strcmp(cmd->cmds[1], "share") != 0) {
+		printf("usage: dedup [share]\n");
+		return false;
+	}
+	const size_t count = registry_count(reg);
+	Matrix_t** all = malloc((count ? count : 1) * sizeof(Matrix_t*));
+	Hashed_matrix_t* items = malloc((count ? count : 1) * sizeof(Hashed_matrix_t));
+	bool* grouped = calloc(count ? count : 1, sizeof(bool));
+	bool ok = all && items && grouped;
+	if (!ok) {
+		perror("cmd_dedup: allocation error\n");
+	}
+	const size_t n = ok ? registry_snapshot(reg, all, count) : 0;
+	for (size_t i = 0; ok && i < n; ++i) {
+		items[i].m = all[i];
+		ok = hash_matrix(all[i], &items[i].hash);
+	}
+	if (ok) {
+		qsort(items, n, sizeof(Hashed_matrix_t), compare_hashed);
+	}
+
+	size_t groups = 0;
+	size_t duplicates = 0;
+	for (size_t i = 0; ok && i < n; ++i) {
+		if (grouped[i]) {
+			continue;
+		}
+		bool first = true;
+		for (size_t j = i + 1; j < n && same_shape_and_hash(&items[i], &items[j]); ++j) {
+			/* equal hashes still get an element check, so a collision never merges different data */
+			if (grouped[j] || !equal_matrices(items[i].m, items[j].m)) {
+				continue;
+			}
+			grouped[j] = true;
+			if (first) {
+				printf("Identical: %s", items[i].m->name);
+				++groups;
+				first = false;
+			}
+			printf(" %s", items[j].m->name);
+			++duplicates;
+			if (share && !duplicate_matrix(items[i].m, items[j].m)) {
+				ok = false;
+			}
+		}
+		if (!first) {
+			printf("\n");
+		}
+	}
+	if (ok) {
+		printf("%zu duplicate matrices in %zu groups%s\n", duplicates, groups,
+			share && duplicates ? ", now sharing data" : "");
+	}
+	else {
+		printf("Dedup Failed\n");
+	}
+	free(grouped);
+	free(items);
+	free(all);
+	return ok;
+}
+
+/* shift <name> <l|r> <shifts>: bitwise shift every element in place */
+static bool cmd_shift (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* mat1 = require_matrix(reg, cmd->cmds[1]);
+	if (!mat1) {
+		printf("Matrix shift failed\n");
+		return false;
+	}
+	unsigned long long shift_value = 0;
+	if (!parse_number(cmd->cmds[3], UINT32_MAX, &shift_value)) {
+		return false;
+	}
+	if (!bitwise_shift_matrix(mat1, cmd->cmds[2][0], shift_value)) {
+		printf("Failure on bitwise shift\n");
+		return false;
+	}
+	chatter("Matrix (%s) has been shifted by %llu\n", mat1->name, shift_value);
+	return true;
+}
+
+/* read <file>: load a matrix file under the name stored in it */
+static bool cmd_read (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* new_matrix = NULL;
+	io_settle_path(cmd->cmds[1]);
+	if (!read_matrix(cmd->cmds[1], &new_matrix)) {
+		printf("Read Failed\n");
+		return false;
+	}
+	if (!register_matrix(reg, new_matrix)) {
+		return false;
+	}
+	chatter("Matrix (%s) is read from the filesystem\n", cmd->cmds[1]);
+	return true;
+}
+
+/*
+ * PURPOSE: Parse the [sync|direct] [packed|delta] options shared by write and write_async
+ * INPUTS:
+ *      Command whose options start at cmds[2], cmd
+ *      Destinations for the policy, whether to pack, and the pack mode
+ * RETURN:
+ *      If an option is unknown, return false after printing a message.
+ *      Else, return true.
+ **/
+static bool parse_write_options (Commands_t* cmd, Write_policy_t* policy, bool* packed, Pack_mode_t* mode) {
+	*policy = WRITE_POLICY_BUFFERED;
+	*packed = false;
+	*mode = PACK_MODE_FOR;
+	for (unsigned int i = 2; i < cmd->num_cmds; ++i) {
+		if (strcmp(cmd->cmds[i], "sync") == 0) {
+			*policy = WRITE_POLICY_SYNC;
+		}
+		else if (strcmp(cmd->cmds[i], "direct") == 0) {
+			*policy = WRITE_POLICY_DIRECT;
+		}
+		else if (strcmp(cmd->cmds[i], "packed") == 0) {
+			*packed = true;
+			*mode = PACK_MODE_FOR;
+		}
+		else if (strcmp(cmd->cmds[i], "delta") == 0) {
+			*packed = true;
+			*mode = PACK_MODE_DELTA;
+		}
+		else {
+			printf("Unknown write option %s (sync|direct|packed|delta)\n", cmd->cmds[i]);
+			return false;
+		}
+	}
+	return true;
+}// end parse_write_options
+
+/* write <name> [sync|direct] [packed|delta]: save a matrix to a file of the same name */
+static bool cmd_write (Commands_t* cmd, Registry_t* reg) {
+	Write_policy_t policy;
+	bool packed;
+	Pack_mode_t mode;
+	if (!parse_write_options(cmd, &policy, &packed, &mode)) {
+		return false;
+	}
+	Matrix_t* mat1 = require_matrix(reg, cmd->cmds[1]);
+	if (!mat1) {
+		return false;
+	}
+	io_settle_path(mat1->name);
+	const bool ok = packed ? write_matrix_packed(mat1->name, mat1, policy, mode)
+		: write_matrix_with_policy(mat1->name, mat1, policy);
+	if (!ok) {
+		printf("Write Failed\n");
+		return false;
+	}
+	chatter("Matrix (%s) is wrote out to the filesystem\n", mat1->name);
+	return true;
+}
+
+/* export <name> <file> [csv|tsv]: write a matrix as comma or tab separated text */
+static bool cmd_export (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* m = require_matrix(reg, cmd->cmds[1]);
+	if (!m) {
+		return false;
+	}
+	char separator = ',';
+	if (cmd->num_cmds == 4) {
+		if (strcmp(cmd->cmds[3], "tsv") == 0) {
+			separator = '\t';
+		}
+		else if (strcmp(cmd->cmds[3], "csv") != 0) {
+			printf("usage: export <name> <file> [csv|tsv]\n");
+			return false;
+		}
+	}
+	io_settle_path(cmd->cmds[2]);
+	if (!export_matrix(m, cmd->cmds[2], separator)) {
+		printf("Export Failed\n");
+		return false;
+	}
+	chatter("Matrix (%s) is exported to %s\n", m->name, cmd->cmds[2]);
+	return true;
+}
+
+/* import <name> <file> [<type>]: load a matrix from comma, tab or space separated text */
+static bool cmd_import (Commands_t* cmd, Registry_t* reg) {
+	Matrix_type_t type = MATRIX_TYPE_U32;
+	if (cmd->num_cmds == 4 && !parse_matrix_type(cmd->cmds[3], &type)) {
+		printf("usage: import <name> <file> [u8|u16|u32|u64]\n");
+		return false;
+	}
+	io_settle_path(cmd->cmds[2]);
+	Matrix_t* m = NULL;
+	if (!import_matrix(cmd->cmds[2], cmd->cmds[1], type, &m)) {
+		printf("Import Failed\n");
+		return false;
+	}
+	if (!register_matrix(reg, m)) {
+		return false;
+	}
+	chatter("Matrix (%s,%zu,%zu) is imported from %s\n", m->name, m->rows, m->cols, cmd->cmds[2]);
+	return true;
+}
+
+/* write_async <name> [sync|direct] [packed|delta]: write in the background, as the matrix is now */
+static bool cmd_write_async (Commands_t* cmd, Registry_t* reg) {
+	Write_policy_t policy;
+	bool packed;
+	Pack_mode_t mode;
+	if (!parse_write_options(cmd, &policy, &packed, &mode)) {
+		return false;
+	}
+	Matrix_t* mat1 = require_matrix(reg, cmd->cmds[1]);
+	if (!mat1) {
+		return false;
+	}
+	unsigned int id = 0;
+	if (!io_write_async(mat1, policy, packed, mode, &id)) {
+		printf("Write Failed\n");
+		return false;
+	}
+	chatter("Job %u: writing matrix (%s) in the background\n", id, mat1->name);
+	return true;
+}
+
+/* read_async <file>: load a matrix file in the background; wait adds it */
+static bool cmd_read_async (Commands_t* cmd, Registry_t* reg) {
+	unsigned int id = 0;
+	if (!io_read_async(cmd->cmds[1], &id)) {
+		printf("Read Failed\n");
+		return false;
+	}
+	chatter("Job %u: reading %s in the background\n", id, cmd->cmds[1]);
+	return true;
+}
+
+/*
+ * PURPOSE: Report a finished background job; a read's matrix joins the registry
+ * INPUTS:
+ *      Registry to update, reg
+ *      Result from io_collect, result
+ * RETURN:
+ *      If the job failed, return false.
+ *      Else, return true.
+ **/
+static bool finish_io_job (Registry_t* reg, Io_result_t* result) {
+	const double ms = result->elapsed_ns / 1e6;
+	if (!result->ok) {
+		printf("Job %u: %s of %s failed\n", result->id, result->kind == IO_JOB_WRITE ? "write" : "read",
+			result->path);
+		return false;
+	}
+	if (result->kind == IO_JOB_WRITE) {
+		chatter("Job %u: matrix (%s) is wrote out to the filesystem in %.3f ms\n", result->id, result->path, ms);
+		return true;
+	}
+	const char* name = result->matrix->name;
+	chatter("Job %u: matrix (%s) is read from %s in %.3f ms\n", result->id, name, result->path, ms);
+	return register_matrix(reg, result->matrix);
+}// end finish_io_job
+
+/* wait [<job>]: finish one background job, or all of them */
+static bool cmd_wait (Commands_t* cmd, Registry_t* reg) {
+	if (cmd->num_cmds == 1) {
+		return wait_background_io(reg);
+	}
+	char* end = NULL;
+	const unsigned long id = strtoul(cmd->cmds[1], &end, 10);
+	Io_result_t result;
+	if (!end || *end != '\0' || id == 0 || id > UINT32_MAX || !io_collect(id, &result)) {
+		printf("No background job %s\n", cmd->cmds[1]);
+		return false;
+	}
+	return finish_io_job(reg, &result);
+}
+
+/* checkpoint: save every matrix to the workspace file */
+static bool cmd_checkpoint (Commands_t* cmd, Registry_t* reg) {
+	(void)cmd;
+	if (!workspace) {
+		printf("No workspace, start with --workspace <file>\n");
+		return false;
+	}
+	/* a pinned write may still map an extent this save would free */
+	const bool ok = wait_background_io(reg);
+	if (!workspace_save(workspace, reg)) {
+		return false;
+	}
+	chatter("Workspace saved, %zu matrices\n", workspace->count);
+	return ok;
+}
+
+/* create <name> <rows> <cols> [<type>]: new zero filled matrix, of u32 elements unless a type is given */
+static bool cmd_create (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* new_mat = NULL;
+	unsigned long long dims[2];
+	if (!parse_number(cmd->cmds[2], SIZE_MAX, &dims[0]) || !parse_number(cmd->cmds[3], SIZE_MAX, &dims[1])) {
+		return false;
+	}
+	Matrix_type_t type = MATRIX_TYPE_U32;
+	if (cmd->num_cmds == 5 && !parse_matrix_type(cmd->cmds[4], &type)) {
+		printf("usage: create <name> <rows> <cols> [u8|u16|u32|u64|f32|f64]\n");
+		return false;
+	}
+
+	if (!create_typed_matrix(&new_mat, cmd->cmds[1], dims[0], dims[1], type)) {
+		printf("error on creating matrix\n");
+		return false;
+	}
+	if (!register_matrix(reg, new_mat)) {
+		return false;
+	}
+	chatter("Created Matrix (%s,%zu,%zu)\n", new_mat->name, new_mat->rows, new_mat->cols);
+	return true;
+}
+
+/* random <name> <start_range> <end_range>: fill with uniform values */
+static bool cmd_random (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* mat1 = require_matrix(reg, cmd->cmds[1]);
+	if (!mat1) {
+		printf("error on writing random matrix\n");
+		return false;
+	}
+	unsigned long long range[2];
+	if (!parse_number(cmd->cmds[2], UINT32_MAX, &range[0]) || !parse_number(cmd->cmds[3], UINT32_MAX, &range[1])) {
+		return false;
+	}
+	if (!random_matrix(mat1, range[0], range[1])) {
+		printf("error on writing random matrix\n");
+		return false;
+	}
+	chatter("Matrix (%s) is randomized between %llu %llu\n", mat1->name, range[0], range[1]);
+	return true;
+}
+
+/* set <name> <row> <col> <value>: write one element */
+static bool cmd_set (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* m = require_matrix(reg, cmd->cmds[1]);
+	if (!m) {
+		return false;
+	}
+	/* row and col are 64-bit, the value 32-bit */
+	unsigned long long args[3];
+	for (unsigned int i = 0; i < 3; ++i) {
+		if (!parse_number(cmd->cmds[i + 2], i == 2 ? UINT32_MAX : SIZE_MAX, &args[i])) {
+			return false;
+		}
+	}
+	if (!set_matrix_element(m, args[0], args[1], args[2])) {
+		printf("Failure on setting (%llu,%llu) of %s\n", args[0], args[1], m->name);
+		return false;
+	}
+	return true;
+}
+
+/* format <name> [dense|sparse|tiled|auto]: print or change how a matrix is stored */
+static bool cmd_format (Commands_t* cmd, Registry_t* reg) {
+	Matrix_t* m = require_matrix(reg, cmd->cmds[1]);
+	if (!m) {
+		return false;
+	}
+	bool ok = true;
+	if (cmd->num_cmds == 3) {
+		if (strcmp(cmd->cmds[2], "dense") == 0) {
+			ok = densify_matrix(m, true);
+		}
+		else if (strcmp(cmd->cmds[2], "sparse") == 0) {
+			ok = sparsify_matrix(m);
+		}
+		else if (strcmp(cmd->cmds[2], "tiled") == 0) {
+			ok = tile_matrix(m);
+		}
+		else if (strcmp(cmd->cmds[2], "auto") == 0) {
+			ok = auto_format_matrix(m);
+		}
+		else {
+			printf("usage: format <name> [dense|sparse|tiled|auto]\n");
+			return false;
+		}
+	}
+	if (!ok) {
+		printf("Failure on converting %s\n", m->name);
+		return false;
+	}
+	if (m->format == MATRIX_FORMAT_CSR) {
+		printf("Matrix (%s) is sparse with %zu non-zero elements\n", m->name, m->nnz);
+	}
+	else {
+		printf("Matrix (%s) is %s\n", m->name, m->format == MATRIX_FORMAT_TILED ? "tiled" : "dense");
+	}
+	return true;
+}
+
+/* list: print every registered matrix */
+static bool cmd_list (Commands_t* cmd, Registry_t* reg) {
+	list_matrices(reg);
+	return true;
+}
+
+/* drop <name> [<name> ...]: destroy matrices */
+static bool cmd_drop (Commands_t* cmd, Registry_t* reg) {
+	bool ok = true;
+	for (unsigned int i = 1; i < cmd->num_cmds; ++i) {
+		if (registry_remove(reg, cmd->cmds[i])) {
+			chatter("Matrix (%s) dropped\n", cmd->cmds[i]);
+		}
+		else {
+			printf("Matrix (%s) doesn't exist\n", cmd->cmds[i]);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+/* seed [<n>]: restart the random generator from n, or print the current seed */
+static bool cmd_seed (Commands_t* cmd, Registry_t* reg) {
+	if (cmd->num_cmds == 1) {
+		printf("Seed is %llu\n", (unsigned long long)random_matrix_seed());
+		return true;
+	}
+	char* end = NULL;
+	const unsigned long long seed = strtoull(cmd->cmds[1], &end, 0);
+	if (!end || *end != '\0') {
+		printf("Invalid seed %s\n", cmd->cmds[1]);
+		return false;
+	}
+	seed_random_matrix(seed);
+	chatter("Seed set to %llu\n", seed);
+	return true;
+}
+
+/* stats [json|reset]: print or clear the latency and traffic counters */
+static bool cmd_stats (Commands_t* cmd, Registry_t* reg) {
+	if (cmd->num_cmds == 1) {
+		stats_print(stdout);
+	}
+	else if (strcmp(cmd->cmds[1], "json") == 0) {
+		stats_print_json(stdout);
+	}
+	else if (strcmp(cmd->cmds[1], "reset") == 0) {
+		stats_reset();
+		chatter("Stats reset\n");
+	}
+	else {
+		printf("usage: stats [json|reset]\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * stream random <file> <rows> <cols> <start_range> <end_range> | add <a> <b> <result>
+ *      | shift <file> <l|r> <shifts> <result> | sum <file> | equal <a> <b>:
+ *      out-of-core operations on matrix files, which are never loaded whole
+ */
+static bool cmd_stream (Commands_t* cmd, Registry_t* reg) {
+	(void)reg;
+	const char* op = cmd->cmds[1];
+	char** args = &cmd->cmds[2];
+	const unsigned int num_args = cmd->num_cmds - 2;
+	/* as for read and write, background jobs on the same files finish first */
+	for (unsigned int i = 0; i < num_args; ++i) {
+		io_settle_path(args[i]);
+	}
+	if (strcmp(op, "random") == 0 && num_args == 5) {
+		unsigned long long values[4];
+		for (unsigned int i = 0; i < 4; ++i) {
+			if (!parse_number(args[i + 1], i < 2 ? SIZE_MAX : UINT32_MAX, &values[i])) {
+				return false;
+			}
+		}
+		if (!stream_random(args[0], values[0], values[1], values[2], values[3])) {
+			printf("Stream random failed\n");
+			return false;
+		}
+		chatter("Matrix file (%s,%llu,%llu) is filled with random values\n", args[0], values[0], values[1]);
+	}
+	else if (strcmp(op, "add") == 0 && num_args == 3) {
+		if (!stream_add(args[0], args[1], args[2])) {
+			printf("Stream add failed\n");
+			return false;
+		}
+		chatter("Matrix files %s and %s are added into %s\n", args[0], args[1], args[2]);
+	}
+	else if (strcmp(op, "shift") == 0 && num_args == 4) {
+		unsigned long long shift = 0;
+		if (!parse_number(args[2], UINT32_MAX, &shift)) {
+			return false;
+		}
+		if (!stream_shift(args[0], args[1][0], shift, args[3])) {
+			printf("Stream shift failed\n");
+			return false;
+		}
+		chatter("Matrix file %s is shifted by %llu into %s\n", args[0], shift, args[3]);
+	}
+	else if (strcmp(op, "sum") == 0 && num_args == 1) {
+		uint64_t sum = 0;
+		if (!stream_sum(args[0], &sum)) {
+			printf("Stream sum failed\n");
+			return false;
+		}
+		printf("Sum of %s is %llu\n", args[0], (unsigned long long)sum);
+	}
+	else if (strcmp(op, "equal") == 0 && num_args == 2) {
+		bool equal = false;
+		if (!stream_equal(args[0], args[1], &equal)) {
+			printf("Stream equal failed\n");
+			return false;
+		}
+		printf(equal ? "SAME DATA IN BOTH\n" : "DIFFERENT DATA IN BOTH\n");
+	}
+	else {
+		printf("usage: stream random <file> <rows> <cols> <start_range> <end_range> | add <a> <b> <result>\n"
+			"       | shift <file> <l|r> <shifts> <result> | sum <file> | equal <a> <b>\n");
+		return false;
+	}
+	return true;
+}
+
+/* Sorted by name for bsearch; token counts include the command name */
+static const Command_entry_t command_table[] = {
+	{ "add",         4, 4,             cmd_add,         "add <a> <b> <result>" },
+	{ "cast",        4, 4,             cmd_cast,        "cast <src> <result> <type>" },
+	{ "checkpoint",  1, 1,             cmd_checkpoint,  "checkpoint" },
+	{ "create",      4, 5,             cmd_create,      "create <name> <rows> <cols> [<type>]" },
+	{ "dedup",       1, 2,             cmd_dedup,       "dedup [share]" },
+	{ "display",     2, 3,             cmd_display,     "display <name> [<n>]" },
+	{ "drop",        2, MAX_CMD_COUNT, cmd_drop,        "drop <name> [<name> ...]" },
+	{ "duplicate",   3, 3,             cmd_duplicate,   "duplicate <src> <dest>" },
+	{ "equal",       3, 3,             cmd_equal,       "equal <a> <b>" },
+	{ "eval",        4, MAX_CMD_COUNT, cmd_eval,        "eval <result> = <expression>" },
+	{ "export",      3, 4,             cmd_export,      "export <name> <file> [csv|tsv]" },
+	{ "format",      2, 3,             cmd_format,      "format <name> [dense|sparse|tiled|auto]" },
+	{ "import",      3, 4,             cmd_import,      "import <name> <file> [<type>]" },
+	{ "list",        1, 1,             cmd_list,        "list" },
+	{ "mul",         4, 4,             cmd_mul,         "mul <a> <b> <result>" },
+	{ "random",      4, 4,             cmd_random,      "random <name> <start_range> <end_range>" },
+	{ "read",        2, 2,             cmd_read,        "read <file>" },
+	{ "read_async",  2, 2,             cmd_read_async,  "read_async <file>" },
+	{ "seed",        1, 2,             cmd_seed,        "seed [<n>]" },
+	{ "set",         5, 5,             cmd_set,         "set <name> <row> <col> <value>" },
+	{ "shift",       4, 4,             cmd_shift,       "shift <name> <l|r> <shifts>" },
+	{ "stats",       1, 2,             cmd_stats,       "stats [json|reset]" },
+	{ "stream",      3, 7,             cmd_stream,      "stream random|add|shift|sum|equal <file> ..." },
+	{ "sum",         2, 2,             cmd_sum,         "sum <name>" },
+	{ "summary",     2, 2,             cmd_summary,     "summary <name>" },
+	{ "transpose",   3, 3,             cmd_transpose,   "transpose <src> <result>" },
+	{ "wait",        1, 2,             cmd_wait,        "wait [<job>]" },
+	{ "write",       2, 4,             cmd_write,       "write <name> [sync|direct] [packed|delta]" },
+	{ "write_async", 2, 4,             cmd_write_async, "write_async <name> [sync|direct] [packed|delta]" },
+};
+
+/*
+ * PURPOSE: bsearch comparator between a command name and a table entry
+ * INPUTS:
+ *      Command name, key
+ *      Table entry, entry
+ * RETURN:
+ *      strcmp of the name against the entry name
+ **/
+static int compare_command (const void* key, const void* entry) {
+	return strcmp((const char*)key, ((const Command_entry_t*)entry)->name);
+}// end compare_command
+
+/*
+ * PURPOSE: Process commands after being processed into an array
+ * INPUTS:
+ *		master-list of all commands to proc, cmd
+ *		registry of all named matrices, reg
+ * RETURN:
+ *		If the command is unknown, malformed or fails, return false.
+ *		Else, return true.
+ **/
+bool run_commands (Commands_t* cmd, Registry_t* reg) {
+	if( !cmd || !reg || cmd->num_cmds == 0 ){
+		perror("run_commands: bad input");
+		return false;
+	}
+
+	const Command_entry_t* entry = bsearch(cmd->cmds[0], command_table,
+		sizeof(command_table) / sizeof(command_table[0]), sizeof(Command_entry_t), compare_command);
+	if (!entry) {
+		printf("Not a command in this application\n");
+		return false;
+	}
+	if (cmd->num_cmds < entry->min_tokens || cmd->num_cmds > entry->max_tokens) {
+		printf("usage: %s\n", entry->usage);
+		return false;
+	}
+
+	/* one stats counter per table entry, registered on first use */
+	static int command_stat[sizeof(command_table) / sizeof(command_table[0])];
+	const size_t index = entry - command_table;
+	if (command_stat[index] == 0) {
+		command_stat[index] = stats_counter(entry->name) + 1;
+	}
+	const int stat = command_stat[index] - 1;
+	const uint64_t start = stats_now();
+	stats_begin_command(stat);
+	const bool ok = entry->handler(cmd, reg);
+	stats_end_command(stat, start);
+	return ok;
+}// end run_commands
+
+/*
+ * PURPOSE: Turn progress messages from successful commands off or on
+ * INPUTS:
+ *      Whether to suppress them, on
+ * RETURN:
+ *      void
+ **/
+void dispatch_set_quiet (bool on) {
+	quiet = on;
+}// end dispatch_set_quiet
+
+/*
+ * PURPOSE: Set the workspace file saved by the checkpoint command
+ * INPUTS:
+ *      Open workspace, or NULL for none, ws
+ * RETURN:
+ *      void
+ **/
+void dispatch_set_workspace (Workspace_t* ws) {
+	workspace = ws;
+}// end dispatch_set_workspace
+
+/*
+ * PURPOSE: Finish every background job, oldest first, adding the matrices
+ *      they read to the registry
+ * INPUTS:
+ *      Registry to update, reg
+ * RETURN:
+ *      If any job failed, return false.
+ *      Else, return true.
+ **/
+bool wait_background_io (Registry_t* reg) {
+	if (!reg) {
+		perror("wait_background_io: bad input\n");
+		return false;
+	}
+	bool ok = true;
+	Io_result_t result;
+	while (io_collect(0, &result)) {
+		ok = finish_io_job(reg, &result) && ok;
+	}
+	return ok;
+}// end wait_background_io
+
+/*
+ * PURPOSE: Print every registered matrix, sorted by name
+ * INPUTS:
+ *      Registry to list, reg
+ * RETURN:
+ *      void
+ **/
+void list_matrices (const Registry_t* reg) {
+	const size_t count = registry_count(reg);
+	Matrix_t** all = malloc(sizeof(Matrix_t*) * (count ? count : 1));
+	if (!all) {
+		perror("list_matrices: allocation error\n");
+		return;
+	}
+	const size_t n = registry_snapshot(reg, all, count);
+	for (size_t i = 0; i < n; ++i) {
+		const Matrix_t* m = all[i];
+		printf("%-*s %10zu x %-10zu %s%s", MATRIX_NAME_LEN, m->name, m->rows, m->cols,
+			m->buffer->storage == MATRIX_STORAGE_MAPPED ? "mapped"
+				: m->buffer->storage == MATRIX_STORAGE_WORKSPACE ? "workspace" : "heap",
+			matrix_is_shared(m) ? " shared" : "");
+		if (io_is_pinned(m)) {
+			printf(" pinned");
+		}
+		if (m->format == MATRIX_FORMAT_CSR) {
+			printf(" sparse nnz=%zu", m->nnz);
+		}
+		else if (m->format == MATRIX_FORMAT_TILED) {
+			printf(" tiled");
+		}
+		if (m->type != MATRIX_TYPE_U32) {
+			printf(" %s", matrix_type_name(m->type));
+		}
+		printf("\n");
+	}
+	printf("%zu matrices\n", n);
+	free(all);
+}// end list_matrices
@@ -0,0 +1,16 @@
+#ifndef _DISPATCH_H_
+#define _DISPATCH_H_
+
+#include <stdbool.h>
+
+#include "command.h"
+#include "registry.h"
+#include "workspace.h"
+
+bool run_commands (Commands_t* cmd, Registry_t* reg);
+void list_matrices (const Registry_t* reg);
+void dispatch_set_quiet (bool on);
+void dispatch_set_workspace (Workspace_t* ws);
+bool wait_background_io (Registry_t* reg);
+
+#endif
@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "expr.h"
+#include "kernels.h"
+#include "pool.h"
+#include "stats.h"
+
+/* Elements per evaluation block; one block of every live node stays in L1/L2 */
+#define EXPR_BLOCK 1024
+/* Deepest parenthesis nesting accepted */
+#define EXPR_MAX_DEPTH 64
+
+typedef struct {
+	const char* pos;
+	const Registry_t* reg;
+	Expr_t* expr;
+	unsigned int depth;
+}Expr_parser_t;
+
+typedef struct {
+	const Expr_t* expr;
+	const unsigned int* operands[EXPR_MAX_NODES];	/* dense elements of each EXPR_MATRIX node */
+	unsigned int* dst;
+	size_t n;
+	bool failed;
+}Expr_job_t;
+
+static bool parse_additive (Expr_parser_t* p, unsigned int* node);
+static bool evaluate_blocks (Expr_job_t* job);
+
+/*
+ * PURPOSE: Skip blanks before the next token
+ * INPUTS:
+ *      Parser state, p
+ * RETURN:
+ *      void
+ **/
+static void skip_space (Expr_parser_t* p) {
+	while (isspace((unsigned char)*p->pos)) {
+		++p->pos;
+	}
+}// end skip_space
+
+/*
+ * PURPOSE: Whether a character ends a name or number
+ * INPUTS:
+ *      Character, c
+ * RETURN:
+ *      true for the end of the text, blanks, parentheses and operator characters
+ **/
+static bool is_delimiter (char c) {
+	return c == '\0' || isspace((unsigned char)c) || strchr("()+-<>", c) != NULL;
+}// end is_delimiter
+
+/*
+ * PURPOSE: Find or append a node, so identical subexpressions share one node
+ * INPUTS:
+ *      Parser state, p
+ *      Node to add, with live unset, node
+ *      Destination for its index, index
+ * RETURN:
+ *      If the expression has too many nodes, return false.
+ *      Else, return true.
+ **/
+static bool add_node (Expr_parser_t* p, const Expr_node_t* node, unsigned int* index) {
+	Expr_t* e = p->expr;
+	for (unsigned int i = 0; i < e->num_nodes; ++i) {
+		const Expr_node_t* n = &e->nodes[i];
+		if (n->op == node->op && n->left == node->left && n->right == node->right
+			&& n->value == node->value && n->matrix == node->matrix) {
+			*index = i;
+			return true;
+		}
+	}
+	if (e->num_nodes == EXPR_MAX_NODES) {
+		printf("eval: expression has more than %d terms\n", EXPR_MAX_NODES);
+		return false;
+	}
+	e->nodes[e->num_nodes] = *node;
+	*index = e->num_nodes++;
+	return true;
+}// end add_node
+
+/*
+ * PURPOSE: Add a binary node, folding it when both operands are constant
+ * INPUTS:
+ *      Parser state, p
+ *      Operation, op
+ *      Operand nodes, left and right
+ *      Destination for the result node, index
+ * RETURN:
+ *      If a shift amount is not constant or the expression is too big, return false.
+ *      Else, return true.
+ **/
+static bool add_binary (Expr_parser_t* p, Expr_op_t op, unsigned int left, unsigned int right, unsigned int* index) {
+	const Expr_node_t* l = &p->expr->nodes[left];
+	const Expr_node_t* r = &p->expr->nodes[right];
+	Expr_node_t node = { .op = op, .left = left };
+
+	if (op == EXPR_SHL || op == EXPR_SHR) {
+		if (r->op != EXPR_CONST) {
+			printf("eval: shift amounts must be constant\n");
+			return false;
+		}
+		node.value = r->value;
+	}
+	else {
+		node.right = right;
+	}
+
+	if (l->op == EXPR_CONST && r->op == EXPR_CONST) {
+		const unsigned int a = l->value;
+		const unsigned int b = r->value;
+		Expr_node_t folded = { .op = EXPR_CONST };
+		switch (op) {
+			case EXPR_ADD: folded.value = a + b; break;
+			case EXPR_SUB: folded.value = a - b; break;
+			case EXPR_SHL: folded.value = b >= 32 ? 0 : a << b; break;
+			default: folded.value = b >= 32 ? 0 : a >> b; break;
+		}
+		return add_node(p, &folded, index);
+	}
+	return add_node(p, &node, index);
+}// end add_binary
+
+/*
+ * PURPOSE: Parse a number, a matrix name or a parenthesized expression
+ * INPUTS:
+ *      Parser state, p
+ *      Destination for the node, node
+ * RETURN:
+ *      If the text is malformed or names a missing matrix, return false.
+ *      Else, return true.
+ **/
+static bool parse_primary (Expr_parser_t* p, unsigned int* node) {
+	skip_space(p);
+	if (*p->pos == '(') {
+		if (++p->depth > EXPR_MAX_DEPTH) {
+			printf("eval: parentheses nested too deeply\n");
+			return false;
+		}
+		++p->pos;
+		if (!parse_additive(p, node)) {
+			return false;
+		}
+		skip_space(p);
+		if (*p->pos != ')') {
+			printf("eval: missing )\n");
+			return false;
+		}
+		++p->pos;
+		--p->depth;
+		return true;
+	}
+
+	const char* start = p->pos;
+	while (!is_delimiter(*p->pos)) {
+		++p->pos;
+	}
+	const size_t len = p->pos - start;
+	if (len == 0) {
+		printf("eval: expected a matrix or number at \"%s\"\n", start);
+		return false;
+	}
+	if (len >= MATRIX_NAME_LEN) {
+		printf("eval: %.*s is not a matrix\n", (int)len, start);
+		return false;
+	}
+	char word[MATRIX_NAME_LEN];
+	memcpy(word, start, len);
+	word[len] = '\0';
+
+	char* end = NULL;
+	const unsigned long value = strtoul(word, &end, 0);
+	if (isdigit((unsigned char)word[0]) && end && *end == '\0') {
+		if (value > UINT_MAX) {
+			printf("eval: %s does not fit in an element\n", word);
+			return false;
+		}
+		Expr_node_t constant = { .op = EXPR_CONST, .value = (unsigned int)value };
+		return add_node(p, &constant, node);
+	}
+
+	Matrix_t* m = registry_find(p->reg, word);
+	if (!m) {
+		printf("Matrix (%s) doesn't exist\n", word);
+		return false;
+	}
+	if (m->type != MATRIX_TYPE_U32) {
+		printf("eval: %s holds %s elements, eval works on u32 matrices\n", m->name, matrix_type_name(m->type));
+		return false;
+	}
+	Expr_t* e = p->expr;
+	if (e->num_matrices == 0) {
+		e->rows = m->rows;
+		e->cols = m->cols;
+	}
+	else if (m->rows != e->rows || m->cols != e->cols) {
+		printf("eval: %s is (%zu,%zu) but the expression is (%zu,%zu)\n", m->name, m->rows, m->cols, e->rows, e->cols);
+		return false;
+	}
+	const unsigned int before = e->num_nodes;
+	Expr_node_t operand = { .op = EXPR_MATRIX, .matrix = m };
+	if (!add_node(p, &operand, node)) {
+		return false;
+	}
+	if (e->num_nodes != before) {
+		++e->num_matrices;
+	}
+	return true;
+}// end parse_primary
+
+/*
+ * PURPOSE: Parse a chain of << and >> by constant amounts
+ * INPUTS:
+ *      Parser state, p
+ *      Destination for the node, node
+ * RETURN:
+ *      If the text is malformed, return false.
+ *      Else, return true.
+ **/
+static bool parse_shift (Expr_parser_t* p, unsigned int* node) {
+	if (!parse_primary(p, node)) {
+		return false;
+	}
+	for (;;) {
+		skip_space(p);
+		Expr_op_t op;
+		if (p->pos[0] == '<' && p->pos[1] == '<') {
+			op = EXPR_SHL;
+		}
+		else if (p->pos[0] == '>' && p->pos[1] == '>') {
+			op = EXPR_SHR;
+		}
+		else {
+			return true;
+		}
+		p->pos += 2;
+		unsigned int amount;
+		if (!parse_primary(p, &amount) || !add_binary(p, op, *node, amount, node)) {
+			return false;
+		}
+	}
+}// end parse_shift
+
+/*
+ * PURPOSE: Parse a chain of + and -
+ * INPUTS:
+ *      Parser state, p
+ *      Destination for the node, node
+ * RETURN:
+ *      If the text is malformed, return false.
+ *      Else, return true.
+ **/
+static bool parse_additive (Expr_parser_t* p, unsigned int* node) {
+	if (!parse_shift(p, node)) {
+		return false;
+	}
+	for (;;) {
+		skip_space(p);
+		Expr_op_t op;
+		if (*p->pos == '+') {
+			op = EXPR_ADD;
+		}
+		else if (*p->pos == '-') {
+			op = EXPR_SUB;
+		}
+		else {
+			return true;
+		}
+		++p->pos;
+		unsigned int right;
+		if (!parse_shift(p, &right) || !add_binary(p, op, *node, right, node)) {
+			return false;
+		}
+	}
+}// end parse_additive
+
+/*
+ * PURPOSE: Mark the nodes the root depends on; folded constants are left dead
+ * INPUTS:
+ *      Expression, e
+ * RETURN:
+ *      void
+ **/
+static void mark_live (Expr_t* e) {
+	e->nodes[e->root].live = true;
+	for (unsigned int i = e->root + 1; i-- > 0;) {
+		const Expr_node_t* n = &e->nodes[i];
+		if (!n->live) {
+			continue;
+		}
+		if (n->op == EXPR_ADD || n->op == EXPR_SUB) {
+			e->nodes[n->left].live = true;
+			e->nodes[n->right].live = true;
+		}
+		else if (n->op == EXPR_SHL || n->op == EXPR_SHR) {
+			e->nodes[n->left].live = true;
+		}
+	}
+}// end mark_live
+
+/*
+ * PURPOSE: Parse an expression and resolve its matrix operands
+ * INPUTS:
+ *      Expression text, text
+ *      Registry the operand names are looked up in, reg
+ *      Expression to fill in, expr
+ * RETURN:
+ *      If the text is malformed, names a missing matrix, mixes dimensions or
+ *      has no matrix operand, print why and return false.
+ *      Else, return true.
+ **/
+bool parse_expression (const char* text, const Registry_t* reg, Expr_t* expr) {
+	if (!text || !reg || !expr) {
+		perror("parse_expression: bad input\n");
+		return false;
+	}
+	memset(expr, 0, sizeof(Expr_t));
+	Expr_parser_t p = { .pos = text, .reg = reg, .expr = expr };
+	if (!parse_additive(&p, &expr->root)) {
+		return false;
+	}
+	skip_space(&p);
+	if (*p.pos != '\0') {
+		printf("eval: unexpected \"%s\"\n", p.pos);
+		return false;
+	}
+	if (expr->num_matrices == 0) {
+		printf("eval: the expression needs at least one matrix\n");
+		return false;
+	}
+	mark_live(expr);
+	return true;
+}// end parse_expression
+
+/*
+ * PURPOSE: Evaluate a run of blocks. Every live node gets one block of scratch;
+ *      the root writes straight into the destination. Matrix operands are read
+ *      in place, so a block of each operand is touched once per pass.
+ * INPUTS:
+ *      Expr_job_t, arg
+ *      Pool chunk index, chunk
+ *      Block range, begin and end
+ * RETURN:
+ *      void
+ **/
+static void expr_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Expr_job_t* job = arg;
+	const Expr_t* e = job->expr;
+	unsigned int* scratch = NULL;
+	if (posix_memalign((void**)&scratch, 64, sizeof(unsigned int) * EXPR_BLOCK * e->num_nodes) != 0) {
+		__atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+		return;
+	}
+	for (unsigned int i = 0; i < e->num_nodes; ++i) {
+		if (e->nodes[i].live && e->nodes[i].op == EXPR_CONST) {
+			for (size_t k = 0; k < EXPR_BLOCK; ++k) {
+				scratch[i * EXPR_BLOCK + k] = e->nodes[i].value;
+			}
+		}
+	}
+
+	const unsigned int* value[EXPR_MAX_NODES];
+	for (size_t block = begin; block < end; ++block) {
+		const size_t base = block * EXPR_BLOCK;
+		const size_t count = job->n - base < EXPR_BLOCK ? job->n - base : EXPR_BLOCK;
+		for (unsigned int i = 0; i <= e->root; ++i) {
+			const Expr_node_t* n = &e->nodes[i];
+			if (!n->live) {
+				continue;
+			}
+			unsigned int* out = i == e->root ? &job->dst[base] : &scratch[i * EXPR_BLOCK];
+			switch (n->op) {
+				case EXPR_MATRIX:
+					value[i] = &job->operands[i][base];
+					if (i == e->root && out != value[i]) {
+						memcpy(out, value[i], count * sizeof(unsigned int));
+					}
+					continue;
+				case EXPR_CONST:
+					value[i] = &scratch[i * EXPR_BLOCK];
+					continue;
+				case EXPR_ADD:
+					kernel_add_u32(out, value[n->left], value[n->right], count);
+					break;
+				case EXPR_SUB:
+					kernel_sub_u32(out, value[n->left], value[n->right], count);
+					break;
+				case EXPR_SHL:
+					kernel_shl_u32(out, value[n->left], n->value, count);
+					break;
+				case EXPR_SHR:
+					kernel_shr_u32(out, value[n->left], n->value, count);
+					break;
+			}
+			value[i] = out;
+		}
+	}
+	free(scratch);
+}// end expr_task
+
+/*
+ * PURPOSE: Evaluate a parsed expression into a matrix in one fused pass.
+ *      dest may also be an operand: each block is fully read before the
+ *      root writes it. A dest sharing its buffer gets a private one first
+ *      and is made dense; other sparse or tiled operands are read through
+ *      dense views and keep their format.
+ * INPUTS:
+ *      Expression from parse_expression, expr
+ *      Destination with the expression's dimensions, dest
+ * RETURN:
+ *      If the dimensions differ or scratch memory runs out, return false.
+ *      Else, return true.
+ **/
+bool evaluate_expression (const Expr_t* expr, Matrix_t* dest) {
+	if (!expr || !dest || !dest->data || expr->num_nodes == 0) {
+		perror("evaluate_expression: bad input\n");
+		return false;
+	}
+	if (dest->rows != expr->rows || dest->cols != expr->cols) {
+		printf("evaluate_expression: dimension mismatch (%zu,%zu) -> (%zu,%zu)\n",
+			expr->rows, expr->cols, dest->rows, dest->cols);
+		return false;
+	}
+	if (dest->type != MATRIX_TYPE_U32) {
+		printf("evaluate_expression: %s holds %s elements, eval writes u32 matrices\n", dest->name,
+			matrix_type_name(dest->type));
+		return false;
+	}
+
+	/* dest's current elements only matter when it is also an operand */
+	bool operand = false;
+	for (unsigned int i = 0; i < expr->num_nodes; ++i) {
+		const Expr_node_t* node = &expr->nodes[i];
+		operand |= node->live && node->op == EXPR_MATRIX && node->matrix == dest;
+	}
+	if (!densify_matrix(dest, operand) || !unshare_matrix(dest, operand)) {
+		return false;
+	}
+
+	/* the blocks read operands densely, so the others get dense views */
+	Expr_job_t job = { .expr = expr, .dst = dest->data, .n = (size_t)dest->rows * dest->cols, .failed = false };
+	Matrix_t* views[EXPR_MAX_NODES] = { NULL };
+	bool ok = true;
+	for (unsigned int i = 0; ok && i < expr->num_nodes; ++i) {
+		const Expr_node_t* node = &expr->nodes[i];
+		if (!node->live || node->op != EXPR_MATRIX) {
+			continue;
+		}
+		if (node->matrix == dest) {
+			job.operands[i] = dest->data;
+		}
+		else if ((ok = dense_view_matrix(node->matrix, &views[i]))) {
+			job.operands[i] = views[i]->data;
+		}
+	}
+	if (ok) {
+		ok = evaluate_blocks(&job);
+	}
+	for (unsigned int i = 0; i < expr->num_nodes; ++i) {
+		destroy_matrix(&views[i]);
+	}
+	return ok;
+}// end evaluate_expression
+
+/*
+ * PURPOSE: Run the fused evaluation over every block of the destination
+ * INPUTS:
+ *      Job with the expression, operands and destination filled in, job
+ * RETURN:
+ *      If scratch memory runs out, return false.
+ *      Else, return true.
+ **/
+static bool evaluate_blocks (Expr_job_t* job) {
+	const uint64_t start = stats_now();
+	const size_t blocks = (job->n + EXPR_BLOCK - 1) / EXPR_BLOCK;
+	pool_parallel_for(blocks, POOL_MIN_GRAIN / EXPR_BLOCK, expr_task, job);
+	if (job->failed) {
+		perror("evaluate_expression: allocation error\n");
+		return false;
+	}
+	stats_record(STAT_EVALUATE_EXPRESSION, start, job->n * (job->expr->num_matrices + 1) * sizeof(unsigned int), 0);
+	return true;
+}// end evaluate_blocks
@@ -0,0 +1,50 @@
+#ifndef _EXPR_H_
+#define _EXPR_H_
+
+#include <stdbool.h>
+
+#include "matrix.h"
+#include "registry.h"
+
+/*
+ * Element-wise expressions over named matrices, e.g. "(a + b) << 2 + c".
+ * Parsing builds a DAG in which identical subexpressions share one node and
+ * constant subexpressions are folded; evaluation then makes one blocked pass
+ * over the operands with no intermediate matrices.
+ *
+ * Precedence, loosest first: + and -, then << and >>, then parentheses.
+ * Shift amounts must be constant. Arithmetic wraps like unsigned int.
+ */
+#define EXPR_MAX_NODES 64
+
+typedef enum {
+	EXPR_MATRIX = 0,
+	EXPR_CONST,
+	EXPR_ADD,
+	EXPR_SUB,
+	EXPR_SHL,
+	EXPR_SHR
+}Expr_op_t;
+
+typedef struct {
+	Expr_op_t op;
+	unsigned int left;	/* operand nodes; shifts only use left */
+	unsigned int right;
+	unsigned int value;	/* EXPR_CONST value, or the shift amount */
+	Matrix_t* matrix;	/* EXPR_MATRIX operand */
+	bool live;	/* reachable from the root */
+}Expr_node_t;
+
+typedef struct {
+	Expr_node_t nodes[EXPR_MAX_NODES];	/* operands always come before the nodes using them */
+	unsigned int num_nodes;
+	unsigned int root;
+	unsigned int num_matrices;
+	size_t rows;	/* shared by every matrix operand */
+	size_t cols;
+}Expr_t;
+
+bool parse_expression (const char* text, const Registry_t* reg, Expr_t* expr);
+bool evaluate_expression (const Expr_t* expr, Matrix_t* dest);
+
+#endif
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "io.h"
+#include "stats.h"
+
+typedef enum {
+	IO_STATE_QUEUED = 0,
+	IO_STATE_RUNNING,
+	IO_STATE_DONE
+}Io_state_t;
+
+typedef struct Io_job {
+	struct Io_job* next;
+	unsigned int id;
+	Io_job_kind_t kind;
+	Io_state_t state;
+	char path[IO_PATH_LEN];
+	Matrix_t* matrix;	/* write: the pinning share; read: the result once done */
+	Write_policy_t policy;
+	bool packed;
+	Pack_mode_t mode;
+	bool ok;
+	uint64_t submitted_ns;
+	uint64_t finished_ns;
+}Io_job_t;
+
+/*
+ * Every submitted job stays on the list, oldest first, until it is
+ * collected. The I/O thread runs the first queued job; job_done is
+ * broadcast each time one finishes.
+ */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_cond_t job_done;
+	pthread_t thread;
+	bool started;
+	bool shutdown;
+	Io_job_t* head;
+	Io_job_t* tail;
+	unsigned int next_id;
+}io = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work_ready = PTHREAD_COND_INITIALIZER,
+	.job_done = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * PURPOSE: I/O thread body, runs queued jobs in order until shutdown
+ * INPUTS:
+ *      unused, arg
+ * RETURN:
+ *      NULL
+ **/
+static void* io_main (void* arg) {
+	(void)arg;
+	pthread_mutex_lock(&io.lock);
+	for (;;) {
+		Io_job_t* job = io.head;
+		while (job && job->state != IO_STATE_QUEUED) {
+			job = job->next;
+		}
+		if (!job) {
+			if (io.shutdown) {
+				break;
+			}
+			pthread_cond_wait(&io.work_ready, &io.lock);
+			continue;
+		}
+		job->state = IO_STATE_RUNNING;
+		pthread_mutex_unlock(&io.lock);
+
+		bool ok;
+		if (job->kind == IO_JOB_WRITE) {
+			ok = job->packed ? write_matrix_packed(job->path, job->matrix, job->policy, job->mode)
+				: write_matrix_with_policy(job->path, job->matrix, job->policy);
+		}
+		else {
+			ok = read_matrix(job->path, &job->matrix);
+		}
+
+		pthread_mutex_lock(&io.lock);
+		job->ok = ok;
+		job->finished_ns = stats_now();
+		job->state = IO_STATE_DONE;
+		pthread_cond_broadcast(&io.job_done);
+	}
+	pthread_mutex_unlock(&io.lock);
+	return NULL;
+}// end io_main
+
+/*
+ * PURPOSE: Queue a job, starting the I/O thread on first use
+ * INPUTS:
+ *      Job filled in by the caller, job
+ *      Destination for the job id, id
+ * RETURN:
+ *      If the I/O thread cannot be started, return false.
+ *      Else, return true.
+ **/
+static bool submit (Io_job_t* job, unsigned int* id) {
+	pthread_mutex_lock(&io.lock);
+	if (!io.started) {
+		if (pthread_create(&io.thread, NULL, io_main, NULL) != 0) {
+			pthread_mutex_unlock(&io.lock);
+			perror("io: cannot start the I/O thread\n");
+			return false;
+		}
+		io.started = true;
+	}
+	/* ids start at 1 and skip 0 on wrap, so 0 can mean "any job" */
+	if (++io.next_id == 0) {
+		++io.next_id;
+	}
+	job->id = io.next_id;
+	job->state = IO_STATE_QUEUED;
+	job->submitted_ns = stats_now();
+	if (io.tail) {
+		io.tail->next = job;
+	}
+	else {
+		io.head = job;
+	}
+	io.tail = job;
+	*id = job->id;
+	pthread_cond_signal(&io.work_ready);
+	pthread_mutex_unlock(&io.lock);
+	return true;
+}// end submit
+
+/*
+ * PURPOSE: Start writing a matrix to a file of its name in the background.
+ *      The data written is the matrix as it is now; later changes to it do
+ *      not reach the file.
+ * INPUTS:
+ *      Matrix to write, m
+ *      Durability policy, policy
+ *      Whether to write the compressed layout, packed, and its mode
+ *      Destination for the job id, id
+ * RETURN:
+ *      If the matrix cannot be pinned or the job cannot start, return false.
+ *      Else, return true.
+ **/
+bool io_write_async (Matrix_t* m, Write_policy_t policy, bool packed, Pack_mode_t mode, unsigned int* id) {
+	if (!m || !id) {
+		perror("io_write_async: bad input\n");
+		return false;
+	}
+	Io_job_t* job = calloc(1, sizeof(Io_job_t));
+	if (!job) {
+		perror("io_write_async: allocation error\n");
+		return false;
+	}
+	if (!share_matrix(m, m->name, &job->matrix)) {
+		free(job);
+		return false;
+	}
+	job->kind = IO_JOB_WRITE;
+	memcpy(job->path, m->name, strlen(m->name) + 1);
+	job->policy = policy;
+	job->packed = packed;
+	job->mode = mode;
+	if (!submit(job, id)) {
+		destroy_matrix(&job->matrix);
+		free(job);
+		return false;
+	}
+	return true;
+}// end io_write_async
+
+/*
+ * PURPOSE: Start reading a matrix file in the background
+ * INPUTS:
+ *      File to read, path (shorter than IO_PATH_LEN)
+ *      Destination for the job id, id
+ * RETURN:
+ *      If the path is too long or the job cannot start, return false.
+ *      Else, return true.
+ **/
+bool io_read_async (const char* path, unsigned int* id) {
+	if (!path || !id) {
+		perror("io_read_async: bad input\n");
+		return false;
+	}
+	const size_t len = strlen(path) + 1;
+	if (len > IO_PATH_LEN) {
+		printf("File name %s is longer than %d characters\n", path, IO_PATH_LEN - 1);
+		return false;
+	}
+	Io_job_t* job = calloc(1, sizeof(Io_job_t));
+	if (!job) {
+		perror("io_read_async: allocation error\n");
+		return false;
+	}
+	job->kind = IO_JOB_READ;
+	memcpy(job->path, path, len);
+	if (!submit(job, id)) {
+		free(job);
+		return false;
+	}
+	return true;
+}// end io_read_async
+
+/*
+ * PURPOSE: Wait for a job to finish and hand back its result. A write's
+ *      share is released here, which unpins the matrix.
+ * INPUTS:
+ *      Job to wait for, id (0 for the oldest uncollected job)
+ *      Destination for the result, result
+ * RETURN:
+ *      If there is no such job, return false.
+ *      Else, return true.
+ **/
+bool io_collect (unsigned int id, Io_result_t* result) {
+	if (!result) {
+		perror("io_collect: bad input\n");
+		return false;
+	}
+	pthread_mutex_lock(&io.lock);
+	Io_job_t* prev = NULL;
+	Io_job_t* job = io.head;
+	while (job && id != 0 && job->id != id) {
+		prev = job;
+		job = job->next;
+	}
+	if (!job) {
+		pthread_mutex_unlock(&io.lock);
+		return false;
+	}
+	while (job->state != IO_STATE_DONE) {
+		pthread_cond_wait(&io.job_done, &io.lock);
+	}
+	/* only this thread unlinks jobs, so prev is still the job before it */
+	if (prev) {
+		prev->next = job->next;
+	}
+	else {
+		io.head = job->next;
+	}
+	if (io.tail == job) {
+		io.tail = prev;
+	}
+	pthread_mutex_unlock(&io.lock);
+
+	result->id = job->id;
+	result->kind = job->kind;
+	result->ok = job->ok;
+	memcpy(result->path, job->path, sizeof(result->path));
+	result->elapsed_ns = job->finished_ns - job->submitted_ns;
+	result->matrix = NULL;
+	if (job->kind == IO_JOB_WRITE) {
+		destroy_matrix(&job->matrix);
+	}
+	else {
+		result->matrix = job->matrix;
+	}
+	free(job);
+	return true;
+}// end io_collect
+
+/*
+ * PURPOSE: Check whether a matrix's current data is being written in the background
+ * INPUTS:
+ *      Matrix to check, m
+ * RETURN:
+ *      If an unfinished write holds the matrix's buffer, return true.
+ *      Else, return false.
+ **/
+bool io_is_pinned (const Matrix_t* m) {
+	if (!m) {
+		return false;
+	}
+	pthread_mutex_lock(&io.lock);
+	const Io_job_t* job = io.head;
+	while (job && !(job->kind == IO_JOB_WRITE && job->state != IO_STATE_DONE
+		&& job->matrix->buffer == m->buffer)) {
+		job = job->next;
+	}
+	pthread_mutex_unlock(&io.lock);
+	return job != NULL;
+}// end io_is_pinned
+
+/*
+ * PURPOSE: Wait until no unfinished job uses a file, so a foreground read or
+ *      write of it happens after the background ones submitted before it
+ * INPUTS:
+ *      File name, path
+ * RETURN:
+ *      void
+ **/
+void io_settle_path (const char* path) {
+	if (!path) {
+		return;
+	}
+	pthread_mutex_lock(&io.lock);
+	for (;;) {
+		const Io_job_t* job = io.head;
+		while (job && (job->state == IO_STATE_DONE || strcmp(job->path, path) != 0)) {
+			job = job->next;
+		}
+		if (!job) {
+			break;
+		}
+		pthread_cond_wait(&io.job_done, &io.lock);
+	}
+	pthread_mutex_unlock(&io.lock);
+}// end io_settle_path
+
+/*
+ * PURPOSE: Finish the queued jobs, stop the I/O thread and drop any results
+ *      nobody collected
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      void
+ **/
+void io_shutdown (void) {
+	pthread_mutex_lock(&io.lock);
+	const bool started = io.started;
+	io.shutdown = true;
+	pthread_cond_signal(&io.work_ready);
+	pthread_mutex_unlock(&io.lock);
+	if (started) {
+		pthread_join(io.thread, NULL);
+	}
+
+	while (io.head) {
+		Io_job_t* job = io.head;
+		io.head = job->next;
+		if (job->matrix) {
+			destroy_matrix(&job->matrix);
+		}
+		free(job);
+	}
+	io.tail = NULL;
+	io.started = false;
+	io.shutdown = false;
+}// end io_shutdown
@@ -0,0 +1,43 @@
+#ifndef _IO_H_
+#define _IO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "matrix.h"
+
+/*
+ * Background matrix reads and writes. Jobs run in submission order on one
+ * I/O thread, started on first use, so commands keep running while files
+ * are written. A write works on a copy-on-write share of the matrix taken
+ * when it is submitted: the share pins the buffer, so a later command that
+ * modifies the matrix copies it first and a drop only releases its own
+ * reference. Finished jobs stay queued until io_collect hands them back;
+ * shares and loaded matrices are only created and released on the thread
+ * that submits and collects, so buffer reference counts stay single threaded.
+ */
+#define IO_PATH_LEN 256
+
+typedef enum {
+	IO_JOB_WRITE = 0,
+	IO_JOB_READ
+}Io_job_kind_t;
+
+/* A finished job handed back by io_collect */
+typedef struct {
+	unsigned int id;
+	Io_job_kind_t kind;
+	bool ok;
+	char path[IO_PATH_LEN];	/* file written or read */
+	Matrix_t* matrix;	/* read: the loaded matrix, now owned by the caller; write: NULL */
+	uint64_t elapsed_ns;	/* from submission to completion */
+}Io_result_t;
+
+bool io_write_async (Matrix_t* m, Write_policy_t policy, bool packed, Pack_mode_t mode, unsigned int* id);
+bool io_read_async (const char* path, unsigned int* id);
+bool io_collect (unsigned int id, Io_result_t* result);
+bool io_is_pinned (const Matrix_t* m);
+void io_settle_path (const char* path);
+void io_shutdown (void);
+
+#endif
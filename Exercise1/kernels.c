@@ -0,0 +1,1482 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86 1
+#endif
+
+#include "kernels.h"
+
+/*
+ * PURPOSE: Portable element-wise add, dst = a + b
+ * INPUTS:
+ *      Destination buffer, dst
+ *      Operand buffers, a and b
+ *      Element count, n
+ * RETURN:
+ *      void
+ **/
+static void add_scalar (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n) {
+	for (size_t i = 0; i < n; ++i) {
+		dst[i] = a[i] + b[i];
+	}
+}// end add_scalar
+
+/*
+ * PURPOSE: Portable element-wise subtract, dst = a - b (wrapping)
+ * INPUTS:
+ *      Destination buffer, dst
+ *      Operand buffers, a and b
+ *      Element count, n
+ * RETURN:
+ *      void
+ **/
+static void sub_scalar (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n) {
+	for (size_t i = 0; i < n; ++i) {
+		dst[i] = a[i] - b[i];
+	}
+}// end sub_scalar
+
+/*
+ * PURPOSE: Portable left shift, shifts of 32 or more clear the element
+ * INPUTS:
+ *      Destination buffer, dst
+ *      Source buffer, src
+ *      Amount to shift by, shift
+ *      Element count, n
+ * RETURN:
+ *      void
+ **/
+static void shl_scalar (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n) {
+	if (shift >= 32) {
+		memset(dst, 0, n * sizeof(unsigned int));
+		return;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		dst[i] = src[i] << shift;
+	}
+}// end shl_scalar
+
+/*
+ * PURPOSE: Portable right shift, shifts of 32 or more clear the element
+ * INPUTS:
+ *      Destination buffer, dst
+ *      Source buffer, src
+ *      Amount to shift by, shift
+ *      Element count, n
+ * RETURN:
+ *      void
+ **/
+static void shr_scalar (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n) {
+	if (shift >= 32) {
+		memset(dst, 0, n * sizeof(unsigned int));
+		return;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		dst[i] = src[i] >> shift;
+	}
+}// end shr_scalar
+
+/*
+ * PURPOSE: Portable sum of a buffer into a 64-bit accumulator
+ * INPUTS:
+ *      Source buffer, src
+ *      Element count, n
+ * RETURN:
+ *      The sum of all elements
+ **/
+static uint64_t sum_scalar (const unsigned int* src, size_t n) {
+	uint64_t sum = 0;
+	for (size_t i = 0; i < n; ++i) {
+		sum += src[i];
+	}
+	return sum;
+}// end sum_scalar
+
+/*
+ * PURPOSE: Portable buffer comparison
+ * INPUTS:
+ *      Buffers to compare, a and b
+ *      Element count, n
+ * RETURN:
+ *      If every element matches, return true.
+ *      Else, return false.
+ **/
+static bool equal_scalar (const unsigned int* a, const unsigned int* b, size_t n) {
+	return memcmp(a, b, n * sizeof(unsigned int)) == 0;
+}// end equal_scalar
+
+/*
+ * PURPOSE: Portable fold of a buffer into a running summary
+ * INPUTS:
+ *      Source buffer, src
+ *      Element count, n
+ *      Summary to update, stats
+ * RETURN:
+ *      void
+ **/
+static void stats_scalar (const unsigned int* src, size_t n, Kernel_stats_t* stats) {
+	uint64_t sum = 0;
+	uint64_t zeros = 0;
+	unsigned int lo = stats->min;
+	unsigned int hi = stats->max;
+	for (size_t i = 0; i < n; ++i) {
+		const unsigned int v = src[i];
+		sum += v;
+		zeros += v == 0;
+		lo = v < lo ? v : lo;
+		hi = v > hi ? v : hi;
+	}
+	stats->sum += sum;
+	stats->nonzero += n - zeros;
+	stats->min = lo;
+	stats->max = hi;
+}// end stats_scalar
+
+static inline uint32_t rotl32 (uint32_t x, int k) {
+	return (x << k) | (x >> (32 - k));
+}
+
+/* Multipliers of the hash's index key and the salt of its second factor */
+#define HASH_INDEX_MUL 0x9E3779B1u
+#define HASH_HIGH_MUL 0x85EBCA77u
+#define HASH_SALT 0xC2B2AE3Du
+
+/* 32-bit key of an element index; consecutive indexes differ by HASH_INDEX_MUL while the low half does not wrap */
+static inline uint32_t hash_key (uint64_t index) {
+	return (uint32_t)index * HASH_INDEX_MUL + (uint32_t)(index >> 32) * HASH_HIGH_MUL;
+}
+
+/* Contribution of value v under key k: a 32 x 32 -> 64 bit product of two mixes of both, 0 for v == 0 */
+static inline uint64_t hash_term (uint32_t v, uint32_t k) {
+	if (!v) {
+		return 0;
+	}
+	return (uint64_t)(v ^ k) * (rotl32(v, 16) ^ k ^ HASH_SALT);
+}
+
+/*
+ * PURPOSE: Portable content hash of a run of elements (see kernel_hash_u32)
+ * INPUTS:
+ *      Source buffer, src
+ *      Element count, n
+ *      Matrix index of src[0], index
+ * RETURN:
+ *      The sum of the elements' contributions
+ **/
+static uint64_t hash_scalar (const unsigned int* src, size_t n, uint64_t index) {
+	uint64_t h = 0;
+	for (size_t i = 0; i < n; ++i) {
+		h += hash_term(src[i], hash_key(index + i));
+	}
+	return h;
+}// end hash_scalar
+
+/*
+ * PURPOSE: Advance one lane of the generator
+ * INPUTS:
+ *      Generator state, rng
+ *      Lane to advance, lane
+ * RETURN:
+ *      The next 32 random bits of that lane
+ **/
+static inline uint32_t rng_next_lane (Kernel_rng_t* rng, unsigned int lane) {
+	uint32_t s0 = rng->s[0][lane];
+	uint32_t s1 = rng->s[1][lane];
+	uint32_t s2 = rng->s[2][lane];
+	uint32_t s3 = rng->s[3][lane];
+	const uint32_t result = rotl32(s1 * 5, 7) * 9;
+	const uint32_t t = s1 << 9;
+	s2 ^= s0;
+	s3 ^= s1;
+	s1 ^= s2;
+	s0 ^= s3;
+	s2 ^= t;
+	s3 = rotl32(s3, 11);
+	rng->s[0][lane] = s0;
+	rng->s[1][lane] = s1;
+	rng->s[2][lane] = s2;
+	rng->s[3][lane] = s3;
+	return result;
+}// end rng_next_lane
+
+/*
+ * PURPOSE: Portable uniform fill over [start, start + span) without modulo bias.
+ *      Each step advances all KERNEL_RNG_LANES lanes and Lemire's multiply-shift
+ *      maps every draw onto the range; draws whose low product word is under
+ *      (2^32 - span) % span are rejected and the accepted ones are appended in
+ *      lane order. The vector kernels produce exactly the same sequence.
+ * INPUTS:
+ *      Destination buffer, dst
+ *      Generator state, rng
+ *      Lowest value, start
+ *      Number of values, span (0 for all 2^32)
+ *      Element count, n
+ * RETURN:
+ *      void
+ **/
+static void random_scalar (unsigned int* dst, Kernel_rng_t* rng, unsigned int start, unsigned int span, size_t n) {
+	const uint32_t threshold = span ? (uint32_t)(0u - span) % span : 0;
+	size_t out = 0;
+	while (out < n) {
+		for (unsigned int lane = 0; lane < KERNEL_RNG_LANES && out < n; ++lane) {
+			const uint32_t x = rng_next_lane(rng, lane);
+			if (span == 0) {
+				dst[out++] = start + x;
+				continue;
+			}
+			const uint64_t m = (uint64_t)x * span;
+			if ((uint32_t)m >= threshold) {
+				dst[out++] = start + (unsigned int)(m >> 32);
+			}
+		}
+	}
+}// end random_scalar
+
+/*
+ * PURPOSE: Portable transpose of a rows x cols block, dst[j][i] = src[i][j]
+ * INPUTS:
+ *      Destination block and its row stride, dst and dst_stride
+ *      Source block and its row stride, src and src_stride
+ *      Source block dimensions, rows and cols
+ * RETURN:
+ *      void
+ **/
+static void transpose_scalar (unsigned int* dst, size_t dst_stride, const unsigned int* src, size_t src_stride,
+		size_t rows, size_t cols) {
+	for (size_t i = 0; i < rows; ++i) {
+		for (size_t j = 0; j < cols; ++j) {
+			dst[j * dst_stride + i] = src[i * src_stride + j];
+		}
+	}
+}// end transpose_scalar
+
+/* Mask of the low bits bits of a word, bits in 0..32 */
+static inline uint32_t pack_mask (unsigned int bits) {
+	return bits >= 32 ? 0xFFFFFFFFu : (1u << bits) - 1;
+}
+
+/*
+ * PURPOSE: Portable unpack of one block, dst[i] = base + field i
+ * INPUTS:
+ *      Destination for KERNEL_PACK_BLOCK values, dst
+ *      Packed block of bits * KERNEL_PACK_BLOCK / 32 words, src
+ *      Value added to every field, base
+ *      Field width, bits (0..32)
+ * RETURN:
+ *      void
+ **/
+static void unpack_scalar (unsigned int* dst, const uint32_t* src, unsigned int base, unsigned int bits) {
+	const uint32_t mask = pack_mask(bits);
+	for (unsigned int lane = 0; lane < KERNEL_PACK_LANES; ++lane) {
+		const uint32_t* word = &src[lane];
+		unsigned int shift = 0;
+		for (unsigned int k = 0; k < KERNEL_PACK_BLOCK / KERNEL_PACK_LANES; ++k) {
+			uint32_t v;
+			if (bits == 0) {
+				v = 0;
+			}
+			else if (shift + bits <= 32) {
+				v = (*word >> shift) & mask;
+				shift += bits;
+				if (shift == 32) {
+					word += KERNEL_PACK_LANES;
+					shift = 0;
+				}
+			}
+			else {
+				v = *word >> shift;
+				word += KERNEL_PACK_LANES;
+				v = (v | (*word << (32 - shift))) & mask;
+				shift = shift + bits - 32;
+			}
+			dst[k * KERNEL_PACK_LANES + lane] = base + v;
+		}
+	}
+}// end unpack_scalar
+
+#ifdef KERNELS_X86
+
+/* SSE2 is part of the x86-64 baseline; the target attributes keep i386 builds honest. */
+
+__attribute__((target("sse2")))
+static void add_sse2 (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i x0 = _mm_loadu_si128((const __m128i*)&a[i]);
+		__m128i x1 = _mm_loadu_si128((const __m128i*)&a[i + 4]);
+		__m128i y0 = _mm_loadu_si128((const __m128i*)&b[i]);
+		__m128i y1 = _mm_loadu_si128((const __m128i*)&b[i + 4]);
+		_mm_storeu_si128((__m128i*)&dst[i], _mm_add_epi32(x0, y0));
+		_mm_storeu_si128((__m128i*)&dst[i + 4], _mm_add_epi32(x1, y1));
+	}
+	add_scalar(&dst[i], &a[i], &b[i], n - i);
+}// end add_sse2
+
+__attribute__((target("sse2")))
+static void sub_sse2 (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i x0 = _mm_loadu_si128((const __m128i*)&a[i]);
+		__m128i x1 = _mm_loadu_si128((const __m128i*)&a[i + 4]);
+		__m128i y0 = _mm_loadu_si128((const __m128i*)&b[i]);
+		__m128i y1 = _mm_loadu_si128((const __m128i*)&b[i + 4]);
+		_mm_storeu_si128((__m128i*)&dst[i], _mm_sub_epi32(x0, y0));
+		_mm_storeu_si128((__m128i*)&dst[i + 4], _mm_sub_epi32(x1, y1));
+	}
+	sub_scalar(&dst[i], &a[i], &b[i], n - i);
+}// end sub_sse2
+
+__attribute__((target("sse2")))
+static void shl_sse2 (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n) {
+	const __m128i count = _mm_cvtsi32_si128((int)(shift < 32 ? shift : 32));
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i*)&src[i]);
+		_mm_storeu_si128((__m128i*)&dst[i], _mm_sll_epi32(x, count));
+	}
+	shl_scalar(&dst[i], &src[i], shift, n - i);
+}// end shl_sse2
+
+__attribute__((target("sse2")))
+static void shr_sse2 (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n) {
+	const __m128i count = _mm_cvtsi32_si128((int)(shift < 32 ? shift : 32));
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i*)&src[i]);
+		_mm_storeu_si128((__m128i*)&dst[i], _mm_srl_epi32(x, count));
+	}
+	shr_scalar(&dst[i], &src[i], shift, n - i);
+}// end shr_sse2
+
+__attribute__((target("sse2")))
+static uint64_t sum_sse2 (const unsigned int* src, size_t n) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero;
+	__m128i acc1 = zero;
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i*)&src[i]);
+		acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(x, zero));
+		acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(x, zero));
+	}
+	uint64_t lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(acc0, acc1));
+	return lanes[0] + lanes[1] + sum_scalar(&src[i], n - i);
+}// end sum_sse2
+
+__attribute__((target("sse2")))
+static bool equal_sse2 (const unsigned int* a, const unsigned int* b, size_t n) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i e0 = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&a[i]),
+			_mm_loadu_si128((const __m128i*)&b[i]));
+		__m128i e1 = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&a[i + 4]),
+			_mm_loadu_si128((const __m128i*)&b[i + 4]));
+		if (_mm_movemask_epi8(_mm_and_si128(e0, e1)) != 0xFFFF) {
+			return false;
+		}
+	}
+	return equal_scalar(&a[i], &b[i], n - i);
+}// end equal_sse2
+
+/*
+ * Elements per pass of the vector stats kernels: zeros are counted in 32-bit
+ * lanes, which are folded into the 64-bit total before they can overflow.
+ */
+#define STATS_PASS ((size_t)1 << 24)
+
+/* SSE2 has no unsigned 32-bit min or max, so both compare with the sign bit flipped */
+__attribute__((target("sse2")))
+static void stats_sse2 (const unsigned int* src, size_t n, Kernel_stats_t* stats) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi32((int)0x80000000u);
+	__m128i lo = _mm_set1_epi32((int)(stats->min ^ 0x80000000u));
+	__m128i hi = _mm_set1_epi32((int)(stats->max ^ 0x80000000u));
+	__m128i acc0 = zero;
+	__m128i acc1 = zero;
+	uint64_t zeros = 0;
+	size_t i = 0;
+	while (n - i >= 4) {
+		const size_t stop = i + ((n - i < STATS_PASS ? n - i : STATS_PASS) & ~(size_t)3);
+		__m128i zero_count = zero;
+		for (; i < stop; i += 4) {
+			const __m128i v = _mm_loadu_si128((const __m128i*)&src[i]);
+			const __m128i biased = _mm_xor_si128(v, bias);
+			const __m128i below = _mm_cmplt_epi32(biased, lo);
+			const __m128i above = _mm_cmpgt_epi32(biased, hi);
+			lo = _mm_or_si128(_mm_and_si128(below, biased), _mm_andnot_si128(below, lo));
+			hi = _mm_or_si128(_mm_and_si128(above, biased), _mm_andnot_si128(above, hi));
+			zero_count = _mm_sub_epi32(zero_count, _mm_cmpeq_epi32(v, zero));
+			acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+			acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+		}
+		uint32_t counts[4];
+		_mm_storeu_si128((__m128i*)counts, zero_count);
+		zeros += (uint64_t)counts[0] + counts[1] + counts[2] + counts[3];
+	}
+	uint64_t sums[2];
+	uint32_t lows[4];
+	uint32_t highs[4];
+	_mm_storeu_si128((__m128i*)sums, _mm_add_epi64(acc0, acc1));
+	_mm_storeu_si128((__m128i*)lows, _mm_xor_si128(lo, bias));
+	_mm_storeu_si128((__m128i*)highs, _mm_xor_si128(hi, bias));
+	stats->sum += sums[0] + sums[1];
+	stats->nonzero += i - zeros;
+	for (unsigned int l = 0; l < 4; ++l) {
+		stats->min = lows[l] < stats->min ? lows[l] : stats->min;
+		stats->max = highs[l] > stats->max ? highs[l] : stats->max;
+	}
+	stats_scalar(&src[i], n - i, stats);
+}// end stats_sse2
+
+/* Four contributions per step; a step whose index crosses a 2^32 boundary goes through hash_scalar */
+__attribute__((target("sse2")))
+static uint64_t hash_sse2 (const unsigned int* src, size_t n, uint64_t index) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lane_keys = _mm_set_epi32((int)(3 * HASH_INDEX_MUL), (int)(2 * HASH_INDEX_MUL),
+		(int)HASH_INDEX_MUL, 0);
+	const __m128i salt = _mm_set1_epi32((int)HASH_SALT);
+	__m128i acc = zero;
+	uint64_t tail = 0;
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		if ((uint32_t)(index + i) > UINT32_MAX - 3) {
+			tail += hash_scalar(&src[i], 4, index + i);
+			continue;
+		}
+		const __m128i k = _mm_add_epi32(_mm_set1_epi32((int)hash_key(index + i)), lane_keys);
+		const __m128i v = _mm_loadu_si128((const __m128i*)&src[i]);
+		const __m128i x = _mm_andnot_si128(_mm_cmpeq_epi32(v, zero), _mm_xor_si128(v, k));
+		const __m128i rot = _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16));
+		const __m128i y = _mm_xor_si128(_mm_xor_si128(rot, k), salt);
+		acc = _mm_add_epi64(acc, _mm_mul_epu32(x, y));
+		acc = _mm_add_epi64(acc, _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32)));
+	}
+	uint64_t lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, acc);
+	return lanes[0] + lanes[1] + tail + hash_scalar(&src[i], n - i, index + i);
+}// end hash_sse2
+
+/* 4 x 4 register transposes, the ragged edges go through transpose_scalar */
+__attribute__((target("sse2")))
+static void transpose_sse2 (unsigned int* dst, size_t dst_stride, const unsigned int* src, size_t src_stride,
+		size_t rows, size_t cols) {
+	size_t i = 0;
+	for (; i + 4 <= rows; i += 4) {
+		size_t j = 0;
+		for (; j + 4 <= cols; j += 4) {
+			const unsigned int* s = &src[i * src_stride + j];
+			const __m128i r0 = _mm_loadu_si128((const __m128i*)s);
+			const __m128i r1 = _mm_loadu_si128((const __m128i*)&s[src_stride]);
+			const __m128i r2 = _mm_loadu_si128((const __m128i*)&s[2 * src_stride]);
+			const __m128i r3 = _mm_loadu_si128((const __m128i*)&s[3 * src_stride]);
+			const __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+			const __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+			const __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+			const __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+			unsigned int* d = &dst[j * dst_stride + i];
+			_mm_storeu_si128((__m128i*)d, _mm_unpacklo_epi64(t0, t1));
+			_mm_storeu_si128((__m128i*)&d[dst_stride], _mm_unpackhi_epi64(t0, t1));
+			_mm_storeu_si128((__m128i*)&d[2 * dst_stride], _mm_unpacklo_epi64(t2, t3));
+			_mm_storeu_si128((__m128i*)&d[3 * dst_stride], _mm_unpackhi_epi64(t2, t3));
+		}
+		transpose_scalar(&dst[j * dst_stride + i], dst_stride, &src[i * src_stride + j], src_stride, 4, cols - j);
+	}
+	transpose_scalar(&dst[i], dst_stride, &src[i * src_stride], src_stride, rows - i, cols);
+}// end transpose_sse2
+
+__attribute__((target("avx2")))
+static void add_avx2 (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i x0 = _mm256_loadu_si256((const __m256i*)&a[i]);
+		__m256i x1 = _mm256_loadu_si256((const __m256i*)&a[i + 8]);
+		__m256i y0 = _mm256_loadu_si256((const __m256i*)&b[i]);
+		__m256i y1 = _mm256_loadu_si256((const __m256i*)&b[i + 8]);
+		_mm256_storeu_si256((__m256i*)&dst[i], _mm256_add_epi32(x0, y0));
+		_mm256_storeu_si256((__m256i*)&dst[i + 8], _mm256_add_epi32(x1, y1));
+	}
+	add_scalar(&dst[i], &a[i], &b[i], n - i);
+}// end add_avx2
+
+__attribute__((target("avx2")))
+static void sub_avx2 (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i x0 = _mm256_loadu_si256((const __m256i*)&a[i]);
+		__m256i x1 = _mm256_loadu_si256((const __m256i*)&a[i + 8]);
+		__m256i y0 = _mm256_loadu_si256((const __m256i*)&b[i]);
+		__m256i y1 = _mm256_loadu_si256((const __m256i*)&b[i + 8]);
+		_mm256_storeu_si256((__m256i*)&dst[i], _mm256_sub_epi32(x0, y0));
+		_mm256_storeu_si256((__m256i*)&dst[i + 8], _mm256_sub_epi32(x1, y1));
+	}
+	sub_scalar(&dst[i], &a[i], &b[i], n - i);
+}// end sub_avx2
+
+__attribute__((target("avx2")))
+static void shl_avx2 (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n) {
+	const __m128i count = _mm_cvtsi32_si128((int)(shift < 32 ? shift : 32));
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)&src[i]);
+		_mm256_storeu_si256((__m256i*)&dst[i], _mm256_sll_epi32(x, count));
+	}
+	shl_scalar(&dst[i], &src[i], shift, n - i);
+}// end shl_avx2
+
+__attribute__((target("avx2")))
+static void shr_avx2 (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n) {
+	const __m128i count = _mm_cvtsi32_si128((int)(shift < 32 ? shift : 32));
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)&src[i]);
+		_mm256_storeu_si256((__m256i*)&dst[i], _mm256_srl_epi32(x, count));
+	}
+	shr_scalar(&dst[i], &src[i], shift, n - i);
+}// end shr_avx2
+
+__attribute__((target("avx2")))
+static uint64_t sum_avx2 (const unsigned int* src, size_t n) {
+	__m256i acc0 = _mm256_setzero_si256();
+	__m256i acc1 = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i lo = _mm_loadu_si128((const __m128i*)&src[i]);
+		__m128i hi = _mm_loadu_si128((const __m128i*)&src[i + 4]);
+		acc0 = _mm256_add_epi64(acc0, _mm256_cvtepu32_epi64(lo));
+		acc1 = _mm256_add_epi64(acc1, _mm256_cvtepu32_epi64(hi));
+	}
+	uint64_t lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(acc0, acc1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_scalar(&src[i], n - i);
+}// end sum_avx2
+
+__attribute__((target("avx2")))
+static bool equal_avx2 (const unsigned int* a, const unsigned int* b, size_t n) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i d0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)&a[i]),
+			_mm256_loadu_si256((const __m256i*)&b[i]));
+		__m256i d1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)&a[i + 8]),
+			_mm256_loadu_si256((const __m256i*)&b[i + 8]));
+		__m256i d = _mm256_or_si256(d0, d1);
+		if (!_mm256_testz_si256(d, d)) {
+			return false;
+		}
+	}
+	return equal_scalar(&a[i], &b[i], n - i);
+}// end equal_avx2
+
+__attribute__((target("avx2")))
+static void stats_avx2 (const unsigned int* src, size_t n, Kernel_stats_t* stats) {
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_set1_epi32((int)stats->min);
+	__m256i hi = _mm256_set1_epi32((int)stats->max);
+	__m256i acc0 = zero;
+	__m256i acc1 = zero;
+	uint64_t zeros = 0;
+	size_t i = 0;
+	while (n - i >= 8) {
+		const size_t stop = i + ((n - i < STATS_PASS ? n - i : STATS_PASS) & ~(size_t)7);
+		__m256i zero_count = zero;
+		for (; i < stop; i += 8) {
+			const __m256i v = _mm256_loadu_si256((const __m256i*)&src[i]);
+			lo = _mm256_min_epu32(lo, v);
+			hi = _mm256_max_epu32(hi, v);
+			zero_count = _mm256_sub_epi32(zero_count, _mm256_cmpeq_epi32(v, zero));
+			acc0 = _mm256_add_epi64(acc0, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(v)));
+			acc1 = _mm256_add_epi64(acc1, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(v, 1)));
+		}
+		uint32_t counts[8];
+		_mm256_storeu_si256((__m256i*)counts, zero_count);
+		for (unsigned int l = 0; l < 8; ++l) {
+			zeros += counts[l];
+		}
+	}
+	uint64_t sums[4];
+	uint32_t lows[8];
+	uint32_t highs[8];
+	_mm256_storeu_si256((__m256i*)sums, _mm256_add_epi64(acc0, acc1));
+	_mm256_storeu_si256((__m256i*)lows, lo);
+	_mm256_storeu_si256((__m256i*)highs, hi);
+	stats->sum += sums[0] + sums[1] + sums[2] + sums[3];
+	stats->nonzero += i - zeros;
+	for (unsigned int l = 0; l < 8; ++l) {
+		stats->min = lows[l] < stats->min ? lows[l] : stats->min;
+		stats->max = highs[l] > stats->max ? highs[l] : stats->max;
+	}
+	stats_scalar(&src[i], n - i, stats);
+}// end stats_avx2
+
+/* Eight contributions per step; a step whose index crosses a 2^32 boundary goes through hash_scalar */
+__attribute__((target("avx2")))
+static uint64_t hash_avx2 (const unsigned int* src, size_t n, uint64_t index) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i lane_keys = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+		_mm256_set1_epi32((int)HASH_INDEX_MUL));
+	const __m256i salt = _mm256_set1_epi32((int)HASH_SALT);
+	__m256i acc0 = zero;
+	__m256i acc1 = zero;
+	uint64_t tail = 0;
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		if ((uint32_t)(index + i) > UINT32_MAX - 7) {
+			tail += hash_scalar(&src[i], 8, index + i);
+			continue;
+		}
+		const __m256i k = _mm256_add_epi32(_mm256_set1_epi32((int)hash_key(index + i)), lane_keys);
+		const __m256i v = _mm256_loadu_si256((const __m256i*)&src[i]);
+		const __m256i x = _mm256_andnot_si256(_mm256_cmpeq_epi32(v, zero), _mm256_xor_si256(v, k));
+		const __m256i rot = _mm256_or_si256(_mm256_slli_epi32(v, 16), _mm256_srli_epi32(v, 16));
+		const __m256i y = _mm256_xor_si256(_mm256_xor_si256(rot, k), salt);
+		acc0 = _mm256_add_epi64(acc0, _mm256_mul_epu32(x, y));
+		acc1 = _mm256_add_epi64(acc1, _mm256_mul_epu32(_mm256_srli_epi64(x, 32), _mm256_srli_epi64(y, 32)));
+	}
+	uint64_t lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(acc0, acc1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + tail + hash_scalar(&src[i], n - i, index + i);
+}// end hash_avx2
+
+/* Indices that move the accepted lanes of a step to the front, one row per acceptance mask */
+static uint32_t compact_lut[1 << KERNEL_RNG_LANES][KERNEL_RNG_LANES];
+
+/*
+ * PURPOSE: Fill compact_lut, called once before the vector random kernels are bound
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      void
+ **/
+static void build_compact_lut (void) {
+	for (unsigned int mask = 0; mask < (1u << KERNEL_RNG_LANES); ++mask) {
+		unsigned int k = 0;
+		for (unsigned int lane = 0; lane < KERNEL_RNG_LANES; ++lane) {
+			if (mask & (1u << lane)) {
+				compact_lut[mask][k++] = lane;
+			}
+		}
+		while (k < KERNEL_RNG_LANES) {
+			compact_lut[mask][k++] = 0;
+		}
+	}
+}// end build_compact_lut
+
+__attribute__((target("sse2")))
+static void random_sse2 (unsigned int* dst, Kernel_rng_t* rng, unsigned int start, unsigned int span, size_t n) {
+	const uint32_t threshold = span ? (uint32_t)(0u - span) % span : 0;
+	const __m128i sign = _mm_set1_epi32((int)0x80000000u);
+	const __m128i vspan = _mm_set1_epi32((int)span);
+	const __m128i vstart = _mm_set1_epi32((int)start);
+	const __m128i vthreshold = _mm_xor_si128(_mm_set1_epi32((int)threshold), sign);
+	__m128i s[4][2];
+	for (int w = 0; w < 4; ++w) {
+		s[w][0] = _mm_loadu_si128((const __m128i*)&rng->s[w][0]);
+		s[w][1] = _mm_loadu_si128((const __m128i*)&rng->s[w][4]);
+	}
+
+	/* stop while a whole step still fits, so the unpacked stores never overrun */
+	size_t out = 0;
+	while (out + KERNEL_RNG_LANES <= n) {
+		__m128i value[2];
+		unsigned int accepted = 0xFF;
+		for (int h = 0; h < 2; ++h) {
+			const __m128i x5 = _mm_add_epi32(s[1][h], _mm_slli_epi32(s[1][h], 2));
+			const __m128i r = _mm_or_si128(_mm_slli_epi32(x5, 7), _mm_srli_epi32(x5, 25));
+			__m128i x = _mm_add_epi32(r, _mm_slli_epi32(r, 3));
+			const __m128i t = _mm_slli_epi32(s[1][h], 9);
+			s[2][h] = _mm_xor_si128(s[2][h], s[0][h]);
+			s[3][h] = _mm_xor_si128(s[3][h], s[1][h]);
+			s[1][h] = _mm_xor_si128(s[1][h], s[2][h]);
+			s[0][h] = _mm_xor_si128(s[0][h], s[3][h]);
+			s[2][h] = _mm_xor_si128(s[2][h], t);
+			s[3][h] = _mm_or_si128(_mm_slli_epi32(s[3][h], 11), _mm_srli_epi32(s[3][h], 21));
+			if (span) {
+				const __m128i even = _mm_mul_epu32(x, vspan);
+				const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), vspan);
+				const __m128i hi = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(3, 1, 3, 1)),
+					_mm_shuffle_epi32(odd, _MM_SHUFFLE(3, 1, 3, 1)));
+				const __m128i lo = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(2, 0, 2, 0)),
+					_mm_shuffle_epi32(odd, _MM_SHUFFLE(2, 0, 2, 0)));
+				const __m128i reject = _mm_cmpgt_epi32(vthreshold, _mm_xor_si128(lo, sign));
+				accepted &= ~((unsigned int)_mm_movemask_ps(_mm_castsi128_ps(reject)) << (4 * h));
+				x = hi;
+			}
+			value[h] = _mm_add_epi32(x, vstart);
+		}
+		if (accepted == 0xFF) {
+			_mm_storeu_si128((__m128i*)&dst[out], value[0]);
+			_mm_storeu_si128((__m128i*)&dst[out + 4], value[1]);
+			out += KERNEL_RNG_LANES;
+		}
+		else {
+			/* SSE2 has no variable shuffle, so rejected steps are packed through memory */
+			uint32_t lanes[KERNEL_RNG_LANES];
+			_mm_storeu_si128((__m128i*)&lanes[0], value[0]);
+			_mm_storeu_si128((__m128i*)&lanes[4], value[1]);
+			const uint32_t* order = compact_lut[accepted];
+			const unsigned int count = __builtin_popcount(accepted);
+			for (unsigned int k = 0; k < count; ++k) {
+				dst[out + k] = lanes[order[k]];
+			}
+			out += count;
+		}
+	}
+	for (int w = 0; w < 4; ++w) {
+		_mm_storeu_si128((__m128i*)&rng->s[w][0], s[w][0]);
+		_mm_storeu_si128((__m128i*)&rng->s[w][4], s[w][1]);
+	}
+	random_scalar(&dst[out], rng, start, span, n - out);
+}// end random_sse2
+
+__attribute__((target("avx2")))
+static void random_avx2 (unsigned int* dst, Kernel_rng_t* rng, unsigned int start, unsigned int span, size_t n) {
+	const uint32_t threshold = span ? (uint32_t)(0u - span) % span : 0;
+	const __m256i sign = _mm256_set1_epi32((int)0x80000000u);
+	const __m256i vspan = _mm256_set1_epi32((int)span);
+	const __m256i vstart = _mm256_set1_epi32((int)start);
+	const __m256i vthreshold = _mm256_xor_si256(_mm256_set1_epi32((int)threshold), sign);
+	__m256i s0 = _mm256_loadu_si256((const __m256i*)rng->s[0]);
+	__m256i s1 = _mm256_loadu_si256((const __m256i*)rng->s[1]);
+	__m256i s2 = _mm256_loadu_si256((const __m256i*)rng->s[2]);
+	__m256i s3 = _mm256_loadu_si256((const __m256i*)rng->s[3]);
+
+	/* stop while a whole step still fits, so the packed store never overruns */
+	size_t out = 0;
+	while (out + KERNEL_RNG_LANES <= n) {
+		const __m256i x5 = _mm256_add_epi32(s1, _mm256_slli_epi32(s1, 2));
+		const __m256i r = _mm256_or_si256(_mm256_slli_epi32(x5, 7), _mm256_srli_epi32(x5, 25));
+		__m256i x = _mm256_add_epi32(r, _mm256_slli_epi32(r, 3));
+		const __m256i t = _mm256_slli_epi32(s1, 9);
+		s2 = _mm256_xor_si256(s2, s0);
+		s3 = _mm256_xor_si256(s3, s1);
+		s1 = _mm256_xor_si256(s1, s2);
+		s0 = _mm256_xor_si256(s0, s3);
+		s2 = _mm256_xor_si256(s2, t);
+		s3 = _mm256_or_si256(_mm256_slli_epi32(s3, 11), _mm256_srli_epi32(s3, 21));
+		if (!span) {
+			_mm256_storeu_si256((__m256i*)&dst[out], _mm256_add_epi32(x, vstart));
+			out += KERNEL_RNG_LANES;
+			continue;
+		}
+		const __m256i even = _mm256_mul_epu32(x, vspan);
+		const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), vspan);
+		const __m256i hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+		const __m256i lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+		const __m256i reject = _mm256_cmpgt_epi32(vthreshold, _mm256_xor_si256(lo, sign));
+		const unsigned int accepted = ~(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(reject)) & 0xFF;
+		__m256i value = _mm256_add_epi32(hi, vstart);
+		if (accepted != 0xFF) {
+			value = _mm256_permutevar8x32_epi32(value, _mm256_loadu_si256((const __m256i*)compact_lut[accepted]));
+		}
+		_mm256_storeu_si256((__m256i*)&dst[out], value);
+		out += __builtin_popcount(accepted);
+	}
+	_mm256_storeu_si256((__m256i*)rng->s[0], s0);
+	_mm256_storeu_si256((__m256i*)rng->s[1], s1);
+	_mm256_storeu_si256((__m256i*)rng->s[2], s2);
+	_mm256_storeu_si256((__m256i*)rng->s[3], s3);
+	random_scalar(&dst[out], rng, start, span, n - out);
+}// end random_avx2
+
+/* The two halves of each row of lanes are decoded side by side in two registers */
+__attribute__((target("sse2")))
+static void unpack_sse2 (unsigned int* dst, const uint32_t* src, unsigned int base, unsigned int bits) {
+	const __m128i mask = _mm_set1_epi32((int)pack_mask(bits));
+	const __m128i offset = _mm_set1_epi32((int)base);
+	const uint32_t* word = src;
+	__m128i lo = _mm_loadu_si128((const __m128i*)word);
+	__m128i hi = _mm_loadu_si128((const __m128i*)&word[4]);
+	unsigned int shift = 0;
+	for (unsigned int k = 0; k < KERNEL_PACK_BLOCK / KERNEL_PACK_LANES; ++k) {
+		__m128i v_lo;
+		__m128i v_hi;
+		if (bits == 0) {
+			v_lo = _mm_setzero_si128();
+			v_hi = v_lo;
+		}
+		else if (shift + bits <= 32) {
+			const __m128i count = _mm_cvtsi32_si128(shift);
+			v_lo = _mm_and_si128(_mm_srl_epi32(lo, count), mask);
+			v_hi = _mm_and_si128(_mm_srl_epi32(hi, count), mask);
+			shift += bits;
+			if (shift == 32 && k + 1 < KERNEL_PACK_BLOCK / KERNEL_PACK_LANES) {
+				word += KERNEL_PACK_LANES;
+				lo = _mm_loadu_si128((const __m128i*)word);
+				hi = _mm_loadu_si128((const __m128i*)&word[4]);
+				shift = 0;
+			}
+		}
+		else {
+			const __m128i count = _mm_cvtsi32_si128(shift);
+			const __m128i back = _mm_cvtsi32_si128(32 - shift);
+			v_lo = _mm_srl_epi32(lo, count);
+			v_hi = _mm_srl_epi32(hi, count);
+			word += KERNEL_PACK_LANES;
+			lo = _mm_loadu_si128((const __m128i*)word);
+			hi = _mm_loadu_si128((const __m128i*)&word[4]);
+			v_lo = _mm_and_si128(_mm_or_si128(v_lo, _mm_sll_epi32(lo, back)), mask);
+			v_hi = _mm_and_si128(_mm_or_si128(v_hi, _mm_sll_epi32(hi, back)), mask);
+			shift = shift + bits - 32;
+		}
+		_mm_storeu_si128((__m128i*)&dst[k * KERNEL_PACK_LANES], _mm_add_epi32(v_lo, offset));
+		_mm_storeu_si128((__m128i*)&dst[k * KERNEL_PACK_LANES + 4], _mm_add_epi32(v_hi, offset));
+	}
+}// end unpack_sse2
+
+/* Every lane in one register: one load per packed word row, shifts and masks per field */
+__attribute__((target("avx2")))
+static void unpack_avx2 (unsigned int* dst, const uint32_t* src, unsigned int base, unsigned int bits) {
+	const __m256i mask = _mm256_set1_epi32((int)pack_mask(bits));
+	const __m256i offset = _mm256_set1_epi32((int)base);
+	if (bits == 0) {
+		for (unsigned int k = 0; k < KERNEL_PACK_BLOCK / KERNEL_PACK_LANES; ++k) {
+			_mm256_storeu_si256((__m256i*)&dst[k * KERNEL_PACK_LANES], offset);
+		}
+		return;
+	}
+	const uint32_t* word = src;
+	__m256i w = _mm256_loadu_si256((const __m256i*)word);
+	unsigned int shift = 0;
+	for (unsigned int k = 0; k < KERNEL_PACK_BLOCK / KERNEL_PACK_LANES; ++k) {
+		__m256i v;
+		if (shift + bits <= 32) {
+			v = _mm256_and_si256(_mm256_srl_epi32(w, _mm_cvtsi32_si128(shift)), mask);
+			shift += bits;
+			if (shift == 32 && k + 1 < KERNEL_PACK_BLOCK / KERNEL_PACK_LANES) {
+				word += KERNEL_PACK_LANES;
+				w = _mm256_loadu_si256((const __m256i*)word);
+				shift = 0;
+			}
+		}
+		else {
+			v = _mm256_srl_epi32(w, _mm_cvtsi32_si128(shift));
+			word += KERNEL_PACK_LANES;
+			w = _mm256_loadu_si256((const __m256i*)word);
+			v = _mm256_and_si256(_mm256_or_si256(v, _mm256_sll_epi32(w, _mm_cvtsi32_si128(32 - shift))), mask);
+			shift = shift + bits - 32;
+		}
+		_mm256_storeu_si256((__m256i*)&dst[k * KERNEL_PACK_LANES], _mm256_add_epi32(v, offset));
+	}
+}// end unpack_avx2
+
+/* 8 x 8 register transposes: 32-bit and 64-bit unpacks within lanes, then a 128-bit lane swap */
+__attribute__((target("avx2")))
+static void transpose_avx2 (unsigned int* dst, size_t dst_stride, const unsigned int* src, size_t src_stride,
+		size_t rows, size_t cols) {
+	size_t i = 0;
+	for (; i + 8 <= rows; i += 8) {
+		size_t j = 0;
+		for (; j + 8 <= cols; j += 8) {
+			const unsigned int* s = &src[i * src_stride + j];
+			__m256i r[8];
+			for (int k = 0; k < 8; ++k) {
+				r[k] = _mm256_loadu_si256((const __m256i*)&s[k * src_stride]);
+			}
+			const __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+			const __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+			const __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+			const __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+			const __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+			const __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+			const __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+			const __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+			const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+			const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+			const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+			const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+			const __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+			const __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+			const __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+			const __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+			unsigned int* d = &dst[j * dst_stride + i];
+			_mm256_storeu_si256((__m256i*)d, _mm256_permute2x128_si256(u0, u4, 0x20));
+			_mm256_storeu_si256((__m256i*)&d[dst_stride], _mm256_permute2x128_si256(u1, u5, 0x20));
+			_mm256_storeu_si256((__m256i*)&d[2 * dst_stride], _mm256_permute2x128_si256(u2, u6, 0x20));
+			_mm256_storeu_si256((__m256i*)&d[3 * dst_stride], _mm256_permute2x128_si256(u3, u7, 0x20));
+			_mm256_storeu_si256((__m256i*)&d[4 * dst_stride], _mm256_permute2x128_si256(u0, u4, 0x31));
+			_mm256_storeu_si256((__m256i*)&d[5 * dst_stride], _mm256_permute2x128_si256(u1, u5, 0x31));
+			_mm256_storeu_si256((__m256i*)&d[6 * dst_stride], _mm256_permute2x128_si256(u2, u6, 0x31));
+			_mm256_storeu_si256((__m256i*)&d[7 * dst_stride], _mm256_permute2x128_si256(u3, u7, 0x31));
+		}
+		transpose_sse2(&dst[j * dst_stride + i], dst_stride, &src[i * src_stride + j], src_stride, 8, cols - j);
+	}
+	transpose_sse2(&dst[i], dst_stride, &src[i * src_stride], src_stride, rows - i, cols);
+}// end transpose_avx2
+
+#endif
+
+/*
+ * Typed kernel templates. TYPED_KERNELS(sfx, T, kind, attr, isa) defines the
+ * kernels for elements of type T as <op>_<sfx>_<isa>, each carrying attr (a
+ * target attribute, or nothing for the baseline build), and gathers them in
+ * the table typed_<sfx>_<isa>. kind is int or real and picks the templates
+ * that differ between integers and floats.
+ */
+#define TYPED_COMMON(sfx, T, attr, isa) \
+attr static void add_##sfx##_##isa (void* dst, const void* a, const void* b, size_t n) { \
+	T* d = dst; \
+	const T* x = a; \
+	const T* y = b; \
+	for (size_t i = 0; i < n; ++i) { \
+		d[i] = (T)(x[i] + y[i]); \
+	} \
+} \
+attr static void from_u64_##sfx##_##isa (void* dst, const uint64_t* src, size_t n) { \
+	T* d = dst; \
+	for (size_t i = 0; i < n; ++i) { \
+		d[i] = (T)src[i]; \
+	} \
+}
+
+#define TYPED_int(sfx, T, attr, isa) \
+attr static void shl_##sfx##_##isa (void* dst, const void* src, unsigned int shift, size_t n) { \
+	T* d = dst; \
+	const T* s = src; \
+	if (shift >= sizeof(T) * 8) { \
+		memset(d, 0, n * sizeof(T)); \
+		return; \
+	} \
+	for (size_t i = 0; i < n; ++i) { \
+		d[i] = (T)(s[i] << shift); \
+	} \
+} \
+attr static void shr_##sfx##_##isa (void* dst, const void* src, unsigned int shift, size_t n) { \
+	T* d = dst; \
+	const T* s = src; \
+	if (shift >= sizeof(T) * 8) { \
+		memset(d, 0, n * sizeof(T)); \
+		return; \
+	} \
+	for (size_t i = 0; i < n; ++i) { \
+		d[i] = (T)(s[i] >> shift); \
+	} \
+} \
+attr static void sum_##sfx##_##isa (const void* src, size_t n, Kernel_total_t* total) { \
+	const T* s = src; \
+	uint64_t acc = 0; \
+	for (size_t i = 0; i < n; ++i) { \
+		acc += s[i]; \
+	} \
+	total->integer += acc; \
+} \
+attr static void random_##sfx##_##isa (void* dst, Kernel_rng_t* rng, unsigned int start, unsigned int span, \
+		size_t n) { \
+	T* d = dst; \
+	unsigned int draws[KERNEL_TYPED_DRAWS]; \
+	for (size_t done = 0; done < n; done += KERNEL_TYPED_DRAWS) { \
+		const size_t count = n - done < KERNEL_TYPED_DRAWS ? n - done : KERNEL_TYPED_DRAWS; \
+		kernel_random_u32(draws, rng, start, span, count); \
+		for (size_t i = 0; i < count; ++i) { \
+			d[done + i] = (T)draws[i]; \
+		} \
+	} \
+} \
+attr static void widen_##sfx##_##isa (void* dst, const void* src, size_t n) { \
+	uint64_t* d = dst; \
+	const T* s = src; \
+	for (size_t i = 0; i < n; ++i) { \
+		d[i] = s[i]; \
+	} \
+} \
+attr static void from_f64_##sfx##_##isa (void* dst, const double* src, size_t n) { \
+	T* d = dst; \
+	const double limit = (double)(T)-1 + 1.0; \
+	for (size_t i = 0; i < n; ++i) { \
+		const double v = src[i]; \
+		d[i] = v > 0 ? (v < limit ? (T)v : (T)-1) : 0; \
+	} \
+}
+
+/*
+ * Floats shift by scaling. Multiplying by a power of two is exact short of
+ * overflow or underflow, so scaling in steps of up to 2^64 matches a single
+ * ldexp, and past 2^TYPED_SCALE_MAX every double has reached zero or infinity.
+ */
+#define TYPED_SCALE_MAX 2200u
+
+#define TYPED_real(sfx, T, attr, isa) \
+attr static void scale_##sfx##_##isa (void* dst, const void* src, unsigned int shift, bool down, size_t n) { \
+	T* d = dst; \
+	const T* s = src; \
+	unsigned int left = shift < TYPED_SCALE_MAX ? shift : TYPED_SCALE_MAX; \
+	do { \
+		const unsigned int step = left < 64 ? left : 64; \
+		const double power = step < 64 ? (double)((uint64_t)1 << step) : 18446744073709551616.0; \
+		const T factor = (T)(down ? 1.0 / power : power); \
+		for (size_t i = 0; i < n; ++i) { \
+			d[i] = s[i] * factor; \
+		} \
+		s = d; \
+		left -= step; \
+	} while (left); \
+} \
+attr static void shl_##sfx##_##isa (void* dst, const void* src, unsigned int shift, size_t n) { \
+	scale_##sfx##_##isa(dst, src, shift, false, n); \
+} \
+attr static void shr_##sfx##_##isa (void* dst, const void* src, unsigned int shift, size_t n) { \
+	scale_##sfx##_##isa(dst, src, shift, true, n); \
+} \
+attr static void sum_##sfx##_##isa (const void* src, size_t n, Kernel_total_t* total) { \
+	const T* s = src; \
+	double lanes[8] = { 0 }; \
+	size_t i = 0; \
+	for (; i + 8 <= n; i += 8) { \
+		for (unsigned int l = 0; l < 8; ++l) { \
+			lanes[l] += s[i + l]; \
+		} \
+	} \
+	double acc = 0; \
+	for (; i < n; ++i) { \
+		acc += s[i]; \
+	} \
+	for (unsigned int l = 0; l < 8; ++l) { \
+		acc += lanes[l]; \
+	} \
+	total->real += acc; \
+} \
+attr static void random_##sfx##_##isa (void* dst, Kernel_rng_t* rng, unsigned int start, unsigned int span, \
+		size_t n) { \
+	T* d = dst; \
+	unsigned int draws[KERNEL_TYPED_DRAWS]; \
+	const double scale = (double)span / 4294967296.0; \
+	for (size_t done = 0; done < n; done += KERNEL_TYPED_DRAWS) { \
+		const size_t count = n - done < KERNEL_TYPED_DRAWS ? n - done : KERNEL_TYPED_DRAWS; \
+		kernel_random_u32(draws, rng, 0, 0, count); \
+		for (size_t i = 0; i < count; ++i) { \
+			d[done + i] = (T)(start + scale * draws[i]); \
+		} \
+	} \
+} \
+attr static void widen_##sfx##_##isa (void* dst, const void* src, size_t n) { \
+	double* d = dst; \
+	const T* s = src; \
+	for (size_t i = 0; i < n; ++i) { \
+		d[i] = s[i]; \
+	} \
+} \
+attr static void from_f64_##sfx##_##isa (void* dst, const double* src, size_t n) { \
+	T* d = dst; \
+	for (size_t i = 0; i < n; ++i) { \
+		d[i] = (T)src[i]; \
+	} \
+}
+
+#define TYPED_KERNELS(sfx, T, kind, attr, isa) \
+TYPED_COMMON(sfx, T, attr, isa) \
+TYPED_##kind(sfx, T, attr, isa) \
+static const Kernel_typed_t typed_##sfx##_##isa = { add_##sfx##_##isa, shl_##sfx##_##isa, shr_##sfx##_##isa, \
+	sum_##sfx##_##isa, random_##sfx##_##isa, widen_##sfx##_##isa, from_u64_##sfx##_##isa, from_f64_##sfx##_##isa };
+
+#define TYPED_ALL(attr, isa) \
+TYPED_KERNELS(u8, uint8_t, int, attr, isa) \
+TYPED_KERNELS(u16, uint16_t, int, attr, isa) \
+TYPED_KERNELS(u32, uint32_t, int, attr, isa) \
+TYPED_KERNELS(u64, uint64_t, int, attr, isa) \
+TYPED_KERNELS(f32, float, real, attr, isa) \
+TYPED_KERNELS(f64, double, real, attr, isa)
+
+TYPED_ALL(, base)
+#ifdef KERNELS_X86
+TYPED_ALL(__attribute__((target("avx2"))), avx2)
+#endif
+
+/*
+ * Dispatch table, filled in by select_kernels the first time any entry point
+ * is called. Each slot starts out pointing at a resolver that binds the
+ * table once (pool workers may race here) and then forwards the call.
+ */
+typedef struct {
+	void (*add) (unsigned int*, const unsigned int*, const unsigned int*, size_t);
+	void (*sub) (unsigned int*, const unsigned int*, const unsigned int*, size_t);
+	void (*shl) (unsigned int*, const unsigned int*, unsigned int, size_t);
+	void (*shr) (unsigned int*, const unsigned int*, unsigned int, size_t);
+	uint64_t (*sum) (const unsigned int*, size_t);
+	bool (*equal) (const unsigned int*, const unsigned int*, size_t);
+	uint64_t (*hash) (const unsigned int*, size_t, uint64_t);
+	void (*stats) (const unsigned int*, size_t, Kernel_stats_t*);
+	void (*random) (unsigned int*, Kernel_rng_t*, unsigned int, unsigned int, size_t);
+	void (*transpose) (unsigned int*, size_t, const unsigned int*, size_t, size_t, size_t);
+	void (*unpack) (unsigned int*, const uint32_t*, unsigned int, unsigned int);
+	const char* isa;
+}Kernels_t;
+
+static void select_kernels (void);
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+/* whether the typed tables are the AVX2 build, set with the dispatch table */
+static bool typed_avx2 = false;
+
+static void add_resolve (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n);
+static void sub_resolve (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n);
+static void shl_resolve (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n);
+static void shr_resolve (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n);
+static uint64_t sum_resolve (const unsigned int* src, size_t n);
+static bool equal_resolve (const unsigned int* a, const unsigned int* b, size_t n);
+static uint64_t hash_resolve (const unsigned int* src, size_t n, uint64_t index);
+static void stats_resolve (const unsigned int* src, size_t n, Kernel_stats_t* stats);
+static void random_resolve (unsigned int* dst, Kernel_rng_t* rng, unsigned int start, unsigned int span, size_t n);
+static void transpose_resolve (unsigned int* dst, size_t dst_stride, const unsigned int* src, size_t src_stride,
+		size_t rows, size_t cols);
+static void unpack_resolve (unsigned int* dst, const uint32_t* src, unsigned int base, unsigned int bits);
+
+static Kernels_t kernels = {
+	add_resolve, sub_resolve, shl_resolve, shr_resolve, sum_resolve, equal_resolve, hash_resolve, stats_resolve,
+	random_resolve, transpose_resolve, unpack_resolve, NULL
+};
+
+static void add_resolve (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n) {
+	pthread_once(&kernels_once, select_kernels);
+	kernels.add(dst, a, b, n);
+}
+static void sub_resolve (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n) {
+	pthread_once(&kernels_once, select_kernels);
+	kernels.sub(dst, a, b, n);
+}
+static void shl_resolve (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n) {
+	pthread_once(&kernels_once, select_kernels);
+	kernels.shl(dst, src, shift, n);
+}
+static void shr_resolve (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n) {
+	pthread_once(&kernels_once, select_kernels);
+	kernels.shr(dst, src, shift, n);
+}
+static uint64_t sum_resolve (const unsigned int* src, size_t n) {
+	pthread_once(&kernels_once, select_kernels);
+	return kernels.sum(src, n);
+}
+static bool equal_resolve (const unsigned int* a, const unsigned int* b, size_t n) {
+	pthread_once(&kernels_once, select_kernels);
+	return kernels.equal(a, b, n);
+}
+static uint64_t hash_resolve (const unsigned int* src, size_t n, uint64_t index) {
+	pthread_once(&kernels_once, select_kernels);
+	return kernels.hash(src, n, index);
+}
+static void stats_resolve (const unsigned int* src, size_t n, Kernel_stats_t* stats) {
+	pthread_once(&kernels_once, select_kernels);
+	kernels.stats(src, n, stats);
+}
+static void random_resolve (unsigned int* dst, Kernel_rng_t* rng, unsigned int start, unsigned int span, size_t n) {
+	pthread_once(&kernels_once, select_kernels);
+	kernels.random(dst, rng, start, span, n);
+}
+static void transpose_resolve (unsigned int* dst, size_t dst_stride, const unsigned int* src, size_t src_stride,
+		size_t rows, size_t cols) {
+	pthread_once(&kernels_once, select_kernels);
+	kernels.transpose(dst, dst_stride, src, src_stride, rows, cols);
+}
+static void unpack_resolve (unsigned int* dst, const uint32_t* src, unsigned int base, unsigned int bits) {
+	pthread_once(&kernels_once, select_kernels);
+	kernels.unpack(dst, src, base, bits);
+}
+
+/*
+ * PURPOSE: Bind the dispatch table to the best kernels for this CPU.
+ *      Setting MATLAB_ISA to "scalar", "sse2" or "avx2" caps the selection.
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      void
+ **/
+static void select_kernels (void) {
+	const char* cap = getenv("MATLAB_ISA");
+	Kernels_t chosen = { add_scalar, sub_scalar, shl_scalar, shr_scalar, sum_scalar, equal_scalar, hash_scalar,
+		stats_scalar, random_scalar, transpose_scalar, unpack_scalar, "scalar" };
+
+#ifdef KERNELS_X86
+	__builtin_cpu_init();
+	build_compact_lut();
+	const bool allow_sse2 = !cap || strcmp(cap, "scalar") != 0;
+	const bool allow_avx2 = allow_sse2 && (!cap || strcmp(cap, "sse2") != 0);
+	if (allow_avx2 && __builtin_cpu_supports("avx2")) {
+		Kernels_t avx2 = { add_avx2, sub_avx2, shl_avx2, shr_avx2, sum_avx2, equal_avx2, hash_avx2, stats_avx2,
+			random_avx2, transpose_avx2, unpack_avx2, "avx2" };
+		chosen = avx2;
+		typed_avx2 = true;
+	}
+	else if (allow_sse2 && __builtin_cpu_supports("sse2")) {
+		Kernels_t sse2 = { add_sse2, sub_sse2, shl_sse2, shr_sse2, sum_sse2, equal_sse2, hash_sse2, stats_sse2,
+			random_sse2, transpose_sse2, unpack_sse2, "sse2" };
+		chosen = sse2;
+	}
+#else
+	(void)cap;
+#endif
+
+	kernels = chosen;
+}// end select_kernels
+
+/*
+ * PURPOSE: Element-wise add of two buffers, dst may alias a or b
+ * INPUTS:
+ *      Destination buffer, dst
+ *      Operand buffers, a and b
+ *      Element count, n
+ * RETURN:
+ *      void
+ **/
+void kernel_add_u32 (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n) {
+	kernels.add(dst, a, b, n);
+}// end kernel_add_u32
+
+/*
+ * PURPOSE: Element-wise wrapping subtract of two buffers, dst may alias a or b
+ * INPUTS:
+ *      Destination buffer, dst
+ *      Operand buffers, a and b
+ *      Element count, n
+ * RETURN:
+ *      void
+ **/
+void kernel_sub_u32 (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n) {
+	kernels.sub(dst, a, b, n);
+}// end kernel_sub_u32
+
+/*
+ * PURPOSE: Element-wise left shift, dst may alias src
+ * INPUTS:
+ *      Destination buffer, dst
+ *      Source buffer, src
+ *      Amount to shift by, shift
+ *      Element count, n
+ * RETURN:
+ *      void
+ **/
+void kernel_shl_u32 (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n) {
+	kernels.shl(dst, src, shift, n);
+}// end kernel_shl_u32
+
+/*
+ * PURPOSE: Element-wise right shift, dst may alias src
+ * INPUTS:
+ *      Destination buffer, dst
+ *      Source buffer, src
+ *      Amount to shift by, shift
+ *      Element count, n
+ * RETURN:
+ *      void
+ **/
+void kernel_shr_u32 (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n) {
+	kernels.shr(dst, src, shift, n);
+}// end kernel_shr_u32
+
+/*
+ * PURPOSE: Sum a buffer without overflowing
+ * INPUTS:
+ *      Source buffer, src
+ *      Element count, n
+ * RETURN:
+ *      The 64-bit sum of all elements
+ **/
+uint64_t kernel_sum_u32 (const unsigned int* src, size_t n) {
+	return kernels.sum(src, n);
+}// end kernel_sum_u32
+
+/*
+ * PURPOSE: Compare two buffers, stopping at the first differing block
+ * INPUTS:
+ *      Buffers to compare, a and b
+ *      Element count, n
+ * RETURN:
+ *      If every element matches, return true.
+ *      Else, return false.
+ **/
+bool kernel_equal_u32 (const unsigned int* a, const unsigned int* b, size_t n) {
+	return kernels.equal(a, b, n);
+}// end kernel_equal_u32
+
+/*
+ * PURPOSE: Fold a buffer into a running summary: sum, non-zero count, min and max
+ * INPUTS:
+ *      Source buffer, src
+ *      Element count, n
+ *      Summary to update, stats
+ * RETURN:
+ *      void
+ **/
+void kernel_stats_u32 (const unsigned int* src, size_t n, Kernel_stats_t* stats) {
+	kernels.stats(src, n, stats);
+}// end kernel_stats_u32
+
+/*
+ * PURPOSE: Content hash contributions of a run of elements
+ * INPUTS:
+ *      Source buffer, src
+ *      Element count, n
+ *      Row-major matrix index of src[0], index
+ * RETURN:
+ *      The wrapping sum of the contributions of the non-zero elements
+ **/
+uint64_t kernel_hash_u32 (const unsigned int* src, size_t n, uint64_t index) {
+	return kernels.hash(src, n, index);
+}// end kernel_hash_u32
+
+/*
+ * PURPOSE: Content hash contributions of the values of one CSR row
+ * INPUTS:
+ *      Values and their columns, values and cols
+ *      Value count, n
+ *      Row-major matrix index of the row's column 0, row_index
+ * RETURN:
+ *      The wrapping sum of the contributions of the non-zero values
+ **/
+uint64_t kernel_hash_sparse_u32 (const unsigned int* values, const unsigned int* cols, size_t n, uint64_t row_index) {
+	uint64_t h = 0;
+	for (size_t i = 0; i < n; ++i) {
+		h += hash_term(values[i], hash_key(row_index + cols[i]));
+	}
+	return h;
+}// end kernel_hash_sparse_u32
+
+/*
+ * PURPOSE: Seed every lane of a generator for one stream. Lanes are filled
+ *      from a splitmix64 sequence started at a mix of seed and stream, so
+ *      nearby streams of the same seed are unrelated.
+ * INPUTS:
+ *      Generator to seed, rng
+ *      Seed of the run, seed
+ *      Stream within the run, stream
+ * RETURN:
+ *      void
+ **/
+void kernel_rng_init (Kernel_rng_t* rng, uint64_t seed, uint64_t stream) {
+	uint64_t x = seed ^ (stream * 0xD1B54A32D192ED03ULL);
+	for (unsigned int lane = 0; lane < KERNEL_RNG_LANES; ++lane) {
+		for (int w = 0; w < 4; w += 2) {
+			x += 0x9E3779B97F4A7C15ULL;
+			uint64_t z = x;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			z ^= z >> 31;
+			rng->s[w][lane] = (uint32_t)z;
+			rng->s[w + 1][lane] = (uint32_t)(z >> 32) | 1;
+		}
+	}
+}// end kernel_rng_init
+
+/*
+ * PURPOSE: Fill a buffer with values uniform over [start, start + span), without
+ *      modulo bias. The state is left mid-step, so a stream should be used for
+ *      one fill.
+ * INPUTS:
+ *      Destination buffer, dst
+ *      Generator state, advanced in place, rng
+ *      Lowest value, start
+ *      Number of values, span (0 for the full 32-bit range)
+ *      Element count, n
+ * RETURN:
+ *      void
+ **/
+void kernel_random_u32 (unsigned int* dst, Kernel_rng_t* rng, unsigned int start, unsigned int span, size_t n) {
+	kernels.random(dst, rng, start, span, n);
+}// end kernel_random_u32
+
+/*
+ * PURPOSE: Transpose a rows x cols block into a cols x rows block,
+ *      dst[j * dst_stride + i] = src[i * src_stride + j]. The blocks must not overlap.
+ * INPUTS:
+ *      Destination block and its row stride, dst and dst_stride
+ *      Source block and its row stride, src and src_stride
+ *      Source block dimensions, rows and cols
+ * RETURN:
+ *      void
+ **/
+void kernel_transpose_u32 (unsigned int* dst, size_t dst_stride, const unsigned int* src, size_t src_stride,
+		size_t rows, size_t cols) {
+	kernels.transpose(dst, dst_stride, src, src_stride, rows, cols);
+}// end kernel_transpose_u32
+
+/*
+ * PURPOSE: Pack one block of values as bits-wide offsets from base. Packing
+ *      runs once per write, so it has only this portable version.
+ * INPUTS:
+ *      Destination for bits * KERNEL_PACK_BLOCK / 32 words, dst
+ *      KERNEL_PACK_BLOCK values, each at least base and within bits of it, src
+ *      Value subtracted from every element, base
+ *      Field width, bits (0..32)
+ * RETURN:
+ *      void
+ **/
+void kernel_pack_u32 (uint32_t* dst, const unsigned int* src, unsigned int base, unsigned int bits) {
+	if (bits == 0) {
+		return;
+	}
+	for (unsigned int lane = 0; lane < KERNEL_PACK_LANES; ++lane) {
+		uint32_t* word = &dst[lane];
+		uint32_t acc = 0;
+		unsigned int shift = 0;
+		for (unsigned int k = 0; k < KERNEL_PACK_BLOCK / KERNEL_PACK_LANES; ++k) {
+			const uint32_t v = src[k * KERNEL_PACK_LANES + lane] - base;
+			acc |= v << shift;
+			if (shift + bits < 32) {
+				shift += bits;
+				continue;
+			}
+			*word = acc;
+			word += KERNEL_PACK_LANES;
+			acc = shift + bits > 32 ? v >> (32 - shift) : 0;
+			shift = shift + bits - 32;
+		}
+	}
+}// end kernel_pack_u32
+
+/*
+ * PURPOSE: Unpack one block written by kernel_pack_u32
+ * INPUTS:
+ *      Destination for KERNEL_PACK_BLOCK values, dst
+ *      Packed block, src
+ *      Value added back to every element, base
+ *      Field width, bits (0..32)
+ * RETURN:
+ *      void
+ **/
+void kernel_unpack_u32 (unsigned int* dst, const uint32_t* src, unsigned int base, unsigned int bits) {
+	kernels.unpack(dst, src, base, bits);
+}// end kernel_unpack_u32
+
+/*
+ * PURPOSE: Name the instruction set the kernels are bound to
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      "avx2", "sse2" or "scalar"
+ **/
+const char* kernel_isa_name (void) {
+	pthread_once(&kernels_once, select_kernels);
+	return kernels.isa;
+}// end kernel_isa_name
+
+/*
+ * PURPOSE: Get the kernel table of one element type, bound like the u32
+ *      kernels (see Kernel_typed_t)
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      The table for the running CPU
+ **/
+#ifdef KERNELS_X86
+#define TYPED_TABLE(sfx) \
+const Kernel_typed_t* kernel_typed_##sfx (void) { \
+	pthread_once(&kernels_once, select_kernels); \
+	return typed_avx2 ? &typed_##sfx##_avx2 : &typed_##sfx##_base; \
+}
+#else
+#define TYPED_TABLE(sfx) \
+const Kernel_typed_t* kernel_typed_##sfx (void) { \
+	pthread_once(&kernels_once, select_kernels); \
+	return &typed_##sfx##_base; \
+}
+#endif
+
+TYPED_TABLE(u8)
+TYPED_TABLE(u16)
+TYPED_TABLE(u32)
+TYPED_TABLE(u64)
+TYPED_TABLE(f32)
+TYPED_TABLE(f64)
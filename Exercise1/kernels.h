@@ -0,0 +1,132 @@
+#ifndef _KERNELS_H_
+#define _KERNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Flat element-wise kernels over contiguous unsigned int buffers, plus a
+ * strided block transpose. Each entry point is bound on first use to the
+ * widest implementation the running CPU supports (AVX2, then SSE2, then
+ * portable C).
+ */
+
+void kernel_add_u32 (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n);
+void kernel_sub_u32 (unsigned int* dst, const unsigned int* a, const unsigned int* b, size_t n);
+void kernel_shl_u32 (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n);
+void kernel_shr_u32 (unsigned int* dst, const unsigned int* src, unsigned int shift, size_t n);
+uint64_t kernel_sum_u32 (const unsigned int* src, size_t n);
+bool kernel_equal_u32 (const unsigned int* a, const unsigned int* b, size_t n);
+void kernel_transpose_u32 (unsigned int* dst, size_t dst_stride, const unsigned int* src, size_t src_stride,
+		size_t rows, size_t cols);
+const char* kernel_isa_name (void);
+
+/*
+ * Running summary of elements for the per-matrix aggregates. Start from
+ * KERNEL_STATS_EMPTY; kernel_stats_u32 folds a run of elements into it.
+ */
+typedef struct {
+	uint64_t sum;
+	uint64_t nonzero;
+	unsigned int min;
+	unsigned int max;
+}Kernel_stats_t;
+
+#define KERNEL_STATS_EMPTY { 0, 0, UINT32_MAX, 0 }
+
+void kernel_stats_u32 (const unsigned int* src, size_t n, Kernel_stats_t* stats);
+
+/*
+ * Content hash of a matrix, built so that any layout gives the same value:
+ * each non-zero element contributes a 64-bit mix of its value and its
+ * row-major index in the whole matrix, and contributions are summed
+ * (wrapping), so ranges can be hashed in any order and on any thread. Zero
+ * elements contribute nothing. kernel_hash_u32 hashes n elements whose
+ * first has index index; kernel_hash_sparse_u32 hashes n values whose
+ * indexes are row_index plus their column.
+ */
+uint64_t kernel_hash_u32 (const unsigned int* src, size_t n, uint64_t index);
+uint64_t kernel_hash_sparse_u32 (const unsigned int* values, const unsigned int* cols, size_t n, uint64_t row_index);
+
+/*
+ * xoshiro128** generator run as KERNEL_RNG_LANES interleaved streams so the
+ * vector kernels advance every lane at once. A fill takes the accepted draws
+ * of each step in lane order, so every implementation produces the same
+ * values for the same state.
+ */
+#define KERNEL_RNG_LANES 8
+
+typedef struct {
+	uint32_t s[4][KERNEL_RNG_LANES];
+}Kernel_rng_t;
+
+void kernel_rng_init (Kernel_rng_t* rng, uint64_t seed, uint64_t stream);
+void kernel_random_u32 (unsigned int* dst, Kernel_rng_t* rng, unsigned int start, unsigned int span, size_t n);
+
+/*
+ * Bit packing of KERNEL_PACK_BLOCK values at a time. Value i of a block goes
+ * to lane i % KERNEL_PACK_LANES, and each lane is a little-endian stream of
+ * bits-wide fields held in 32-bit words; word w of lane l is stored at
+ * w * KERNEL_PACK_LANES + l. A packed block is therefore bits * 32 bytes,
+ * and the unpackers decode a whole vector of lanes per step.
+ */
+#define KERNEL_PACK_BLOCK 256
+#define KERNEL_PACK_LANES 8
+
+void kernel_pack_u32 (uint32_t* dst, const unsigned int* src, unsigned int base, unsigned int bits);
+void kernel_unpack_u32 (unsigned int* dst, const uint32_t* src, unsigned int base, unsigned int bits);
+
+/*
+ * Kernels for every element type, one table per type, for matrices whose
+ * elements are not unsigned int (see Matrix_type_t). The tables are
+ * generated from one set of templates in kernels.c, compiled for the
+ * baseline instruction set and again with AVX2 enabled, and the loops are
+ * left to the compiler's vectorizer; the AVX2 build is used when the u32
+ * kernels are bound to AVX2. Buffers hold elements of the table's type.
+ *
+ *   add       dst = a + b, wrapping for integers; dst may alias a or b
+ *   shl, shr  integers shift, and a shift of the width or more gives 0;
+ *             floats are scaled by 2^shift or 2^-shift
+ *   sum       adds the elements into total->integer (wrapping) for
+ *             integers, or into total->real for floats
+ *   random    draws n values with kernel_random_u32 and converts them:
+ *             integers get start + [0, span) and the range must fit the
+ *             type; floats get start + span * [0, 1). A call of up to
+ *             KERNEL_TYPED_DRAWS elements uses the generator once, so it
+ *             gives the same values on every instruction set.
+ *   widen     copies elements out as uint64_t (integers) or double (floats)
+ *   from_u64  converts uint64_t values in, integers keeping the low bits
+ *   from_f64  converts double values in; integers round toward zero and
+ *             saturate, and NaN gives 0
+ *
+ * Casting is widen from the source type, then from_u64 or from_f64 to the
+ * destination: the result of a C conversion, except that floats going to
+ * integers saturate where C leaves them undefined.
+ */
+#define KERNEL_TYPED_DRAWS ((size_t)1 << 14)
+
+typedef struct {
+	uint64_t integer;
+	double real;
+}Kernel_total_t;
+
+typedef struct {
+	void (*add) (void* dst, const void* a, const void* b, size_t n);
+	void (*shl) (void* dst, const void* src, unsigned int shift, size_t n);
+	void (*shr) (void* dst, const void* src, unsigned int shift, size_t n);
+	void (*sum) (const void* src, size_t n, Kernel_total_t* total);
+	void (*random) (void* dst, Kernel_rng_t* rng, unsigned int start, unsigned int span, size_t n);
+	void (*widen) (void* dst, const void* src, size_t n);
+	void (*from_u64) (void* dst, const uint64_t* src, size_t n);
+	void (*from_f64) (void* dst, const double* src, size_t n);
+}Kernel_typed_t;
+
+const Kernel_typed_t* kernel_typed_u8 (void);
+const Kernel_typed_t* kernel_typed_u16 (void);
+const Kernel_typed_t* kernel_typed_u32 (void);
+const Kernel_typed_t* kernel_typed_u64 (void);
+const Kernel_typed_t* kernel_typed_f32 (void);
+const Kernel_typed_t* kernel_typed_f64 (void);
+
+#endif
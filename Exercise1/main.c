@@ -5,311 +5,304 @@
 #include <math.h>
 #include <stdbool.h>
 #include <time.h>
+#include <getopt.h>
+#include <unistd.h>
 
 #include<readline/readline.h>
 
 #include "command.h"
 #include "matrix.h"
+#include "pool.h"
+#include "registry.h"
+#include "alloc.h"
+#include "dispatch.h"
+#include "stats.h"
+#include "io.h"
+#include "workspace.h"
 
-void run_commands (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats);
-unsigned int find_matrix_given_name (Matrix_t** mats, unsigned int num_mats, const char* target);
+/* Settings taken from the command line and environment */
+typedef struct {
+	unsigned int threads;
+	const char* script;	/* NULL reads stdin */
+	bool quiet;
+	const char* stats_json;	/* NULL skips the dump on exit */
+	uint64_t seed;
+	const char* workspace;	/* NULL runs without a workspace file */
+}Options_t;
 
-void destroy_remaining_heap_allocations(Matrix_t **mats, unsigned int num_mats);
+bool parse_program_options (int argc, char** argv, Options_t* opts);
+bool run_interactive (Registry_t* reg);
+bool run_script (FILE* in, const char* source, Registry_t* reg);
 
 /*
  * PURPOSE: Starting point of program. Creates temp matrices w/ empty data, reads user input, proc commands, destory when done
  * INPUTS:
- *      none
+ *      Program options, argv (see parse_program_options)
  * RETURN:
  *      If a process fails, -1
- *		else, 1
+ *      If a script command fails, 1
+ *		else, 0
  **/
 int main (int argc, char **argv) {
-	srand(time(NULL));		
-	char *line = NULL;
-	Commands_t* cmd;
+	Options_t opts;
+	if (!parse_program_options(argc, argv, &opts)) {
+		return -1;
+	}
+	if (!pool_init(opts.threads)) {
+		perror("Failure on starting worker threads\n");
+		return -1;
+	}
+
+	seed_random_matrix(opts.seed);
 
-	Matrix_t *mats[10];
-	memset(&mats,0, sizeof(Matrix_t*) * 10); // IMPORTANT C FUNCTION TO LEARN
-                                                 // set all elements in matrix-list to 0
+	FILE* script = NULL;
+	if (opts.script) {
+		script = fopen(opts.script, "r");
+		if (!script) {
+			perror(opts.script);
+			pool_destroy();
+			return -1;
+		}
+	}
+	const bool interactive = !script && isatty(STDIN_FILENO);
+	if (!interactive) {
+		/* batch output is only read once the run is over, so let stdio fill whole blocks */
+		setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+	}
+	dispatch_set_quiet(opts.quiet);
+
+	Registry_t reg;
+	if (!registry_init(&reg, 0)) {
+		pool_destroy();
+		return -1;
+	}
 
 	Matrix_t *temp = NULL;
 	if(create_matrix (&temp,"temp_mat", 5, 5)==false){
         perror("Failure on creating matrix temp_mat\n");//debug
-        destroy_remaining_heap_allocations(mats,10);
+        registry_destroy(&reg);
 	    return -1;
     }
 
-	if( add_matrix_to_array(mats,temp, 10) == -1){
+	if( !registry_insert(&reg,temp) ){
 		perror("Failure on adding matrices together\n");
-		destroy_remaining_heap_allocations(mats,10);
-		return -1;
-	}
-	int mat_idx = find_matrix_given_name(mats,10,"temp_mat");
-
-	if (mat_idx < 0) {
-		perror("PROGRAM FAILED TO INIT\n");
+		destroy_matrix(&temp);
+		registry_destroy(&reg);
 		return -1;
 	}
-	if(random_matrix(mats[mat_idx], 10, 15)==false){
+	if(random_matrix(temp, 10, 15)==false){
    		perror("Failure on writing random matrix\n");
+        registry_destroy(&reg);
         return -1;
     }
-	if(write_matrix("temp_mat", mats[mat_idx])==false){
+	if(write_matrix("temp_mat", temp)==false){
 	    perror("Failure on writing matrix\n");
+        registry_destroy(&reg);
         return -1;
     }
 
-	line = readline("> ");
-	while (strncmp(line,"exit", strlen("exit")  + 1) != 0) {
-		
-		if (!parse_user_input(line,&cmd)) {
-			printf("Failed at parsing command\n\n");
+	/* loaded after temp_mat so a saved temp_mat replaces the fresh one */
+	Workspace_t ws;
+	if (opts.workspace) {
+		if (!workspace_open(&ws, opts.workspace, &reg)) {
+			registry_destroy(&reg);
+			pool_destroy();
+			return -1;
 		}
-		
-		if (cmd->num_cmds > 1) {	
-			run_commands(cmd,mats,10);
+		dispatch_set_workspace(&ws);
+	}
+
+	bool ok;
+	if (interactive) {
+		ok = run_interactive(&reg);
+	}
+	else {
+		ok = run_script(script ? script : stdin, opts.script ? opts.script : "<stdin>", &reg);
+	}
+	if (script) {
+		fclose(script);
+	}
+	/* background writes still in flight finish before exit, and count toward the status */
+	ok = wait_background_io(&reg) && ok;
+	if (opts.workspace) {
+		ok = workspace_save(&ws, &reg) && ok;
+	}
+	registry_destroy(&reg);
+	if (opts.workspace) {
+		dispatch_set_workspace(NULL);
+		workspace_close(&ws);
+	}
+	io_shutdown();
+	if (opts.stats_json) {
+		FILE* out = fopen(opts.stats_json, "w");
+		if (!out) {
+			perror(opts.stats_json);
 		}
-		if (line) {
-			free(line);
+		else {
+			stats_print_json(out);
+			fclose(out);
 		}
-		destroy_commands(&cmd);
-		line = readline("> ");
 	}
-	free(line);
-	destroy_remaining_heap_allocations(mats,10);
-	return 0;	
+	block_cache_trim();
+	pool_destroy();
+	fflush(stdout);
+	return ok ? 0 : 1;	
 }
 
 /*
- * PURPOSE: Process commands after being processed into an array
+ * PURPOSE: Prompt for commands with readline until exit or end of input.
+ *      Failed commands are reported and the session carries on.
  * INPUTS:
- *		master-list of all commands to proc, cmd
- *		master-list of all matrices to proc, mats
- *		number of matrices, num_mats
+ *      Registry of named matrices, reg
  * RETURN:
- *		void
+ *      true
  **/
-void run_commands (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats) {
-	if( !cmd  || !(cmd)->cmds || !mats || !(*mats) ){
-		perror("run_commands: bad input");
-		return;
-	}
-    if( num_mats < 0 || num_mats > 4294967295 ){
-        perror("find_matrix_given_name: num_mats oob\n");
-        return;
-    }
+bool run_interactive (Registry_t* reg) {
+	char *line = NULL;
+	Commands_t cmd;
 
-	/*Parsing and calling of commands*/
-	if (strncmp(cmd->cmds[0],"display",strlen("display") + 1) == 0
-		&& cmd->num_cmds == 2) {
-		/*find the requested matrix*/
-		int idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		if (idx >= 0) {
-			display_matrix (mats[idx]);
+	while ((line = readline("> ")) != NULL) {
+		if (!parse_user_input(line,&cmd)) {
+			printf("Failed at parsing command\n\n");
 		}
-		else {
-			printf("Matrix (%s) doesn't exist\n", cmd->cmds[1]);
-			return;
+		else if (cmd.num_cmds == 1 && strcmp(cmd.cmds[0], "exit") == 0) {
+			free(line);
+			break;
 		}
-	}
-	else if (strncmp(cmd->cmds[0],"add",strlen("add") + 1) == 0
-		&& cmd->num_cmds == 4) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		int mat2_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[2]);
-		if (mat1_idx >= 0 && mat2_idx >= 0) {
-			Matrix_t* c = NULL;
-			if( !create_matrix (&c,cmd->cmds[3], mats[mat1_idx]->rows, 
-				mats[mat1_idx]->cols)) {
-				printf("Failure to create the result Matrix (%s)\n", cmd->cmds[3]);
-				return;
-			}
-			
-			if(add_matrix_to_array(mats,c, num_mats)==-1){ 
-                printf("Failure on adding matrix %s to array\n", c->name);
-                return;
-            }
-
-			if (! add_matrices(mats[mat1_idx], mats[mat2_idx],c) ) {
-				printf("Failure to add %s with %s into %s\n", mats[mat1_idx]->name, mats[mat2_idx]->name,c->name);
-				return;	
-			}
+		else if (cmd.num_cmds > 0) {
+			run_commands(&cmd,reg);
 		}
+		free(line);
 	}
-	else if (strncmp(cmd->cmds[0],"duplicate",strlen("duplicate") + 1) == 0
-		&& cmd->num_cmds == 3 && strlen(cmd->cmds[1]) + 1 <= MATRIX_NAME_LEN) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		if (mat1_idx >= 0 ) {
-			Matrix_t* dup_mat = NULL;
-			if( !create_matrix (&dup_mat,cmd->cmds[2], mats[mat1_idx]->rows, 
-				mats[mat1_idx]->cols)) {
-				return;
-			}
-			if(duplicate_matrix (mats[mat1_idx], dup_mat)==false){ 
-                perror("Failure on duplicate\n");
-                return;
-            }
-			if(add_matrix_to_array(mats,dup_mat,num_mats)==-1){
-                perror("Failure on adding matrix to array\n");
-                return;
-            }
-			printf ("Duplication of %s into %s finished\n", mats[mat1_idx]->name, cmd->cmds[2]);
+	return true;
+}// end run_interactive
+
+/*
+ * PURPOSE: Run commands from a file or pipe, one per line, without prompting.
+ *      Blank lines and lines starting with # are skipped. The first command
+ *      that fails stops the run.
+ * INPUTS:
+ *      Stream to read, in
+ *      Name of the stream for error messages, source
+ *      Registry of named matrices, reg
+ * RETURN:
+ *      If a line fails to parse or a command fails, return false.
+ *      Else, return true.
+ **/
+bool run_script (FILE* in, const char* source, Registry_t* reg) {
+	char* line = NULL;
+	size_t cap = 0;
+	unsigned long line_no = 0;
+	Commands_t cmd;
+	bool ok = true;
+
+	while (ok && getline(&line, &cap, in) != -1) {
+		++line_no;
+		if (!parse_user_input(line, &cmd)) {
+			ok = false;
 		}
-		else {
-			printf("Duplication Failed\n");
-			return;
+		else if (cmd.num_cmds == 0 || cmd.cmds[0][0] == '#') {
+			continue;
 		}
-	}
-	else if (strncmp(cmd->cmds[0],"equal",strlen("equal") + 1) == 0
-		&& cmd->num_cmds == 2) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		int mat2_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[2]);
-		if (mat1_idx >= 0 && mat2_idx >= 0) {
-			if ( equal_matrices(mats[mat1_idx],mats[mat2_idx]) ) {
-				printf("SAME DATA IN BOTH\n");
-			}
-			else {
-				printf("DIFFERENT DATA IN BOTH\n");
-			}
+		else if (cmd.num_cmds == 1 && strcmp(cmd.cmds[0], "exit") == 0) {
+			break;
 		}
 		else {
-			printf("Equal Failed\n");
-			return;
+			ok = run_commands(&cmd, reg);
 		}
-	}
-	else if (strncmp(cmd->cmds[0],"shift",strlen("shift") + 1) == 0
-		&& cmd->num_cmds == 4) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		const int shift_value = atoi(cmd->cmds[3]);
-		if (mat1_idx >= 0 ) {
-			if(bitwise_shift_matrix(mats[mat1_idx],cmd->cmds[2][0], shift_value)==false){
-	            perror("Failure on bitwise shift\n");
-	            return;
-            }
-			printf("Matrix (%s) has been shifted by %d\n", mats[mat1_idx]->name, shift_value);
+		if (!ok) {
+			fflush(stdout);
+			fprintf(stderr, "%s:%lu: command failed, stopping\n", source, line_no);
 		}
-		else {
-			printf("Matrix shift failed\n");
-			return;
-		}
-
 	}
-	else if (strncmp(cmd->cmds[0],"read",strlen("read") + 1) == 0
-		&& cmd->num_cmds == 2) {
-		Matrix_t* new_matrix = NULL;
-		if(! read_matrix(cmd->cmds[1],&new_matrix)) {
-			printf("Read Failed\n");
-			return;
-		}	
-		
-		if(add_matrix_to_array(mats,new_matrix, num_mats)==-1){
-            perror("error on adding matrix to array\n");
-            return;
-        }
-		printf("Matrix (%s) is read from the filesystem\n", cmd->cmds[1]);	
-	}
-	else if (strncmp(cmd->cmds[0],"write",strlen("write") + 1) == 0
-		&& cmd->num_cmds == 2) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		if(! write_matrix(mats[mat1_idx]->name,mats[mat1_idx])) {
-			printf("Write Failed\n");
-			return;
-		}
-		else {
-			printf("Matrix (%s) is wrote out to the filesystem\n", mats[mat1_idx]->name);
-		}
+	free(line);
+	return ok;
+}// end run_script
+
+/*
+ * PURPOSE: Read program options
+ *      --threads N, -t N   threads used by the matrix kernels (default MATLAB_THREADS, else all CPUs)
+ *      --file F, -f F      run the commands in F instead of prompting
+ *      --quiet, -q         only print command results and errors
+ *      --seed N, -s N      seed of the random generator (default MATLAB_SEED, else the clock)
+ *      --stats-json F      write the stats counters to F as JSON on exit (default MATLAB_STATS_JSON)
+ *      --workspace F, -w F load the matrices saved in F and save them back on exit (default MATLAB_WORKSPACE)
+ * INPUTS:
+ *      Argument count and vector from main, argc and argv
+ *      Options to populate, opts
+ * RETURN:
+ *      If an option is unknown or malformed, return false.
+ *      Else, return true.
+ **/
+bool parse_program_options (int argc, char** argv, Options_t* opts) {
+	if (!argv || !opts) {
+		perror("parse_program_options: bad input\n");
+		return false;
 	}
-	else if (strncmp(cmd->cmds[0], "create", strlen("create") + 1) == 0
-		&& strlen(cmd->cmds[1]) + 1 <= MATRIX_NAME_LEN && cmd->num_cmds == 4) {
-		Matrix_t* new_mat = NULL;
-		const unsigned int rows = atoi(cmd->cmds[2]);
-		const unsigned int cols = atoi(cmd->cmds[3]);
+	memset(opts, 0, sizeof(Options_t));
 
-		if(create_matrix(&new_mat,cmd->cmds[1],rows, cols)==false){ 
-	        perror("error on creating matrix\n");
-            return;
-        }
-		if(add_matrix_to_array(mats,new_mat,num_mats)==-1){ 
-	        perror("error on adding matrix\n");
-            return;
-        }
-		printf("Created Matrix (%s,%u,%u)\n", new_mat->name, new_mat->rows, new_mat->cols);
+	const char* env_threads = getenv("MATLAB_THREADS");
+	if (env_threads) {
+		opts->threads = strtoul(env_threads, NULL, 10);
 	}
-	else if (strncmp(cmd->cmds[0], "random", strlen("random") + 1) == 0
-		&& cmd->num_cmds == 4) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		const unsigned int start_range = atoi(cmd->cmds[2]);
-		const unsigned int end_range = atoi(cmd->cmds[3]);
-		if(random_matrix(mats[mat1_idx],start_range, end_range)==false){
-       		perror("error on writing random matrix\n");
-            return;                
-        }
-        
-		printf("Matrix (%s) is randomized between %u %u\n", mats[mat1_idx]->name, start_range, end_range);
+	opts->stats_json = getenv("MATLAB_STATS_JSON");
+	opts->workspace = getenv("MATLAB_WORKSPACE");
+	const char* env_seed = getenv("MATLAB_SEED");
+	if (env_seed) {
+		opts->seed = strtoull(env_seed, NULL, 0);
 	}
 	else {
-		printf("Not a command in this application\n");
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		opts->seed = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
 	}
 
-}// end run_commands
-
-/*
- * PURPOSE: find a Matrix given a name to search for
- * INPUTS:
- *      List of all arrays to search, mats
- *      Number of matrices in the master-list, num_mats
- *      Name to search for, target
- * RETURN:
- *      If found, return the index.
- *      Else, return -1.
- **/
-unsigned int find_matrix_given_name (Matrix_t** mats, unsigned int num_mats, const char* target) {
-    if(!mats || !(*mats) || !target ){
-        perror("find_matrix_given_name: bad input\n");
-        return -1;
-    }
-    if( num_mats < 0 || num_mats > 4294967295 ){
-        perror("find_matrix_given_name: num_mats oob\n");
-        return -1;
-    }
-
-	for (int i = 0; i < num_mats; ++i) {
-		if (strncmp(mats[i]->name,target,strlen(mats[i]->name)) == 0) {
-			return i;
+	static const struct option long_opts[] = {
+		{ "threads", required_argument, NULL, 't' },
+		{ "file", required_argument, NULL, 'f' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "seed", required_argument, NULL, 's' },
+		{ "stats-json", required_argument, NULL, 'S' },
+		{ "workspace", required_argument, NULL, 'w' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "t:f:qs:w:", long_opts, NULL)) != -1) {
+		switch (c) {
+			case 't': {
+				char* end = NULL;
+				opts->threads = strtoul(optarg, &end, 10);
+				if (!end || *end != '\0') {
+					fprintf(stderr, "Invalid thread count %s\n", optarg);
+					return false;
+				}
+				break;
+			}
+			case 'f':
+				opts->script = optarg;
+				break;
+			case 'q':
+				opts->quiet = true;
+				break;
+			case 's': {
+				char* end = NULL;
+				opts->seed = strtoull(optarg, &end, 0);
+				if (!end || *end != '\0') {
+					fprintf(stderr, "Invalid seed %s\n", optarg);
+					return false;
+				}
+				break;
+			}
+			case 'S':
+				opts->stats_json = optarg;
+				break;
+			case 'w':
+				opts->workspace = optarg;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [--threads N] [--file script] [--quiet] [--seed N] [--stats-json file] [--workspace file]\n", argv[0]);
+				return false;
 		}
 	}
-	return -1;
-}// end find_matrix_given_name
-
-/*
- * PURPOSE: Free up all Matrices remaining
- * INPUTS:
- *      Master-list of matrices, mats
- *      Number of matrices in mater-list, num_mats
- * RETURN:
- *      void
- **/
-void destroy_remaining_heap_allocations(Matrix_t **mats, unsigned int num_mats) {
-    if(!mats || num_mats < 0){
-        perror("destroy_remaining_heap_allocations: bad input\n");
-        return;
-    }
-    if(!(*mats)){
-//    	free(mats);
-    }
-    
-	// COMPLETE MISSING MEMORY CLEARING HERE
-    int i;
-    for (i = 0; i < num_mats-1; ++i){
-        if(mats[i]){
-            if( (mats[i])->data ){
-	            free((mats[i])->data);
-            }
-            free(mats[i]);
-            mats[i] = NULL;
-        }
-    }
-    //destroy_matrix(mats);
-    mats = NULL;
-}// end destroy_remaining_heap_allocations
-
+	return true;
+}// end parse_program_options
@@ -1,26 +1,743 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
 
 #include <assert.h>
 
 #include "matrix.h"
+#include "kernels.h"
+#include "stats.h"
+#include "pool.h"
+#include "alloc.h"
+#include "text.h"
 
 
 #define MAX_CMD_COUNT 50
 
+/*
+ * On-disk layout written by write_matrix. The header sits at offset 0 and the
+ * row-major data starts at data_offset, a multiple of MATRIX_FILE_DATA_ALIGN,
+ * so read_matrix can map the file and point the matrix straight at it.
+ * A CSR matrix stores rows + 1 uint64 row offsets, then nnz column indices,
+ * then nnz values from data_offset; a tiled matrix stores its padded tiles.
+ * Version 5 added the element type (Matrix_type_t, dense only for types other
+ * than u32; version 4 headers read it as zero, u32, from the padded header
+ * page). Version 4 widened rows and cols to 64 bits; older headers are
+ * widened into Matrix_file_header_t on read. Version 2 files predate the format and nnz
+ * fields and are always dense; their header page reads those as zero.
+ * Files that do not start with the magic are in the original layout:
+ * name_len, name, rows, cols, data.
+ */
+#define MATRIX_FILE_MAGIC "OSFMATRX"
+#define MATRIX_FILE_VERSION 5
+#define MATRIX_FILE_DATA_ALIGN 4096
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t name_len;
+	uint64_t rows;
+	uint64_t cols;
+	uint64_t data_offset;
+	uint64_t nnz;	/* CSR values */
+	uint32_t format;	/* Matrix_format_t */
+	char name[MATRIX_NAME_LEN];
+	uint32_t type;	/* Matrix_type_t */
+}Matrix_file_header_t;
+
+/* Header of version 2 and 3 files */
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t name_len;
+	uint32_t rows;
+	uint32_t cols;
+	uint64_t data_offset;
+	char name[MATRIX_NAME_LEN];
+	uint32_t format;	/* Matrix_format_t, version 3 on */
+	uint64_t nnz;	/* CSR values, version 3 on */
+}Matrix_file_header_v3_t;
+
+/*
+ * Compressed layout written by write_matrix_packed. A header page comes
+ * first, then a directory of one Pack_block_t per KERNEL_PACK_BLOCK stored
+ * elements at directory_offset, then the packed blocks back to back from
+ * payload_offset. A block takes bits * KERNEL_PACK_BLOCK / 8 bytes, so block
+ * offsets are a prefix sum over the directory and blocks decode
+ * independently. The last block is padded with its final element. Version 2
+ * widened rows and cols to 64 bits; version 1 headers are widened on read.
+ */
+#define MATRIX_PACK_MAGIC "OSFMPACK"
+#define MATRIX_PACK_VERSION 2
+#define MATRIX_PACK_ALIGN 64
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t name_len;
+	uint64_t rows;
+	uint64_t cols;
+	uint32_t format;	/* MATRIX_FORMAT_DENSE or MATRIX_FORMAT_TILED */
+	uint32_t block_len;	/* KERNEL_PACK_BLOCK */
+	uint64_t elements;	/* stored elements, tile padding included */
+	uint64_t blocks;
+	uint64_t directory_offset;
+	uint64_t payload_offset;
+	uint64_t payload_bytes;
+	char name[MATRIX_NAME_LEN];
+}Matrix_pack_header_t;
+
+/* Header of version 1 packed files */
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t name_len;
+	uint32_t rows;
+	uint32_t cols;
+	uint32_t format;
+	uint32_t block_len;	/* KERNEL_PACK_BLOCK */
+	uint64_t elements;	/* stored elements, tile padding included */
+	uint64_t blocks;
+	uint64_t directory_offset;
+	uint64_t payload_offset;
+	uint64_t payload_bytes;
+	char name[MATRIX_NAME_LEN];
+}Matrix_pack_header_v1_t;
+
+/*
+ * One packed block. Without delta the elements are base + field; with delta
+ * the fields are zigzag encoded differences and the elements are their
+ * running sum starting from base.
+ */
+typedef struct {
+	uint32_t base;
+	uint8_t bits;
+	uint8_t delta;
+	uint16_t reserved;
+}Pack_block_t;
+
+/* Blocks packed per write by write_matrix_packed, at most 4 MiB of payload */
+#define PACK_CHUNK_BLOCKS 4096
+
+/* Offset of the data from the start of a buffer block, keeps the data BLOCK_ALIGN aligned */
+#define MATRIX_DATA_OFFSET ((sizeof(Matrix_buffer_t) + BLOCK_ALIGN - 1) / BLOCK_ALIGN * BLOCK_ALIGN)
+
 /*protected functions*/
-void load_matrix (Matrix_t* m, unsigned int* data);
+static bool allocate_matrix (Matrix_t** new_matrix, const char* name, size_t rows, size_t cols);
+static bool allocate_header (Matrix_t** new_matrix, const char* name, size_t rows, size_t cols);
+static bool dimensions_fit (size_t rows, size_t cols);
+static Matrix_buffer_t* allocate_buffer (size_t data_bytes, bool zero, unsigned int** data);
+static void release_buffer (Matrix_buffer_t* buffer);
+static bool allocate_csr (Matrix_t* m, size_t capacity);
+static bool copy_csr (Matrix_t* m, size_t capacity);
+static void replace_contents (Matrix_t* m, const Matrix_t* next);
+static void adopt_contents (Matrix_t* dest, const Matrix_t* src);
+static void carry_cache (Matrix_t* next, const Matrix_t* m);
+static void keep_aggregates (Matrix_t* m, const Kernel_stats_t* partials, size_t chunks);
+static bool update_aggregates (Matrix_aggregates_t* aggregates, unsigned int old, unsigned int value);
+static bool settle_sparse (Matrix_t* m);
+static void drop_sparse_zeros (Matrix_t* m);
+static bool dense_to_csr (Matrix_t* m, bool force);
+static bool check_csr (const Matrix_t* m);
+static bool add_sparse (Matrix_t* a, Matrix_t* b, Matrix_t* c);
+static bool add_mixed (Matrix_t* d, Matrix_t* s, Matrix_t* c);
+static bool add_typed (Matrix_t* a, Matrix_t* b, Matrix_t* c);
+static size_t tiled_elements (size_t rows, size_t cols);
+static size_t stored_elements (const Matrix_t* m);
+static size_t element_index (const Matrix_t* m, size_t row, size_t col);
+static bool fresh_contents (Matrix_t* next, Matrix_format_t format, bool zero);
+static bool prepare_output (Matrix_t* m, Matrix_format_t format, bool keep_contents);
+static bool match_layouts (Matrix_t** a, Matrix_t** b, const Matrix_t* c, Matrix_t** view);
+static bool equal_contents (Matrix_t* a, Matrix_t* b);
+static bool add_u32 (Matrix_t* a, Matrix_t* b, Matrix_t* c);
+static bool transpose_sparse (Matrix_t* src, Matrix_t* dest);
+static bool multiply_dense (Matrix_t* a, Matrix_t* b, Matrix_t* c);
+static void report_file_error (const char* what);
+static bool read_full (int fd, void* buf, size_t len);
+static bool write_full_vec (int fd, struct iovec* iov, int iovcnt);
+static bool map_matrix_file (int fd, size_t file_len, const Matrix_file_header_t* header, Matrix_t** m);
+static bool check_file_header (const Matrix_file_header_t* header, size_t file_len);
+static void init_file_header (Matrix_file_header_t* header, const Matrix_t* m);
+static void widen_file_header (Matrix_file_header_t* header);
+static bool read_legacy_matrix (int fd, Matrix_t** m);
+static bool read_packed_matrix (int fd, size_t file_len, Matrix_t** m);
+static void widen_pack_header (Matrix_pack_header_t* header);
+static const Kernel_typed_t* typed_kernels (Matrix_type_t type);
+static bool require_u32 (const Matrix_t* m, const char* what);
+static bool prepare_typed_output (Matrix_t* m, Matrix_type_t type, bool keep_contents);
+static bool typed_total (Matrix_t* m, Kernel_total_t* total);
+static bool hash_typed (Matrix_t* m, uint64_t* sum);
+static bool random_typed (Matrix_t* m, unsigned int start_range, unsigned int end_range);
+static void cast_sparse (const Matrix_t* src, Matrix_t* dest);
+
+/*
+ * random_seed is set by seed_random_matrix; random_calls counts the fills
+ * since, each keyed by next_random_key.
+ */
+static uint64_t random_seed = 0;
+static uint64_t random_calls = 0;
+
+/*
+ * Shared argument block for the element-wise jobs handed to the pool. Each
+ * task works on the flat element range [begin, end); reductions leave one
+ * partial per chunk for the caller to fold.
+ */
+typedef struct {
+	unsigned int* dst;
+	const unsigned int* a;
+	const unsigned int* b;
+	unsigned int shift;
+	unsigned int start_range;
+	unsigned int span;
+	uint64_t seed;
+	size_t n;
+	uint64_t partial[POOL_MAX_CHUNKS];
+	Kernel_stats_t* stats;	/* when set, writers summarize each chunk they wrote, while it is in cache */
+	bool mismatch;
+}Element_job_t;
+
+static void summarize_chunk (Element_job_t* job, size_t chunk, size_t begin, size_t end) {
+	if (job->stats) {
+		job->stats[chunk] = (Kernel_stats_t)KERNEL_STATS_EMPTY;
+		kernel_stats_u32(&job->dst[begin], end - begin, &job->stats[chunk]);
+	}
+}
+
+static void add_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Element_job_t* job = arg;
+	kernel_add_u32(&job->dst[begin], &job->a[begin], &job->b[begin], end - begin);
+	summarize_chunk(job, chunk, begin, end);
+}
+
+static void shl_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Element_job_t* job = arg;
+	kernel_shl_u32(&job->dst[begin], &job->a[begin], job->shift, end - begin);
+	summarize_chunk(job, chunk, begin, end);
+}
+
+static void shr_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Element_job_t* job = arg;
+	kernel_shr_u32(&job->dst[begin], &job->a[begin], job->shift, end - begin);
+	summarize_chunk(job, chunk, begin, end);
+}
+
+static void copy_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Element_job_t* job = arg;
+	memcpy(&job->dst[begin], &job->a[begin], (end - begin) * sizeof(unsigned int));
+}
+
+/* [begin, end) counts bytes here, so unshare_matrix copies buffers of every element type */
+static void copy_bytes_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Element_job_t* job = arg;
+	memcpy((unsigned char*)job->dst + begin, (const unsigned char*)job->a + begin, end - begin);
+}
+
+static void equal_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Element_job_t* job = arg;
+	if (__atomic_load_n(&job->mismatch, __ATOMIC_RELAXED)) {
+		return;
+	}
+	if (!kernel_equal_u32(&job->a[begin], &job->b[begin], end - begin)) {
+		__atomic_store_n(&job->mismatch, true, __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * Element type properties, indexed by Matrix_type_t. Matrices of any type
+ * but u32 are dense, and their element-wise work goes through the type's
+ * kernel table.
+ */
+typedef struct {
+	const char* name;
+	size_t size;
+	bool real;
+	const Kernel_typed_t* (*kernels) (void);
+}Matrix_type_info_t;
+
+static const Matrix_type_info_t matrix_types[MATRIX_TYPE_COUNT] = {
+	[MATRIX_TYPE_U32] = { "u32", sizeof(uint32_t), false, kernel_typed_u32 },
+	[MATRIX_TYPE_U8] = { "u8", sizeof(uint8_t), false, kernel_typed_u8 },
+	[MATRIX_TYPE_U16] = { "u16", sizeof(uint16_t), false, kernel_typed_u16 },
+	[MATRIX_TYPE_U64] = { "u64", sizeof(uint64_t), false, kernel_typed_u64 },
+	[MATRIX_TYPE_F32] = { "f32", sizeof(float), true, kernel_typed_f32 },
+	[MATRIX_TYPE_F64] = { "f64", sizeof(double), true, kernel_typed_f64 },
+};
+
+/* Widest element of any type, which bounds the size of every dense or tiled buffer */
+#define MATRIX_MAX_ELEMENT sizeof(uint64_t)
+
+/* Elements a cast converts at a time, through a buffer of 64-bit values that stays in L1 */
+#define CAST_BLOCK 1024
+
+/*
+ * Element-wise job over a typed dense buffer, the typed counterpart of
+ * Element_job_t: ranges count elements of width bytes, and a cast also
+ * converts into the to table's type.
+ */
+typedef struct {
+	const Kernel_typed_t* kernels;
+	size_t width;
+	unsigned char* dst;
+	const unsigned char* a;
+	const unsigned char* b;
+	unsigned int shift;
+	unsigned int start_range;
+	unsigned int span;
+	uint64_t seed;
+	size_t n;
+	const Kernel_typed_t* to;	/* cast: table of the destination type */
+	size_t to_width;
+	bool real;	/* cast: whether the source type is a float type */
+	Kernel_total_t partial[POOL_MAX_CHUNKS];
+	bool mismatch;
+}Typed_job_t;
+
+static void typed_add_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Typed_job_t* job = arg;
+	job->kernels->add(&job->dst[begin * job->width], &job->a[begin * job->width], &job->b[begin * job->width],
+		end - begin);
+}
+
+static void typed_shl_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Typed_job_t* job = arg;
+	job->kernels->shl(&job->dst[begin * job->width], &job->a[begin * job->width], job->shift, end - begin);
+}
+
+static void typed_shr_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Typed_job_t* job = arg;
+	job->kernels->shr(&job->dst[begin * job->width], &job->a[begin * job->width], job->shift, end - begin);
+}
+
+static void typed_sum_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Typed_job_t* job = arg;
+	job->partial[chunk] = (Kernel_total_t){ 0, 0 };
+	job->kernels->sum(&job->a[begin * job->width], end - begin, &job->partial[chunk]);
+}
+
+/* Equal elements of one type are equal bytes, so the comparison ignores the type */
+static void typed_equal_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Typed_job_t* job = arg;
+	if (__atomic_load_n(&job->mismatch, __ATOMIC_RELAXED)) {
+		return;
+	}
+	if (memcmp(&job->a[begin * job->width], &job->b[begin * job->width], (end - begin) * job->width) != 0) {
+		__atomic_store_n(&job->mismatch, true, __ATOMIC_RELAXED);
+	}
+}
+
+/* Hashes the bytes of a typed matrix as 32-bit words; [begin, end) counts words, the last one possibly short */
+static void typed_hash_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Typed_job_t* job = arg;
+	const size_t bytes = job->n * job->width;
+	const size_t whole = bytes / sizeof(unsigned int) < end ? bytes / sizeof(unsigned int) : end;
+	uint64_t h = 0;
+	if (whole > begin) {
+		/* data buffers are BLOCK_ALIGN aligned, so the words are too */
+		h = kernel_hash_u32((const unsigned int*)&job->a[begin * sizeof(unsigned int)], whole - begin, begin);
+	}
+	if (whole < end) {
+		unsigned int last = 0;
+		memcpy(&last, &job->a[whole * sizeof(unsigned int)], bytes - whole * sizeof(unsigned int));
+		h += kernel_hash_u32(&last, 1, whole);
+	}
+	job->partial[chunk].integer = h;
+}
+
+/* [begin, end) counts MATRIX_RANDOM_BLOCK-element blocks, each drawn from its own stream as random_task does */
+static void typed_random_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Typed_job_t* job = arg;
+	Kernel_rng_t rng;
+	for (size_t block = begin; block < end; ++block) {
+		const size_t first = block * MATRIX_RANDOM_BLOCK;
+		const size_t count = job->n - first < MATRIX_RANDOM_BLOCK ? job->n - first : MATRIX_RANDOM_BLOCK;
+		kernel_rng_init(&rng, job->seed, block);
+		job->kernels->random(&job->dst[first * job->width], &rng, job->start_range, job->span, count);
+	}
+}
+
+static void typed_cast_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Typed_job_t* job = arg;
+	union {
+		uint64_t integer[CAST_BLOCK];
+		double real[CAST_BLOCK];
+	}wide;
+	for (size_t first = begin; first < end; first += CAST_BLOCK) {
+		const size_t count = end - first < CAST_BLOCK ? end - first : CAST_BLOCK;
+		if (job->real) {
+			job->kernels->widen(wide.real, &job->a[first * job->width], count);
+			job->to->from_f64(&job->dst[first * job->to_width], wide.real, count);
+		}
+		else {
+			job->kernels->widen(wide.integer, &job->a[first * job->width], count);
+			job->to->from_u64(&job->dst[first * job->to_width], wide.integer, count);
+		}
+	}
+}
+
+/*
+ * Row-range job for the CSR conversions and comparisons. The count pass
+ * leaves the number of non-zeros of row r in row_ptr[r + 1]; once the caller
+ * has turned those into offsets the fill pass copies every row independently.
+ */
+typedef struct {
+	const unsigned int* dense;
+	size_t cols;
+	uint64_t* row_ptr;
+	unsigned int* col_idx;
+	unsigned int* values;
+	bool mismatch;
+}Sparse_job_t;
+
+/* Rows per pool chunk so a chunk covers about POOL_MIN_GRAIN elements */
+static size_t sparse_row_grain (size_t cols) {
+	return cols >= POOL_MIN_GRAIN ? 1 : POOL_MIN_GRAIN / (cols ? cols : 1);
+}
+
+static void count_nonzero_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Sparse_job_t* job = arg;
+	for (size_t r = begin; r < end; ++r) {
+		const unsigned int* row = &job->dense[r * job->cols];
+		uint64_t count = 0;
+		for (size_t j = 0; j < job->cols; ++j) {
+			count += row[j] != 0;
+		}
+		job->row_ptr[r + 1] = count;
+	}
+}
+
+static void fill_sparse_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Sparse_job_t* job = arg;
+	for (size_t r = begin; r < end; ++r) {
+		const unsigned int* row = &job->dense[r * job->cols];
+		uint64_t k = job->row_ptr[r];
+		for (size_t j = 0; j < job->cols; ++j) {
+			if (row[j]) {
+				job->col_idx[k] = j;
+				job->values[k++] = row[j];
+			}
+		}
+	}
+}
+
+/* Compares each dense row against the same CSR row, zeros included */
+static void equal_sparse_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Sparse_job_t* job = arg;
+	for (size_t r = begin; r < end && !__atomic_load_n(&job->mismatch, __ATOMIC_RELAXED); ++r) {
+		const unsigned int* row = &job->dense[r * job->cols];
+		uint64_t k = job->row_ptr[r];
+		const uint64_t row_end = job->row_ptr[r + 1];
+		for (size_t j = 0; j < job->cols; ++j) {
+			const unsigned int expect = k < row_end && job->col_idx[k] == j ? job->values[k++] : 0;
+			if (row[j] != expect) {
+				__atomic_store_n(&job->mismatch, true, __ATOMIC_RELAXED);
+				return;
+			}
+		}
+	}
+}
+
+/*
+ * Job for converting between the dense and tiled layouts and for transposing.
+ * Tasks work on [begin, end) strips of MATRIX_TILE source rows, which in the
+ * tiled layout is one row of tiles.
+ */
+typedef struct {
+	const unsigned int* src;
+	unsigned int* dst;
+	size_t rows;	/* of the source */
+	size_t cols;
+}Layout_job_t;
+
+/* Strips per pool chunk so a chunk covers about POOL_MIN_GRAIN elements */
+static size_t strip_grain (size_t cols) {
+	const size_t strip = (cols ? cols : 1) * MATRIX_TILE;
+	return strip >= POOL_MIN_GRAIN ? 1 : POOL_MIN_GRAIN / strip;
+}
+
+static size_t tile_count (size_t n) {
+	return (n + MATRIX_TILE - 1) / MATRIX_TILE;
+}
+
+/* Copies dense rows into tiles, writing the padding as zeros */
+static void tile_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Layout_job_t* job = arg;
+	const size_t tiles_across = tile_count(job->cols);
+	for (size_t t = begin; t < end; ++t) {
+		for (size_t tc = 0; tc < tiles_across; ++tc) {
+			unsigned int* tile = &job->dst[(t * tiles_across + tc) * MATRIX_TILE * MATRIX_TILE];
+			const size_t col = tc * MATRIX_TILE;
+			const size_t width = job->cols - col < MATRIX_TILE ? job->cols - col : MATRIX_TILE;
+			for (size_t r = 0; r < MATRIX_TILE; ++r) {
+				const size_t row = t * MATRIX_TILE + r;
+				size_t copied = 0;
+				if (row < job->rows) {
+					memcpy(&tile[r * MATRIX_TILE], &job->src[row * job->cols + col], width * sizeof(unsigned int));
+					copied = width;
+				}
+				memset(&tile[r * MATRIX_TILE + copied], 0, (MATRIX_TILE - copied) * sizeof(unsigned int));
+			}
+		}
+	}
+}
+
+/* Copies tiles back into dense rows, skipping the padding */
+static void untile_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Layout_job_t* job = arg;
+	const size_t tiles_across = tile_count(job->cols);
+	for (size_t t = begin; t < end; ++t) {
+		for (size_t tc = 0; tc < tiles_across; ++tc) {
+			const unsigned int* tile = &job->src[(t * tiles_across + tc) * MATRIX_TILE * MATRIX_TILE];
+			const size_t col = tc * MATRIX_TILE;
+			const size_t width = job->cols - col < MATRIX_TILE ? job->cols - col : MATRIX_TILE;
+			for (size_t r = 0; r < MATRIX_TILE && t * MATRIX_TILE + r < job->rows; ++r) {
+				memcpy(&job->dst[(t * MATRIX_TILE + r) * job->cols + col], &tile[r * MATRIX_TILE],
+					width * sizeof(unsigned int));
+			}
+		}
+	}
+}
+
+/* Transposes a dense matrix one MATRIX_TILE square at a time, so both sides stay cache resident */
+static void transpose_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Layout_job_t* job = arg;
+	for (size_t t = begin; t < end; ++t) {
+		const size_t row = t * MATRIX_TILE;
+		const size_t height = job->rows - row < MATRIX_TILE ? job->rows - row : MATRIX_TILE;
+		for (size_t col = 0; col < job->cols; col += MATRIX_TILE) {
+			const size_t width = job->cols - col < MATRIX_TILE ? job->cols - col : MATRIX_TILE;
+			kernel_transpose_u32(&job->dst[col * job->rows + row], job->rows,
+				&job->src[row * job->cols + col], job->cols, height, width);
+		}
+	}
+}
+
+/* Transposes every tile of a tiled matrix into the mirrored tile; padding maps onto padding */
+static void transpose_tiles_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Layout_job_t* job = arg;
+	const size_t tiles_across = tile_count(job->cols);
+	const size_t tiles_down = tile_count(job->rows);
+	for (size_t t = begin; t < end; ++t) {
+		for (size_t tc = 0; tc < tiles_across; ++tc) {
+			kernel_transpose_u32(&job->dst[(tc * tiles_down + t) * MATRIX_TILE * MATRIX_TILE], MATRIX_TILE,
+				&job->src[(t * tiles_across + tc) * MATRIX_TILE * MATRIX_TILE], MATRIX_TILE,
+				MATRIX_TILE, MATRIX_TILE);
+		}
+	}
+}
+
+/* Job for hash_matrix: one partial per chunk of elements, tile strips or CSR rows */
+typedef struct {
+	const Matrix_t* m;
+	uint64_t partial[POOL_MAX_CHUNKS];
+}Hash_job_t;
+
+static void hash_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Hash_job_t* job = arg;
+	job->partial[chunk] = kernel_hash_u32(&job->m->data[begin], end - begin, begin);
+}
+
+/* Hashes each tile row at its place in the matrix; the padding is zero and adds nothing */
+static void hash_tiles_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Hash_job_t* job = arg;
+	const Matrix_t* m = job->m;
+	const size_t tiles_across = tile_count(m->cols);
+	uint64_t h = 0;
+	for (size_t t = begin; t < end; ++t) {
+		for (size_t tc = 0; tc < tiles_across; ++tc) {
+			const unsigned int* tile = &m->data[(t * tiles_across + tc) * MATRIX_TILE * MATRIX_TILE];
+			for (size_t r = 0; r < MATRIX_TILE; ++r) {
+				h += kernel_hash_u32(&tile[r * MATRIX_TILE], MATRIX_TILE,
+					(t * MATRIX_TILE + r) * m->cols + tc * MATRIX_TILE);
+			}
+		}
+	}
+	job->partial[chunk] = h;
+}
+
+static void hash_sparse_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Hash_job_t* job = arg;
+	const Matrix_t* m = job->m;
+	uint64_t h = 0;
+	for (size_t r = begin; r < end; ++r) {
+		const uint64_t first = m->row_ptr[r];
+		h += kernel_hash_sparse_u32(&m->data[first], &m->col_idx[first], m->row_ptr[r + 1] - first, r * m->cols);
+	}
+	job->partial[chunk] = h;
+}
+
+/* Job for aggregate_matrix: one summary per chunk of elements or tile strips */
+typedef struct {
+	const Matrix_t* m;
+	Kernel_stats_t partial[POOL_MAX_CHUNKS];
+}Aggregate_job_t;
+
+static void aggregate_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Aggregate_job_t* job = arg;
+	job->partial[chunk] = (Kernel_stats_t)KERNEL_STATS_EMPTY;
+	kernel_stats_u32(&job->m->data[begin], end - begin, &job->partial[chunk]);
+}
+
+/* Summarizes only the part of each tile inside the matrix, so padding does not count as zeros */
+static void aggregate_tiles_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Aggregate_job_t* job = arg;
+	const Matrix_t* m = job->m;
+	const size_t tiles_across = tile_count(m->cols);
+	Kernel_stats_t stats = KERNEL_STATS_EMPTY;
+	for (size_t t = begin; t < end; ++t) {
+		const size_t height = m->rows - t * MATRIX_TILE < MATRIX_TILE ? m->rows - t * MATRIX_TILE : MATRIX_TILE;
+		for (size_t tc = 0; tc < tiles_across; ++tc) {
+			const unsigned int* tile = &m->data[(t * tiles_across + tc) * MATRIX_TILE * MATRIX_TILE];
+			const size_t col = tc * MATRIX_TILE;
+			const size_t width = m->cols - col < MATRIX_TILE ? m->cols - col : MATRIX_TILE;
+			for (size_t r = 0; r < height; ++r) {
+				kernel_stats_u32(&tile[r * MATRIX_TILE], width, &stats);
+			}
+		}
+	}
+	job->partial[chunk] = stats;
+}
+
+/*
+ * Argument block for the packed file jobs. Each task handles a range of
+ * blocks; pack_task works on the chunk of blocks starting at first and
+ * writes at the chunk's own payload offsets.
+ */
+typedef struct {
+	const unsigned int* src;
+	unsigned int* dst;
+	size_t elements;
+	Pack_block_t* directory;
+	const uint64_t* offsets;	/* payload offset of each block, blocks + 1 entries */
+	size_t first;
+	unsigned char* payload;
+	const unsigned char* packed;
+	Pack_mode_t mode;
+}Pack_job_t;
+
+/* Width of the widest field in v, 0 for v == 0 */
+static inline unsigned int bit_width (uint32_t v) {
+	return v ? 32 - __builtin_clz(v) : 0;
+}
+
+/* Difference from prev as a zigzag code: small magnitudes of either sign stay small */
+static inline uint32_t zigzag (uint32_t prev, uint32_t v) {
+	const int32_t d = (int32_t)(v - prev);
+	return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+}
+
+/* The KERNEL_PACK_BLOCK elements of a block; the short last block is copied to tmp and padded */
+static const unsigned int* block_values (const Pack_job_t* job, size_t block, unsigned int* tmp) {
+	const size_t begin = block * KERNEL_PACK_BLOCK;
+	const size_t n = job->elements - begin;
+	if (n >= KERNEL_PACK_BLOCK) {
+		return &job->src[begin];
+	}
+	memcpy(tmp, &job->src[begin], n * sizeof(unsigned int));
+	for (size_t i = n; i < KERNEL_PACK_BLOCK; ++i) {
+		tmp[i] = tmp[n - 1];
+	}
+	return tmp;
+}
+
+static void plan_pack_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Pack_job_t* job = arg;
+	unsigned int tmp[KERNEL_PACK_BLOCK];
+	(void)chunk;
+	for (size_t b = begin; b < end; ++b) {
+		const unsigned int* v = block_values(job, b, tmp);
+		unsigned int lo = v[0];
+		unsigned int hi = v[0];
+		uint32_t deltas = 0;
+		for (size_t i = 1; i < KERNEL_PACK_BLOCK; ++i) {
+			lo = v[i] < lo ? v[i] : lo;
+			hi = v[i] > hi ? v[i] : hi;
+			deltas |= zigzag(v[i - 1], v[i]);
+		}
+		Pack_block_t entry = { .base = lo, .bits = bit_width(hi - lo) };
+		if (job->mode == PACK_MODE_DELTA && bit_width(deltas) < entry.bits) {
+			entry = (Pack_block_t){ .base = v[0], .bits = bit_width(deltas), .delta = 1 };
+		}
+		job->directory[b] = entry;
+	}
+}
+
+static void pack_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Pack_job_t* job = arg;
+	unsigned int tmp[KERNEL_PACK_BLOCK];
+	unsigned int codes[KERNEL_PACK_BLOCK];
+	(void)chunk;
+	for (size_t b = job->first + begin; b < job->first + end; ++b) {
+		const Pack_block_t entry = job->directory[b];
+		const unsigned int* v = block_values(job, b, tmp);
+		uint32_t* dst = (uint32_t*)&job->payload[job->offsets[b] - job->offsets[job->first]];
+		if (entry.delta) {
+			codes[0] = 0;
+			for (size_t i = 1; i < KERNEL_PACK_BLOCK; ++i) {
+				codes[i] = zigzag(v[i - 1], v[i]);
+			}
+			kernel_pack_u32(dst, codes, 0, entry.bits);
+		}
+		else {
+			kernel_pack_u32(dst, v, entry.base, entry.bits);
+		}
+	}
+}
+
+static void unpack_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Pack_job_t* job = arg;
+	unsigned int tmp[KERNEL_PACK_BLOCK];
+	(void)chunk;
+	for (size_t b = begin; b < end; ++b) {
+		const Pack_block_t entry = job->directory[b];
+		const size_t first = b * KERNEL_PACK_BLOCK;
+		const size_t n = job->elements - first < KERNEL_PACK_BLOCK ? job->elements - first : KERNEL_PACK_BLOCK;
+		unsigned int* out = n == KERNEL_PACK_BLOCK ? &job->dst[first] : tmp;
+		kernel_unpack_u32(out, (const uint32_t*)&job->packed[job->offsets[b]], entry.delta ? 0 : entry.base,
+			entry.bits);
+		if (entry.delta) {
+			uint32_t run = entry.base;
+			for (size_t i = 0; i < KERNEL_PACK_BLOCK; ++i) {
+				run += (out[i] >> 1) ^ (0u - (out[i] & 1));
+				out[i] = run;
+			}
+		}
+		if (out == tmp) {
+			memcpy(&job->dst[first], tmp, n * sizeof(unsigned int));
+		}
+	}
+}
+
+/* [begin, end) counts MATRIX_RANDOM_BLOCK-element blocks here, each filled from its own stream and summarized while in L1 */
+static void random_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Element_job_t* job = arg;
+	Kernel_rng_t rng;
+	Kernel_stats_t stats = KERNEL_STATS_EMPTY;
+	for (size_t block = begin; block < end; ++block) {
+		const size_t first = block * MATRIX_RANDOM_BLOCK;
+		const size_t count = job->n - first < MATRIX_RANDOM_BLOCK ? job->n - first : MATRIX_RANDOM_BLOCK;
+		kernel_rng_init(&rng, job->seed, block);
+		kernel_random_u32(&job->dst[first], &rng, job->start_range, job->span, count);
+		kernel_stats_u32(&job->dst[first], count, &stats);
+	}
+	job->stats[chunk] = stats;
+}
 
 /* 
  * PURPOSE: instantiates a new matrix with the passed name, rows, cols 
+ *      filled with zeros. It starts out as an empty CSR matrix, so only the
+ *      row offsets are allocated whatever the dimensions.
  * INPUTS: 
  *	name the name of the matrix limited to 50 characters 
  *  rows the number of rows the matrix
@@ -30,323 +747,3229 @@ void load_matrix (Matrix_t* m, unsigned int* data);
  *  else false for an error in the process.
  *
  **/
-bool create_matrix (Matrix_t** new_matrix, const char* name, const unsigned int rows, const unsigned int cols) {
-
+bool create_matrix (Matrix_t** new_matrix, const char* name, const size_t rows, const size_t cols) {
 	if( !new_matrix || !name  ){
 		perror("create_matrix: bad input\n");
 		return false;
 	}
+	*new_matrix = NULL;
+	const uint64_t start = stats_now();
 
-	*new_matrix = calloc(1,sizeof(Matrix_t));
-	if (!(*new_matrix)) {
+	Matrix_t* m = NULL;
+	if (!allocate_header(&m, name, rows, cols)) {
 		return false;
 	}
-	(*new_matrix)->data = calloc(rows * cols,sizeof(unsigned int));
-	if (!(*new_matrix)->data) {
+	if (!allocate_csr(m, 0)) {
+		block_free(m, m->block_size);
 		return false;
 	}
-	(*new_matrix)->rows = rows;
-	(*new_matrix)->cols = cols;
-	unsigned int len = strlen(name) + 1; 
-	if (len > MATRIX_NAME_LEN) {
-		return false;
-	}
-	strncpy((*new_matrix)->name,name,len);
+	const size_t ptr_bytes = ((size_t)rows + 1) * sizeof(uint64_t);
+	memset(m->row_ptr, 0, ptr_bytes);
+	*new_matrix = m;
+	stats_record(STAT_CREATE_MATRIX, start, ptr_bytes, 0);
 	return true;
-
 }// end create_matrix
 
 /*
- * PURPOSE: deallocates passed matrix
- * INPUTS: 
- *      Matrix to deallocate
+ * PURPOSE: instantiates a new matrix like create_matrix but leaves the data
+ *      uninitialized, for callers that overwrite every element
+ * INPUTS:
+ *	name the name of the matrix limited to MATRIX_NAME_LEN - 1 characters
+ *  rows the number of rows the matrix
+ *  cols the number of cols the matrix
  * RETURN:
- *      void
+ *  If no errors occurred during instantiation then true
+ *  else false for an error in the process.
  **/
-void destroy_matrix (Matrix_t** m) {        
-    if( *m ){
-        free((*m)->data);
-        free(*m);
-        *m = NULL;
-    }
-}// end destory matrix
+bool create_matrix_uninit (Matrix_t** new_matrix, const char* name, const size_t rows, const size_t cols) {
+	return allocate_matrix(new_matrix, name, rows, cols);
+}// end create_matrix_uninit
 
 /*
- * PURPOSE: compare memory blocks of two matrices, to see if they are the same
- * INPUTS: 
- *      two matrices to compare
+ * PURPOSE: instantiates a new zero filled matrix with elements of any type.
+ *      u32 matrices start as empty CSR matrices like create_matrix; the
+ *      other types are always dense.
+ * INPUTS:
+ *	name the name of the matrix limited to MATRIX_NAME_LEN - 1 characters
+ *  rows the number of rows the matrix
+ *  cols the number of cols the matrix
+ *  type the element type
  * RETURN:
- *      if blocks of memory are the same, return true. Else, return false.
+ *  If no errors occurred during instantiation then true
+ *  else false for an error in the process.
  **/
-bool equal_matrices (Matrix_t* a, Matrix_t* b) {	
-	if (!a || !b || !a->data || !b->data ) {
-        perror("equal_matrices: bad input\n");
-		return false;	
+bool create_typed_matrix (Matrix_t** new_matrix, const char* name, const size_t rows, const size_t cols,
+		Matrix_type_t type) {
+	if (!new_matrix || !name || type >= MATRIX_TYPE_COUNT) {
+		perror("create_typed_matrix: bad input\n");
+		return false;
 	}
+	if (type == MATRIX_TYPE_U32) {
+		return create_matrix(new_matrix, name, rows, cols);
+	}
+	*new_matrix = NULL;
+	const uint64_t start = stats_now();
 
-	int result = memcmp(a->data,b->data, sizeof(unsigned int) * a->rows * a->cols);
-	if (result == 0) {
-		return true;
+	Matrix_t* m = NULL;
+	if (!allocate_header(&m, name, rows, cols)) {
+		return false;
 	}
-	return false;
-}
+	m->type = type;
+	if (!fresh_contents(m, MATRIX_FORMAT_DENSE, true)) {
+		block_free(m, m->block_size);
+		return false;
+	}
+	*new_matrix = m;
+	stats_record(STAT_CREATE_MATRIX, start, matrix_stored_bytes(m), 0);
+	return true;
+}// end create_typed_matrix
 
 /*
- * PURPOSE: copy matrix to another memory block
+ * PURPOSE: Create a matrix under a new name holding src's elements converted
+ *      to another type, in one pass on the pool. Narrowed integers keep
+ *      their low bits and floats going to integers round toward zero and
+ *      saturate, with NaN giving 0. A cast to src's own type shares src's
+ *      data like duplicate. The result is dense: a sparse source is
+ *      converted from its non-zeros, and a tiled one through a dense view.
  * INPUTS:
- *      source matrix src
- *      destination matrix dest
+ *      Source matrix, src
+ *      Name of the new matrix, name
+ *      Element type of the new matrix, type
+ *      Destination for the new matrix, dest
  * RETURN:
- *      If dest matrix the same as src, return true.
- *      Else, return false.
+ *      If the inputs are invalid or memory is exhausted, return false.
+ *      Else, return true.
  **/
-bool duplicate_matrix (Matrix_t* src, Matrix_t* dest) {
-	if (!src || !dest || !src->data ) {
-        perror("duplicate_matrix: bad input\n");
+bool cast_matrix (Matrix_t* src, const char* name, Matrix_type_t type, Matrix_t** dest) {
+	if (!src || !src->data || !src->buffer || !name || !dest || type >= MATRIX_TYPE_COUNT) {
+		perror("cast_matrix: bad input\n");
 		return false;
 	}
-	/*
-	 * copy over data
-	 */
-	unsigned int bytesToCopy = sizeof(unsigned int) * src->rows * src->cols;
-	memcpy(dest->data,src->data, bytesToCopy);	
-	return equal_matrices (src,dest);
-}// end duplicate_matrix
+	if (src->type == type) {
+		return share_matrix(src, name, dest);
+	}
+	if (src->format == MATRIX_FORMAT_TILED) {
+		/* cast from a dense view, so src stays tiled */
+		Matrix_t* view = NULL;
+		if (!dense_view_matrix(src, &view)) {
+			return false;
+		}
+		const bool ok = cast_matrix(view, name, type, dest);
+		destroy_matrix(&view);
+		return ok;
+	}
+
+	Matrix_t* m = NULL;
+	if (!allocate_header(&m, name, src->rows, src->cols)) {
+		return false;
+	}
+	m->type = type;
+	const bool sparse = src->format == MATRIX_FORMAT_CSR;
+	if (!fresh_contents(m, MATRIX_FORMAT_DENSE, sparse)) {
+		block_free(m, m->block_size);
+		return false;
+	}
+
+	const uint64_t start = stats_now();
+	const size_t n = stored_elements(src);
+	const size_t width = matrix_element_size(src->type);
+	const size_t to_width = matrix_element_size(type);
+	if (sparse) {
+		cast_sparse(src, m);
+	}
+	else {
+		Typed_job_t job = { .kernels = typed_kernels(src->type), .width = width, .dst = (unsigned char*)m->data,
+			.a = (const unsigned char*)src->data, .to = typed_kernels(type), .to_width = to_width,
+			.real = matrix_type_is_real(src->type) };
+		pool_parallel_for(n, POOL_MIN_GRAIN, typed_cast_task, &job);
+	}
+	*dest = m;
+	stats_record(STAT_CAST_MATRIX, start, n * (width + to_width), 0);
+	return true;
+}// end cast_matrix
 
 /*
- * PURPOSE: Preform a bitwise shift on the members of an array
+ * PURPOSE: Scatter the values of a u32 CSR matrix into a zeroed dense matrix of another type
  * INPUTS:
- *		Direction the shift should move, direction
- *		Matrix to preform shift on, a
- *		Amount to shift by, shift
+ *      CSR source, src
+ *      Zero filled dense destination of the same dimensions, dest
  * RETURN:
- *		If bad inputs are given, return false.
- *		Else, return true.
+ *      void
  **/
-bool bitwise_shift_matrix (Matrix_t* a, char direction, unsigned int shift) {
-	
-	if ( !a || !a->data ) {
-        perror("bitwise_shift_matrix: bad input\n");
-		return false;
+static void cast_sparse (const Matrix_t* src, Matrix_t* dest) {
+	const Kernel_typed_t* to = typed_kernels(dest->type);
+	const size_t to_width = matrix_element_size(dest->type);
+	unsigned char* data = (unsigned char*)dest->data;
+	for (size_t r = 0; r < src->rows; ++r) {
+		for (uint64_t k = src->row_ptr[r]; k < src->row_ptr[r + 1]; ++k) {
+			const uint64_t value = src->data[k];
+			to->from_u64(&data[(r * src->cols + src->col_idx[k]) * to_width], &value, 1);
+		}
 	}
+}// end cast_sparse
 
-	if (direction == 'l') {
-		unsigned int i = 0;
-		for (; i < a->rows; ++i) {
-			unsigned int j = 0;
-			for (; j < a->cols; ++j) {
-				a->data[i * a->cols + j] = a->data[i * a->cols + j] << shift;
-			}
-		}
+/*
+ * PURPOSE: Size of one element of a type
+ * INPUTS:
+ *      Element type, type
+ * RETURN:
+ *      The size in bytes, or 0 for an unknown type
+ **/
+size_t matrix_element_size (Matrix_type_t type) {
+	return type < MATRIX_TYPE_COUNT ? matrix_types[type].size : 0;
+}// end matrix_element_size
+
+/*
+ * PURPOSE: Tell floating point element types from integer ones
+ * INPUTS:
+ *      Element type, type
+ * RETURN:
+ *      If the type is f32 or f64, return true.
+ *      Else, return false.
+ **/
+bool matrix_type_is_real (Matrix_type_t type) {
+	return type < MATRIX_TYPE_COUNT && matrix_types[type].real;
+}// end matrix_type_is_real
+
+/*
+ * PURPOSE: Name an element type as the commands spell it
+ * INPUTS:
+ *      Element type, type
+ * RETURN:
+ *      "u8", "u16", "u32", "u64", "f32", "f64", or "unknown"
+ **/
+const char* matrix_type_name (Matrix_type_t type) {
+	return type < MATRIX_TYPE_COUNT ? matrix_types[type].name : "unknown";
+}// end matrix_type_name
 
+/*
+ * PURPOSE: Look up an element type by name
+ * INPUTS:
+ *      Name, text
+ *      Destination for the type, type
+ * RETURN:
+ *      If the name is not a type, return false.
+ *      Else, return true.
+ **/
+bool parse_matrix_type (const char* text, Matrix_type_t* type) {
+	if (!text || !type) {
+		perror("parse_matrix_type: bad input\n");
+		return false;
 	}
-	else {
-		unsigned int i = 0;
-		for (; i < a->rows; ++i) {
-			unsigned int j = 0;
-			for (; j < a->cols; ++j) {
-				a->data[i * a->cols + j] = a->data[i * a->cols + j] >> shift;
-			}
+	for (unsigned int t = 0; t < MATRIX_TYPE_COUNT; ++t) {
+		if (strcmp(text, matrix_types[t].name) == 0) {
+			*type = t;
+			return true;
 		}
 	}
-	
-	return true;
-}// end bitwise_shift_matrix
+	return false;
+}// end parse_matrix_type
 
 /*
- * PURPOSE: Add two matrices together
+ * PURPOSE: Get the kernel table of an element type
+ * INPUTS:
+ *      Element type, type
+ * RETURN:
+ *      The table, bound to the running CPU
+ **/
+static const Kernel_typed_t* typed_kernels (Matrix_type_t type) {
+	return matrix_types[type].kernels();
+}// end typed_kernels
+
+/*
+ * PURPOSE: Check that an operation that only handles u32 elements got a u32 matrix
+ * INPUTS:
+ *      Operand, m
+ *      Name of the operation, what
+ * RETURN:
+ *      If m holds another element type, return false after printing a message.
+ *      Else, return true.
+ **/
+static bool require_u32 (const Matrix_t* m, const char* what) {
+	if (m->type == MATRIX_TYPE_U32) {
+		return true;
+	}
+	printf("%s: %s holds %s elements, only u32 matrices are supported (cast it first)\n",
+		what, m->name, matrix_type_name(m->type));
+	return false;
+}// end require_u32
+
+/*
+ * PURPOSE: Allocate a matrix header and a fresh, uninitialized dense data buffer for it
+ * INPUTS:
+ *      Destination for the matrix, new_matrix
+ *      Name of the matrix, name
+ *      Dimensions of the data, rows and cols
+ * RETURN:
+ *      If the name is too long or memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool allocate_matrix (Matrix_t** new_matrix, const char* name, size_t rows, size_t cols) {
+	if( !new_matrix || !name  ){
+		perror("create_matrix: bad input\n");
+		return false;
+	}
+	*new_matrix = NULL;
+	const uint64_t start = stats_now();
+
+	Matrix_t* m = NULL;
+	if (!allocate_header(&m, name, rows, cols)) {
+		return false;
+	}
+	/* allocate_header checked that this cannot overflow */
+	const size_t data_bytes = rows * cols * sizeof(unsigned int);
+	m->buffer = allocate_buffer(data_bytes, false, &m->data);
+	if (!m->buffer) {
+		block_free(m, m->block_size);
+		return false;
+	}
+	*new_matrix = m;
+	stats_record(STAT_CREATE_MATRIX, start, 0, 0);
+	return true;
+}// end allocate_matrix
+
+/*
+ * PURPOSE: Allocate a matrix header with no data buffer yet
+ * INPUTS:
+ *      Destination for the matrix, new_matrix
+ *      Name of the matrix, name
+ *      Dimensions the data will have, rows and cols
+ * RETURN:
+ *      If the name is too long, the dimensions too large or memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool allocate_header (Matrix_t** new_matrix, const char* name, size_t rows, size_t cols) {
+	const size_t len = strlen(name) + 1;
+	if (len > MATRIX_NAME_LEN) {
+		printf("Matrix name %s is longer than %d characters\n", name, MATRIX_NAME_LEN - 1);
+		return false;
+	}
+	if (!dimensions_fit(rows, cols)) {
+		printf("Matrix dimensions (%zu,%zu) are too large\n", rows, cols);
+		return false;
+	}
+	size_t block_size = 0;
+	bool zeroed = false;
+	Matrix_t* m = block_alloc(sizeof(Matrix_t), &block_size, &zeroed);
+	if (!m) {
+		perror("create_matrix: allocation error\n");
+		return false;
+	}
+	memset(m, 0, sizeof(Matrix_t));
+	memcpy(m->name, name, len);
+	m->rows = rows;
+	m->cols = cols;
+	m->block_size = block_size;
+	stats_note_alloc(block_size);
+	*new_matrix = m;
+	return true;
+}// end allocate_header
+
+/*
+ * PURPOSE: Check that a matrix of the given dimensions can be addressed in
+ *      every layout and type: the tile-padded data of the widest element
+ *      (which bounds every dense buffer) and the CSR row offsets must fit in
+ *      a size_t, and columns in a CSR column index
+ * INPUTS:
+ *      Dimensions to check, rows and cols
+ * RETURN:
+ *      If any size would overflow, return false.
+ *      Else, return true.
+ **/
+static bool dimensions_fit (size_t rows, size_t cols) {
+	size_t bytes = 0;
+	return cols <= MATRIX_MAX_COLS && rows < SIZE_MAX / sizeof(uint64_t)
+		&& !__builtin_mul_overflow(tile_count(rows), tile_count(cols), &bytes)
+		&& !__builtin_mul_overflow(bytes, (size_t)MATRIX_TILE * MATRIX_TILE * MATRIX_MAX_ELEMENT, &bytes)
+		&& bytes <= SIZE_MAX - MATRIX_DATA_OFFSET;
+}// end dimensions_fit
+
+/*
+ * PURPOSE: Allocate a data buffer with one reference. The data starts
+ *      MATRIX_DATA_OFFSET bytes into the block, so it is BLOCK_ALIGN aligned.
+ * INPUTS:
+ *      Size of the data, data_bytes (0 for a buffer that will point at a mapping)
+ *      Whether the data must read as zero, zero
+ *      Destination for the data pointer, data
+ * RETURN:
+ *      The buffer, or NULL when memory is exhausted
+ **/
+static Matrix_buffer_t* allocate_buffer (size_t data_bytes, bool zero, unsigned int** data) {
+	size_t block_size = 0;
+	bool zeroed = false;
+	unsigned char* block = block_alloc(MATRIX_DATA_OFFSET + data_bytes, &block_size, &zeroed);
+	if (!block) {
+		perror("create_matrix: allocation error\n");
+		return NULL;
+	}
+	Matrix_buffer_t* buffer = (Matrix_buffer_t*)block;
+	memset(buffer, 0, sizeof(Matrix_buffer_t));
+	buffer->refs = 1;
+	buffer->storage = MATRIX_STORAGE_INLINE;
+	buffer->block_size = block_size;
+	*data = (unsigned int*)&block[MATRIX_DATA_OFFSET];
+	if (zero && !zeroed) {
+		memset(*data, 0, data_bytes);
+	}
+	stats_note_alloc(block_size);
+	return buffer;
+}// end allocate_buffer
+
+/*
+ * PURPOSE: Drop one reference to a data buffer, freeing it with the last one
+ * INPUTS:
+ *      Buffer to release, buffer
+ * RETURN:
+ *      void
+ **/
+static void release_buffer (Matrix_buffer_t* buffer) {
+	if (!buffer || __atomic_sub_fetch(&buffer->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+		return;
+	}
+	if (buffer->storage != MATRIX_STORAGE_INLINE) {
+		munmap(buffer->mapping, buffer->mapping_len);
+	}
+	block_free(buffer, buffer->block_size);
+}// end release_buffer
+
+/*
+ * PURPOSE: Point m at a fresh CSR buffer with one reference, laid out as
+ *      rows + 1 row offsets, capacity column indices, then capacity values.
+ *      The old buffer is not released: callers fill a copy of the header and
+ *      swap it in with replace_contents.
+ * INPUTS:
+ *      Matrix whose rows size the offsets, m
+ *      Number of values to make room for, capacity
+ * RETURN:
+ *      If memory is exhausted, return false and leave m alone.
+ *      Else, return true; the offsets and nnz are for the caller to fill.
+ **/
+static bool allocate_csr (Matrix_t* m, size_t capacity) {
+	const size_t ptr_bytes = ((size_t)m->rows + 1) * sizeof(uint64_t);
+	if (capacity > (SIZE_MAX / 2 - MATRIX_DATA_OFFSET - ptr_bytes) / (2 * sizeof(unsigned int))) {
+		return false;
+	}
+	const size_t idx_bytes = (capacity * sizeof(unsigned int) + BLOCK_ALIGN - 1) / BLOCK_ALIGN * BLOCK_ALIGN;
+	unsigned int* base = NULL;
+	Matrix_buffer_t* buffer = allocate_buffer(ptr_bytes + idx_bytes + capacity * sizeof(unsigned int), false, &base);
+	if (!buffer) {
+		return false;
+	}
+	unsigned char* bytes = (unsigned char*)base;
+	m->format = MATRIX_FORMAT_CSR;
+	m->type = MATRIX_TYPE_U32;
+	m->buffer = buffer;
+	m->row_ptr = (uint64_t*)bytes;
+	m->col_idx = (unsigned int*)&bytes[ptr_bytes];
+	m->data = (unsigned int*)&bytes[ptr_bytes + idx_bytes];
+	m->capacity = capacity;
+	return true;
+}// end allocate_csr
+
+/*
+ * PURPOSE: Move a CSR matrix into a private buffer with room for capacity values
+ * INPUTS:
+ *      CSR matrix, m
+ *      Number of values to make room for, at least m->nnz, capacity
+ * RETURN:
+ *      If memory is exhausted, return false and leave m alone.
+ *      Else, return true.
+ **/
+static bool copy_csr (Matrix_t* m, size_t capacity) {
+	Matrix_t next = *m;
+	if (!allocate_csr(&next, capacity)) {
+		return false;
+	}
+	memcpy(next.row_ptr, m->row_ptr, ((size_t)m->rows + 1) * sizeof(uint64_t));
+	memcpy(next.col_idx, m->col_idx, m->nnz * sizeof(unsigned int));
+	memcpy(next.data, m->data, m->nnz * sizeof(unsigned int));
+	replace_contents(m, &next);
+	return true;
+}// end copy_csr
+
+/*
+ * PURPOSE: Swap in the contents built in a copy of m's header, dropping m's
+ *      reference to its old buffer
+ * INPUTS:
+ *      Matrix to update, m
+ *      Copy of m pointing at the new buffer, next
+ * RETURN:
+ *      void
+ **/
+static void replace_contents (Matrix_t* m, const Matrix_t* next) {
+	release_buffer(m->buffer);
+	*m = *next;
+}// end replace_contents
+
+/*
+ * PURPOSE: Make dest another reference to src's buffer, in src's format.
+ *      dest's own buffer must already be released.
+ * INPUTS:
+ *      Matrix taking the reference, dest
+ *      Matrix holding the buffer, src
+ * RETURN:
+ *      void
+ **/
+static void adopt_contents (Matrix_t* dest, const Matrix_t* src) {
+	__atomic_add_fetch(&src->buffer->refs, 1, __ATOMIC_RELAXED);
+	dest->format = src->format;
+	dest->type = src->type;
+	dest->data = src->data;
+	dest->row_ptr = src->row_ptr;
+	dest->col_idx = src->col_idx;
+	dest->nnz = src->nnz;
+	dest->capacity = src->capacity;
+	dest->buffer = src->buffer;
+}// end adopt_contents
+
+/*
+ * PURPOSE: Keep the cached hash and aggregates across a layout conversion,
+ *      which does not change the elements
+ * INPUTS:
+ *      Converted copy holding the new buffer, next
+ *      Matrix being converted, m
+ * RETURN:
+ *      void
+ **/
+static void carry_cache (Matrix_t* next, const Matrix_t* m) {
+	next->buffer->hash = m->buffer->hash;
+	next->buffer->hashed = m->buffer->hashed;
+	next->buffer->aggregates = m->buffer->aggregates;
+	next->buffer->aggregated = m->buffer->aggregated;
+}// end carry_cache
+
+/*
+ * PURPOSE: Fold per-chunk summaries of every element of m into its cached aggregates
+ * INPUTS:
+ *      Matrix just written, m
+ *      Summaries covering all its elements and nothing else, partials and chunks
+ * RETURN:
+ *      void
+ **/
+static void keep_aggregates (Matrix_t* m, const Kernel_stats_t* partials, size_t chunks) {
+	Matrix_aggregates_t* out = &m->buffer->aggregates;
+	Kernel_stats_t total = KERNEL_STATS_EMPTY;
+	for (size_t c = 0; c < chunks; ++c) {
+		total.sum += partials[c].sum;
+		total.nonzero += partials[c].nonzero;
+		total.min = partials[c].min < total.min ? partials[c].min : total.min;
+		total.max = partials[c].max > total.max ? partials[c].max : total.max;
+	}
+	out->sum = total.sum;
+	out->nonzero = total.nonzero;
+	out->min = m->rows && m->cols ? total.min : 0;
+	out->max = total.max;
+	m->buffer->aggregated = true;
+}// end keep_aggregates
+
+/*
+ * PURPOSE: Move aggregates for one element changing from old to value
+ * INPUTS:
+ *      Aggregates from before the change, aggregates
+ *      Previous and new value of the element, old and value
+ * RETURN:
+ *      If the change removed the only known min or max, return false:
+ *      another element may or may not hold the same value.
+ *      Else, return true with aggregates updated.
+ **/
+static bool update_aggregates (Matrix_aggregates_t* aggregates, unsigned int old, unsigned int value) {
+	if ((old == aggregates->min && value > old) || (old == aggregates->max && value < old)) {
+		return false;
+	}
+	aggregates->sum = aggregates->sum - old + value;
+	aggregates->nonzero = aggregates->nonzero - (old != 0) + (value != 0);
+	aggregates->min = value < aggregates->min ? value : aggregates->min;
+	aggregates->max = value > aggregates->max ? value : aggregates->max;
+	return true;
+}// end update_aggregates
+
+/*
+ * PURPOSE: Count the elements a tiled matrix stores, padding included
+ * INPUTS:
+ *      Dimensions of the matrix, rows and cols
+ * RETURN:
+ *      The element count, or SIZE_MAX when it does not fit in a size_t
+ **/
+static size_t tiled_elements (size_t rows, size_t cols) {
+	const size_t padded_rows = tile_count(rows) * MATRIX_TILE;
+	const size_t padded_cols = tile_count(cols) * MATRIX_TILE;
+	if (padded_rows && padded_cols > SIZE_MAX / padded_rows) {
+		return SIZE_MAX;
+	}
+	return padded_rows * padded_cols;
+}// end tiled_elements
+
+/*
+ * PURPOSE: Count the elements in a matrix's data array: every element when
+ *      dense, the padded tiles when tiled, the values when CSR
+ * INPUTS:
+ *      Matrix, m
+ * RETURN:
+ *      The element count
+ **/
+static size_t stored_elements (const Matrix_t* m) {
+	switch (m->format) {
+		case MATRIX_FORMAT_CSR:
+			return m->nnz;
+		case MATRIX_FORMAT_TILED:
+			return tiled_elements(m->rows, m->cols);
+		default:
+			return (size_t)m->rows * m->cols;
+	}
+}// end stored_elements
+
+/*
+ * PURPOSE: Locate an element in the data of a dense or tiled matrix
+ * INPUTS:
+ *      Dense or tiled matrix, m
+ *      Position of the element, row and col
+ * RETURN:
+ *      Index of the element in m->data
+ **/
+static size_t element_index (const Matrix_t* m, size_t row, size_t col) {
+	if (m->format != MATRIX_FORMAT_TILED) {
+		return row * m->cols + col;
+	}
+	const size_t tile = (row / MATRIX_TILE) * tile_count(m->cols) + col / MATRIX_TILE;
+	return tile * MATRIX_TILE * MATRIX_TILE + (row % MATRIX_TILE) * MATRIX_TILE + col % MATRIX_TILE;
+}// end element_index
+
+/*
+ * PURPOSE: Point a copy of a matrix header at a fresh dense or tiled buffer,
+ *      for the caller to fill and swap in with replace_contents
+ * INPUTS:
+ *      Copy of the matrix header, next (its type sizes the elements)
+ *      Layout of the new buffer, format (MATRIX_FORMAT_DENSE or MATRIX_FORMAT_TILED)
+ *      Whether the data must read as zero, zero
+ * RETURN:
+ *      If the size overflows or memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool fresh_contents (Matrix_t* next, Matrix_format_t format, bool zero) {
+	const size_t n = format == MATRIX_FORMAT_TILED ? tiled_elements(next->rows, next->cols)
+		: (size_t)next->rows * next->cols;
+	const size_t width = matrix_element_size(next->type);
+	if (n > (SIZE_MAX - MATRIX_DATA_OFFSET) / width) {
+		return false;
+	}
+	next->buffer = allocate_buffer(n * width, zero, &next->data);
+	if (!next->buffer) {
+		return false;
+	}
+	next->format = format;
+	next->row_ptr = NULL;
+	next->col_idx = NULL;
+	next->nnz = 0;
+	next->capacity = 0;
+	return true;
+}// end fresh_contents
+
+/*
+ * PURPOSE: Get a matrix ready to be written in a dense or tiled layout: give it
+ *      a private buffer in that layout, converting the current elements only
+ *      when they are needed
+ * INPUTS:
+ *      Matrix about to be written, m
+ *      Layout wanted, format (MATRIX_FORMAT_DENSE or MATRIX_FORMAT_TILED)
+ *      Whether the current elements must be carried over, keep_contents
+ * RETURN:
+ *      If memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool prepare_output (Matrix_t* m, Matrix_format_t format, bool keep_contents) {
+	if (m->format == format && m->type == MATRIX_TYPE_U32) {
+		return unshare_matrix(m, keep_contents);
+	}
+	if (keep_contents) {
+		/* the conversion carries the cached hash and aggregates, which the write makes stale */
+		return (format == MATRIX_FORMAT_TILED ? tile_matrix(m) : densify_matrix(m, true))
+			&& unshare_matrix(m, true);
+	}
+	Matrix_t next = *m;
+	next.type = MATRIX_TYPE_U32;
+	if (!fresh_contents(&next, format, false)) {
+		return false;
+	}
+	replace_contents(m, &next);
+	return true;
+}// end prepare_output
+
+/*
+ * PURPOSE: Get a matrix ready to be written as a dense matrix of a given
+ *      element type, the typed counterpart of prepare_output
+ * INPUTS:
+ *      Matrix about to be written, m
+ *      Element type wanted, type
+ *      Whether the current elements must be carried over, keep_contents
+ *      (only when m already has that type)
+ * RETURN:
+ *      If memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool prepare_typed_output (Matrix_t* m, Matrix_type_t type, bool keep_contents) {
+	if (m->format == MATRIX_FORMAT_DENSE && m->type == type) {
+		return unshare_matrix(m, keep_contents);
+	}
+	Matrix_t next = *m;
+	next.type = type;
+	if (!fresh_contents(&next, MATRIX_FORMAT_DENSE, false)) {
+		return false;
+	}
+	replace_contents(m, &next);
+	return true;
+}// end prepare_typed_output
+
+/*
+ * PURPOSE: Bring two operands to layouts the element-wise code can combine.
+ *      Tiles only line up with tiles, so a tiled operand paired with any
+ *      other layout is swapped for a dense view of it and keeps its own
+ *      format, unless it is also the destination, which is made dense.
+ * INPUTS:
+ *      Operands, a and b
+ *      Destination that is about to be written, c (NULL when there is none)
+ *      Destination for the view standing in for an operand, view (set to
+ *      NULL when none is needed; the caller destroys it)
+ * RETURN:
+ *      If memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool match_layouts (Matrix_t** a, Matrix_t** b, const Matrix_t* c, Matrix_t** view) {
+	*view = NULL;
+	if ((*a)->format == (*b)->format) {
+		return true;
+	}
+	/* the layouts differ, so at most one of them is tiled */
+	Matrix_t** tiled = (*a)->format == MATRIX_FORMAT_TILED ? a : b;
+	if ((*tiled)->format != MATRIX_FORMAT_TILED) {
+		return true;
+	}
+	if (*tiled == c) {
+		return densify_matrix(*tiled, true);
+	}
+	if (!dense_view_matrix(*tiled, view)) {
+		return false;
+	}
+	*tiled = *view;
+	return true;
+}// end match_layouts
+
+/*
+ * PURPOSE: Turn a CSR matrix dense once it is too full to be worth keeping sparse
+ * INPUTS:
+ *      Matrix just written, m
+ * RETURN:
+ *      If the conversion runs out of memory, return false.
+ *      Else, return true.
+ **/
+static bool settle_sparse (Matrix_t* m) {
+	if (m->format != MATRIX_FORMAT_CSR || m->nnz <= (size_t)m->rows * m->cols / MATRIX_SPARSE_MAX_DIV) {
+		return true;
+	}
+	return densify_matrix(m, true);
+}// end settle_sparse
+
+/*
+ * PURPOSE: Squeeze out the values of a CSR matrix that an operation turned to zero
+ * INPUTS:
+ *      Unshared CSR matrix, m
+ * RETURN:
+ *      void
+ **/
+static void drop_sparse_zeros (Matrix_t* m) {
+	uint64_t begin = m->row_ptr[0];
+	uint64_t k = 0;
+	for (size_t r = 0; r < m->rows; ++r) {
+		const uint64_t end = m->row_ptr[r + 1];
+		for (uint64_t i = begin; i < end; ++i) {
+			if (m->data[i]) {
+				m->col_idx[k] = m->col_idx[i];
+				m->data[k++] = m->data[i];
+			}
+		}
+		begin = end;
+		m->row_ptr[r + 1] = k;
+	}
+	m->nnz = k;
+}// end drop_sparse_zeros
+
+/*
+ * PURPOSE: Convert a CSR or tiled matrix to the dense format
+ * INPUTS:
+ *      Matrix to convert, m (dense matrices are left alone)
+ *      Whether the current elements must be carried over, keep_contents
+ *      (false when the caller overwrites every element without reading them)
+ * RETURN:
+ *      If memory is exhausted, return false and leave m as it was.
+ *      Else, return true.
+ **/
+bool densify_matrix (Matrix_t* m, bool keep_contents) {
+	if (!m || !m->buffer) {
+		perror("densify_matrix: bad input\n");
+		return false;
+	}
+	if (m->format == MATRIX_FORMAT_DENSE) {
+		return true;
+	}
+	const uint64_t start = stats_now();
+	const size_t n = (size_t)m->rows * m->cols;
+	const bool tiled = m->format == MATRIX_FORMAT_TILED;
+	const size_t stored = stored_elements(m);
+
+	/* a CSR matrix scatters into zeros; tiles overwrite every element */
+	Matrix_t next = *m;
+	if (!fresh_contents(&next, MATRIX_FORMAT_DENSE, keep_contents && !tiled)) {
+		return false;
+	}
+	if (keep_contents && tiled) {
+		Layout_job_t job = { .src = m->data, .dst = next.data, .rows = m->rows, .cols = m->cols };
+		pool_parallel_for(tile_count(m->rows), strip_grain(m->cols), untile_task, &job);
+	}
+	else if (keep_contents) {
+		for (size_t r = 0; r < m->rows; ++r) {
+			unsigned int* row = &next.data[r * m->cols];
+			for (uint64_t k = m->row_ptr[r]; k < m->row_ptr[r + 1]; ++k) {
+				row[m->col_idx[k]] = m->data[k];
+			}
+		}
+	}
+	if (keep_contents) {
+		carry_cache(&next, m);
+	}
+	replace_contents(m, &next);
+	stats_record(STAT_CONVERT_MATRIX, start,
+		keep_contents ? (n + stored * (tiled ? 1 : 2)) * sizeof(unsigned int) : 0, 0);
+	return true;
+}// end densify_matrix
+
+/*
+ * PURPOSE: Give read-only dense access to a matrix without converting it.
+ *      The view shares m's buffer when m is dense; otherwise it is a private
+ *      dense copy, so m keeps its format either way.
+ * INPUTS:
+ *      Matrix to read, m
+ *      Destination for the view, view (the caller destroys it)
+ * RETURN:
+ *      If memory is exhausted, return false.
+ *      Else, return true.
+ **/
+bool dense_view_matrix (Matrix_t* m, Matrix_t** view) {
+	if (!m || !m->buffer || !view) {
+		perror("dense_view_matrix: bad input\n");
+		return false;
+	}
+	if (!share_matrix(m, m->name, view)) {
+		return false;
+	}
+	if (!densify_matrix(*view, true)) {
+		destroy_matrix(view);
+		return false;
+	}
+	return true;
+}// end dense_view_matrix
+
+/*
+ * PURPOSE: Convert a matrix to the tiled format, so column-wise and 2-D local
+ *      work (transpose) touches whole cache-resident tiles instead of
+ *      striding across rows
+ * INPUTS:
+ *      Matrix to convert, m (tiled matrices are left alone; CSR ones are made
+ *      dense on the way)
+ * RETURN:
+ *      If memory is exhausted, return false.
+ *      Else, return true.
+ **/
+bool tile_matrix (Matrix_t* m) {
+	if (!m || !m->buffer) {
+		perror("tile_matrix: bad input\n");
+		return false;
+	}
+	if (m->format == MATRIX_FORMAT_TILED) {
+		return true;
+	}
+	if (!require_u32(m, "tile_matrix")) {
+		return false;
+	}
+	if (!densify_matrix(m, true)) {
+		return false;
+	}
+	const uint64_t start = stats_now();
+	Matrix_t next = *m;
+	if (!fresh_contents(&next, MATRIX_FORMAT_TILED, false)) {
+		return false;
+	}
+	Layout_job_t job = { .src = m->data, .dst = next.data, .rows = m->rows, .cols = m->cols };
+	pool_parallel_for(tile_count(m->rows), strip_grain(m->cols), tile_task, &job);
+	carry_cache(&next, m);
+	replace_contents(m, &next);
+	stats_record(STAT_CONVERT_MATRIX, start,
+		((size_t)m->rows * m->cols + stored_elements(m)) * sizeof(unsigned int), 0);
+	return true;
+}// end tile_matrix
+
+/*
+ * PURPOSE: Convert a dense or tiled matrix to CSR, whatever its density
+ * INPUTS:
+ *      Matrix to convert, m (CSR matrices are left alone)
+ * RETURN:
+ *      If memory is exhausted, return false.
+ *      Else, return true.
+ **/
+bool sparsify_matrix (Matrix_t* m) {
+	if (!m || !m->buffer) {
+		perror("sparsify_matrix: bad input\n");
+		return false;
+	}
+	return m->format == MATRIX_FORMAT_CSR
+		|| (require_u32(m, "sparsify_matrix") && densify_matrix(m, true) && dense_to_csr(m, true));
+}// end sparsify_matrix
+
+/*
+ * PURPOSE: Pick the format that suits a matrix's density: CSR matrices above
+ *      1 / MATRIX_SPARSE_MAX_DIV non-zero become dense, dense and tiled
+ *      matrices below 1 / MATRIX_SPARSE_MIN_DIV non-zero become CSR. Checking
+ *      a dense or tiled matrix counts its non-zeros, one pass over the data.
+ * INPUTS:
+ *      Matrix to check, m (matrices of other types than u32 are always dense and left alone)
+ * RETURN:
+ *      If memory is exhausted, return false and leave m as it was.
+ *      Else, return true.
+ **/
+bool auto_format_matrix (Matrix_t* m) {
+	if (!m || !m->buffer) {
+		perror("auto_format_matrix: bad input\n");
+		return false;
+	}
+	if (m->type != MATRIX_TYPE_U32) {
+		return true;
+	}
+	if (m->format == MATRIX_FORMAT_CSR) {
+		return settle_sparse(m);
+	}
+	if (m->format == MATRIX_FORMAT_DENSE) {
+		return dense_to_csr(m, false);
+	}
+
+	/* tiles are counted as rows of MATRIX_TILE; padding is zero so it adds nothing */
+	const uint64_t start = stats_now();
+	const size_t lines = stored_elements(m) / MATRIX_TILE;
+	uint64_t* counts = malloc((lines + 1) * sizeof(uint64_t));
+	if (!counts) {
+		perror("auto_format_matrix: allocation error\n");
+		return false;
+	}
+	Sparse_job_t job = { .dense = m->data, .cols = MATRIX_TILE, .row_ptr = counts };
+	pool_parallel_for(lines, sparse_row_grain(MATRIX_TILE), count_nonzero_task, &job);
+	size_t nnz = 0;
+	for (size_t i = 1; i <= lines; ++i) {
+		nnz += counts[i];
+	}
+	free(counts);
+	stats_record(STAT_CONVERT_MATRIX, start, lines * MATRIX_TILE * sizeof(unsigned int), 0);
+	if (nnz >= (size_t)m->rows * m->cols / MATRIX_SPARSE_MIN_DIV) {
+		return true;
+	}
+	return densify_matrix(m, true) && dense_to_csr(m, true);
+}// end auto_format_matrix
+
+/*
+ * PURPOSE: Build the CSR form of a dense matrix: count the non-zeros of every
+ *      row, turn the counts into offsets, then copy the rows out in parallel
+ * INPUTS:
+ *      Dense matrix, m
+ *      Whether to convert even when m is not below 1 / MATRIX_SPARSE_MIN_DIV
+ *      non-zero, force
+ * RETURN:
+ *      If memory is exhausted, return false and leave m dense.
+ *      Else, return true.
+ **/
+static bool dense_to_csr (Matrix_t* m, bool force) {
+	const uint64_t start = stats_now();
+	const size_t rows = m->rows;
+	const size_t n = rows * m->cols;
+	uint64_t* counts = malloc((rows + 1) * sizeof(uint64_t));
+	if (!counts) {
+		perror("sparsify_matrix: allocation error\n");
+		return false;
+	}
+	counts[0] = 0;
+	const size_t grain = sparse_row_grain(m->cols);
+	Sparse_job_t job = { .dense = m->data, .cols = m->cols, .row_ptr = counts };
+	pool_parallel_for(rows, grain, count_nonzero_task, &job);
+	for (size_t r = 0; r < rows; ++r) {
+		counts[r + 1] += counts[r];
+	}
+	const size_t nnz = counts[rows];
+	if (!force && nnz >= n / MATRIX_SPARSE_MIN_DIV) {
+		free(counts);
+		stats_record(STAT_CONVERT_MATRIX, start, n * sizeof(unsigned int), 0);
+		return true;
+	}
+
+	Matrix_t next = *m;
+	if (!allocate_csr(&next, nnz)) {
+		free(counts);
+		return false;
+	}
+	memcpy(next.row_ptr, counts, (rows + 1) * sizeof(uint64_t));
+	free(counts);
+	next.nnz = nnz;
+	job.row_ptr = next.row_ptr;
+	job.col_idx = next.col_idx;
+	job.values = next.data;
+	pool_parallel_for(rows, grain, fill_sparse_task, &job);
+	carry_cache(&next, m);
+	replace_contents(m, &next);
+	stats_record(STAT_CONVERT_MATRIX, start, (n * 2 + nnz * 2) * sizeof(unsigned int), 0);
+	return true;
+}// end dense_to_csr
+
+/*
+ * PURPOSE: Set one element of a matrix. A CSR matrix inserts or removes the
+ *      value in place, which moves the values after it, and turns dense if
+ *      that leaves it too full.
+ * INPUTS:
+ *      Matrix to write, m
+ *      Position of the element, row and col
+ *      New value, value (converted to m's element type, which it must fit)
+ * RETURN:
+ *      If the position is outside m or memory is exhausted, return false.
+ *      Else, return true.
+ **/
+bool set_matrix_element (Matrix_t* m, size_t row, size_t col, unsigned int value) {
+	if (!m || !m->data) {
+		perror("set_matrix_element: bad input\n");
+		return false;
+	}
+	if (row >= m->rows || col >= m->cols) {
+		printf("set_matrix_element: (%zu,%zu) is outside (%zu,%zu)\n", row, col, m->rows, m->cols);
+		return false;
+	}
+	const size_t width = matrix_element_size(m->type);
+	if (!matrix_type_is_real(m->type) && width < sizeof(unsigned int) && value >> (width * 8)) {
+		printf("set_matrix_element: %u does not fit in a %s element\n", value, matrix_type_name(m->type));
+		return false;
+	}
+	/* unsharing drops the cached aggregates, but one element moves them by a known amount */
+	Matrix_aggregates_t aggregates = m->buffer->aggregates;
+	const bool aggregated = m->buffer->aggregated;
+	if (!unshare_matrix(m, true)) {
+		return false;
+	}
+
+	const uint64_t start = stats_now();
+	if (m->type != MATRIX_TYPE_U32) {
+		const uint64_t wide = value;
+		typed_kernels(m->type)->from_u64((unsigned char*)m->data + element_index(m, row, col) * width, &wide, 1);
+		stats_record(STAT_SET_MATRIX, start, width, 0);
+		return true;
+	}
+	if (m->format != MATRIX_FORMAT_CSR) {
+		unsigned int* element = &m->data[element_index(m, row, col)];
+		const unsigned int old = *element;
+		*element = value;
+		if (aggregated && update_aggregates(&aggregates, old, value)) {
+			m->buffer->aggregates = aggregates;
+			m->buffer->aggregated = true;
+		}
+		stats_record(STAT_SET_MATRIX, start, sizeof(unsigned int), 0);
+		return true;
+	}
+
+	const uint64_t row_end = m->row_ptr[row + 1];
+	uint64_t lo = m->row_ptr[row];
+	uint64_t hi = row_end;
+	while (lo < hi) {
+		const uint64_t mid = lo + (hi - lo) / 2;
+		if (m->col_idx[mid] < col) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	const bool found = lo < row_end && m->col_idx[lo] == col;
+	const size_t tail = m->nnz - lo;
+	const unsigned int old = found ? m->data[lo] : 0;
+
+	if (found && value) {
+		m->data[lo] = value;
+	}
+	else if (found) {
+		memmove(&m->col_idx[lo], &m->col_idx[lo + 1], (tail - 1) * sizeof(unsigned int));
+		memmove(&m->data[lo], &m->data[lo + 1], (tail - 1) * sizeof(unsigned int));
+		for (size_t r = (size_t)row + 1; r <= m->rows; ++r) {
+			--m->row_ptr[r];
+		}
+		--m->nnz;
+	}
+	else if (value) {
+		if (m->nnz == m->capacity) {
+			const size_t elements = (size_t)m->rows * m->cols;
+			size_t capacity = m->capacity < 16 ? 16 : m->capacity * 2;
+			if (!copy_csr(m, capacity < elements ? capacity : elements)) {
+				return false;
+			}
+		}
+		memmove(&m->col_idx[lo + 1], &m->col_idx[lo], tail * sizeof(unsigned int));
+		memmove(&m->data[lo + 1], &m->data[lo], tail * sizeof(unsigned int));
+		m->col_idx[lo] = col;
+		m->data[lo] = value;
+		for (size_t r = (size_t)row + 1; r <= m->rows; ++r) {
+			++m->row_ptr[r];
+		}
+		++m->nnz;
+	}
+	if (aggregated && update_aggregates(&aggregates, old, value)) {
+		m->buffer->aggregates = aggregates;
+		m->buffer->aggregated = true;
+	}
+	stats_record(STAT_SET_MATRIX, start,
+		tail * 2 * sizeof(unsigned int) + ((size_t)m->rows - row) * sizeof(uint64_t), 0);
+	return settle_sparse(m);
+}// end set_matrix_element
+
+/*
+ * PURPOSE: Whether a matrix shares its data buffer with another matrix
+ * INPUTS:
+ *      Matrix to check, m
+ * RETURN:
+ *      If another matrix holds the same buffer, return true.
+ *      Else, return false.
+ **/
+bool matrix_is_shared (const Matrix_t* m) {
+	return m && m->buffer && __atomic_load_n(&m->buffer->refs, __ATOMIC_ACQUIRE) > 1;
+}// end matrix_is_shared
+
+/*
+ * PURPOSE: Give a matrix its own data buffer before it is written. Does nothing
+ *      when the matrix already holds the only reference, unless the data is a
+ *      read-only workspace mapping, which is always copied.
+ * INPUTS:
+ *      Matrix about to be written, m
+ *      Whether the current elements must be carried over, keep_contents
+ *      (false when the caller overwrites every element without reading them)
+ * RETURN:
+ *      If memory is exhausted, return false and leave m sharing.
+ *      Else, return true.
+ **/
+bool unshare_matrix (Matrix_t* m, bool keep_contents) {
+	if (!m || !m->buffer) {
+		perror("unshare_matrix: bad input\n");
+		return false;
+	}
+	if (!matrix_is_shared(m) && m->buffer->storage != MATRIX_STORAGE_WORKSPACE) {
+		/* the caller is about to write, so the cached hash and aggregates go */
+		m->buffer->hashed = false;
+		m->buffer->aggregated = false;
+		return true;
+	}
+	const uint64_t start = stats_now();
+	if (m->format == MATRIX_FORMAT_CSR) {
+		/* the CSR arrays are small next to a dense copy, so they are always carried over */
+		if (!copy_csr(m, m->capacity)) {
+			return false;
+		}
+		stats_record(STAT_UNSHARE_MATRIX, start,
+			(((size_t)m->rows + 1) * sizeof(uint64_t) + m->nnz * 2 * sizeof(unsigned int)) * 2, 0);
+		return true;
+	}
+	const size_t bytes = matrix_stored_bytes(m);
+	unsigned int* data = NULL;
+	Matrix_buffer_t* buffer = allocate_buffer(bytes, false, &data);
+	if (!buffer) {
+		return false;
+	}
+	if (keep_contents) {
+		Element_job_t job = { .dst = data, .a = m->data };
+		pool_parallel_for(bytes, POOL_MIN_GRAIN * sizeof(unsigned int), copy_bytes_task, &job);
+	}
+	release_buffer(m->buffer);
+	m->buffer = buffer;
+	m->data = data;
+	stats_record(STAT_UNSHARE_MATRIX, start, keep_contents ? bytes * 2 : 0, 0);
+	return true;
+}// end unshare_matrix
+
+/*
+ * PURPOSE: deallocates passed matrix
+ * INPUTS: 
+ *      Matrix to deallocate
+ * RETURN:
+ *      void
+ **/
+void destroy_matrix (Matrix_t** m) {        
+    if( m && *m ){
+        const uint64_t start = stats_now();
+        release_buffer((*m)->buffer);
+        block_free(*m, (*m)->block_size);
+        *m = NULL;
+        stats_record(STAT_DESTROY_MATRIX, start, 0, 0);
+    }
+}// end destory matrix
+
+/*
+ * PURPOSE: compare memory blocks of two matrices, to see if they are the same.
+ *      The content hashes are compared first, so the elements are only
+ *      compared when they agree. Matrices of different element types are
+ *      never equal, and float elements compare bit for bit.
+ * INPUTS: 
+ *      two matrices to compare
+ * RETURN:
+ *      if blocks of memory are the same, return true. Else, return false.
+ **/
+bool equal_matrices (Matrix_t* a, Matrix_t* b) {	
+	if (!a || !b || !a->data || !b->data ) {
+        perror("equal_matrices: bad input\n");
+		return false;	
+	}
+	if (a->rows != b->rows || a->cols != b->cols || a->type != b->type) {
+		return false;
+	}
+
+	if (a->data == b->data) {
+		return true;
+	}
+	/* hashes are cached per buffer and layout independent, so most mismatches stop here */
+	uint64_t hash_a = 0;
+	uint64_t hash_b = 0;
+	if (!hash_matrix(a, &hash_a) || !hash_matrix(b, &hash_b) || hash_a != hash_b) {
+		return false;
+	}
+	Matrix_t* view = NULL;
+	if (!match_layouts(&a, &b, NULL, &view)) {
+		return false;
+	}
+	const bool same = equal_contents(a, b);
+	destroy_matrix(&view);
+	return same;
+}// end equal_matrices
+
+/*
+ * PURPOSE: Compare the elements of two matrices of one shape and type,
+ *      in layouts match_layouts has paired up
+ * INPUTS:
+ *      Matrices to compare, a and b
+ * RETURN:
+ *      If every element matches, return true. Else, return false.
+ **/
+static bool equal_contents (Matrix_t* a, Matrix_t* b) {
+	const uint64_t start = stats_now();
+	const size_t n = stored_elements(a);
+	if (a->type != MATRIX_TYPE_U32) {
+		const size_t width = matrix_element_size(a->type);
+		Typed_job_t job = { .width = width, .a = (const unsigned char*)a->data, .b = (const unsigned char*)b->data,
+			.mismatch = false };
+		pool_parallel_for(n, POOL_MIN_GRAIN, typed_equal_task, &job);
+		stats_record(STAT_EQUAL_MATRICES, start, n * 2 * width, 0);
+		return !job.mismatch;
+	}
+	if (a->format == MATRIX_FORMAT_CSR && b->format == MATRIX_FORMAT_CSR) {
+		/* CSR never stores zeros and keeps columns sorted, so equal matrices have identical arrays */
+		const size_t ptr_bytes = ((size_t)a->rows + 1) * sizeof(uint64_t);
+		const bool same = a->nnz == b->nnz
+			&& memcmp(a->row_ptr, b->row_ptr, ptr_bytes) == 0
+			&& memcmp(a->col_idx, b->col_idx, a->nnz * sizeof(unsigned int)) == 0
+			&& memcmp(a->data, b->data, a->nnz * sizeof(unsigned int)) == 0;
+		stats_record(STAT_EQUAL_MATRICES, start, (ptr_bytes + a->nnz * 2 * sizeof(unsigned int)) * 2, 0);
+		return same;
+	}
+	if (a->format == MATRIX_FORMAT_CSR || b->format == MATRIX_FORMAT_CSR) {
+		const Matrix_t* sparse = a->format == MATRIX_FORMAT_CSR ? a : b;
+		const Matrix_t* dense = sparse == a ? b : a;
+		Sparse_job_t job = { .dense = dense->data, .cols = dense->cols, .row_ptr = sparse->row_ptr,
+			.col_idx = sparse->col_idx, .values = sparse->data, .mismatch = false };
+		pool_parallel_for(a->rows, sparse_row_grain(a->cols), equal_sparse_task, &job);
+		stats_record(STAT_EQUAL_MATRICES, start, (stored_elements(dense) + sparse->nnz * 2) * sizeof(unsigned int), 0);
+		return !job.mismatch;
+	}
+	Element_job_t job = { .a = a->data, .b = b->data, .mismatch = false };
+	pool_parallel_for(n, POOL_MIN_GRAIN, equal_task, &job);
+	stats_record(STAT_EQUAL_MATRICES, start, n * 2 * sizeof(unsigned int), 0);
+	return !job.mismatch;
+}// end equal_contents
+
+/*
+ * PURPOSE: Make dest hold the same data as src by sharing src's buffer.
+ *      No elements are copied; whichever of the two is written first gets
+ *      a private copy then.
+ * INPUTS:
+ *      source matrix src
+ *      destination matrix dest, with the same dimensions
+ * RETURN:
+ *      If the inputs are invalid or the dimensions differ, return false.
+ *      Else, return true.
+ **/
+bool duplicate_matrix (Matrix_t* src, Matrix_t* dest) {
+	if (!src || !dest || !src->data || !src->buffer ) {
+        perror("duplicate_matrix: bad input\n");
+		return false;
+	}
+	if (src->rows != dest->rows || src->cols != dest->cols) {
+		printf("duplicate_matrix: dimension mismatch (%zu,%zu) -> (%zu,%zu)\n",
+			src->rows, src->cols, dest->rows, dest->cols);
+		return false;
+	}
+	if (src->buffer == dest->buffer) {
+		return true;
+	}
+	const uint64_t start = stats_now();
+	release_buffer(dest->buffer);
+	adopt_contents(dest, src);
+	stats_record(STAT_DUPLICATE_MATRIX, start, 0, 0);
+	return true;
+}// end duplicate_matrix
+
+/*
+ * PURPOSE: Create a matrix under a new name that shares src's data buffer
+ * INPUTS:
+ *      Source matrix, src
+ *      Name of the new matrix, name
+ *      Destination for the new matrix, dest
+ * RETURN:
+ *      If the inputs are invalid or memory is exhausted, return false.
+ *      Else, return true.
+ **/
+bool share_matrix (Matrix_t* src, const char* name, Matrix_t** dest) {
+	if (!src || !src->buffer || !name || !dest) {
+		perror("share_matrix: bad input\n");
+		return false;
+	}
+	const uint64_t start = stats_now();
+	if (!allocate_header(dest, name, src->rows, src->cols)) {
+		return false;
+	}
+	adopt_contents(*dest, src);
+	stats_record(STAT_DUPLICATE_MATRIX, start, 0, 0);
+	return true;
+}// end share_matrix
+
+/*
+ * PURPOSE: Preform a bitwise shift on the members of an array. A CSR matrix
+ *      only shifts its stored values, since shifted zeros stay zero. Float
+ *      matrices are scaled by 2^shift instead (2^-shift to the right).
+ * INPUTS:
+ *		Direction the shift should move, direction
+ *		Matrix to preform shift on, a
+ *		Amount to shift by, shift
+ * RETURN:
+ *		If bad inputs are given, return false.
+ *		Else, return true.
+ **/
+bool bitwise_shift_matrix (Matrix_t* a, char direction, unsigned int shift) {
+	
+	if ( !a || !a->data ) {
+        perror("bitwise_shift_matrix: bad input\n");
+		return false;
+	}
+	if (!unshare_matrix(a, true)) {
+		return false;
+	}
+
+	const uint64_t start = stats_now();
+	if (a->type != MATRIX_TYPE_U32) {
+		const size_t n = stored_elements(a);
+		const size_t width = matrix_element_size(a->type);
+		Typed_job_t job = { .kernels = typed_kernels(a->type), .width = width, .dst = (unsigned char*)a->data,
+			.a = (const unsigned char*)a->data, .shift = shift };
+		pool_parallel_for(n, POOL_MIN_GRAIN, direction == 'l' ? typed_shl_task : typed_shr_task, &job);
+		stats_record(STAT_SHIFT_MATRIX, start, n * 2 * width, 0);
+		return true;
+	}
+	const bool sparse = a->format == MATRIX_FORMAT_CSR;
+	const bool dense = a->format == MATRIX_FORMAT_DENSE;
+	const size_t n = stored_elements(a);
+	Kernel_stats_t partials[POOL_MAX_CHUNKS];
+	Element_job_t job = { .dst = a->data, .a = a->data, .shift = shift, .stats = dense ? partials : NULL };
+	pool_parallel_for(n, POOL_MIN_GRAIN, direction == 'l' ? shl_task : shr_task, &job);
+	if (sparse) {
+		drop_sparse_zeros(a);
+	}
+	if (dense) {
+		keep_aggregates(a, partials, pool_chunk_count(n, POOL_MIN_GRAIN));
+	}
+	stats_record(STAT_SHIFT_MATRIX, start, n * 2 * sizeof(unsigned int), 0);
+	return true;
+}// end bitwise_shift_matrix
+
+/*
+ * PURPOSE: Add two matrices together. Two CSR operands give a CSR sum
+ *      (dense if it comes out too full) and two tiled operands a tiled sum;
+ *      otherwise the sum is dense. The operands must have the same element
+ *      type, which the sum takes.
  * INPUTS: 
  *      1st matrix to add, a.
  *      2nd matrix to add, b.
  *      Destinaiton of the sum, c.
  * RETURN:
- *      If parameters are invalid, return false.
+ *      If parameters are invalid, return false.
+ *      Else, return true.
+ **/
+bool add_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c) {
+	if ( !a || !b || !c || !a->data || !b->data || !c->data ) {
+        perror("add_matrices: bad input\n");
+		return false;
+	}
+
+	if ( a->rows != b->rows || a->cols != b->cols || c->rows != a->rows || c->cols != a->cols ) {
+		printf("add_matrices: dimension mismatch (%zu,%zu) + (%zu,%zu) -> (%zu,%zu)\n",
+			a->rows, a->cols, b->rows, b->cols, c->rows, c->cols);
+		return false;
+	}
+	if (a->type != b->type) {
+		printf("add_matrices: %s holds %s elements but %s holds %s (cast one first)\n",
+			a->name, matrix_type_name(a->type), b->name, matrix_type_name(b->type));
+		return false;
+	}
+	if (a->type != MATRIX_TYPE_U32) {
+		return add_typed(a, b, c);
+	}
+	/* c is not an operand here, so whatever it held can go */
+	if (c->type != MATRIX_TYPE_U32 && !prepare_typed_output(c, MATRIX_TYPE_U32, false)) {
+		return false;
+	}
+	Matrix_t* view = NULL;
+	if (!match_layouts(&a, &b, c, &view)) {
+		return false;
+	}
+	const bool ok = add_u32(a, b, c);
+	destroy_matrix(&view);
+	return ok;
+}// end add_matrices
+
+/*
+ * PURPOSE: Add two u32 matrices in layouts match_layouts has paired up
+ * INPUTS:
+ *      Operands of the same dimensions, a and b
+ *      Destination of the sum, c (may be a or b)
+ * RETURN:
+ *      If memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool add_u32 (Matrix_t* a, Matrix_t* b, Matrix_t* c) {
+	if (a->format == MATRIX_FORMAT_CSR && b->format == MATRIX_FORMAT_CSR) {
+		return add_sparse(a, b, c);
+	}
+	if (a->format == MATRIX_FORMAT_CSR || b->format == MATRIX_FORMAT_CSR) {
+		return a->format == MATRIX_FORMAT_DENSE ? add_mixed(a, b, c) : add_mixed(b, a, c);
+	}
+	/* a and b now share a dense or tiled layout; the old elements of c are only read when c is also an operand */
+	if (!prepare_output(c, a->format, c == a || c == b)) {
+		return false;
+	}
+
+	const uint64_t start = stats_now();
+	const size_t n = stored_elements(a);
+	/* tile padding would count as zeros, so only a dense sum keeps its aggregates */
+	const bool dense = a->format == MATRIX_FORMAT_DENSE;
+	Kernel_stats_t partials[POOL_MAX_CHUNKS];
+	Element_job_t job = { .dst = c->data, .a = a->data, .b = b->data, .stats = dense ? partials : NULL };
+	pool_parallel_for(n, POOL_MIN_GRAIN, add_task, &job);
+	if (dense) {
+		keep_aggregates(c, partials, pool_chunk_count(n, POOL_MIN_GRAIN));
+	}
+	stats_record(STAT_ADD_MATRICES, start, n * 3 * sizeof(unsigned int), 0);
+	return true;
+}// end add_u32
+
+/*
+ * PURPOSE: Add two dense matrices of another element type than u32; the sum
+ *      has their type and wraps for integers
+ * INPUTS:
+ *      Operands of the same dimensions and type, a and b
+ *      Destination of the sum, c (may be a or b)
+ * RETURN:
+ *      If memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool add_typed (Matrix_t* a, Matrix_t* b, Matrix_t* c) {
+	if (!prepare_typed_output(c, a->type, c == a || c == b)) {
+		return false;
+	}
+	const uint64_t start = stats_now();
+	const size_t n = stored_elements(a);
+	const size_t width = matrix_element_size(a->type);
+	Typed_job_t job = { .kernels = typed_kernels(a->type), .width = width, .dst = (unsigned char*)c->data,
+		.a = (const unsigned char*)a->data, .b = (const unsigned char*)b->data };
+	pool_parallel_for(n, POOL_MIN_GRAIN, typed_add_task, &job);
+	stats_record(STAT_ADD_MATRICES, start, n * 3 * width, 0);
+	return true;
+}// end add_typed
+
+/*
+ * PURPOSE: Add two CSR matrices by merging their rows into a new CSR buffer
+ *      for c, leaving out sums that wrap to zero
+ * INPUTS:
+ *      CSR operands of the same dimensions, a and b
+ *      Destination of the sum, c (may be a or b)
+ * RETURN:
+ *      If memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool add_sparse (Matrix_t* a, Matrix_t* b, Matrix_t* c) {
+	const uint64_t start = stats_now();
+	const size_t elements = (size_t)a->rows * a->cols;
+	const size_t most = a->nnz + b->nnz;
+	Matrix_t next = *c;
+	if (!allocate_csr(&next, most < elements ? most : elements)) {
+		return false;
+	}
+
+	uint64_t k = 0;
+	next.row_ptr[0] = 0;
+	for (size_t r = 0; r < a->rows; ++r) {
+		uint64_t i = a->row_ptr[r];
+		uint64_t j = b->row_ptr[r];
+		const uint64_t i_end = a->row_ptr[r + 1];
+		const uint64_t j_end = b->row_ptr[r + 1];
+		while (i < i_end || j < j_end) {
+			unsigned int col;
+			unsigned int value;
+			if (j == j_end || (i < i_end && a->col_idx[i] < b->col_idx[j])) {
+				col = a->col_idx[i];
+				value = a->data[i++];
+			}
+			else if (i == i_end || b->col_idx[j] < a->col_idx[i]) {
+				col = b->col_idx[j];
+				value = b->data[j++];
+			}
+			else {
+				col = a->col_idx[i];
+				value = a->data[i++] + b->data[j++];
+			}
+			if (value) {
+				next.col_idx[k] = col;
+				next.data[k++] = value;
+			}
+		}
+		next.row_ptr[r + 1] = k;
+	}
+	next.nnz = k;
+
+	const uint64_t bytes = (most + k) * 2 * sizeof(unsigned int) + ((uint64_t)a->rows + 1) * 3 * sizeof(uint64_t);
+	replace_contents(c, &next);
+	stats_record(STAT_ADD_MATRICES, start, bytes, 0);
+	return settle_sparse(c);
+}// end add_sparse
+
+/*
+ * PURPOSE: Add a dense and a CSR matrix into a dense c
+ * INPUTS:
+ *      Dense operand, d
+ *      CSR operand of the same dimensions, s
+ *      Destination of the sum, c (may be d or s)
+ * RETURN:
+ *      If memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool add_mixed (Matrix_t* d, Matrix_t* s, Matrix_t* c) {
+	const uint64_t start = stats_now();
+	const size_t n = (size_t)d->rows * d->cols;
+	const size_t nnz = s->nnz;
+	if (c == s) {
+		/* expand s in place, then add d over it */
+		if (!densify_matrix(c, true) || !unshare_matrix(c, true)) {
+			return false;
+		}
+		Element_job_t job = { .dst = c->data, .a = c->data, .b = d->data };
+		pool_parallel_for(n, POOL_MIN_GRAIN, add_task, &job);
+	}
+	else {
+		if (!densify_matrix(c, false) || !unshare_matrix(c, c == d)) {
+			return false;
+		}
+		if (c != d) {
+			Element_job_t job = { .dst = c->data, .a = d->data };
+			pool_parallel_for(n, POOL_MIN_GRAIN, copy_task, &job);
+		}
+		for (size_t r = 0; r < s->rows; ++r) {
+			unsigned int* row = &c->data[r * s->cols];
+			for (uint64_t k = s->row_ptr[r]; k < s->row_ptr[r + 1]; ++k) {
+				row[s->col_idx[k]] += s->data[k];
+			}
+		}
+	}
+	stats_record(STAT_ADD_MATRICES, start, (n * 2 + nnz * 2) * sizeof(unsigned int), 0);
+	return true;
+}// end add_mixed
+
+/*
+ * PURPOSE: Transpose a matrix into another, dest = src^T, keeping src's
+ *      layout. Dense matrices go MATRIX_TILE squares at a time, tiled ones
+ *      tile by tile, CSR ones by a counting pass over the columns.
+ * INPUTS:
+ *      Matrix to transpose, src
+ *      Destination, dest. Must be src->cols x src->rows and distinct from src.
+ * RETURN:
+ *      If parameters are invalid or memory is exhausted, return false.
+ *      Else, return true.
+ **/
+bool transpose_matrix (Matrix_t* src, Matrix_t* dest) {
+	if (!src || !dest || !src->data || !dest->buffer || src == dest) {
+		perror("transpose_matrix: bad input\n");
+		return false;
+	}
+	if (dest->rows != src->cols || dest->cols != src->rows) {
+		printf("transpose_matrix: dimension mismatch (%zu,%zu) -> (%zu,%zu)\n",
+			src->rows, src->cols, dest->rows, dest->cols);
+		return false;
+	}
+	if (!require_u32(src, "transpose_matrix")) {
+		return false;
+	}
+	if (src->format == MATRIX_FORMAT_CSR) {
+		if (!transpose_sparse(src, dest)) {
+			return false;
+		}
+	}
+	else {
+		if (!prepare_output(dest, src->format, false)) {
+			return false;
+		}
+		const uint64_t start = stats_now();
+		Layout_job_t job = { .src = src->data, .dst = dest->data, .rows = src->rows, .cols = src->cols };
+		pool_parallel_for(tile_count(src->rows), strip_grain(src->cols),
+			src->format == MATRIX_FORMAT_TILED ? transpose_tiles_task : transpose_task, &job);
+		stats_record(STAT_TRANSPOSE_MATRIX, start, stored_elements(src) * 2 * sizeof(unsigned int), 0);
+	}
+	/* the same elements in other places: the aggregates hold, the hash does not */
+	dest->buffer->aggregates = src->buffer->aggregates;
+	dest->buffer->aggregated = src->buffer->aggregated;
+	return true;
+}// end transpose_matrix
+
+/*
+ * PURPOSE: Transpose a CSR matrix into a new CSR buffer for dest. Columns of
+ *      src are counted into dest's row offsets, then the values are dropped
+ *      into place row by row, which keeps every dest row sorted.
+ * INPUTS:
+ *      CSR matrix to transpose, src
+ *      Destination of the transposed dimensions, dest
+ * RETURN:
+ *      If memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool transpose_sparse (Matrix_t* src, Matrix_t* dest) {
+	const uint64_t start = stats_now();
+	Matrix_t next = *dest;
+	if (!allocate_csr(&next, src->nnz)) {
+		return false;
+	}
+	uint64_t* row_ptr = next.row_ptr;
+	memset(row_ptr, 0, ((size_t)next.rows + 1) * sizeof(uint64_t));
+	for (size_t k = 0; k < src->nnz; ++k) {
+		++row_ptr[src->col_idx[k] + 1];
+	}
+	for (size_t r = 0; r < next.rows; ++r) {
+		row_ptr[r + 1] += row_ptr[r];
+	}
+	/* row_ptr[r] is the fill cursor of row r and ends up at the start of row r + 1 */
+	for (size_t r = 0; r < src->rows; ++r) {
+		for (uint64_t k = src->row_ptr[r]; k < src->row_ptr[r + 1]; ++k) {
+			const uint64_t pos = row_ptr[src->col_idx[k]]++;
+			next.col_idx[pos] = r;
+			next.data[pos] = src->data[k];
+		}
+	}
+	memmove(&row_ptr[1], row_ptr, (size_t)next.rows * sizeof(uint64_t));
+	row_ptr[0] = 0;
+	next.nnz = src->nnz;
+
+	replace_contents(dest, &next);
+	stats_record(STAT_TRANSPOSE_MATRIX, start,
+		(((uint64_t)src->rows + src->cols + 2) * sizeof(uint64_t) + src->nnz * 4 * sizeof(unsigned int)), 0);
+	return true;
+}// end transpose_sparse
+
+/*
+ * PURPOSE: Sum every element of a matrix, from its cached aggregates when they are valid.
+ *      Integer types other than u32 are summed in one pass, wrapping at 64 bits;
+ *      float matrices are summed with sum_matrix_real.
+ * INPUTS:
+ *      Matrix to sum, m
+ *      Destination of the 64-bit sum, sum
+ * RETURN:
+ *      If parameters are invalid or m holds floats, return false.
+ *      Else, return true.
+ **/
+bool sum_matrix (Matrix_t* m, uint64_t* sum) {
+	if ( !m || !m->data || !sum ) {
+		perror("sum_matrix: bad input\n");
+		return false;
+	}
+	if (matrix_type_is_real(m->type)) {
+		printf("sum_matrix: %s holds %s elements, which have a real sum\n", m->name, matrix_type_name(m->type));
+		return false;
+	}
+
+	const uint64_t start = stats_now();
+	if (m->type != MATRIX_TYPE_U32) {
+		Kernel_total_t total;
+		typed_total(m, &total);
+		*sum = total.integer;
+		stats_record(STAT_SUM_MATRIX, start, matrix_stored_bytes(m), 0);
+		return true;
+	}
+	Matrix_aggregates_t aggregates;
+	if (!aggregate_matrix(m, &aggregates)) {
+		return false;
+	}
+	*sum = aggregates.sum;
+	stats_record(STAT_SUM_MATRIX, start, 0, 0);
+	return true;
+}// end sum_matrix
+
+/*
+ * PURPOSE: Sum every element of a float matrix in double precision. The
+ *      chunks are added in order, but their bounds follow the thread count,
+ *      so the last bits may differ between runs on different pools.
+ * INPUTS:
+ *      Matrix of type f32 or f64 to sum, m
+ *      Destination of the sum, sum
+ * RETURN:
+ *      If parameters are invalid or m holds integers, return false.
+ *      Else, return true.
+ **/
+bool sum_matrix_real (Matrix_t* m, double* sum) {
+	if (!m || !m->data || !sum) {
+		perror("sum_matrix_real: bad input\n");
+		return false;
+	}
+	if (!matrix_type_is_real(m->type)) {
+		printf("sum_matrix_real: %s holds %s elements, which have an integer sum\n", m->name,
+			matrix_type_name(m->type));
+		return false;
+	}
+
+	const uint64_t start = stats_now();
+	Kernel_total_t total;
+	typed_total(m, &total);
+	*sum = total.real;
+	stats_record(STAT_SUM_MATRIX, start, matrix_stored_bytes(m), 0);
+	return true;
+}// end sum_matrix_real
+
+/*
+ * PURPOSE: Sum the elements of a dense matrix of any type other than u32
+ *      on the pool, into total->integer for integers or total->real for floats
+ * INPUTS:
+ *      Matrix to sum, m
+ *      Destination of the totals, total
+ * RETURN:
+ *      Always true.
+ **/
+static bool typed_total (Matrix_t* m, Kernel_total_t* total) {
+	const size_t n = stored_elements(m);
+	Typed_job_t job = { .kernels = typed_kernels(m->type), .width = matrix_element_size(m->type),
+		.a = (const unsigned char*)m->data };
+	pool_parallel_for(n, POOL_MIN_GRAIN, typed_sum_task, &job);
+	*total = (Kernel_total_t){ 0, 0 };
+	const size_t chunks = pool_chunk_count(n, POOL_MIN_GRAIN);
+	for (size_t c = 0; c < chunks; ++c) {
+		total->integer += job.partial[c].integer;
+		total->real += job.partial[c].real;
+	}
+	return true;
+}// end typed_total
+
+/*
+ * PURPOSE: Sum, min, max and non-zero count of a matrix's elements. They
+ *      are kept with the data buffer: add, shift and random produce them
+ *      while writing dense results, set adjusts them, and anything else
+ *      that writes drops them, so they are only recomputed here on demand.
+ * INPUTS:
+ *      Matrix to summarize, m
+ *      Destination of the aggregates, aggregates
+ * RETURN:
+ *      If parameters are invalid, return false.
+ *      Else, return true.
+ **/
+bool aggregate_matrix (Matrix_t* m, Matrix_aggregates_t* aggregates) {
+	if (!m || !m->data || !m->buffer || !aggregates) {
+		perror("aggregate_matrix: bad input\n");
+		return false;
+	}
+	if (!require_u32(m, "aggregate_matrix")) {
+		return false;
+	}
+	if (!m->buffer->aggregated) {
+		const uint64_t start = stats_now();
+		Aggregate_job_t job = { .m = m };
+		/* a CSR matrix summarizes its stored values, and its zeros are counted in afterwards */
+		size_t items = m->format == MATRIX_FORMAT_CSR ? m->nnz : stored_elements(m);
+		size_t grain = POOL_MIN_GRAIN;
+		if (m->format == MATRIX_FORMAT_TILED) {
+			items = tile_count(m->rows);
+			grain = strip_grain(m->cols);
+			pool_parallel_for(items, grain, aggregate_tiles_task, &job);
+		}
+		else {
+			pool_parallel_for(items, grain, aggregate_task, &job);
+		}
+		keep_aggregates(m, job.partial, pool_chunk_count(items, grain));
+		if (m->format == MATRIX_FORMAT_CSR && m->nnz < (size_t)m->rows * m->cols) {
+			m->buffer->aggregates.min = 0;
+		}
+		stats_record(STAT_AGGREGATE_MATRIX, start,
+			(m->format == MATRIX_FORMAT_CSR ? m->nnz : stored_elements(m)) * sizeof(unsigned int), 0);
+	}
+	*aggregates = m->buffer->aggregates;
+	return true;
+}// end aggregate_matrix
+
+/*
+ * PURPOSE: Content hash of a matrix, the same for every layout of the same
+ *      elements (see kernel_hash_u32) and different for another element
+ *      type holding the same bytes. It is kept with the data buffer, so
+ *      duplicates share it, and recomputed only after the data is written.
+ * INPUTS:
+ *      Matrix to hash, m
+ *      Destination of the hash, hash
+ * RETURN:
+ *      If parameters are invalid, return false.
+ *      Else, return true.
+ **/
+bool hash_matrix (Matrix_t* m, uint64_t* hash) {
+	if (!m || !m->data || !m->buffer || !hash) {
+		perror("hash_matrix: bad input\n");
+		return false;
+	}
+	if (m->buffer->hashed) {
+		*hash = m->buffer->hash;
+		return true;
+	}
+
+	const uint64_t start = stats_now();
+	Hash_job_t job = { .m = m };
+	size_t items = stored_elements(m);
+	size_t grain = POOL_MIN_GRAIN;
+	uint64_t h = 0;
+	if (m->type != MATRIX_TYPE_U32) {
+		hash_typed(m, &h);
+	}
+	else {
+		if (m->format == MATRIX_FORMAT_CSR) {
+			items = m->rows;
+			grain = sparse_row_grain(m->cols);
+			pool_parallel_for(items, grain, hash_sparse_task, &job);
+		}
+		else if (m->format == MATRIX_FORMAT_TILED) {
+			items = tile_count(m->rows);
+			grain = strip_grain(m->cols);
+			pool_parallel_for(items, grain, hash_tiles_task, &job);
+		}
+		else {
+			pool_parallel_for(items, grain, hash_task, &job);
+		}
+		const size_t chunks = pool_chunk_count(items, grain);
+		for (size_t c = 0; c < chunks; ++c) {
+			h += job.partial[c];
+		}
+	}
+	/* u32 is type 0, so only the other types change the sum: the same bytes as another type hash differently */
+	h += (uint64_t)m->type * 0xD6E8FEB86659FD93ULL;
+	/* fold in the shape and finish with the murmur3 mixer so every bit of the sum reaches every bit of the hash */
+	h ^= ((uint64_t)m->rows << 32 | m->cols) * 0x9E3779B97F4A7C15ULL;
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+
+	m->buffer->hash = h;
+	m->buffer->hashed = true;
+	*hash = h;
+	stats_record(STAT_HASH_MATRIX, start, matrix_stored_bytes(m), 0);
+	return true;
+}// end hash_matrix
+
+/*
+ * PURPOSE: Sum of the hash contributions of a matrix of any type other than
+ *      u32: its bytes are hashed as 32-bit words, the last one zero padded,
+ *      so equal elements of one type give equal hashes
+ * INPUTS:
+ *      Dense matrix to hash, m
+ *      Destination of the sum before the shape is folded in, sum
+ * RETURN:
+ *      Always true.
+ **/
+static bool hash_typed (Matrix_t* m, uint64_t* sum) {
+	const size_t n = stored_elements(m);
+	const size_t width = matrix_element_size(m->type);
+	const size_t words = (n * width + sizeof(unsigned int) - 1) / sizeof(unsigned int);
+	Typed_job_t job = { .width = width, .a = (const unsigned char*)m->data, .n = n };
+	pool_parallel_for(words, POOL_MIN_GRAIN, typed_hash_task, &job);
+	*sum = 0;
+	const size_t chunks = pool_chunk_count(words, POOL_MIN_GRAIN);
+	for (size_t c = 0; c < chunks; ++c) {
+		*sum += job.partial[c].integer;
+	}
+	return true;
+}// end hash_typed
+
+/*
+ * Blocking parameters for multiply_matrices. A KC x NC panel of b and a
+ * MC x KC block of a are packed so the micro-kernel streams both with unit
+ * stride; an MR x NR tile of c is held in registers across the KC loop.
+ */
+#define MUL_MC 64
+#define MUL_KC 256
+#define MUL_NC 2048
+#define MUL_MR 4
+#define MUL_NR 8
+
+/*
+ * PURPOSE: Pack an mc x kc block of a into MR-row panels, zero padding the last panel
+ * INPUTS:
+ *      Top-left element of the block, a
+ *      Row stride of a, lda
+ *      Block dimensions, mc and kc
+ *      Destination buffer, buf
+ * RETURN:
+ *      void
+ **/
+static void pack_mul_a (const unsigned int* a, size_t lda, size_t mc, size_t kc, unsigned int* buf) {
+	for (size_t i = 0; i < mc; i += MUL_MR) {
+		const size_t mr = mc - i < MUL_MR ? mc - i : MUL_MR;
+		for (size_t p = 0; p < kc; ++p) {
+			size_t r = 0;
+			for (; r < mr; ++r) {
+				*buf++ = a[(i + r) * lda + p];
+			}
+			for (; r < MUL_MR; ++r) {
+				*buf++ = 0;
+			}
+		}
+	}
+}// end pack_mul_a
+
+/*
+ * PURPOSE: Pack a kc x nc panel of b into NR-column panels, zero padding the last panel
+ * INPUTS:
+ *      Top-left element of the panel, b
+ *      Row stride of b, ldb
+ *      Panel dimensions, kc and nc
+ *      Destination buffer, buf
+ * RETURN:
+ *      void
+ **/
+static void pack_mul_b (const unsigned int* b, size_t ldb, size_t kc, size_t nc, unsigned int* buf) {
+	for (size_t j = 0; j < nc; j += MUL_NR) {
+		const size_t nr = nc - j < MUL_NR ? nc - j : MUL_NR;
+		for (size_t p = 0; p < kc; ++p) {
+			const unsigned int* row = &b[p * ldb + j];
+			size_t c = 0;
+			for (; c < nr; ++c) {
+				*buf++ = row[c];
+			}
+			for (; c < MUL_NR; ++c) {
+				*buf++ = 0;
+			}
+		}
+	}
+}// end pack_mul_b
+
+/*
+ * PURPOSE: Accumulate the product of one packed a panel and one packed b panel into c
+ * INPUTS:
+ *      Shared dimension of the panels, kc
+ *      Packed MR x kc panel of a, ap
+ *      Packed kc x NR panel of b, bp
+ *      Top-left element of the destination tile, c
+ *      Row stride of c, ldc
+ *      Valid rows and cols of the tile, mr and nr
+ * RETURN:
+ *      void
+ **/
+static void mul_micro_kernel (size_t kc, const unsigned int* ap, const unsigned int* bp,
+		unsigned int* c, size_t ldc, size_t mr, size_t nr) {
+	unsigned int acc[MUL_MR][MUL_NR] = {{0}};
+
+	for (size_t p = 0; p < kc; ++p) {
+		for (size_t r = 0; r < MUL_MR; ++r) {
+			const unsigned int av = ap[r];
+			for (size_t j = 0; j < MUL_NR; ++j) {
+				acc[r][j] += av * bp[j];
+			}
+		}
+		ap += MUL_MR;
+		bp += MUL_NR;
+	}
+
+	for (size_t r = 0; r < mr; ++r) {
+		for (size_t j = 0; j < nr; ++j) {
+			c[r * ldc + j] += acc[r][j];
+		}
+	}
+}// end mul_micro_kernel
+
+/*
+ * State for one (jc, pc) step of multiply_matrices, shared by the pool tasks
+ */
+typedef struct {
+	const unsigned int* a;
+	unsigned int* c;
+	const unsigned int* packed_b;
+	size_t m, n, k;
+	size_t jc, nc;
+	size_t pc, kc;
+	bool failed;
+}Mul_job_t;
+
+/*
+ * PURPOSE: Multiply a range of MC row blocks of a against the packed b panel
+ * INPUTS:
+ *      Shared multiply state, arg
+ *      Chunk index (unused), chunk
+ *      Range of MC row blocks to process, begin and end
+ * RETURN:
+ *      void
+ **/
+static void mul_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Mul_job_t* job = arg;
+	unsigned int* packed_a = malloc(sizeof(unsigned int) * (MUL_MC + MUL_MR) * MUL_KC);
+	if ( !packed_a ) {
+		job->failed = true;
+		return;
+	}
+
+	for (size_t ic = begin * MUL_MC; ic < end * MUL_MC && ic < job->m; ic += MUL_MC) {
+		const size_t mc = job->m - ic < MUL_MC ? job->m - ic : MUL_MC;
+		pack_mul_a(&job->a[ic * job->k + job->pc], job->k, mc, job->kc, packed_a);
+
+		for (size_t jr = 0; jr < job->nc; jr += MUL_NR) {
+			const size_t nr = job->nc - jr < MUL_NR ? job->nc - jr : MUL_NR;
+			for (size_t ir = 0; ir < mc; ir += MUL_MR) {
+				const size_t mr = mc - ir < MUL_MR ? mc - ir : MUL_MR;
+				mul_micro_kernel(job->kc, &packed_a[ir * job->kc], &job->packed_b[jr * job->kc],
+					&job->c[(ic + ir) * job->n + job->jc + jr], job->n, mr, nr);
+			}
+		}
+	}
+	free(packed_a);
+}// end mul_task
+
+/*
+ * PURPOSE: Multiply two matrices together (c = a * b)
+ * INPUTS:
+ *      Left hand matrix, a.
+ *      Right hand matrix, b.
+ *      Destination of the product, c. Must be a->rows x b->cols and distinct from a and b.
+ *      CSR and tiled operands are read through dense views; c is made dense.
+ * RETURN:
+ *      If parameters are invalid or the dimensions do not agree, return false.
+ *      Else, return true.
+ **/
+bool multiply_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c) {
+	if ( !a || !b || !c || !a->data || !b->data || !c->data || c == a || c == b ) {
+		perror("multiply_matrices: bad input\n");
+		return false;
+	}
+	if ( a->cols != b->rows || c->rows != a->rows || c->cols != b->cols ) {
+		printf("multiply_matrices: dimension mismatch (%zu,%zu) * (%zu,%zu) -> (%zu,%zu)\n",
+			a->rows, a->cols, b->rows, b->cols, c->rows, c->cols);
+		return false;
+	}
+	if (!require_u32(a, "multiply_matrices") || !require_u32(b, "multiply_matrices")) {
+		return false;
+	}
+	Matrix_t* dense_a = NULL;
+	Matrix_t* dense_b = NULL;
+	const bool ok = dense_view_matrix(a, &dense_a) && dense_view_matrix(b, &dense_b)
+		&& prepare_output(c, MATRIX_FORMAT_DENSE, false)
+		&& multiply_dense(dense_a, dense_b, c);
+	destroy_matrix(&dense_a);
+	destroy_matrix(&dense_b);
+	return ok;
+}// end multiply_matrices
+
+/*
+ * PURPOSE: Multiply two dense matrices into a dense destination of the right shape
+ * INPUTS:
+ *      Left hand matrix, a.
+ *      Right hand matrix, b.
+ *      Destination of the product, c.
+ * RETURN:
+ *      If scratch memory runs out, return false.
+ *      Else, return true.
+ **/
+static bool multiply_dense (Matrix_t* a, Matrix_t* b, Matrix_t* c) {
+	const uint64_t start = stats_now();
+	const size_t m = a->rows;
+	const size_t n = b->cols;
+	const size_t k = a->cols;
+	/* compulsory traffic only: each operand read once and the product written once */
+	const uint64_t bytes = (m * k + k * n + m * n) * sizeof(unsigned int);
+
+	memset(c->data, 0, m * n * sizeof(unsigned int));
+	if ( !m || !n || !k ) {
+		stats_record(STAT_MULTIPLY_MATRICES, start, bytes, 0);
+		return true;
+	}
+
+	unsigned int* packed_b = malloc(sizeof(unsigned int) * (MUL_NC + MUL_NR) * MUL_KC);
+	if ( !packed_b ) {
+		perror("multiply_matrices: allocation error\n");
+		return false;
+	}
+
+	/* b panels are packed once and shared; the MC row blocks of c are split across the pool */
+	const size_t blocks = (m + MUL_MC - 1) / MUL_MC;
+	const size_t grain = m * n * k < ((size_t)1 << 24) ? blocks : 1;
+	Mul_job_t job = { .a = a->data, .c = c->data, .packed_b = packed_b, .m = m, .n = n, .k = k };
+
+	for (size_t jc = 0; jc < n; jc += MUL_NC) {
+		job.jc = jc;
+		job.nc = n - jc < MUL_NC ? n - jc : MUL_NC;
+		for (size_t pc = 0; pc < k; pc += MUL_KC) {
+			job.pc = pc;
+			job.kc = k - pc < MUL_KC ? k - pc : MUL_KC;
+			pack_mul_b(&b->data[pc * n + jc], n, job.kc, job.nc, packed_b);
+			pool_parallel_for(blocks, grain, mul_task, &job);
+		}
+	}
+
+	free(packed_b);
+	if (job.failed) {
+		perror("multiply_matrices: allocation error\n");
+		return false;
+	}
+	stats_record(STAT_MULTIPLY_MATRICES, start, bytes, 0);
+	return true;
+}// end multiply_dense
+
+/*
+ * How format_rows lays a matrix out as text. A window keeps only the first
+ * and last window rows and columns, with a "..." row and column between.
+ */
+typedef struct {
+	char separator;
+	bool trailing;	/* a separator after the last element of a row too */
+	bool exact;	/* floats with enough digits to read back the same value */
+	size_t window;	/* 0 for every row and column */
+}Text_layout_t;
+
+/*
+ * PURPOSE: Add elements [begin, end) of one row to a text writer, each
+ *      preceded by the separator unless it is the first of the row
+ * INPUTS:
+ *      Matrix, m
+ *      Row, r
+ *      Column range, begin and end
+ *      Layout, layout
+ *      Whether the row already has elements, continued
+ *      Writer, out
+ * RETURN:
+ *      void
+ **/
+static void format_row (const Matrix_t* m, size_t r, size_t begin, size_t end, const Text_layout_t* layout,
+		bool continued, Text_writer_t* out) {
+	if (m->type != MATRIX_TYPE_U32) {
+		const Kernel_typed_t* kernels = typed_kernels(m->type);
+		const size_t width = matrix_element_size(m->type);
+		const bool real = matrix_type_is_real(m->type);
+		const int precision = !layout->exact ? 6 : m->type == MATRIX_TYPE_F32 ? 9 : 17;
+		const unsigned char* data = (const unsigned char*)m->data;
+		union {
+			uint64_t integer[CAST_BLOCK];
+			double real[CAST_BLOCK];
+		}wide;
+		for (size_t j = begin; j < end; j += CAST_BLOCK) {
+			const size_t count = end - j < CAST_BLOCK ? end - j : CAST_BLOCK;
+			kernels->widen(real ? (void*)wide.real : (void*)wide.integer, &data[(r * m->cols + j) * width], count);
+			for (size_t k = 0; k < count; ++k) {
+				if (continued || k + j > begin) {
+					text_put_char(out, layout->separator);
+				}
+				if (real) {
+					text_put_real(out, wide.real[k], precision);
+				}
+				else {
+					text_put_u64(out, wide.integer[k]);
+				}
+			}
+		}
+		return;
+	}
+	if (m->format == MATRIX_FORMAT_CSR) {
+		uint64_t k = m->row_ptr[r];
+		const uint64_t row_end = m->row_ptr[r + 1];
+		while (k < row_end && m->col_idx[k] < begin) {
+			++k;
+		}
+		for (size_t j = begin; j < end; ++j) {
+			if (continued || j > begin) {
+				text_put_char(out, layout->separator);
+			}
+			text_put_u64(out, k < row_end && m->col_idx[k] == j ? m->data[k++] : 0);
+		}
+		return;
+	}
+	if (m->format == MATRIX_FORMAT_TILED) {
+		for (size_t j = begin; j < end; ++j) {
+			if (continued || j > begin) {
+				text_put_char(out, layout->separator);
+			}
+			text_put_u64(out, m->data[element_index(m, r, j)]);
+		}
+		return;
+	}
+	const unsigned int* row = &m->data[r * m->cols];
+	for (size_t j = begin; j < end; ++j) {
+		if (continued || j > begin) {
+			text_put_char(out, layout->separator);
+		}
+		text_put_u64(out, row[j]);
+	}
+}// end format_row
+
+/*
+ * PURPOSE: Add a matrix to a text writer, one line per row
+ * INPUTS:
+ *      Matrix, m
+ *      Layout, layout
+ *      Writer, out
+ * RETURN:
+ *      Number of elements formatted
+ **/
+static size_t format_rows (const Matrix_t* m, const Text_layout_t* layout, Text_writer_t* out) {
+	const size_t window = layout->window;
+	const bool cut_rows = window && m->rows > 2 * window;
+	const bool cut_cols = window && m->cols > 2 * window;
+	const size_t head_cols = cut_cols ? window : m->cols;
+	for (size_t r = 0; r < m->rows; ++r) {
+		if (cut_rows && r == window) {
+			text_put_str(out, "...\n");
+			r = m->rows - window;
+		}
+		format_row(m, r, 0, head_cols, layout, false, out);
+		if (cut_cols) {
+			text_put_char(out, layout->separator);
+			text_put_str(out, "...");
+			format_row(m, r, m->cols - window, m->cols, layout, true, out);
+		}
+		if (layout->trailing && m->cols) {
+			text_put_char(out, layout->separator);
+		}
+		text_put_char(out, '\n');
+	}
+	return (cut_rows ? 2 * window : m->rows) * (cut_cols ? 2 * window : m->cols);
+}// end format_rows
+
+/*
+ * PURPOSE: Print the contents of a matrix to the screen through a buffered
+ *      writer, optionally only its corners
+ * INPUTS:
+ *      Matrix to print, m
+ *      Rows and columns to show at each end, window (0 shows everything)
+ * RETURN:
+ *      void
+ **/
+void display_matrix (Matrix_t* m, size_t window) {
+    if( !m || !m->data ){
+        perror("display_matrix: bad input");
+        return;
+    }
+	const uint64_t start = stats_now();
+	printf("\nMatrix Contents (%s):\n", m->name);
+	printf("DIM = (%zu,%zu)\n", m->rows, m->cols);
+	/* the rows bypass stdio, so what printf buffered must go out first */
+	fflush(stdout);
+	Text_writer_t out;
+	if (!text_writer_open(&out, STDOUT_FILENO)) {
+		return;
+	}
+	const Text_layout_t layout = { .separator = ' ', .trailing = true, .window = window };
+	const size_t shown = format_rows(m, &layout, &out);
+	text_put_char(&out, '\n');
+	text_writer_close(&out);
+	stats_record(STAT_DISPLAY_MATRIX, start, m->format == MATRIX_FORMAT_CSR && !window
+		? ((uint64_t)m->rows + 1) * sizeof(uint64_t) + m->nnz * 2 * sizeof(unsigned int)
+		: (uint64_t)shown * matrix_element_size(m->type), 0);
+}// end display_matrix
+
+/*
+ * PURPOSE: Write a matrix as delimited text, one line per row. Rows are
+ *      formatted into a buffer that is written out each time it fills, so
+ *      the text is never held in memory whole. Floats get enough digits to
+ *      read back exactly. The file is replaced only once it is complete.
+ * INPUTS:
+ *      Matrix to write, m
+ *      Destination file, filename
+ *      Separator between elements, separator (',' or '\t')
+ * RETURN:
+ *      If the file cannot be created or a write fails, return false.
  *      Else, return true.
  **/
-bool add_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c) {
-	if ( !a || !b || !c || !a->data || !b->data || !c->data ) {
-        perror("add_matrices: bad input\n");
+bool export_matrix (Matrix_t* m, const char* filename, char separator) {
+	if (!m || !m->data || !filename) {
+		perror("export_matrix: bad input\n");
+		return false;
+	}
+	const uint64_t start = stats_now();
+	char* tmp_filename = NULL;
+	const int fd = create_temp_file(filename, &tmp_filename);
+	if (fd < 0) {
+		return false;
+	}
+	Text_writer_t out;
+	bool ok = text_writer_open(&out, fd);
+	if (ok) {
+		const Text_layout_t layout = { .separator = separator, .exact = true };
+		format_rows(m, &layout, &out);
+		ok = text_writer_close(&out);
+	}
+	const uint64_t written = out.written;
+	ok = finish_temp_file(fd, tmp_filename, filename, ok, false);
+	if (ok) {
+		stats_record(STAT_EXPORT_MATRIX, start, matrix_stored_bytes(m), written);
+	}
+	return ok;
+}// end export_matrix
+
+/* Bytes of text one import task scans or parses at a time */
+#define IMPORT_CHUNK ((size_t)1 << 20)
+
+typedef enum {
+	IMPORT_OK = 0,
+	IMPORT_SHORT,	/* fewer numbers than the first row */
+	IMPORT_LONG,	/* more numbers than the first row */
+	IMPORT_NUMBER,	/* something other than an unsigned number */
+	IMPORT_RANGE	/* a number too large for the element type */
+}Import_error_t;
+
+/* One IMPORT_CHUNK of text. A line belongs to the chunk holding its first byte. */
+typedef struct {
+	uint64_t rows;	/* rows starting in the chunk, then the index of the first of them */
+	size_t error_at;	/* offset of the first malformed line */
+	Import_error_t error;
+}Import_chunk_t;
+
+typedef struct {
+	const char* text;	/* the rows, after any header line */
+	size_t len;
+	Import_chunk_t* chunks;
+	Matrix_t* m;
+	size_t cols;
+	size_t width;
+	uint64_t limit;	/* largest value of the element type */
+}Import_job_t;
+
+static bool is_blank (char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char* skip_blanks (const char* p, const char* end) {
+	while (p < end && is_blank(*p)) {
+		++p;
+	}
+	return p;
+}
+
+/* Numbers are separated by blanks, by a comma or semicolon, or by both */
+static const char* skip_separator (const char* p, const char* end) {
+	p = skip_blanks(p, end);
+	if (p < end && (*p == ',' || *p == ';')) {
+		p = skip_blanks(p + 1, end);
+	}
+	return p;
+}
+
+/* Offset of the first line starting at or after offset */
+static size_t import_line_start (const Import_job_t* job, size_t offset) {
+	if (offset == 0 || job->text[offset - 1] == '\n') {
+		return offset;
+	}
+	return text_find_byte(&job->text[offset], &job->text[job->len], '\n') - job->text + 1;
+}
+
+/* Counts the rows (lines that are not blank) starting in each chunk */
+static void import_count_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Import_job_t* job = arg;
+	const char* text_end = &job->text[job->len];
+	for (size_t c = begin; c < end; ++c) {
+		const size_t stop = job->len - c * IMPORT_CHUNK < IMPORT_CHUNK ? job->len : (c + 1) * IMPORT_CHUNK;
+		uint64_t rows = 0;
+		for (size_t p = import_line_start(job, c * IMPORT_CHUNK); p < stop;) {
+			const char* line_end = text_find_byte(&job->text[p], text_end, '\n');
+			rows += skip_blanks(&job->text[p], line_end) != line_end;
+			p = line_end - job->text + 1;
+		}
+		job->chunks[c].rows = rows;
+	}
+}
+
+/*
+ * PURPOSE: Parse one row of text into the matrix
+ * INPUTS:
+ *      Import job, job
+ *      The row's text, p to line_end
+ *      Row of the matrix it fills, row
+ * RETURN:
+ *      IMPORT_OK, or what is wrong with the line
+ **/
+static Import_error_t import_row (const Import_job_t* job, const char* p, const char* line_end, size_t row) {
+	unsigned char* dst = (unsigned char*)job->m->data + row * job->cols * job->width;
+	p = skip_blanks(p, line_end);
+	for (size_t j = 0; j < job->cols; ++j) {
+		if (j > 0) {
+			p = skip_separator(p, line_end);
+		}
+		uint64_t value;
+		bool overflow;
+		const char* after = text_scan_u64(p, line_end, &value, &overflow);
+		if (after == p) {
+			return p == line_end ? IMPORT_SHORT : IMPORT_NUMBER;
+		}
+		if (overflow || value > job->limit) {
+			return IMPORT_RANGE;
+		}
+		switch (job->width) {
+			case sizeof(uint8_t):
+				dst[j] = value;
+				break;
+			case sizeof(uint16_t):
+				((uint16_t*)dst)[j] = value;
+				break;
+			case sizeof(uint32_t):
+				((uint32_t*)dst)[j] = value;
+				break;
+			default:
+				((uint64_t*)dst)[j] = value;
+				break;
+		}
+		p = after;
+	}
+	/* a trailing separator is allowed */
+	p = skip_separator(p, line_end);
+	if (p == line_end) {
+		return IMPORT_OK;
+	}
+	return (unsigned char)(*p - '0') <= 9 ? IMPORT_LONG : IMPORT_NUMBER;
+}// end import_row
+
+/* Parses the rows starting in each chunk, stopping a chunk at its first bad line */
+static void import_parse_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Import_job_t* job = arg;
+	const char* text_end = &job->text[job->len];
+	for (size_t c = begin; c < end; ++c) {
+		const size_t stop = job->len - c * IMPORT_CHUNK < IMPORT_CHUNK ? job->len : (c + 1) * IMPORT_CHUNK;
+		uint64_t row = job->chunks[c].rows;
+		job->chunks[c].error = IMPORT_OK;
+		for (size_t p = import_line_start(job, c * IMPORT_CHUNK); p < stop;) {
+			const char* line_end = text_find_byte(&job->text[p], text_end, '\n');
+			if (skip_blanks(&job->text[p], line_end) != line_end) {
+				const Import_error_t error = import_row(job, &job->text[p], line_end, row++);
+				if (error != IMPORT_OK) {
+					job->chunks[c].error = error;
+					job->chunks[c].error_at = p;
+					break;
+				}
+			}
+			p = line_end - job->text + 1;
+		}
+	}
+}
+
+/*
+ * PURPOSE: Count the numbers at the start of a line, to size the rows
+ * INPUTS:
+ *      Line, p to line_end
+ * RETURN:
+ *      How many numbers the line starts with
+ **/
+static size_t count_fields (const char* p, const char* line_end) {
+	size_t count = 0;
+	p = skip_blanks(p, line_end);
+	for (;;) {
+		if (count > 0) {
+			p = skip_separator(p, line_end);
+		}
+		uint64_t value;
+		bool overflow;
+		const char* after = text_scan_u64(p, line_end, &value, &overflow);
+		if (after == p) {
+			return count;
+		}
+		++count;
+		p = after;
+	}
+}// end count_fields
+
+/*
+ * PURPOSE: Load a matrix from text, one row per line with the numbers
+ *      separated by commas, semicolons, tabs or spaces (CSV and TSV both
+ *      work). Blank lines are skipped, a first line that does not start
+ *      with a number is taken as a header, and the first row sets the
+ *      number of columns. The file is mapped; a first pass on the pool
+ *      counts the rows in each 1 MiB chunk, and a second parses the chunks
+ *      in parallel straight into the new matrix.
+ * INPUTS:
+ *      Text file to read, filename
+ *      Name of the new matrix, name
+ *      Element type, type (an integer type)
+ *      Destination for the matrix, m
+ * RETURN:
+ *      If the file cannot be read, a line is malformed or a number does not
+ *      fit the type, return false after printing the line number.
+ *      Else, return true.
+ **/
+bool import_matrix (const char* filename, const char* name, Matrix_type_t type, Matrix_t** m) {
+	if (!filename || !name || !m || type >= MATRIX_TYPE_COUNT) {
+		perror("import_matrix: bad input\n");
+		return false;
+	}
+	if (matrix_type_is_real(type)) {
+		printf("import: only integer types can be imported (import u64 and cast it to %s)\n",
+			matrix_type_name(type));
+		return false;
+	}
+	const uint64_t start = stats_now();
+	const int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		printf("FAILED TO OPEN FOR READING\n");
+		report_file_error("open");
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		printf("import: %s is empty or cannot be read\n", filename);
+		close(fd);
+		return false;
+	}
+	const size_t len = st.st_size;
+	char* base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		printf("FAILED TO MAP %s\n", filename);
+		report_file_error("mmap");
+		return false;
+	}
+	madvise(base, len, MADV_WILLNEED);
+
+	/* skip blank lines and a header, then size the rows from the first one */
+	const char* end = &base[len];
+	const char* p = base;
+	const char* line_end = text_find_byte(p, end, '\n');
+	bool header = false;
+	size_t text_offset = 0;
+	size_t cols = 0;
+	while (p < end) {
+		const char* first = skip_blanks(p, line_end);
+		if (first != line_end) {
+			if ((unsigned char)(*first - '0') <= 9 || header) {
+				cols = count_fields(p, line_end);
+				break;
+			}
+			header = true;
+			text_offset = line_end < end ? line_end + 1 - base : len;
+		}
+		p = line_end + 1;
+		line_end = p < end ? text_find_byte(p, end, '\n') : end;
+	}
+	Import_job_t job = { .text = &base[text_offset], .len = len - text_offset, .cols = cols,
+		.width = matrix_element_size(type) };
+	job.limit = job.width == sizeof(uint64_t) ? UINT64_MAX : ((uint64_t)1 << (job.width * 8)) - 1;
+	const size_t num_chunks = (job.len + IMPORT_CHUNK - 1) / IMPORT_CHUNK;
+	job.chunks = malloc((num_chunks ? num_chunks : 1) * sizeof(Import_chunk_t));
+	if (!job.chunks) {
+		perror("import_matrix: allocation error\n");
+		munmap(base, len);
+		return false;
+	}
+
+	pool_parallel_for(num_chunks, 1, import_count_task, &job);
+	uint64_t rows = 0;
+	for (size_t c = 0; c < num_chunks; ++c) {
+		const uint64_t count = job.chunks[c].rows;
+		job.chunks[c].rows = rows;
+		rows += count;
+	}
+	bool ok = cols > 0 && rows > 0;
+	if (!ok) {
+		printf("import: %s holds no rows of numbers\n", filename);
+	}
+	else if (type == MATRIX_TYPE_U32 ? !create_matrix_uninit(m, name, rows, cols)
+		: !create_typed_matrix(m, name, rows, cols, type)) {
+		printf("import: cannot make a (%llu,%zu) matrix\n", (unsigned long long)rows, cols);
+		ok = false;
+	}
+	if (ok) {
+		job.m = *m;
+		pool_parallel_for(num_chunks, 1, import_parse_task, &job);
+		for (size_t c = 0; ok && c < num_chunks; ++c) {
+			if (job.chunks[c].error == IMPORT_OK) {
+				continue;
+			}
+			/* number the line in the whole file, header and blank lines included */
+			size_t line = 1;
+			const char* at = base;
+			const char* bad = &job.text[job.chunks[c].error_at];
+			while ((at = text_find_byte(at, bad, '\n')) < bad) {
+				++line;
+				++at;
+			}
+			const Import_error_t error = job.chunks[c].error;
+			if (error == IMPORT_SHORT || error == IMPORT_LONG) {
+				printf("import: line %zu of %s has %s than %zu numbers\n", line, filename,
+					error == IMPORT_SHORT ? "fewer" : "more", cols);
+			}
+			else if (error == IMPORT_RANGE) {
+				printf("import: line %zu of %s holds a number too large for %s elements\n", line, filename,
+					matrix_type_name(type));
+			}
+			else {
+				printf("import: line %zu of %s holds something other than an unsigned number\n", line, filename);
+			}
+			destroy_matrix(m);
+			ok = false;
+		}
+	}
+	free(job.chunks);
+	munmap(base, len);
+	if (ok) {
+		stats_record(STAT_IMPORT_MATRIX, start, matrix_stored_bytes(*m), len);
+	}
+	return ok;
+}// end import_matrix
+
+/*
+ * PURPOSE: Load a matrix from a file. Files in the current layout are mapped
+ *      privately and the matrix data points straight into the mapping, so
+ *      only pages that get touched are read and writes stay copy-on-write.
+ *      Files in the original layout are read into a heap buffer.
+ * INPUTS:
+ *      File containing the matrix, matrix_input_filename.
+ *      Destrination for loaded matrix, m.
+ * RETURN:
+ *      If there is an error in reading the file, return false.
+ *      Else, return true.
+ **/
+bool read_matrix (const char* matrix_input_filename, Matrix_t** m) {
+    if( !matrix_input_filename || !m ){
+        perror("read_matrix: bad input\n");
+        return false;
+    }
+
+	const uint64_t start = stats_now();
+	int fd = open(matrix_input_filename,O_RDONLY);
+	if (fd < 0) {
+		printf("FAILED TO OPEN FOR READING\n");
+		report_file_error("open");
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		printf("FAILED TO STAT FILE\n");
+		report_file_error("fstat");
+		close(fd);
+		return false;
+	}
+
+	Matrix_file_header_t header;
+	const bool has_header = (size_t)st.st_size >= sizeof(header)
+		&& pread(fd, &header, sizeof(header), 0) == sizeof(header);
+	bool ok;
+	if (has_header && memcmp(header.magic, MATRIX_FILE_MAGIC, sizeof(header.magic)) == 0) {
+		if (header.version < 4) {
+			widen_file_header(&header);
+		}
+		ok = map_matrix_file(fd, st.st_size, &header, m);
+	}
+	else if (has_header && memcmp(header.magic, MATRIX_PACK_MAGIC, sizeof(header.magic)) == 0) {
+		ok = read_packed_matrix(fd, st.st_size, m);
+	}
+	else {
+		ok = read_legacy_matrix(fd, m);
+	}
+
+	if (close(fd) && ok) {
+		destroy_matrix(m);
+		return false;
+	}
+	if (ok) {
+		/* mapped files are charged in full although pages only fault in when touched */
+		stats_record(STAT_READ_MATRIX, start, 0, st.st_size);
+	}
+	return ok;
+}//end read_matrix
+
+/*
+ * PURPOSE: Map a matrix file in the current layout
+ * INPUTS:
+ *      Open descriptor of the file, fd
+ *      Size of the file in bytes, file_len
+ *      Header already read from offset 0, header
+ *      Destination for loaded matrix, m
+ * RETURN:
+ *      If the header is inconsistent or the mapping fails, return false.
+ *      Else, return true.
+ **/
+static bool map_matrix_file (int fd, size_t file_len, const Matrix_file_header_t* header, Matrix_t** m) {
+	if (!check_file_header(header, file_len)) {
+		return false;
+	}
+	const bool sparse = header->format == MATRIX_FORMAT_CSR;
+
+	void* base = mmap(NULL, file_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		printf("FAILED TO MAP MATRIX FILE\n");
+		report_file_error("mmap");
+		return false;
+	}
+
+	if (!allocate_header(m, header->name, header->rows, header->cols)) {
+		munmap(base, file_len);
+		return false;
+	}
+	(*m)->type = header->type;
+	unsigned int* unused = NULL;
+	Matrix_buffer_t* buffer = allocate_buffer(0, false, &unused);
+	if (!buffer) {
+		munmap(base, file_len);
+		block_free(*m, (*m)->block_size);
+		*m = NULL;
+		return false;
+	}
+	buffer->storage = MATRIX_STORAGE_MAPPED;
+	buffer->mapping = base;
+	buffer->mapping_len = file_len;
+	(*m)->buffer = buffer;
+	unsigned char* data = (unsigned char*)base + header->data_offset;
+	if (!sparse) {
+		(*m)->format = header->format;
+		(*m)->data = (unsigned int*)data;
+		return true;
+	}
+
+	const size_t ptr_bytes = ((size_t)header->rows + 1) * sizeof(uint64_t);
+	(*m)->format = MATRIX_FORMAT_CSR;
+	(*m)->nnz = header->nnz;
+	(*m)->capacity = header->nnz;
+	(*m)->row_ptr = (uint64_t*)data;
+	(*m)->col_idx = (unsigned int*)&data[ptr_bytes];
+	(*m)->data = (unsigned int*)&data[ptr_bytes + header->nnz * sizeof(unsigned int)];
+	if (!check_csr(*m)) {
+		printf("CORRUPT SPARSE MATRIX DATA\n");
+		destroy_matrix(m);
+		return false;
+	}
+	return true;
+}// end map_matrix_file
+
+/*
+ * PURPOSE: Check a header in the current layout against the file it came from,
+ *      so nothing sized from it reaches past the end of the file
+ * INPUTS:
+ *      Header, widened if it came from an older file, header
+ *      Size of the file in bytes, file_len
+ * RETURN:
+ *      If the header is inconsistent, return false after printing a message.
+ *      Else, return true.
+ **/
+static bool check_file_header (const Matrix_file_header_t* header, size_t file_len) {
+	if (!dimensions_fit(header->rows, header->cols)) {
+		printf("CORRUPT MATRIX FILE HEADER\n");
+		return false;
+	}
+	const uint32_t format = header->format;
+	const bool sparse = format == MATRIX_FORMAT_CSR;
+	const size_t elements = (size_t)header->rows * header->cols;
+	const size_t stored = format == MATRIX_FORMAT_TILED ? tiled_elements(header->rows, header->cols) : elements;
+	const size_t width = matrix_element_size(header->type);
+	const size_t data_len = sparse
+		? ((size_t)header->rows + 1) * sizeof(uint64_t) + header->nnz * 2 * sizeof(unsigned int)
+		: stored * width;
+	if (header->version < 2 || header->version > MATRIX_FILE_VERSION
+		|| (format != MATRIX_FORMAT_DENSE && format != MATRIX_FORMAT_CSR && format != MATRIX_FORMAT_TILED)
+		|| header->type >= MATRIX_TYPE_COUNT
+		|| (header->type != MATRIX_TYPE_U32 && format != MATRIX_FORMAT_DENSE)
+		|| (!sparse && stored > SIZE_MAX / width)
+		|| (sparse && (header->nnz > elements || header->nnz > file_len / (2 * sizeof(unsigned int))))
+		|| header->name_len == 0 || header->name_len > MATRIX_NAME_LEN
+		|| header->name[header->name_len - 1] != '\0'
+		|| header->data_offset % MATRIX_FILE_DATA_ALIGN != 0
+		|| header->data_offset > file_len || file_len - header->data_offset < data_len) {
+		printf("CORRUPT MATRIX FILE HEADER\n");
+		return false;
+	}
+	return true;
+}// end check_file_header
+
+/*
+ * PURPOSE: Read and check the header of a matrix file in the current
+ *      layout, for callers that work on the file's data in place
+ * INPUTS:
+ *      Open descriptor of the file, fd
+ *      Destination for the name, dimensions, format, type and nnz, shape
+ *      Destination for where the data starts, data_offset
+ * RETURN:
+ *      If the file is packed, in the original layout or malformed, return false.
+ *      Else, return true.
+ **/
+bool probe_matrix_file (int fd, Matrix_t* shape, uint64_t* data_offset) {
+	if (!shape || !data_offset) {
+		perror("probe_matrix_file: bad input\n");
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		printf("FAILED TO STAT FILE\n");
+		report_file_error("fstat");
+		return false;
+	}
+	Matrix_file_header_t header;
+	if ((size_t)st.st_size < sizeof(header) || pread(fd, &header, sizeof(header), 0) != sizeof(header)
+		|| memcmp(header.magic, MATRIX_FILE_MAGIC, sizeof(header.magic)) != 0) {
+		printf("NOT A PLAIN MATRIX FILE (packed and original layout files must be read first)\n");
+		return false;
+	}
+	if (header.version < 4) {
+		widen_file_header(&header);
+	}
+	if (!check_file_header(&header, st.st_size)) {
+		return false;
+	}
+	memset(shape, 0, sizeof(Matrix_t));
+	memcpy(shape->name, header.name, header.name_len);
+	shape->rows = header.rows;
+	shape->cols = header.cols;
+	shape->format = header.format;
+	shape->type = header.type;
+	shape->nnz = header.nnz;
+	*data_offset = header.data_offset;
+	return true;
+}// end probe_matrix_file
+
+/*
+ * PURPOSE: Write the header page of a matrix file in the current layout,
+ *      for callers that write the data themselves
+ * INPUTS:
+ *      Open descriptor of the file, fd
+ *      Name, dimensions, format, type and nnz of the matrix, shape
+ *      Destination for where the data must start, data_offset
+ * RETURN:
+ *      If the write fails, return false.
+ *      Else, return true.
+ **/
+bool write_matrix_header (int fd, const Matrix_t* shape, uint64_t* data_offset) {
+	if (!shape || !data_offset) {
+		perror("write_matrix_header: bad input\n");
+		return false;
+	}
+	unsigned char page[MATRIX_FILE_DATA_ALIGN];
+	Matrix_file_header_t header;
+	init_file_header(&header, shape);
+	memset(page, 0, sizeof(page));
+	memcpy(page, &header, sizeof(header));
+	if (pwrite(fd, page, sizeof(page), 0) != (ssize_t)sizeof(page)) {
+		printf("FAILED TO WRITE MATRIX HEADER\n");
+		report_file_error("pwrite");
+		return false;
+	}
+	*data_offset = header.data_offset;
+	return true;
+}// end write_matrix_header
+
+/*
+ * PURPOSE: Fill in the file header describing a matrix
+ * INPUTS:
+ *      Header to fill, header
+ *      Matrix, or a header carrying only the name, shape, format, type and nnz, m
+ * RETURN:
+ *      void
+ **/
+static void init_file_header (Matrix_file_header_t* header, const Matrix_t* m) {
+	memset(header, 0, sizeof(Matrix_file_header_t));
+	memcpy(header->magic, MATRIX_FILE_MAGIC, sizeof(header->magic));
+	header->version = MATRIX_FILE_VERSION;
+	header->name_len = strlen(m->name) + 1;
+	header->rows = m->rows;
+	header->cols = m->cols;
+	header->data_offset = MATRIX_FILE_DATA_ALIGN;
+	memcpy(header->name, m->name, header->name_len);
+	header->format = m->format;
+	header->nnz = m->nnz;
+	header->type = m->type;
+}// end init_file_header
+
+/*
+ * PURPOSE: Turn a version 2 or 3 header, read over the start of a current
+ *      one, into the current layout in place
+ * INPUTS:
+ *      Header as read from the file, header
+ * RETURN:
+ *      void
+ **/
+static void widen_file_header (Matrix_file_header_t* header) {
+	Matrix_file_header_v3_t old;
+	memcpy(&old, header, sizeof(old));
+	header->rows = old.rows;
+	header->cols = old.cols;
+	header->data_offset = old.data_offset;
+	/* version 2 headers end before format and nnz, which read as zero from the padded header page */
+	header->nnz = old.version >= 3 ? old.nnz : 0;
+	header->format = old.version >= 3 ? old.format : MATRIX_FORMAT_DENSE;
+	memcpy(header->name, old.name, sizeof(header->name));
+	header->type = MATRIX_TYPE_U32;
+}// end widen_file_header
+
+/*
+ * PURPOSE: Check that CSR arrays from a file are well formed, so no later
+ *      operation indexes outside the matrix
+ * INPUTS:
+ *      CSR matrix pointing into the file mapping, m
+ * RETURN:
+ *      If the offsets, columns or values break the CSR rules, return false.
+ *      Else, return true.
+ **/
+static bool check_csr (const Matrix_t* m) {
+	if (m->row_ptr[0] != 0 || m->row_ptr[m->rows] != m->nnz) {
+		return false;
+	}
+	for (size_t r = 0; r < m->rows; ++r) {
+		const uint64_t begin = m->row_ptr[r];
+		const uint64_t end = m->row_ptr[r + 1];
+		if (end < begin || end > m->nnz) {
+			return false;
+		}
+		for (uint64_t k = begin; k < end; ++k) {
+			if (m->col_idx[k] >= m->cols || (k > begin && m->col_idx[k] <= m->col_idx[k - 1]) || !m->data[k]) {
+				return false;
+			}
+		}
+	}
+	return true;
+}// end check_csr
+
+/*
+ * PURPOSE: Read a matrix file in the original name_len, name, rows, cols, data layout
+ * INPUTS:
+ *      Open descriptor positioned at the start of the file, fd
+ *      Destination for loaded matrix, m
+ * RETURN:
+ *      If the file is short or malformed, return false.
+ *      Else, return true.
+ **/
+static bool read_legacy_matrix (int fd, Matrix_t** m) {
+	unsigned int name_len = 0;
+	unsigned int rows = 0;
+	unsigned int cols = 0;
+	char name_buffer[MATRIX_NAME_LEN];
+
+	if (!read_full(fd, &name_len, sizeof(unsigned int))) {
+		printf("FAILED TO READING FILE\n");
+		return false;
+	}
+	if (name_len == 0 || name_len > MATRIX_NAME_LEN) {
+		printf("BAD MATRIX NAME LENGTH %u\n", name_len);
+		return false;
+	}
+	if (!read_full(fd, name_buffer, name_len)) {
+		printf("FAILED TO READ MATRIX NAME\n");
+		return false;
+	}
+	name_buffer[name_len - 1] = '\0';
+	if (!read_full(fd, &rows, sizeof(unsigned int)) || !read_full(fd, &cols, sizeof(unsigned int))) {
+		printf("FAILED TO READ MATRIX DIMENSIONS\n");
+		return false;
+	}
+
+	if (!create_matrix_uninit(m,name_buffer,rows,cols)) {
+		return false;
+	}
+	if (!read_full(fd, (*m)->data, (size_t)rows * cols * sizeof(unsigned int))) {
+		printf("FAILED TO READ MATRIX DATA\n");
+		destroy_matrix(m);
+		return false;
+	}
+	return true;
+}// end read_legacy_matrix
+
+/*
+ * PURPOSE: Read a file written by write_matrix_packed. The file is mapped
+ *      read-only, the directory is checked against the payload size, and the
+ *      blocks are decoded on the pool into a fresh buffer.
+ * INPUTS:
+ *      Open descriptor of the file, fd
+ *      Size of the file in bytes, file_len
+ *      Destination for loaded matrix, m
+ * RETURN:
+ *      If the file is malformed or memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool read_packed_matrix (int fd, size_t file_len, Matrix_t** m) {
+	Matrix_pack_header_t header;
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+		printf("FAILED TO READING FILE\n");
+		return false;
+	}
+	if (header.version == 1) {
+		widen_pack_header(&header);
+	}
+	if (!dimensions_fit(header.rows, header.cols)) {
+		printf("CORRUPT MATRIX FILE HEADER\n");
+		return false;
+	}
+	const size_t elements = header.format == MATRIX_FORMAT_TILED ? tiled_elements(header.rows, header.cols)
+		: (size_t)header.rows * header.cols;
+	const size_t blocks = (elements + KERNEL_PACK_BLOCK - 1) / KERNEL_PACK_BLOCK;
+	if (header.version != MATRIX_PACK_VERSION || header.block_len != KERNEL_PACK_BLOCK
+		|| (header.format != MATRIX_FORMAT_DENSE && header.format != MATRIX_FORMAT_TILED)
+		|| header.elements != elements || header.blocks != blocks
+		|| header.name_len == 0 || header.name_len > MATRIX_NAME_LEN
+		|| header.name[header.name_len - 1] != '\0'
+		|| header.directory_offset < sizeof(header) || header.directory_offset % sizeof(uint64_t) != 0
+		|| header.directory_offset > file_len
+		|| blocks > (file_len - header.directory_offset) / sizeof(Pack_block_t)
+		|| header.payload_offset < header.directory_offset + blocks * sizeof(Pack_block_t)
+		|| header.payload_offset % MATRIX_PACK_ALIGN != 0 || header.payload_offset > file_len
+		|| header.payload_bytes > file_len - header.payload_offset) {
+		printf("CORRUPT MATRIX FILE HEADER\n");
 		return false;
 	}
 
-	for (int i = 0; i < a->rows; ++i) {
-		for (int j = 0; j < b->cols; ++j) {
-			c->data[i * a->cols +j] = a->data[i * a->cols + j] + b->data[i * a->cols + j];
+	void* base = mmap(NULL, file_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		printf("FAILED TO MAP MATRIX FILE\n");
+		report_file_error("mmap");
+		return false;
+	}
+	madvise(base, file_len, MADV_WILLNEED);
+	const Pack_block_t* directory = (const Pack_block_t*)((unsigned char*)base + header.directory_offset);
+	uint64_t* offsets = malloc((blocks + 1) * sizeof(uint64_t));
+	bool ok = offsets != NULL;
+	if (ok) {
+		offsets[0] = 0;
+		for (size_t b = 0; ok && b < blocks; ++b) {
+			ok = directory[b].bits <= 32 && directory[b].delta <= 1;
+			offsets[b + 1] = offsets[b] + (uint64_t)directory[b].bits * (KERNEL_PACK_BLOCK / 8);
+		}
+		if (!ok || offsets[blocks] != header.payload_bytes) {
+			printf("CORRUPT PACKED MATRIX DATA\n");
+			ok = false;
 		}
 	}
-	return true;
-}// end add_matrices
+
+	if (ok && allocate_header(m, header.name, header.rows, header.cols)) {
+		if (fresh_contents(*m, header.format, false)) {
+			Pack_job_t job = { .dst = (*m)->data, .elements = elements, .directory = (Pack_block_t*)directory,
+				.offsets = offsets, .packed = (const unsigned char*)base + header.payload_offset };
+			pool_parallel_for(blocks, POOL_MIN_GRAIN / KERNEL_PACK_BLOCK, unpack_task, &job);
+		}
+		else {
+			block_free(*m, (*m)->block_size);
+			*m = NULL;
+			ok = false;
+		}
+	}
+	else {
+		ok = false;
+	}
+	free(offsets);
+	munmap(base, file_len);
+	return ok;
+}// end read_packed_matrix
 
 /*
- * PURPOSE: Print the contents of a matrix to the screen
+ * PURPOSE: Turn a version 1 packed header, read over the start of a current
+ *      one, into the current layout in place
  * INPUTS:
- *      Matrix to print, m
+ *      Header as read from the file, header
  * RETURN:
  *      void
  **/
-void display_matrix (Matrix_t* m) {
-    if( !m || !m->data ){
-        perror("display_matrix: bad input");
-        return;
-    }
-	printf("\nMatrix Contents (%s):\n", m->name);
-	printf("DIM = (%u,%u)\n", m->rows, m->cols);
-	for (int i = 0; i < m->rows; ++i) {
-		for (int j = 0; j < m->cols; ++j) {
-			printf("%u ", m->data[i * m->cols + j]);
+static void widen_pack_header (Matrix_pack_header_t* header) {
+	Matrix_pack_header_v1_t old;
+	memcpy(&old, header, sizeof(old));
+	header->version = MATRIX_PACK_VERSION;
+	header->rows = old.rows;
+	header->cols = old.cols;
+	header->format = old.format;
+	header->block_len = old.block_len;
+	header->elements = old.elements;
+	header->blocks = old.blocks;
+	header->directory_offset = old.directory_offset;
+	header->payload_offset = old.payload_offset;
+	header->payload_bytes = old.payload_bytes;
+	memcpy(header->name, old.name, sizeof(header->name));
+}// end widen_pack_header
+
+/*
+ * PURPOSE: Count the bytes a matrix's data takes on disk and in a workspace:
+ *      the stored elements, or for CSR the row offsets, columns and values
+ * INPUTS:
+ *      Matrix, or a header carrying only the shape, format, type and nnz, m
+ * RETURN:
+ *      The byte count, or SIZE_MAX when it does not fit in a size_t
+ **/
+size_t matrix_stored_bytes (const Matrix_t* m) {
+	if (!dimensions_fit(m->rows, m->cols)) {
+		return SIZE_MAX;
+	}
+	if (m->format == MATRIX_FORMAT_CSR) {
+		if (m->nnz > (SIZE_MAX / 2 - ((size_t)m->rows + 1) * sizeof(uint64_t)) / (2 * sizeof(unsigned int))) {
+			return SIZE_MAX;
 		}
-		printf("\n");
+		return ((size_t)m->rows + 1) * sizeof(uint64_t) + m->nnz * 2 * sizeof(unsigned int);
 	}
-	printf("\n");
-}// end display_matrix
+	const size_t n = stored_elements(m);
+	const size_t width = matrix_element_size(m->type);
+	return n > SIZE_MAX / width ? SIZE_MAX : n * width;
+}// end matrix_stored_bytes
 
 /*
- * PURPOSE: Load a matrix from a file
+ * PURPOSE: Make a matrix whose data is a read-only mapping of a file region in
+ *      the layout write_matrix_region uses. Pages fault in when touched, and
+ *      unshare_matrix copies the data before anything writes to it.
  * INPUTS:
- *      File containing the matrix, matrix_input_filename.
- *      Destrination for loaded matrix, m.
+ *      Destination for the matrix, m
+ *      Name, dimensions, format, type and nnz of the matrix, shape
+ *      Open file descriptor, fd
+ *      Page-aligned start of the region, offset
  * RETURN:
- *      If there is an error in reading the file, return false.
+ *      If the shape is invalid, the mapping fails or memory is exhausted, return false.
  *      Else, return true.
  **/
-bool read_matrix (const char* matrix_input_filename, Matrix_t** m) {
-    if( !matrix_input_filename || !m ){
-        perror("read_matrix: bad input\n");
-        return false;
-    }
-
-	int fd = open(matrix_input_filename,O_RDONLY);
-	if (fd < 0) {
-		printf("FAILED TO OPEN FOR READING\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
+bool map_matrix_region (Matrix_t** m, const Matrix_t* shape, int fd, uint64_t offset) {
+	if (!m || !shape || fd < 0 || (shape->format != MATRIX_FORMAT_DENSE && shape->format != MATRIX_FORMAT_CSR
+		&& shape->format != MATRIX_FORMAT_TILED)
+		|| (shape->format == MATRIX_FORMAT_CSR && shape->nnz > (size_t)shape->rows * shape->cols)
+		|| shape->type >= MATRIX_TYPE_COUNT
+		|| (shape->type != MATRIX_TYPE_U32 && shape->format != MATRIX_FORMAT_DENSE)) {
+		perror("map_matrix_region: bad input\n");
 		return false;
 	}
-
-	/*read the wrote dimensions and name length*/
-	unsigned int name_len = 0;
-	unsigned int rows = 0;
-	unsigned int cols = 0;
-	
-	if (read(fd,&name_len,sizeof(unsigned int)) != sizeof(unsigned int)) {
-		printf("FAILED TO READING FILE\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
+	const size_t bytes = matrix_stored_bytes(shape);
+	if (bytes == SIZE_MAX || bytes > SIZE_MAX - MATRIX_DATA_OFFSET) {
 		return false;
 	}
-	char name_buffer[50];
-	if (read (fd,name_buffer,sizeof(char) * name_len) != sizeof(char) * name_len) {		// segfaults around here...
-		printf("FAILED TO READ MATRIX NAME\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
+	if (!allocate_header(m, shape->name, shape->rows, shape->cols)) {
+		return false;
+	}
+	(*m)->type = shape->type;
+	if (bytes == 0) {
+		if (!fresh_contents(*m, shape->format, false)) {
+			block_free(*m, (*m)->block_size);
+			*m = NULL;
+			return false;
 		}
-
-		return false;	
+		return true;
 	}
 
-	if (read (fd,&rows, sizeof(unsigned int)) != sizeof(unsigned int)) {
-		printf("FAILED TO READ MATRIX ROW SIZE\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
+	void* base = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, offset);
+	unsigned int* unused = NULL;
+	Matrix_buffer_t* buffer = base == MAP_FAILED ? NULL : allocate_buffer(0, false, &unused);
+	if (!buffer) {
+		if (base == MAP_FAILED) {
+			printf("FAILED TO MAP MATRIX %s\n", shape->name);
+			report_file_error("mmap");
 		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
+		else {
+			munmap(base, bytes);
 		}
-
+		block_free(*m, (*m)->block_size);
+		*m = NULL;
 		return false;
 	}
+	buffer->storage = MATRIX_STORAGE_WORKSPACE;
+	buffer->mapping = base;
+	buffer->mapping_len = bytes;
+	buffer->file_offset = offset;
+	(*m)->buffer = buffer;
+	(*m)->format = shape->format;
+	if (shape->format != MATRIX_FORMAT_CSR) {
+		(*m)->data = base;
+		return true;
+	}
+	const size_t ptr_bytes = ((size_t)shape->rows + 1) * sizeof(uint64_t);
+	unsigned char* bytes_at = base;
+	(*m)->nnz = shape->nnz;
+	(*m)->capacity = shape->nnz;
+	(*m)->row_ptr = base;
+	(*m)->col_idx = (unsigned int*)&bytes_at[ptr_bytes];
+	(*m)->data = (unsigned int*)&bytes_at[ptr_bytes + shape->nnz * sizeof(unsigned int)];
+	return true;
+}// end map_matrix_region
 
-	if (read(fd,&cols,sizeof(unsigned int)) != sizeof(unsigned int)) {
-		printf("FAILED TO READ MATRIX COLUMN SIZE\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
-
+/*
+ * PURPOSE: Write a matrix's data at a file offset, laid out for map_matrix_region
+ * INPUTS:
+ *      Open file descriptor, fd (its file position moves)
+ *      Where the data goes, offset
+ *      Matrix to write, m
+ * RETURN:
+ *      If a write fails, return false.
+ *      Else, return true.
+ **/
+bool write_matrix_region (int fd, uint64_t offset, const Matrix_t* m) {
+	if (fd < 0 || !m || !m->data) {
+		perror("write_matrix_region: bad input\n");
 		return false;
 	}
-
-	unsigned int numberOfDataBytes = rows * cols * sizeof(unsigned int);
-	unsigned int *data = calloc(rows * cols, sizeof(unsigned int));
-	if (read(fd,data,numberOfDataBytes) != numberOfDataBytes) {
-		printf("FAILED TO READ MATRIX DATA\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
-		}
-
-		return false;	
+	const uint64_t start = stats_now();
+	const size_t bytes = matrix_stored_bytes(m);
+	struct iovec iov[3] = { { .iov_base = m->data, .iov_len = bytes } };
+	int iovcnt = 1;
+	if (m->format == MATRIX_FORMAT_CSR) {
+		iov[0] = (struct iovec){ .iov_base = m->row_ptr, .iov_len = ((size_t)m->rows + 1) * sizeof(uint64_t) };
+		iov[1] = (struct iovec){ .iov_base = m->col_idx, .iov_len = m->nnz * sizeof(unsigned int) };
+		iov[2] = (struct iovec){ .iov_base = m->data, .iov_len = m->nnz * sizeof(unsigned int) };
+		iovcnt = 3;
 	}
-
-	if (!create_matrix(m,name_buffer,rows,cols)) {
+	if (lseek(fd, offset, SEEK_SET) < 0) {
+		report_file_error("lseek");
 		return false;
 	}
+	if (!write_full_vec(fd, iov, iovcnt)) {
+		return false;
+	}
+	stats_record(STAT_WRITE_MATRIX, start, 0, bytes);
+	return true;
+}// end write_matrix_region
 
-	load_matrix(*m,data);
-
-    if( !m ){
-            return false;
-    }
-        
-	free(data);
-
-	if (close(fd)) {
+/*
+ * PURPOSE: Switch a matrix over to a mapping of the region its data was
+ *      written to, releasing its reference to the old buffer
+ * INPUTS:
+ *      Matrix to switch, m (the data at offset must match it)
+ *      Open file descriptor, fd
+ *      Where the data starts, offset
+ * RETURN:
+ *      If the region cannot be mapped, return false with m unchanged.
+ *      Else, return true.
+ **/
+bool remap_matrix_region (Matrix_t* m, int fd, uint64_t offset) {
+	if (!m || fd < 0) {
+		perror("remap_matrix_region: bad input\n");
+		return false;
+	}
+	Matrix_t* mapped = NULL;
+	if (!map_matrix_region(&mapped, m, fd, offset)) {
 		return false;
+	}
+	release_buffer(m->buffer);
+	adopt_contents(m, mapped);
+	destroy_matrix(&mapped);
+	return true;
+}// end remap_matrix_region
 
+/*
+ * PURPOSE: Tell whether a matrix still holds the workspace region it was mapped from
+ * INPUTS:
+ *      Matrix, m
+ *      Destination for the region's file offset, offset
+ * RETURN:
+ *      If the data is an untouched workspace mapping, return true.
+ *      Else, return false.
+ **/
+bool matrix_region (const Matrix_t* m, uint64_t* offset) {
+	if (!m || !m->buffer || !offset || m->buffer->storage != MATRIX_STORAGE_WORKSPACE) {
+		return false;
 	}
+	*offset = m->buffer->file_offset;
 	return true;
-}//end read_matrix
+}// end matrix_region
 
 /*
  * PURPOSE: Write a matrix to a file
@@ -358,82 +3981,218 @@ bool read_matrix (const char* matrix_input_filename, Matrix_t** m) {
  *      Else, return true.
  **/
 bool write_matrix (const char* matrix_output_filename, Matrix_t* m) {
-    if(!matrix_output_filename || !m || !m->name || !m->rows || !m->cols){
+	return write_matrix_with_policy(matrix_output_filename, m, WRITE_POLICY_BUFFERED);
+}//end write_matrix
+
+/*
+ * PURPOSE: Write a matrix to a file, streaming the header page and the data
+ *      straight from their own memory with no staging copy. CSR matrices are
+ *      written as their arrays and tiled matrices as their tiles.
+ * INPUTS:
+ *      Destination file for the matrix, matrix_output_filename
+ *      Matrix to write from, m
+ *      Durability policy, policy:
+ *          WRITE_POLICY_BUFFERED  leave the data in the page cache
+ *          WRITE_POLICY_SYNC      fdatasync before the file is renamed into place
+ *          WRITE_POLICY_DIRECT    bypass the page cache for the page-aligned part
+ *                                 of the data (when the buffer allows), then fdatasync
+ * RETURN:
+ *      If there is an error in writing to the file, return false.
+ *      Else, return true.
+ **/
+bool write_matrix_with_policy (const char* matrix_output_filename, Matrix_t* m, Write_policy_t policy) {
+    if(!matrix_output_filename || !m || !m->data || !m->rows || !m->cols){
 	    perror("write_matrix: bad input\n");
         return false;
     }
 
-	int fd = open (matrix_output_filename, O_CREAT | O_RDWR | O_TRUNC, 0644);
-	/* ERROR HANDLING USING errorno*/
+	const uint64_t start = stats_now();
+
+	/* The header page is the only staging memory; it is page aligned so it can go out with O_DIRECT */
+	unsigned char* header_page = NULL;
+	if (posix_memalign((void**)&header_page, MATRIX_FILE_DATA_ALIGN, MATRIX_FILE_DATA_ALIGN) != 0) {
+		perror("write_matrix: allocation error\n");
+		return false;
+	}
+	memset(header_page, 0, MATRIX_FILE_DATA_ALIGN);
+
+	Matrix_file_header_t header;
+	init_file_header(&header, m);
+	memcpy(header_page, &header, sizeof(header));
+
+	char* tmp_filename = NULL;
+	const int fd = create_temp_file(matrix_output_filename, &tmp_filename);
 	if (fd < 0) {
-		printf("FAILED TO CREATE/OPEN FILE FOR WRITING\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
-		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXISTS\n");
-		}
+		free(header_page);
 		return false;
 	}
-	/* Calculate the needed buffer for our matrix */
-	unsigned int name_len = strlen(m->name) + 1;
-	unsigned int numberOfBytes = sizeof(unsigned int) + (sizeof(unsigned int)  * 2) + name_len + sizeof(unsigned int) * m->rows * m->cols + 1;
-	/* Allocate the output_buffer in bytes
-	 * IMPORTANT TO UNDERSTAND THIS WAY OF MOVING MEMORY
-	 * --------------------------------------------------
-	 * Here we create an output buffer big enough to hold all out-going memory (+ EOF)
-	 */
-	unsigned char* output_buffer = calloc(numberOfBytes,sizeof(unsigned char));
-	unsigned int offset = 0;
+
+	const bool sparse = m->format == MATRIX_FORMAT_CSR;
+	const size_t ptr_bytes = sparse ? ((size_t)m->rows + 1) * sizeof(uint64_t) : 0;
+	const size_t data_bytes = sparse ? ptr_bytes + m->nnz * 2 * sizeof(unsigned int)
+		: stored_elements(m) * matrix_element_size(m->type);
+	unsigned char* data = (unsigned char*)m->data;
+
 	/*
-	 * start copying data from the matrix into the output buffer
-	 * increment the offset with each copy to prevent unwanted overwriting
+	 * With O_DIRECT every buffer and length must be block aligned. Send the
+	 * header page and the aligned prefix of the data direct, then drop the
+	 * flag for whatever tail is left.
 	 */
-	memcpy(&output_buffer[offset], &name_len, sizeof(unsigned int)); // IMPORTANT C FUNCTION TO KNOW
-	offset += sizeof(unsigned int);	
-	memcpy(&output_buffer[offset], m->name,name_len);
-	offset += name_len;
-	memcpy(&output_buffer[offset],&m->rows,sizeof(unsigned int));
-	offset += sizeof(unsigned int);
-	memcpy(&output_buffer[offset],&m->cols,sizeof(unsigned int));
-	offset += sizeof(unsigned int);
-	memcpy (&output_buffer[offset],m->data,m->rows * m->cols * sizeof(unsigned int));
-	offset += (m->rows * m->cols * sizeof(unsigned int));
-	output_buffer[numberOfBytes - 1] = EOF;
-
-	if (write(fd,output_buffer,numberOfBytes) != numberOfBytes) {
-		printf("FAILED TO WRITE MATRIX TO FILE\n");
-		if (errno == EACCES ) {
-			perror("DO NOT HAVE ACCESS TO FILE\n");
-		}
-		else if (errno == EADDRINUSE ){
-			perror("FILE ALREADY IN USE\n");
+	size_t direct_bytes = 0;
+	if (policy == WRITE_POLICY_DIRECT && !sparse && (uintptr_t)data % MATRIX_FILE_DATA_ALIGN == 0) {
+		const int flags = fcntl(fd, F_GETFL);
+		if (flags >= 0 && fcntl(fd, F_SETFL, flags | O_DIRECT) == 0) {
+			direct_bytes = data_bytes - data_bytes % MATRIX_FILE_DATA_ALIGN;
 		}
-		else if (errno == EBADF) {
-			perror("BAD FILE DESCRIPTOR\n");	
-		}
-		else if (errno == EEXIST) {
-			perror("FILE EXIST\n");
+	}
+
+	bool ok = true;
+	struct iovec iov[4] = {
+		{ .iov_base = header_page, .iov_len = MATRIX_FILE_DATA_ALIGN },
+		{ .iov_base = data, .iov_len = direct_bytes ? direct_bytes : data_bytes },
+	};
+	int iovcnt = 2;
+	if (sparse) {
+		iov[1] = (struct iovec){ .iov_base = m->row_ptr, .iov_len = ptr_bytes };
+		iov[2] = (struct iovec){ .iov_base = m->col_idx, .iov_len = m->nnz * sizeof(unsigned int) };
+		iov[3] = (struct iovec){ .iov_base = m->data, .iov_len = m->nnz * sizeof(unsigned int) };
+		iovcnt = 4;
+	}
+	if (!write_full_vec(fd, iov, iovcnt)) {
+		ok = false;
+	}
+	if (ok && direct_bytes && direct_bytes < data_bytes) {
+		const int flags = fcntl(fd, F_GETFL);
+		struct iovec tail = { .iov_base = &data[direct_bytes], .iov_len = data_bytes - direct_bytes };
+		if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_DIRECT) != 0 || !write_full_vec(fd, &tail, 1)) {
+			ok = false;
 		}
+	}
+	if (!ok) {
+		printf("FAILED TO WRITE MATRIX TO FILE\n");
+	}
+	free(header_page);
+	ok = finish_temp_file(fd, tmp_filename, matrix_output_filename, ok, policy != WRITE_POLICY_BUFFERED);
+	if (ok) {
+		stats_record(STAT_WRITE_MATRIX, start, 0, MATRIX_FILE_DATA_ALIGN + data_bytes);
+	}
+	return ok;
+}//end write_matrix_with_policy
+
+/*
+ * PURPOSE: Write a matrix compressed: each block of KERNEL_PACK_BLOCK elements
+ *      is stored as offsets from its minimum in as few bits as the block
+ *      needs. Blocks are planned and packed on the pool and streamed to the
+ *      file a chunk at a time, so only one chunk of payload is staged.
+ *      CSR matrices already store only their non-zeros, and the packer
+ *      works on u32 elements, so both CSR and other element types are
+ *      written in the plain layout.
+ * INPUTS:
+ *      Destination file for the matrix, matrix_output_filename
+ *      Matrix to write from, m
+ *      Durability policy, policy (direct writes are synced but go through
+ *          the page cache, since the payload is staged anyway)
+ *      Compression, mode:
+ *          PACK_MODE_FOR    per-block minimum plus bit-packed offsets
+ *          PACK_MODE_DELTA  per block, the narrower of offsets and zigzag deltas
+ * RETURN:
+ *      If there is an error in writing to the file, return false.
+ *      Else, return true.
+ **/
+bool write_matrix_packed (const char* matrix_output_filename, Matrix_t* m, Write_policy_t policy, Pack_mode_t mode) {
+	if (!matrix_output_filename || !m || !m->data || !m->rows || !m->cols) {
+		perror("write_matrix_packed: bad input\n");
 		return false;
 	}
-	
-	if (close(fd)) {
+	if (m->format == MATRIX_FORMAT_CSR || m->type != MATRIX_TYPE_U32) {
+		return write_matrix_with_policy(matrix_output_filename, m, policy);
+	}
+
+	const uint64_t start = stats_now();
+	const size_t elements = stored_elements(m);
+	const size_t blocks = (elements + KERNEL_PACK_BLOCK - 1) / KERNEL_PACK_BLOCK;
+	const size_t chunk_bytes = (blocks < PACK_CHUNK_BLOCKS ? blocks : PACK_CHUNK_BLOCKS) * KERNEL_PACK_BLOCK
+		* sizeof(unsigned int);
+	Pack_block_t* directory = malloc(blocks * sizeof(Pack_block_t));
+	uint64_t* offsets = malloc((blocks + 1) * sizeof(uint64_t));
+	unsigned char* header_page = calloc(1, MATRIX_FILE_DATA_ALIGN);
+	unsigned char* payload = NULL;
+	if (!directory || !offsets || !header_page
+		|| posix_memalign((void**)&payload, MATRIX_PACK_ALIGN, chunk_bytes) != 0) {
+		perror("write_matrix_packed: allocation error\n");
+		free(directory);
+		free(offsets);
+		free(header_page);
 		return false;
 	}
-	free(output_buffer);
 
-	return true;
-}//end write_matrix
+	Pack_job_t job = { .src = m->data, .elements = elements, .directory = directory,
+		.offsets = offsets, .payload = payload, .mode = mode };
+	pool_parallel_for(blocks, POOL_MIN_GRAIN / KERNEL_PACK_BLOCK, plan_pack_task, &job);
+	offsets[0] = 0;
+	for (size_t b = 0; b < blocks; ++b) {
+		offsets[b + 1] = offsets[b] + (uint64_t)directory[b].bits * (KERNEL_PACK_BLOCK / 8);
+	}
+
+	Matrix_pack_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MATRIX_PACK_MAGIC, sizeof(header.magic));
+	header.version = MATRIX_PACK_VERSION;
+	header.name_len = strlen(m->name) + 1;
+	header.rows = m->rows;
+	header.cols = m->cols;
+	header.format = m->format;
+	header.block_len = KERNEL_PACK_BLOCK;
+	header.elements = elements;
+	header.blocks = blocks;
+	header.directory_offset = MATRIX_FILE_DATA_ALIGN;
+	header.payload_offset = (header.directory_offset + blocks * sizeof(Pack_block_t) + MATRIX_PACK_ALIGN - 1)
+		/ MATRIX_PACK_ALIGN * MATRIX_PACK_ALIGN;
+	header.payload_bytes = offsets[blocks];
+	memcpy(header.name, m->name, header.name_len);
+	memcpy(header_page, &header, sizeof(header));
+
+	char* tmp_filename = NULL;
+	const int fd = create_temp_file(matrix_output_filename, &tmp_filename);
+	bool ok = fd >= 0;
+	if (ok) {
+		static const unsigned char padding[MATRIX_PACK_ALIGN];
+		struct iovec iov[3] = {
+			{ .iov_base = header_page, .iov_len = MATRIX_FILE_DATA_ALIGN },
+			{ .iov_base = directory, .iov_len = blocks * sizeof(Pack_block_t) },
+			{ .iov_base = (void*)padding,
+				.iov_len = header.payload_offset - header.directory_offset - blocks * sizeof(Pack_block_t) },
+		};
+		ok = write_full_vec(fd, iov, 3);
+	}
+	for (size_t first = 0; ok && first < blocks; first += PACK_CHUNK_BLOCKS) {
+		const size_t count = blocks - first < PACK_CHUNK_BLOCKS ? blocks - first : PACK_CHUNK_BLOCKS;
+		job.first = first;
+		pool_parallel_for(count, POOL_MIN_GRAIN / KERNEL_PACK_BLOCK, pack_task, &job);
+		struct iovec chunk = { .iov_base = payload, .iov_len = offsets[first + count] - offsets[first] };
+		ok = write_full_vec(fd, &chunk, 1);
+	}
+	if (fd >= 0 && !ok) {
+		printf("FAILED TO WRITE MATRIX TO FILE\n");
+	}
+	if (fd >= 0) {
+		ok = finish_temp_file(fd, tmp_filename, matrix_output_filename, ok, policy != WRITE_POLICY_BUFFERED);
+	}
+	free(payload);
+	free(header_page);
+	free(offsets);
+	free(directory);
+	if (ok) {
+		stats_record(STAT_WRITE_MATRIX, start, elements * sizeof(unsigned int),
+			header.payload_offset + header.payload_bytes);
+	}
+	return ok;
+}//end write_matrix_packed
 
 /*
- * PURPOSE: Allocates a matrix with random numbers
+ * PURPOSE: Allocates a matrix with random numbers. Integer elements are drawn
+ *      from [start_range, end_range], and the range must fit the type; float
+ *      elements are drawn uniformly from [start_range, end_range).
  * INPUTS:
  *      Matrix to populate, m
  *      Start range of matrix, start_range
@@ -447,56 +4206,263 @@ bool random_matrix(Matrix_t* m, unsigned int start_range, unsigned int end_range
         perror("random_matrix: bad input\n");
         return false;
     }
-
-	for (unsigned int i = 0; i < m->rows; ++i) {
-		for (unsigned int j = 0; j < m->cols; ++j) {
-			m->data[i * m->cols + j] = rand() % (end_range + 1 - start_range) + start_range;
-		}
+	if (m->type != MATRIX_TYPE_U32) {
+		return random_typed(m, start_range, end_range);
+	}
+	if (!prepare_output(m, MATRIX_FORMAT_DENSE, false)) {
+		return false;
 	}
+
+	const uint64_t start = stats_now();
+	const size_t n = (size_t)m->rows * m->cols;
+	/* a span of 0 means the full 32-bit range */
+	Element_job_t job = { .dst = m->data, .start_range = start_range,
+		.span = end_range + 1 - start_range, .n = n };
+	job.seed = next_random_key();
+	Kernel_stats_t partials[POOL_MAX_CHUNKS];
+	job.stats = partials;
+	const size_t blocks = (n + MATRIX_RANDOM_BLOCK - 1) / MATRIX_RANDOM_BLOCK;
+	pool_parallel_for(blocks, POOL_MIN_GRAIN / MATRIX_RANDOM_BLOCK, random_task, &job);
+	keep_aggregates(m, partials, pool_chunk_count(blocks, POOL_MIN_GRAIN / MATRIX_RANDOM_BLOCK));
+	stats_record(STAT_RANDOM_MATRIX, start, n * sizeof(unsigned int), 0);
 	return true;
 }//end random_matrix
 
-/*Protected Functions in C*/
-
 /*
- * PURPOSE: Translate the unsigned int into a Matrix
+ * PURPOSE: Fill a dense matrix of any type other than u32 with random
+ *      numbers, block by block from the same streams random_matrix uses
  * INPUTS:
  *      Matrix to populate, m
- *      Data to read from, data
+ *      Range of the values, start_range and end_range (start_range <= end_range)
+ * RETURN:
+ *      If the range does not fit the type or memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool random_typed (Matrix_t* m, unsigned int start_range, unsigned int end_range) {
+	const size_t width = matrix_element_size(m->type);
+	const bool real = matrix_type_is_real(m->type);
+	if (!real && width < sizeof(unsigned int) && end_range >> (width * 8)) {
+		printf("random_matrix: %u does not fit in %s elements\n", end_range, matrix_type_name(m->type));
+		return false;
+	}
+	if (!unshare_matrix(m, false)) {
+		return false;
+	}
+
+	const uint64_t start = stats_now();
+	const size_t n = (size_t)m->rows * m->cols;
+	/* integers draw from the closed range (a span of 0 means the full 32-bit range), floats from the half-open one */
+	Typed_job_t job = { .kernels = typed_kernels(m->type), .width = width, .dst = (unsigned char*)m->data,
+		.start_range = start_range, .span = real ? end_range - start_range : end_range + 1 - start_range, .n = n };
+	job.seed = next_random_key();
+	const size_t blocks = (n + MATRIX_RANDOM_BLOCK - 1) / MATRIX_RANDOM_BLOCK;
+	pool_parallel_for(blocks, POOL_MIN_GRAIN / MATRIX_RANDOM_BLOCK, typed_random_task, &job);
+	stats_record(STAT_RANDOM_MATRIX, start, n * width, 0);
+	return true;
+}// end random_typed
+
+/*
+ * PURPOSE: Restart the random_matrix generator from a seed, so the fills
+ *      that follow repeat exactly for the same seed and sequence of calls
+ * INPUTS:
+ *      Seed, seed
  * RETURN:
  *      void
  **/
-void load_matrix (Matrix_t* m, unsigned int* data) {
-    if(!data || !m || !m->data ){
-        perror("load_matrix: bad input\n");
-        return;
-    }
+void seed_random_matrix (uint64_t seed) {
+	random_seed = seed;
+	random_calls = 0;
+}// end seed_random_matrix
+
+/*
+ * PURPOSE: Start a new random fill: every fill draws its blocks from
+ *      generator streams under its own key, taken in call order from the seed
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      The key to pass to kernel_rng_init with each block index
+ **/
+uint64_t next_random_key (void) {
+	return random_seed + 0x9E3779B97F4A7C15ULL * ++random_calls;
+}// end next_random_key
+
+/*
+ * PURPOSE: Report the seed random_matrix was last restarted from
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      The seed
+ **/
+uint64_t random_matrix_seed (void) {
+	return random_seed;
+}// end random_matrix_seed
 
-	memcpy(m->data,data,m->rows * m->cols * sizeof(unsigned int));
-}//end load_matrix
+/*Protected Functions in C*/
+
+/*
+ * PURPOSE: Print the errno explanation that goes with a failed file operation
+ * INPUTS:
+ *      Name of the failed operation, what
+ * RETURN:
+ *      void
+ **/
+static void report_file_error (const char* what) {
+	if (errno == EACCES ) {
+		perror("DO NOT HAVE ACCESS TO FILE\n");
+	}
+	else if (errno == EADDRINUSE ){
+		perror("FILE ALREADY IN USE\n");
+	}
+	else if (errno == EBADF) {
+		perror("BAD FILE DESCRIPTOR\n");
+	}
+	else if (errno == EEXIST) {
+		perror("FILE EXIST\n");
+	}
+	else {
+		perror(what);
+	}
+}// end report_file_error
 
 /*
- * PURPOSE: 
+ * PURPOSE: Open a temporary file beside a write target. Writers fill it and
+ *      rename it into place with finish_temp_file: truncating the target in
+ *      place would pull the pages out from under any matrix still mapped from
+ *      it, including the one being written.
  * INPUTS:
- *      The master-list of matrices, mats.
- *      The matrix to be added, new_matrix.
- *      The count of matrices in the master-list, num_mats
+ *      Target file name, filename
+ *      Destination for the malloc'd temporary name, tmp_filename
  * RETURN:
- *      If there is an error, return -1.
- *      Else, return the pos of the new matrix
+ *      The open descriptor, or -1 when the file cannot be created
  **/
-unsigned int add_matrix_to_array (Matrix_t** mats, Matrix_t* new_matrix, unsigned int num_mats) {
-	if( !mats || !new_matrix ){
-		perror("add_matrix_to_array: bad input\n");
+int create_temp_file (const char* filename, char** tmp_filename) {
+	const size_t path_len = strlen(filename);
+	char* name = malloc(path_len + sizeof(".XXXXXX"));
+	if (!name) {
+		return -1;
+	}
+	memcpy(name, filename, path_len);
+	memcpy(&name[path_len], ".XXXXXX", sizeof(".XXXXXX"));
+
+	const int fd = mkstemp(name);
+	/* ERROR HANDLING USING errorno*/
+	if (fd < 0) {
+		printf("FAILED TO CREATE/OPEN FILE FOR WRITING\n");
+		report_file_error("mkstemp");
+		free(name);
 		return -1;
 	}
+	fchmod(fd, 0644);
+	*tmp_filename = name;
+	return fd;
+}// end create_temp_file
+
+/*
+ * PURPOSE: Close a temporary file from create_temp_file and, if it was written
+ *      in full, sync it on request and rename it over the target; otherwise
+ *      remove it. The temporary name is freed.
+ * INPUTS:
+ *      Descriptor of the temporary file, fd
+ *      Temporary file name, tmp_filename
+ *      Target file name, filename
+ *      Whether every write succeeded, ok
+ *      Whether to fdatasync before the rename, sync
+ * RETURN:
+ *      If any step fails, return false.
+ *      Else, return true.
+ **/
+bool finish_temp_file (int fd, char* tmp_filename, const char* filename, bool ok, bool sync) {
+	if (ok && sync && fdatasync(fd) != 0) {
+		printf("FAILED TO SYNC MATRIX FILE\n");
+		report_file_error("fdatasync");
+		ok = false;
+	}
+	if (close(fd)) {
+		ok = false;
+	}
+	if (ok && rename(tmp_filename, filename) != 0) {
+		printf("FAILED TO REPLACE %s\n", filename);
+		report_file_error("rename");
+		ok = false;
+	}
+	if (!ok) {
+		unlink(tmp_filename);
+	}
+	free(tmp_filename);
+	return ok;
+}// end finish_temp_file
+
+/*
+ * PURPOSE: Read exactly len bytes, retrying short reads and interrupts
+ * INPUTS:
+ *      Descriptor to read from, fd
+ *      Destination buffer, buf
+ *      Number of bytes wanted, len
+ * RETURN:
+ *      If the file ends early or a read fails, return false.
+ *      Else, return true.
+ **/
+static bool read_full (int fd, void* buf, size_t len) {
+	unsigned char* p = buf;
+	while (len > 0) {
+		const ssize_t got = read(fd, p, len);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			if (got < 0) {
+				report_file_error("read");
+			}
+			return false;
+		}
+		p += got;
+		len -= got;
+	}
+	return true;
+}// end read_full
+
+/*
+ * PURPOSE: Write every byte described by an iovec array, resuming after short
+ *      writes and interrupts. The iovecs are consumed in the process.
+ * INPUTS:
+ *      Descriptor to write to, fd
+ *      Buffers to write in order, iov
+ *      Number of buffers, iovcnt
+ * RETURN:
+ *      If a write fails, return false.
+ *      Else, return true.
+ **/
+static bool write_full_vec (int fd, struct iovec* iov, int iovcnt) {
+	for (;;) {
+		while (iovcnt > 0 && iov->iov_len == 0) {
+			++iov;
+			--iovcnt;
+		}
+		if (iovcnt == 0) {
+			return true;
+		}
+
+		ssize_t put = writev(fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+		if (put < 0 && errno == EINTR) {
+			continue;
+		}
+		if (put <= 0) {
+			report_file_error("writev");
+			return false;
+		}
+		while (put > 0) {
+			if ((size_t)put >= iov->iov_len) {
+				put -= iov->iov_len;
+				iov->iov_len = 0;
+				++iov;
+				--iovcnt;
+			}
+			else {
+				iov->iov_base = (unsigned char*)iov->iov_base + put;
+				iov->iov_len -= put;
+				put = 0;
+			}
+		}
+	}
+}// end write_full_vec
 
-	static long int current_position = 0;
-	const long int pos = current_position % num_mats;
-	if ( mats[pos] ) {
-		destroy_matrix(&mats[pos]);
-	} 
-	mats[pos] = new_matrix;
-	current_position++;
-	return pos;
-}// end add_matrix_to_array
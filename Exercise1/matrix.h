@@ -1,27 +1,178 @@
 #ifndef _MATRIX_H_
 #define _MATRIX_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
 #define MATRIX_NAME_LEN 25
 
+/* Where a data buffer's elements live and how its last reference releases them */
+typedef enum {
+	MATRIX_STORAGE_INLINE = 0,	/* follow the buffer header in the same allocator block */
+	MATRIX_STORAGE_MAPPED,		/* in a private file mapping, unmapped */
+	MATRIX_STORAGE_WORKSPACE	/* in a read-only workspace mapping, copied before any write */
+}Matrix_storage_t;
+
+/* Summary of a matrix's elements, zeros included; min and max are 0 for an empty matrix */
+typedef struct {
+	uint64_t sum;
+	uint64_t nonzero;
+	unsigned int min;
+	unsigned int max;
+}Matrix_aggregates_t;
+
+/*
+ * Reference-counted holder of matrix data. duplicate_matrix shares one
+ * buffer between matrices; the first write through any of them gives that
+ * matrix a private copy (unshare_matrix) and leaves the others alone.
+ */
+typedef struct {
+	unsigned int refs;	/* matrices pointing at this buffer */
+	Matrix_storage_t storage;
+	void *mapping;
+	size_t mapping_len;
+	uint64_t file_offset;	/* workspace: where the mapping starts in the file */
+	uint64_t hash;	/* content hash, see hash_matrix; valid while hashed */
+	bool hashed;	/* cleared by unshare_matrix before any write */
+	Matrix_aggregates_t aggregates;	/* see aggregate_matrix; valid while aggregated */
+	bool aggregated;	/* cleared by unshare_matrix, set again by writers that track them */
+	size_t block_size;	/* size of the allocator block holding this buffer */
+}Matrix_buffer_t;
+
+/* How a matrix lays out its elements */
+typedef enum {
+	MATRIX_FORMAT_DENSE = 0,	/* rows * cols elements, row-major */
+	MATRIX_FORMAT_CSR,		/* compressed sparse rows: only the non-zero elements */
+	MATRIX_FORMAT_TILED		/* MATRIX_TILE x MATRIX_TILE row-major tiles, themselves row-major */
+}Matrix_format_t;
+
+/*
+ * Type of a matrix's elements. Unsigned 32-bit is the default and the only
+ * type that can be sparse or tiled, or go through mul, eval, transpose,
+ * summary, packed files or the stream commands; the other types are always
+ * dense and run add, shift, sum, equal, random, set, display, read and write
+ * on kernels generated per type (see Kernel_typed_t). cast_matrix converts
+ * between types.
+ */
+typedef enum {
+	MATRIX_TYPE_U32 = 0,
+	MATRIX_TYPE_U8,
+	MATRIX_TYPE_U16,
+	MATRIX_TYPE_U64,
+	MATRIX_TYPE_F32,
+	MATRIX_TYPE_F64,
+	MATRIX_TYPE_COUNT
+}Matrix_type_t;
+
+/*
+ * Side of a tile in MATRIX_FORMAT_TILED. Every tile is stored whole, so the
+ * tiles along the bottom and right edges are padded with zeros; a 64 x 64
+ * tile of 4-byte elements is 16K, which sits in L1 while it is worked on.
+ */
+#define MATRIX_TILE 64
+
+/*
+ * A CSR matrix switches to dense once more than 1 / MATRIX_SPARSE_MAX_DIV of
+ * its elements are non-zero; auto_format_matrix turns a dense matrix sparse
+ * when fewer than 1 / MATRIX_SPARSE_MIN_DIV are. The gap keeps a matrix near
+ * either threshold from converting back and forth.
+ */
+#define MATRIX_SPARSE_MAX_DIV 3
+#define MATRIX_SPARSE_MIN_DIV 16
+
+/*
+ * Dimensions are 64-bit, but CSR column indices are 32-bit, so a matrix has
+ * at most MATRIX_MAX_COLS columns. Every constructor also checks that the
+ * tile-padded element count fits in memory sizes before allocating.
+ */
+#define MATRIX_MAX_COLS UINT32_MAX
+
+/*
+ * Random fills draw each block of MATRIX_RANDOM_BLOCK elements from its own
+ * generator stream, keyed by the fill (next_random_key) and the block index,
+ * so a fill depends on the seed alone and not on how blocks land on threads
+ * or in memory.
+ */
+#define MATRIX_RANDOM_BLOCK ((size_t)1 << 14)
+
 typedef struct {
 	char name[MATRIX_NAME_LEN];
-	unsigned int rows;
-	unsigned int cols;
-	unsigned int *data;
+	size_t rows;
+	size_t cols;
+	Matrix_format_t format;
+	Matrix_type_t type;
+	unsigned int *data;	/* elements (tiles when tiled), or the CSR values; owned by buffer; of type type */
+	uint64_t *row_ptr;	/* CSR: row i holds values [row_ptr[i], row_ptr[i + 1]) */
+	unsigned int *col_idx;	/* CSR: column of each value, ascending within a row */
+	size_t nnz;	/* CSR: stored values, never zero */
+	size_t capacity;	/* CSR: values the buffer has room for */
+	Matrix_buffer_t *buffer;
+	size_t block_size;	/* size of the allocator block holding this header */
 }Matrix_t;
 
-bool create_matrix (Matrix_t** new_matrix, const char* name, const unsigned int rows, const unsigned int cols);
+/* Durability of write_matrix_with_policy */
+typedef enum {
+	WRITE_POLICY_BUFFERED = 0,
+	WRITE_POLICY_SYNC,
+	WRITE_POLICY_DIRECT
+}Write_policy_t;
+
+/* Compression used by write_matrix_packed */
+typedef enum {
+	PACK_MODE_FOR = 0,	/* per-block minimum plus bit-packed offsets */
+	PACK_MODE_DELTA	/* per block, the narrower of the above and zigzag deltas */
+}Pack_mode_t;
+
+bool create_matrix (Matrix_t** new_matrix, const char* name, const size_t rows, const size_t cols);
+bool create_matrix_uninit (Matrix_t** new_matrix, const char* name, const size_t rows, const size_t cols);
+bool create_typed_matrix (Matrix_t** new_matrix, const char* name, const size_t rows, const size_t cols,
+		Matrix_type_t type);
+bool cast_matrix (Matrix_t* src, const char* name, Matrix_type_t type, Matrix_t** dest);
+size_t matrix_element_size (Matrix_type_t type);
+bool matrix_type_is_real (Matrix_type_t type);
+const char* matrix_type_name (Matrix_type_t type);
+bool parse_matrix_type (const char* text, Matrix_type_t* type);
 void destroy_matrix (Matrix_t** m); 
 bool write_matrix (const char* matrix_output_filename, Matrix_t* m);
+bool write_matrix_with_policy (const char* matrix_output_filename, Matrix_t* m, Write_policy_t policy);
+bool write_matrix_packed (const char* matrix_output_filename, Matrix_t* m, Write_policy_t policy, Pack_mode_t mode);
 bool read_matrix (const char* matrix_input_filename, Matrix_t** m);
-int sum_matrix (Matrix_t* m);
+size_t matrix_stored_bytes (const Matrix_t* m);
+bool map_matrix_region (Matrix_t** m, const Matrix_t* shape, int fd, uint64_t offset);
+bool write_matrix_region (int fd, uint64_t offset, const Matrix_t* m);
+bool remap_matrix_region (Matrix_t* m, int fd, uint64_t offset);
+bool matrix_region (const Matrix_t* m, uint64_t* offset);
+bool probe_matrix_file (int fd, Matrix_t* shape, uint64_t* data_offset);
+bool write_matrix_header (int fd, const Matrix_t* shape, uint64_t* data_offset);
+int create_temp_file (const char* filename, char** tmp_filename);
+bool finish_temp_file (int fd, char* tmp_filename, const char* filename, bool ok, bool sync);
+bool sum_matrix (Matrix_t* m, uint64_t* sum);
+bool sum_matrix_real (Matrix_t* m, double* sum);
+bool hash_matrix (Matrix_t* m, uint64_t* hash);
+bool aggregate_matrix (Matrix_t* m, Matrix_aggregates_t* aggregates);
 bool add_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c); 
+bool multiply_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c);
 bool bitwise_shift_matrix (Matrix_t* a, char direction, unsigned int shift);
 bool duplicate_matrix (Matrix_t* src, Matrix_t* dest);
+bool share_matrix (Matrix_t* src, const char* name, Matrix_t** dest);
+bool unshare_matrix (Matrix_t* m, bool keep_contents);
+bool matrix_is_shared (const Matrix_t* m);
+bool set_matrix_element (Matrix_t* m, size_t row, size_t col, unsigned int value);
+bool densify_matrix (Matrix_t* m, bool keep_contents);
+bool dense_view_matrix (Matrix_t* m, Matrix_t** view);
+bool sparsify_matrix (Matrix_t* m);
+bool auto_format_matrix (Matrix_t* m);
+bool tile_matrix (Matrix_t* m);
+bool transpose_matrix (Matrix_t* src, Matrix_t* dest);
 bool equal_matrices (Matrix_t* a, Matrix_t* b); 
-void display_matrix (Matrix_t* m); 
+void display_matrix (Matrix_t* m, size_t window);
+bool export_matrix (Matrix_t* m, const char* filename, char separator);
+bool import_matrix (const char* filename, const char* name, Matrix_type_t type, Matrix_t** m);
 bool random_matrix(Matrix_t* m, unsigned int start_range, unsigned int end_range);
-unsigned int add_matrix_to_array (Matrix_t** mats, Matrix_t* new_matrix, unsigned int num_mats);
+void seed_random_matrix (uint64_t seed);
+uint64_t random_matrix_seed (void);
+uint64_t next_random_key (void);
 
 
 #endif
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+/*
+ * One process-wide pool of persistent workers. The submitting thread takes
+ * part in every job, so a pool of N threads starts N - 1 workers. Jobs are
+ * published by bumping the generation counter under the lock; chunks are
+ * claimed with an atomic counter so uneven chunks balance themselves.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_cond_t work_done;
+	pthread_mutex_t submit_lock;
+	pthread_t* workers;
+	unsigned int num_workers;
+	unsigned long generation;
+	bool shutdown;
+
+	Pool_task_t task;
+	void* arg;
+	size_t n;
+	size_t num_chunks;
+	size_t next_chunk;
+	unsigned int active;
+}Pool_t;
+
+static Pool_t pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work_ready = PTHREAD_COND_INITIALIZER,
+	.work_done = PTHREAD_COND_INITIALIZER,
+	.submit_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* set while a thread is executing pool work, nested submissions run inline */
+static __thread bool in_pool_task = false;
+
+/*
+ * PURPOSE: Claim and run chunks of the current job until none are left
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      void
+ **/
+static void run_chunks (void) {
+	in_pool_task = true;
+	for (;;) {
+		const size_t chunk = __atomic_fetch_add(&pool.next_chunk, 1, __ATOMIC_RELAXED);
+		if (chunk >= pool.num_chunks) {
+			break;
+		}
+		const size_t begin = pool.n * chunk / pool.num_chunks;
+		const size_t end = pool.n * (chunk + 1) / pool.num_chunks;
+		pool.task(pool.arg, chunk, begin, end);
+	}
+	in_pool_task = false;
+}// end run_chunks
+
+/*
+ * PURPOSE: Worker thread body, sleeps until a new generation of work is posted
+ * INPUTS:
+ *      unused, arg
+ * RETURN:
+ *      NULL
+ **/
+static void* worker_main (void* arg) {
+	(void)arg;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&pool.lock);
+	for (;;) {
+		while (!pool.shutdown && pool.generation == seen) {
+			pthread_cond_wait(&pool.work_ready, &pool.lock);
+		}
+		if (pool.shutdown) {
+			break;
+		}
+		seen = pool.generation;
+		pthread_mutex_unlock(&pool.lock);
+
+		run_chunks();
+
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.active == 0) {
+			pthread_cond_signal(&pool.work_done);
+		}
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}// end worker_main
+
+/*
+ * PURPOSE: Start the worker threads
+ * INPUTS:
+ *      Total threads to run jobs on including the caller, num_threads.
+ *      Zero picks the number of online CPUs.
+ * RETURN:
+ *      If the workers could not be started, return false.
+ *      Else, return true.
+ **/
+bool pool_init (unsigned int num_threads) {
+	if (pool.workers) {
+		perror("pool_init: pool already running\n");
+		return false;
+	}
+	if (num_threads == 0) {
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = cpus > 0 ? (unsigned int)cpus : 1;
+	}
+	if (num_threads > POOL_MAX_CHUNKS) {
+		num_threads = POOL_MAX_CHUNKS;
+	}
+	if (num_threads == 1) {
+		return true;
+	}
+
+	pool.workers = calloc(num_threads - 1, sizeof(pthread_t));
+	if (!pool.workers) {
+		perror("pool_init: allocation error\n");
+		return false;
+	}
+	pool.shutdown = false;
+	for (unsigned int i = 0; i < num_threads - 1; ++i) {
+		if (pthread_create(&pool.workers[i], NULL, worker_main, NULL) != 0) {
+			perror("pool_init: failed to start worker\n");
+			pool_destroy();
+			return false;
+		}
+		pool.num_workers++;
+	}
+	return true;
+}// end pool_init
+
+/*
+ * PURPOSE: Stop and join the worker threads
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      void
+ **/
+void pool_destroy (void) {
+	if (!pool.workers) {
+		return;
+	}
+	pthread_mutex_lock(&pool.lock);
+	pool.shutdown = true;
+	pthread_cond_broadcast(&pool.work_ready);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (unsigned int i = 0; i < pool.num_workers; ++i) {
+		pthread_join(pool.workers[i], NULL);
+	}
+	free(pool.workers);
+	pool.workers = NULL;
+	pool.num_workers = 0;
+}// end pool_destroy
+
+/*
+ * PURPOSE: Report how many threads a job can run on
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      Worker count plus the calling thread
+ **/
+unsigned int pool_size (void) {
+	return pool.num_workers + 1;
+}// end pool_size
+
+/*
+ * PURPOSE: Compute how many chunks pool_parallel_for will split a range into
+ * INPUTS:
+ *      Number of elements, n
+ *      Minimum elements per chunk, grain
+ * RETURN:
+ *      Chunk count between 1 and POOL_MAX_CHUNKS
+ **/
+size_t pool_chunk_count (size_t n, size_t grain) {
+	if (grain == 0) {
+		grain = 1;
+	}
+	size_t chunks = n / grain;
+	const size_t cap = in_pool_task ? 1 : (size_t)pool_size() * 4;
+	if (chunks > cap) {
+		chunks = cap;
+	}
+	if (chunks > POOL_MAX_CHUNKS) {
+		chunks = POOL_MAX_CHUNKS;
+	}
+	return chunks ? chunks : 1;
+}// end pool_chunk_count
+
+/*
+ * PURPOSE: Run task over [0, n) split into chunks of at least grain elements.
+ *      Small ranges, single-threaded pools and nested calls run inline.
+ * INPUTS:
+ *      Number of elements, n
+ *      Minimum elements per chunk, grain
+ *      Work callback, task
+ *      Argument handed to every task call, arg
+ * RETURN:
+ *      void
+ **/
+void pool_parallel_for (size_t n, size_t grain, Pool_task_t task, void* arg) {
+	if (!task) {
+		perror("pool_parallel_for: bad input\n");
+		return;
+	}
+	const size_t chunks = pool_chunk_count(n, grain);
+	if (chunks == 1 || pool.num_workers == 0) {
+		for (size_t c = 0; c < chunks; ++c) {
+			task(arg, c, n * c / chunks, n * (c + 1) / chunks);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool.submit_lock);
+	pthread_mutex_lock(&pool.lock);
+	pool.task = task;
+	pool.arg = arg;
+	pool.n = n;
+	pool.num_chunks = chunks;
+	pool.next_chunk = 0;
+	pool.active = pool.num_workers;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.work_ready);
+	pthread_mutex_unlock(&pool.lock);
+
+	run_chunks();
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.active > 0) {
+		pthread_cond_wait(&pool.work_done, &pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	pthread_mutex_unlock(&pool.submit_lock);
+}// end pool_parallel_for
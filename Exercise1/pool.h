@@ -0,0 +1,25 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Upper bound on the chunks a single pool_parallel_for splits its range into */
+#define POOL_MAX_CHUNKS 256
+
+/* Ranges smaller than this many elements per chunk are not worth a hand-off */
+#define POOL_MIN_GRAIN (1u << 16)
+
+/*
+ * Work callback for pool_parallel_for. Invoked once per chunk with the chunk
+ * index and the half-open element range [begin, end) it covers.
+ */
+typedef void (*Pool_task_t) (void* arg, size_t chunk, size_t begin, size_t end);
+
+bool pool_init (unsigned int num_threads);
+void pool_destroy (void);
+unsigned int pool_size (void);
+size_t pool_chunk_count (size_t n, size_t grain);
+void pool_parallel_for (size_t n, size_t grain, Pool_task_t task, void* arg);
+
+#endif
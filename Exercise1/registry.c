@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "registry.h"
+
+#define REGISTRY_MIN_CAPACITY 16
+
+/*
+ * PURPOSE: Hash a matrix name (64-bit FNV-1a)
+ * INPUTS:
+ *      NUL terminated name, name
+ * RETURN:
+ *      The hash of every byte of the name
+ **/
+static uint64_t hash_name (const char* name) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (const unsigned char* p = (const unsigned char*)name; *p; ++p) {
+		h ^= *p;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}// end hash_name
+
+/*
+ * PURPOSE: Locate the slot holding name, or the empty slot that ends its probe run
+ * INPUTS:
+ *      Registry to search, reg
+ *      Name to look for and its hash, name and hash
+ * RETURN:
+ *      Index of the matching or empty slot
+ **/
+static size_t probe (const Registry_t* reg, const char* name, uint64_t hash) {
+	const size_t mask = reg->capacity - 1;
+	size_t i = hash & mask;
+	while (reg->slots[i].matrix) {
+		if (reg->slots[i].hash == hash && strcmp(reg->slots[i].matrix->name, name) == 0) {
+			return i;
+		}
+		i = (i + 1) & mask;
+	}
+	return i;
+}// end probe
+
+/*
+ * PURPOSE: Rehash every entry into a table of new_capacity slots
+ * INPUTS:
+ *      Registry to resize, reg
+ *      New slot count, a power of two larger than the entry count, new_capacity
+ * RETURN:
+ *      If the new table cannot be allocated, return false.
+ *      Else, return true.
+ **/
+static bool resize (Registry_t* reg, size_t new_capacity) {
+	Registry_slot_t* slots = calloc(new_capacity, sizeof(Registry_slot_t));
+	if (!slots) {
+		perror("registry: allocation error\n");
+		return false;
+	}
+	const size_t mask = new_capacity - 1;
+	for (size_t i = 0; i < reg->capacity; ++i) {
+		if (!reg->slots[i].matrix) {
+			continue;
+		}
+		size_t j = reg->slots[i].hash & mask;
+		while (slots[j].matrix) {
+			j = (j + 1) & mask;
+		}
+		slots[j] = reg->slots[i];
+	}
+	free(reg->slots);
+	reg->slots = slots;
+	reg->capacity = new_capacity;
+	return true;
+}// end resize
+
+/*
+ * PURPOSE: Empty the slot at index i, shifting later members of the probe run back
+ * INPUTS:
+ *      Registry to update, reg
+ *      Index of an occupied slot, i
+ * RETURN:
+ *      void
+ **/
+static void remove_slot (Registry_t* reg, size_t i) {
+	const size_t mask = reg->capacity - 1;
+	size_t j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		if (!reg->slots[j].matrix) {
+			break;
+		}
+		/* an entry may move into the hole only if its home slot is not between the hole and it */
+		const size_t home = reg->slots[j].hash & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			reg->slots[i] = reg->slots[j];
+			i = j;
+		}
+	}
+	reg->slots[i].matrix = NULL;
+	reg->slots[i].hash = 0;
+	reg->count--;
+}// end remove_slot
+
+/*
+ * PURPOSE: Set up an empty registry
+ * INPUTS:
+ *      Registry to initialize, reg
+ *      Expected number of matrices, capacity (rounded up to a power of two)
+ * RETURN:
+ *      If the table cannot be allocated, return false.
+ *      Else, return true.
+ **/
+bool registry_init (Registry_t* reg, size_t capacity) {
+	if (!reg) {
+		perror("registry_init: bad input\n");
+		return false;
+	}
+	size_t slots = REGISTRY_MIN_CAPACITY;
+	while (slots < capacity * 2) {
+		slots <<= 1;
+	}
+	reg->slots = calloc(slots, sizeof(Registry_slot_t));
+	if (!reg->slots) {
+		perror("registry_init: allocation error\n");
+		return false;
+	}
+	reg->capacity = slots;
+	reg->count = 0;
+	return true;
+}// end registry_init
+
+/*
+ * PURPOSE: Destroy every matrix in the registry and release the table
+ * INPUTS:
+ *      Registry to tear down, reg
+ * RETURN:
+ *      void
+ **/
+void registry_destroy (Registry_t* reg) {
+	if (!reg || !reg->slots) {
+		return;
+	}
+	for (size_t i = 0; i < reg->capacity; ++i) {
+		destroy_matrix(&reg->slots[i].matrix);
+	}
+	free(reg->slots);
+	reg->slots = NULL;
+	reg->capacity = 0;
+	reg->count = 0;
+}// end registry_destroy
+
+/*
+ * PURPOSE: Look up a matrix by its exact name
+ * INPUTS:
+ *      Registry to search, reg
+ *      Name to look for, name
+ * RETURN:
+ *      The matrix, or NULL when no matrix has that name
+ **/
+Matrix_t* registry_find (const Registry_t* reg, const char* name) {
+	if (!reg || !reg->slots || !name) {
+		return NULL;
+	}
+	return reg->slots[probe(reg, name, hash_name(name))].matrix;
+}// end registry_find
+
+/*
+ * PURPOSE: Take ownership of a matrix under its name, destroying any matrix
+ *      previously registered with the same name
+ * INPUTS:
+ *      Registry to update, reg
+ *      Matrix to add, m
+ * RETURN:
+ *      If the table could not grow, return false and leave m with the caller.
+ *      Else, return true.
+ **/
+bool registry_insert (Registry_t* reg, Matrix_t* m) {
+	if (!reg || !reg->slots || !m) {
+		perror("registry_insert: bad input\n");
+		return false;
+	}
+	const uint64_t hash = hash_name(m->name);
+	size_t i = probe(reg, m->name, hash);
+	if (reg->slots[i].matrix) {
+		if (reg->slots[i].matrix != m) {
+			destroy_matrix(&reg->slots[i].matrix);
+		}
+		reg->slots[i].matrix = m;
+		return true;
+	}
+
+	if ((reg->count + 1) * 10 > reg->capacity * 7) {
+		if (!resize(reg, reg->capacity * 2)) {
+			return false;
+		}
+		i = probe(reg, m->name, hash);
+	}
+	reg->slots[i].hash = hash;
+	reg->slots[i].matrix = m;
+	reg->count++;
+	return true;
+}// end registry_insert
+
+/*
+ * PURPOSE: Remove a matrix from the registry without destroying it
+ * INPUTS:
+ *      Registry to update, reg
+ *      Name of the matrix, name
+ * RETURN:
+ *      The matrix now owned by the caller, or NULL when no matrix has that name
+ **/
+Matrix_t* registry_detach (Registry_t* reg, const char* name) {
+	if (!reg || !reg->slots || !name) {
+		return NULL;
+	}
+	const size_t i = probe(reg, name, hash_name(name));
+	Matrix_t* m = reg->slots[i].matrix;
+	if (m) {
+		remove_slot(reg, i);
+	}
+	return m;
+}// end registry_detach
+
+/*
+ * PURPOSE: Remove and destroy a matrix
+ * INPUTS:
+ *      Registry to update, reg
+ *      Name of the matrix, name
+ * RETURN:
+ *      If no matrix has that name, return false.
+ *      Else, return true.
+ **/
+bool registry_remove (Registry_t* reg, const char* name) {
+	Matrix_t* m = registry_detach(reg, name);
+	if (!m) {
+		return false;
+	}
+	destroy_matrix(&m);
+	return true;
+}// end registry_remove
+
+/*
+ * PURPOSE: Report how many matrices are registered
+ * INPUTS:
+ *      Registry to inspect, reg
+ * RETURN:
+ *      Number of matrices
+ **/
+size_t registry_count (const Registry_t* reg) {
+	return reg ? reg->count : 0;
+}// end registry_count
+
+/*
+ * PURPOSE: qsort comparator ordering matrix pointers by name
+ * INPUTS:
+ *      Pointers to two Matrix_t pointers, a and b
+ * RETURN:
+ *      strcmp of the two names
+ **/
+static int compare_names (const void* a, const void* b) {
+	return strcmp((*(Matrix_t* const*)a)->name, (*(Matrix_t* const*)b)->name);
+}// end compare_names
+
+/*
+ * PURPOSE: Copy up to max registered matrix pointers into out, sorted by name
+ * INPUTS:
+ *      Registry to inspect, reg
+ *      Destination array, out
+ *      Capacity of out, max
+ * RETURN:
+ *      Number of pointers written
+ **/
+size_t registry_snapshot (const Registry_t* reg, Matrix_t** out, size_t max) {
+	if (!reg || !out) {
+		return 0;
+	}
+	size_t n = 0;
+	for (size_t i = 0; i < reg->capacity && n < max; ++i) {
+		if (reg->slots[i].matrix) {
+			out[n++] = reg->slots[i].matrix;
+		}
+	}
+	qsort(out, n, sizeof(Matrix_t*), compare_names);
+	return n;
+}// end registry_snapshot
@@ -0,0 +1,36 @@
+#ifndef _REGISTRY_H_
+#define _REGISTRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "matrix.h"
+
+/*
+ * Named matrices owned by the session. Open addressing with linear probing
+ * over a power-of-two table keyed on the full matrix name; deletion shifts
+ * followers back so there are no tombstones. The table doubles before it
+ * passes 70% load and never evicts on its own.
+ */
+typedef struct {
+	uint64_t hash;
+	Matrix_t* matrix;	/* NULL marks an empty slot */
+}Registry_slot_t;
+
+typedef struct {
+	Registry_slot_t* slots;
+	size_t capacity;
+	size_t count;
+}Registry_t;
+
+bool registry_init (Registry_t* reg, size_t capacity);
+void registry_destroy (Registry_t* reg);
+Matrix_t* registry_find (const Registry_t* reg, const char* name);
+bool registry_insert (Registry_t* reg, Matrix_t* m);
+bool registry_remove (Registry_t* reg, const char* name);
+Matrix_t* registry_detach (Registry_t* reg, const char* name);
+size_t registry_count (const Registry_t* reg);
+size_t registry_snapshot (const Registry_t* reg, Matrix_t** out, size_t max);
+
+#endif
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+/* Latency histogram: four sub-buckets per power of two of nanoseconds */
+#define STATS_SUB_BUCKETS 4
+#define STATS_NUM_BUCKETS (64 * STATS_SUB_BUCKETS)
+
+typedef struct {
+	const char* name;
+	uint64_t calls;
+	uint64_t total_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t bytes;
+	uint64_t io_bytes;
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+	uint32_t hist[STATS_NUM_BUCKETS];
+}Stat_counter_t;
+
+static Stat_counter_t counters[STATS_MAX_COUNTERS] = {
+	[STAT_CREATE_MATRIX] = { .name = "create_matrix" },
+	[STAT_DESTROY_MATRIX] = { .name = "destroy_matrix" },
+	[STAT_ADD_MATRICES] = { .name = "add_matrices" },
+	[STAT_MULTIPLY_MATRICES] = { .name = "multiply_matrices" },
+	[STAT_SHIFT_MATRIX] = { .name = "bitwise_shift_matrix" },
+	[STAT_SUM_MATRIX] = { .name = "sum_matrix" },
+	[STAT_EQUAL_MATRICES] = { .name = "equal_matrices" },
+	[STAT_DUPLICATE_MATRIX] = { .name = "duplicate_matrix" },
+	[STAT_RANDOM_MATRIX] = { .name = "random_matrix" },
+	[STAT_READ_MATRIX] = { .name = "read_matrix" },
+	[STAT_WRITE_MATRIX] = { .name = "write_matrix" },
+	[STAT_DISPLAY_MATRIX] = { .name = "display_matrix" },
+	[STAT_EVALUATE_EXPRESSION] = { .name = "evaluate_expression" },
+	[STAT_UNSHARE_MATRIX] = { .name = "unshare_matrix" },
+	[STAT_CONVERT_MATRIX] = { .name = "convert_matrix" },
+	[STAT_SET_MATRIX] = { .name = "set_matrix" },
+	[STAT_TRANSPOSE_MATRIX] = { .name = "transpose_matrix" },
+	[STAT_HASH_MATRIX] = { .name = "hash_matrix" },
+	[STAT_AGGREGATE_MATRIX] = { .name = "aggregate_matrix" },
+	[STAT_STREAM_RANDOM] = { .name = "stream_random" },
+	[STAT_STREAM_ADD] = { .name = "stream_add" },
+	[STAT_STREAM_SHIFT] = { .name = "stream_shift" },
+	[STAT_STREAM_SUM] = { .name = "stream_sum" },
+	[STAT_STREAM_EQUAL] = { .name = "stream_equal" },
+	[STAT_CAST_MATRIX] = { .name = "cast_matrix" },
+	[STAT_EXPORT_MATRIX] = { .name = "export_matrix" },
+	[STAT_IMPORT_MATRIX] = { .name = "import_matrix" },
+};
+static int num_counters = STAT_NUM_FIXED;
+static pthread_mutex_t register_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* counter of the command running on this thread, -1 outside commands */
+static __thread int current_command = -1;
+
+/*
+ * PURPOSE: Read the monotonic clock
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      Nanoseconds since an arbitrary epoch
+ **/
+uint64_t stats_now (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}// end stats_now
+
+/*
+ * PURPOSE: Map a latency to its histogram bucket
+ * INPUTS:
+ *      Latency, ns
+ * RETURN:
+ *      Bucket index
+ **/
+static unsigned int bucket_of (uint64_t ns) {
+	if (ns < STATS_SUB_BUCKETS) {
+		return (unsigned int)ns;
+	}
+	const unsigned int lg = 63 - __builtin_clzll(ns);
+	const unsigned int sub = (unsigned int)((ns >> (lg - 2)) & (STATS_SUB_BUCKETS - 1));
+	return lg * STATS_SUB_BUCKETS + sub;
+}// end bucket_of
+
+/*
+ * PURPOSE: Upper bound of the latencies a histogram bucket holds
+ * INPUTS:
+ *      Bucket index, bucket
+ * RETURN:
+ *      Latency in nanoseconds
+ **/
+static uint64_t bucket_limit (unsigned int bucket) {
+	if (bucket < STATS_SUB_BUCKETS) {
+		return bucket;
+	}
+	const unsigned int lg = bucket / STATS_SUB_BUCKETS;
+	const uint64_t sub = bucket % STATS_SUB_BUCKETS;
+	return ((uint64_t)1 << lg) + (sub + 1) * ((uint64_t)1 << (lg - 2)) - 1;
+}// end bucket_limit
+
+/*
+ * PURPOSE: Fold one sample into a counter
+ * INPUTS:
+ *      Counter to update, c
+ *      Latency, ns
+ *      Memory and I/O traffic, bytes and io_bytes
+ * RETURN:
+ *      void
+ **/
+static void add_sample (Stat_counter_t* c, uint64_t ns, uint64_t bytes, uint64_t io_bytes) {
+	__atomic_fetch_add(&c->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->total_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->io_bytes, io_bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->hist[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+
+	uint64_t seen = __atomic_load_n(&c->max_ns, __ATOMIC_RELAXED);
+	while (ns > seen && !__atomic_compare_exchange_n(&c->max_ns, &seen, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+	/* min_ns of zero means no sample yet; store ns + 1 so a 0 ns sample still counts */
+	seen = __atomic_load_n(&c->min_ns, __ATOMIC_RELAXED);
+	while ((seen == 0 || ns + 1 < seen)
+		&& !__atomic_compare_exchange_n(&c->min_ns, &seen, ns + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}// end add_sample
+
+/*
+ * PURPOSE: Record one completed call
+ * INPUTS:
+ *      Counter id, id
+ *      stats_now() taken when the call started, start_ns
+ *      Memory the call read and wrote, bytes
+ *      Bytes the call moved to or from files, io_bytes
+ * RETURN:
+ *      void
+ **/
+void stats_record (int id, uint64_t start_ns, uint64_t bytes, uint64_t io_bytes) {
+	if (id < 0 || id >= __atomic_load_n(&num_counters, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	add_sample(&counters[id], stats_now() - start_ns, bytes, io_bytes);
+	if (current_command >= 0) {
+		__atomic_fetch_add(&counters[current_command].bytes, bytes, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&counters[current_command].io_bytes, io_bytes, __ATOMIC_RELAXED);
+	}
+}// end stats_record
+
+/*
+ * PURPOSE: Count a matrix allocation against create_matrix and the running command
+ * INPUTS:
+ *      Size of the allocation, bytes
+ * RETURN:
+ *      void
+ **/
+void stats_note_alloc (uint64_t bytes) {
+	__atomic_fetch_add(&counters[STAT_CREATE_MATRIX].allocs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counters[STAT_CREATE_MATRIX].alloc_bytes, bytes, __ATOMIC_RELAXED);
+	if (current_command >= 0) {
+		__atomic_fetch_add(&counters[current_command].allocs, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&counters[current_command].alloc_bytes, bytes, __ATOMIC_RELAXED);
+	}
+}// end stats_note_alloc
+
+/*
+ * PURPOSE: Find or register the counter for a name
+ * INPUTS:
+ *      Name of the counter, kept by reference, name
+ * RETURN:
+ *      Counter id, or -1 when the table is full
+ **/
+int stats_counter (const char* name) {
+	pthread_mutex_lock(&register_lock);
+	int id = -1;
+	for (int i = 0; i < num_counters; ++i) {
+		if (strcmp(counters[i].name, name) == 0) {
+			id = i;
+			break;
+		}
+	}
+	if (id < 0 && num_counters < STATS_MAX_COUNTERS) {
+		id = num_counters;
+		counters[id].name = name;
+		__atomic_store_n(&num_counters, num_counters + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&register_lock);
+	return id;
+}// end stats_counter
+
+/*
+ * PURPOSE: Mark the start of a command on this thread
+ * INPUTS:
+ *      Counter id of the command, id
+ * RETURN:
+ *      void
+ **/
+void stats_begin_command (int id) {
+	current_command = id;
+}// end stats_begin_command
+
+/*
+ * PURPOSE: Record a finished command
+ * INPUTS:
+ *      Counter id of the command, id
+ *      stats_now() taken before stats_begin_command, start_ns
+ * RETURN:
+ *      void
+ **/
+void stats_end_command (int id, uint64_t start_ns) {
+	current_command = -1;
+	if (id >= 0 && id < num_counters) {
+		add_sample(&counters[id], stats_now() - start_ns, 0, 0);
+	}
+}// end stats_end_command
+
+/*
+ * PURPOSE: Zero every counter, keeping the registered names
+ * INPUTS:
+ *      none
+ * RETURN:
+ *      void
+ **/
+void stats_reset (void) {
+	for (int i = 0; i < num_counters; ++i) {
+		const char* name = counters[i].name;
+		memset(&counters[i], 0, sizeof(Stat_counter_t));
+		counters[i].name = name;
+	}
+}// end stats_reset
+
+/*
+ * PURPOSE: Estimate the p-th percentile latency from a counter's histogram
+ * INPUTS:
+ *      Counter, c
+ *      Percentile between 0 and 100, p
+ * RETURN:
+ *      Upper bound of the bucket holding that rank, clamped to max_ns
+ **/
+static uint64_t percentile_ns (const Stat_counter_t* c, double p) {
+	const uint64_t rank = (uint64_t)(p / 100.0 * c->calls + 0.999999);
+	uint64_t seen = 0;
+	for (unsigned int b = 0; b < STATS_NUM_BUCKETS; ++b) {
+		seen += c->hist[b];
+		if (seen >= rank && seen > 0) {
+			const uint64_t limit = bucket_limit(b);
+			return limit < c->max_ns ? limit : c->max_ns;
+		}
+	}
+	return c->max_ns;
+}// end percentile_ns
+
+/*
+ * PURPOSE: Print every counter that has been hit as a table
+ * INPUTS:
+ *      Destination stream, out
+ * RETURN:
+ *      void
+ **/
+void stats_print (FILE* out) {
+	fprintf(out, "%-22s %9s %11s %10s %10s %10s %10s %11s %8s %10s\n",
+		"operation", "calls", "total_ms", "avg_us", "min_us", "max_us", "p99_us", "touched_MB", "allocs", "io_MB");
+	for (int i = 0; i < num_counters; ++i) {
+		const Stat_counter_t* c = &counters[i];
+		if (c->calls == 0 && c->allocs == 0) {
+			continue;
+		}
+		fprintf(out, "%-22s %9llu %11.3f %10.2f %10.2f %10.2f %10.2f %11.2f %8llu %10.2f\n",
+			c->name, (unsigned long long)c->calls, c->total_ns / 1e6,
+			c->calls ? c->total_ns / 1e3 / c->calls : 0.0,
+			c->min_ns ? (c->min_ns - 1) / 1e3 : 0.0, c->max_ns / 1e3, percentile_ns(c, 99) / 1e3,
+			c->bytes / 1048576.0, (unsigned long long)c->allocs, c->io_bytes / 1048576.0);
+	}
+}// end stats_print
+
+/*
+ * PURPOSE: Print every counter that has been hit as one JSON object
+ * INPUTS:
+ *      Destination stream, out
+ * RETURN:
+ *      void
+ **/
+void stats_print_json (FILE* out) {
+	bool first = true;
+	fprintf(out, "{\"counters\":[");
+	for (int i = 0; i < num_counters; ++i) {
+		const Stat_counter_t* c = &counters[i];
+		if (c->calls == 0 && c->allocs == 0) {
+			continue;
+		}
+		fprintf(out, "%s{\"name\":\"%s\",\"calls\":%llu,\"total_ns\":%llu,\"min_ns\":%llu,\"max_ns\":%llu,"
+			"\"p50_ns\":%llu,\"p99_ns\":%llu,\"bytes\":%llu,\"allocs\":%llu,\"alloc_bytes\":%llu,\"io_bytes\":%llu}",
+			first ? "" : ",", c->name, (unsigned long long)c->calls, (unsigned long long)c->total_ns,
+			(unsigned long long)(c->min_ns ? c->min_ns - 1 : 0), (unsigned long long)c->max_ns,
+			(unsigned long long)percentile_ns(c, 50), (unsigned long long)percentile_ns(c, 99),
+			(unsigned long long)c->bytes, (unsigned long long)c->allocs,
+			(unsigned long long)c->alloc_bytes, (unsigned long long)c->io_bytes);
+		first = false;
+	}
+	fprintf(out, "]}\n");
+}// end stats_print_json
@@ -0,0 +1,58 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Session-wide latency and traffic counters. Matrix entry points record
+ * against the fixed ids below; commands register a counter per name. While
+ * a command runs, everything its matrix calls record is also charged to the
+ * command's counter, so the command rows show the total bytes, allocations
+ * and I/O each command caused. Updates are lock-free atomics.
+ */
+typedef enum {
+	STAT_CREATE_MATRIX = 0,
+	STAT_DESTROY_MATRIX,
+	STAT_ADD_MATRICES,
+	STAT_MULTIPLY_MATRICES,
+	STAT_SHIFT_MATRIX,
+	STAT_SUM_MATRIX,
+	STAT_EQUAL_MATRICES,
+	STAT_DUPLICATE_MATRIX,
+	STAT_RANDOM_MATRIX,
+	STAT_READ_MATRIX,
+	STAT_WRITE_MATRIX,
+	STAT_DISPLAY_MATRIX,
+	STAT_EVALUATE_EXPRESSION,
+	STAT_UNSHARE_MATRIX,
+	STAT_CONVERT_MATRIX,
+	STAT_SET_MATRIX,
+	STAT_TRANSPOSE_MATRIX,
+	STAT_HASH_MATRIX,
+	STAT_AGGREGATE_MATRIX,
+	STAT_STREAM_RANDOM,
+	STAT_STREAM_ADD,
+	STAT_STREAM_SHIFT,
+	STAT_STREAM_SUM,
+	STAT_STREAM_EQUAL,
+	STAT_CAST_MATRIX,
+	STAT_EXPORT_MATRIX,
+	STAT_IMPORT_MATRIX,
+	STAT_NUM_FIXED
+}Stat_id_t;
+
+#define STATS_MAX_COUNTERS 128
+
+uint64_t stats_now (void);
+void stats_record (int id, uint64_t start_ns, uint64_t bytes, uint64_t io_bytes);
+void stats_note_alloc (uint64_t bytes);
+int stats_counter (const char* name);
+void stats_begin_command (int id);
+void stats_end_command (int id, uint64_t start_ns);
+void stats_reset (void);
+void stats_print (FILE* out);
+void stats_print_json (FILE* out);
+
+#endif
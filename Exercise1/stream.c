@@ -0,0 +1,555 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "stream.h"
+#include "matrix.h"
+#include "kernels.h"
+#include "pool.h"
+#include "alloc.h"
+#include "stats.h"
+
+#define STREAM_CHUNK_ELEMENTS (STREAM_CHUNK / sizeof(unsigned int))
+
+/*
+ * An operand file. The elements streamed are the stored ones from
+ * first_byte into the data: all of them, or only the values of a CSR file
+ * when summing.
+ */
+typedef struct {
+	int fd;
+	Matrix_t shape;	/* name, dimensions, format and nnz from the header; no data */
+	uint64_t data_offset;
+	uint64_t first_byte;
+	size_t elements;
+	bool paced;	/* larger than the page cache should hold, see beyond_cache */
+}Stream_file_t;
+
+/* A result being written to a temporary file beside its target */
+typedef struct {
+	int fd;
+	char* tmp_path;
+	uint64_t data_offset;
+	bool paced;
+	uint64_t pending;	/* start and length of the last chunk handed to writeback */
+	size_t pending_len;
+}Stream_output_t;
+
+/*
+ * Argument block for the per-chunk tasks. dst, a and b point at the chunk
+ * buffers; reductions leave one partial per pool chunk.
+ */
+typedef struct {
+	unsigned int* dst;
+	const unsigned int* a;
+	const unsigned int* b;
+	unsigned int shift;
+	uint64_t key;	/* random: fill key from next_random_key */
+	uint64_t first_block;	/* random: index of the chunk's first block in the whole fill */
+	size_t n;	/* elements in the chunk */
+	unsigned int start_range;
+	unsigned int span;
+	uint64_t partial[POOL_MAX_CHUNKS];
+	bool mismatch;
+}Stream_job_t;
+
+static bool beyond_cache (uint64_t bytes);
+static bool open_operand (const char* path, Stream_file_t* f);
+static bool read_chunk (Stream_file_t* f, size_t first, void* buf, size_t n);
+static bool begin_result (const char* path, Matrix_t* shape, Stream_output_t* out);
+static bool write_chunk (Stream_output_t* out, size_t first, const void* buf, size_t n);
+static bool run_chunks (size_t elements, Stream_file_t* a, Stream_file_t* b, Stream_output_t* out,
+		Pool_task_t task, size_t unit, Stream_job_t* job, uint64_t* total);
+
+static void add_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Stream_job_t* job = arg;
+	kernel_add_u32(&job->dst[begin], &job->a[begin], &job->b[begin], end - begin);
+}
+
+static void shl_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Stream_job_t* job = arg;
+	kernel_shl_u32(&job->dst[begin], &job->a[begin], job->shift, end - begin);
+}
+
+static void shr_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Stream_job_t* job = arg;
+	kernel_shr_u32(&job->dst[begin], &job->a[begin], job->shift, end - begin);
+}
+
+static void sum_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Stream_job_t* job = arg;
+	job->partial[chunk] = kernel_sum_u32(&job->a[begin], end - begin);
+}
+
+static void equal_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Stream_job_t* job = arg;
+	if (__atomic_load_n(&job->mismatch, __ATOMIC_RELAXED)) {
+		return;
+	}
+	if (!kernel_equal_u32(&job->a[begin], &job->b[begin], end - begin)) {
+		__atomic_store_n(&job->mismatch, true, __ATOMIC_RELAXED);
+	}
+}
+
+/* [begin, end) counts MATRIX_RANDOM_BLOCK-element blocks of the chunk, keyed by their index in the whole fill */
+static void random_task (void* arg, size_t chunk, size_t begin, size_t end) {
+	Stream_job_t* job = arg;
+	Kernel_rng_t rng;
+	for (size_t block = begin; block < end; ++block) {
+		const size_t first = block * MATRIX_RANDOM_BLOCK;
+		const size_t count = job->n - first < MATRIX_RANDOM_BLOCK ? job->n - first : MATRIX_RANDOM_BLOCK;
+		kernel_rng_init(&rng, job->key, job->first_block + block);
+		kernel_random_u32(&job->dst[first], &rng, job->start_range, job->span, count);
+	}
+}
+
+/*
+ * PURPOSE: Write a dense matrix file of uniform random values without
+ *      holding the matrix: the same fill random_matrix would give a matrix
+ *      of these dimensions, generated a chunk at a time
+ * INPUTS:
+ *      File to write, path (its last component names the matrix)
+ *      Dimensions, rows and cols
+ *      Range of the values, start_range to end_range inclusive
+ * RETURN:
+ *      If the dimensions or range are bad or any I/O fails, return false.
+ *      Else, return true.
+ **/
+bool stream_random (const char* path, size_t rows, size_t cols, unsigned int start_range, unsigned int end_range) {
+	if (!path || !rows || !cols || start_range > end_range) {
+		perror("stream_random: bad input\n");
+		return false;
+	}
+	const uint64_t start = stats_now();
+	Matrix_t shape = { .rows = rows, .cols = cols, .format = MATRIX_FORMAT_DENSE };
+	if (matrix_stored_bytes(&shape) == SIZE_MAX) {
+		printf("Matrix dimensions (%zu,%zu) are too large\n", rows, cols);
+		return false;
+	}
+	Stream_output_t out;
+	if (!begin_result(path, &shape, &out)) {
+		return false;
+	}
+	/* a span of 0 means the full 32-bit range */
+	Stream_job_t job = { .key = next_random_key(), .start_range = start_range, .span = end_range + 1 - start_range };
+	const size_t n = rows * cols;
+	bool ok = run_chunks(n, NULL, NULL, &out, random_task, MATRIX_RANDOM_BLOCK, &job, NULL);
+	ok = finish_temp_file(out.fd, out.tmp_path, path, ok, false);
+	if (ok) {
+		stats_record(STAT_STREAM_RANDOM, start, n * sizeof(unsigned int), n * sizeof(unsigned int));
+	}
+	return ok;
+}// end stream_random
+
+/*
+ * PURPOSE: Add two matrix files element by element into a third, c = a + b,
+ *      a chunk at a time. Both must have the same dimensions and both be
+ *      dense or both tiled; the sum keeps their layout.
+ * INPUTS:
+ *      Operand files, a_path and b_path
+ *      File to write, c_path (may be an operand; its last component names the matrix)
+ * RETURN:
+ *      If the operands do not match or any I/O fails, return false.
+ *      Else, return true.
+ **/
+bool stream_add (const char* a_path, const char* b_path, const char* c_path) {
+	if (!a_path || !b_path || !c_path) {
+		perror("stream_add: bad input\n");
+		return false;
+	}
+	const uint64_t start = stats_now();
+	Stream_file_t a;
+	Stream_file_t b;
+	if (!open_operand(a_path, &a)) {
+		return false;
+	}
+	if (!open_operand(b_path, &b)) {
+		close(a.fd);
+		return false;
+	}
+	bool ok = false;
+	if (a.shape.rows != b.shape.rows || a.shape.cols != b.shape.cols) {
+		printf("stream_add: dimension mismatch (%zu,%zu) + (%zu,%zu)\n",
+			a.shape.rows, a.shape.cols, b.shape.rows, b.shape.cols);
+	}
+	else if (a.shape.format == MATRIX_FORMAT_CSR || a.shape.format != b.shape.format) {
+		printf("stream_add: both files must be dense or both tiled\n");
+	}
+	else {
+		Matrix_t shape = a.shape;
+		Stream_output_t out;
+		if (begin_result(c_path, &shape, &out)) {
+			Stream_job_t job = { 0 };
+			ok = run_chunks(a.elements, &a, &b, &out, add_task, 1, &job, NULL);
+			ok = finish_temp_file(out.fd, out.tmp_path, c_path, ok, false);
+		}
+	}
+	close(a.fd);
+	close(b.fd);
+	if (ok) {
+		stats_record(STAT_STREAM_ADD, start, a.elements * 3 * sizeof(unsigned int),
+			a.elements * 3 * sizeof(unsigned int));
+	}
+	return ok;
+}// end stream_add
+
+/*
+ * PURPOSE: Shift every element of a dense or tiled matrix file into a
+ *      result file, a chunk at a time
+ * INPUTS:
+ *      Operand file, path
+ *      'l' for a left shift, else right, direction
+ *      Bits to shift by, shift
+ *      File to write, result_path (may be path; its last component names the matrix)
+ * RETURN:
+ *      If the operand is sparse or any I/O fails, return false.
+ *      Else, return true.
+ **/
+bool stream_shift (const char* path, char direction, unsigned int shift, const char* result_path) {
+	if (!path || !result_path) {
+		perror("stream_shift: bad input\n");
+		return false;
+	}
+	const uint64_t start = stats_now();
+	Stream_file_t a;
+	if (!open_operand(path, &a)) {
+		return false;
+	}
+	bool ok = false;
+	if (a.shape.format == MATRIX_FORMAT_CSR) {
+		/* a shift can turn values to zero, which CSR may not store */
+		printf("stream_shift: %s is sparse, read it instead\n", path);
+	}
+	else {
+		Matrix_t shape = a.shape;
+		Stream_output_t out;
+		if (begin_result(result_path, &shape, &out)) {
+			Stream_job_t job = { .shift = shift };
+			ok = run_chunks(a.elements, &a, NULL, &out, direction == 'l' ? shl_task : shr_task, 1, &job, NULL);
+			ok = finish_temp_file(out.fd, out.tmp_path, result_path, ok, false);
+		}
+	}
+	close(a.fd);
+	if (ok) {
+		stats_record(STAT_STREAM_SHIFT, start, a.elements * 2 * sizeof(unsigned int),
+			a.elements * 2 * sizeof(unsigned int));
+	}
+	return ok;
+}// end stream_shift
+
+/*
+ * PURPOSE: Sum the elements of a matrix file, a chunk at a time. Only the
+ *      values of a CSR file are read.
+ * INPUTS:
+ *      Operand file, path
+ *      Destination for the sum, sum
+ * RETURN:
+ *      If any I/O fails, return false.
+ *      Else, return true.
+ **/
+bool stream_sum (const char* path, uint64_t* sum) {
+	if (!path || !sum) {
+		perror("stream_sum: bad input\n");
+		return false;
+	}
+	const uint64_t start = stats_now();
+	Stream_file_t a;
+	if (!open_operand(path, &a)) {
+		return false;
+	}
+	if (a.shape.format == MATRIX_FORMAT_CSR) {
+		a.first_byte = (a.shape.rows + 1) * sizeof(uint64_t) + a.shape.nnz * sizeof(unsigned int);
+		a.elements = a.shape.nnz;
+	}
+	Stream_job_t job = { 0 };
+	*sum = 0;
+	const bool ok = run_chunks(a.elements, &a, NULL, NULL, sum_task, 1, &job, sum);
+	close(a.fd);
+	if (ok) {
+		stats_record(STAT_STREAM_SUM, start, a.elements * sizeof(unsigned int), a.elements * sizeof(unsigned int));
+	}
+	return ok;
+}// end stream_sum
+
+/*
+ * PURPOSE: Compare two matrix files element by element, a chunk at a time,
+ *      stopping at the first chunk that differs. Files in one layout are
+ *      compared as stored, which for CSR covers the offsets and columns too.
+ * INPUTS:
+ *      Files to compare, a_path and b_path
+ *      Destination for the result, equal
+ * RETURN:
+ *      If the files are in different layouts or any I/O fails, return false.
+ *      Else, return true.
+ **/
+bool stream_equal (const char* a_path, const char* b_path, bool* equal) {
+	if (!a_path || !b_path || !equal) {
+		perror("stream_equal: bad input\n");
+		return false;
+	}
+	const uint64_t start = stats_now();
+	Stream_file_t a;
+	Stream_file_t b;
+	if (!open_operand(a_path, &a)) {
+		return false;
+	}
+	if (!open_operand(b_path, &b)) {
+		close(a.fd);
+		return false;
+	}
+	bool ok = true;
+	*equal = false;
+	if (a.shape.rows != b.shape.rows || a.shape.cols != b.shape.cols) {
+		/* different dimensions are simply not equal */
+	}
+	else if (a.shape.format != b.shape.format) {
+		printf("stream_equal: %s and %s are stored in different formats\n", a_path, b_path);
+		ok = false;
+	}
+	else if (a.shape.nnz == b.shape.nnz) {
+		Stream_job_t job = { 0 };
+		ok = run_chunks(a.elements, &a, &b, NULL, equal_task, 1, &job, NULL);
+		*equal = ok && !job.mismatch;
+	}
+	close(a.fd);
+	close(b.fd);
+	if (ok) {
+		stats_record(STAT_STREAM_EQUAL, start, a.elements * 2 * sizeof(unsigned int),
+			a.elements * 2 * sizeof(unsigned int));
+	}
+	return ok;
+}// end stream_equal
+
+/*Protected Functions in C*/
+
+/*
+ * PURPOSE: Decide whether a file is too large to leave in the page cache.
+ *      Streaming one that big would push everything else out of memory for
+ *      pages that are never used again, so its pages are dropped once done.
+ * INPUTS:
+ *      Size of the file's data, bytes
+ * RETURN:
+ *      If bytes exceed half the physical memory, return true.
+ *      Else, return false.
+ **/
+static bool beyond_cache (uint64_t bytes) {
+	const long pages = sysconf(_SC_PHYS_PAGES);
+	const long page_size = sysconf(_SC_PAGESIZE);
+	return pages > 0 && page_size > 0 && bytes > (uint64_t)pages * page_size / 2;
+}// end beyond_cache
+
+/*
+ * PURPOSE: Open an operand file and read its header
+ * INPUTS:
+ *      File to open, path
+ *      Operand to fill, f
+ * RETURN:
+ *      If the file cannot be opened, is not a plain matrix file or holds
+ *      elements other than u32, return false.
+ *      Else, return true.
+ **/
+static bool open_operand (const char* path, Stream_file_t* f) {
+	f->fd = open(path, O_RDONLY);
+	if (f->fd < 0) {
+		printf("FAILED TO OPEN FOR READING\n");
+		perror(path);
+		return false;
+	}
+	if (!probe_matrix_file(f->fd, &f->shape, &f->data_offset)) {
+		close(f->fd);
+		return false;
+	}
+	if (f->shape.type != MATRIX_TYPE_U32) {
+		printf("%s holds %s elements, streams work on u32 files\n", path, matrix_type_name(f->shape.type));
+		close(f->fd);
+		return false;
+	}
+	const size_t bytes = matrix_stored_bytes(&f->shape);
+	f->first_byte = 0;
+	f->elements = bytes / sizeof(unsigned int);
+	f->paced = beyond_cache(bytes);
+	posix_fadvise(f->fd, f->data_offset, bytes, POSIX_FADV_SEQUENTIAL);
+	return true;
+}// end open_operand
+
+/*
+ * PURPOSE: Read a chunk of an operand's elements, then ask for the next
+ *      chunk so the disk reads it while this one is worked on
+ * INPUTS:
+ *      Operand, f
+ *      Index of the first element, first
+ *      Destination, buf
+ *      Elements to read, n
+ * RETURN:
+ *      If the file is short or the read fails, return false.
+ *      Else, return true.
+ **/
+static bool read_chunk (Stream_file_t* f, size_t first, void* buf, size_t n) {
+	const uint64_t offset = f->data_offset + f->first_byte + (uint64_t)first * sizeof(unsigned int);
+	const size_t len = n * sizeof(unsigned int);
+	size_t done = 0;
+	while (done < len) {
+		const ssize_t got = pread(f->fd, (unsigned char*)buf + done, len - done, offset + done);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			printf("FAILED TO READ MATRIX FILE\n");
+			perror("pread");
+			return false;
+		}
+		done += got;
+	}
+	if (first + n < f->elements) {
+		const size_t next = f->elements - first - n < STREAM_CHUNK_ELEMENTS ? f->elements - first - n : STREAM_CHUNK_ELEMENTS;
+		posix_fadvise(f->fd, offset + len, next * sizeof(unsigned int), POSIX_FADV_WILLNEED);
+	}
+	if (f->paced) {
+		posix_fadvise(f->fd, offset, len, POSIX_FADV_DONTNEED);
+	}
+	return true;
+}// end read_chunk
+
+/*
+ * PURPOSE: Start a result file: a temporary file beside the target holding
+ *      the header, for write_chunk to fill and finish_temp_file to rename
+ * INPUTS:
+ *      Target file, path; its last component becomes the matrix name
+ *      Dimensions, format and nnz of the result, shape (the name is set here)
+ *      Result to fill, out
+ * RETURN:
+ *      If the name is too long or the file cannot be created, return false.
+ *      Else, return true.
+ **/
+static bool begin_result (const char* path, Matrix_t* shape, Stream_output_t* out) {
+	const char* slash = strrchr(path, '/');
+	const char* name = slash ? slash + 1 : path;
+	const size_t len = strlen(name) + 1;
+	if (len == 1 || len > MATRIX_NAME_LEN) {
+		printf("Matrix name %s must be 1 to %d characters\n", name, MATRIX_NAME_LEN - 1);
+		return false;
+	}
+	memcpy(shape->name, name, len);
+	out->fd = create_temp_file(path, &out->tmp_path);
+	if (out->fd < 0) {
+		return false;
+	}
+	if (!write_matrix_header(out->fd, shape, &out->data_offset)) {
+		finish_temp_file(out->fd, out->tmp_path, path, false, false);
+		return false;
+	}
+	out->paced = beyond_cache(matrix_stored_bytes(shape));
+	out->pending_len = 0;
+	return true;
+}// end begin_result
+
+/*
+ * PURPOSE: Write a chunk of a result. For a result too large for the page
+ *      cache, the chunk is handed to writeback at once and the chunk before
+ *      it waited for and dropped, so dirty pages stay at about two chunks
+ *      instead of piling up until the kernel stalls the writer.
+ * INPUTS:
+ *      Result, out
+ *      Index of the first element, first
+ *      Elements to write, buf and n
+ * RETURN:
+ *      If the write fails, return false.
+ *      Else, return true.
+ **/
+static bool write_chunk (Stream_output_t* out, size_t first, const void* buf, size_t n) {
+	const uint64_t offset = out->data_offset + (uint64_t)first * sizeof(unsigned int);
+	const size_t len = n * sizeof(unsigned int);
+	size_t done = 0;
+	while (done < len) {
+		const ssize_t put = pwrite(out->fd, (const unsigned char*)buf + done, len - done, offset + done);
+		if (put < 0 && errno == EINTR) {
+			continue;
+		}
+		if (put <= 0) {
+			printf("FAILED TO WRITE MATRIX FILE\n");
+			perror("pwrite");
+			return false;
+		}
+		done += put;
+	}
+	if (out->paced) {
+		sync_file_range(out->fd, offset, len, SYNC_FILE_RANGE_WRITE);
+		if (out->pending_len) {
+			sync_file_range(out->fd, out->pending, out->pending_len,
+				SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+			posix_fadvise(out->fd, out->pending, out->pending_len, POSIX_FADV_DONTNEED);
+		}
+		out->pending = offset;
+		out->pending_len = len;
+	}
+	return true;
+}// end write_chunk
+
+/*
+ * PURPOSE: Drive a task over the elements of up to two operands, one chunk
+ *      buffer per operand. Each chunk is read, processed on the pool and,
+ *      when there is a result, written from the first buffer.
+ * INPUTS:
+ *      Elements to process, elements
+ *      Operands, a and b (NULL when not used)
+ *      Result, out (NULL when not used)
+ *      Task and the elements each of its items covers, task and unit
+ *      Job carrying the task's settings, job
+ *      Destination for the sum of the task's partials, total (NULL when not used)
+ * RETURN:
+ *      If memory is exhausted or any I/O fails, return false.
+ *      Else, return true; job->mismatch tells whether an equal task stopped early.
+ **/
+static bool run_chunks (size_t elements, Stream_file_t* a, Stream_file_t* b, Stream_output_t* out,
+		Pool_task_t task, size_t unit, Stream_job_t* job, uint64_t* total) {
+	const size_t chunk_elements = elements < STREAM_CHUNK_ELEMENTS ? elements : STREAM_CHUNK_ELEMENTS;
+	const size_t chunk_bytes = (chunk_elements ? chunk_elements : 1) * sizeof(unsigned int);
+	size_t block_sizes[2] = { 0, 0 };
+	bool zeroed = false;
+	unsigned int* buffers[2] = { block_alloc(chunk_bytes, &block_sizes[0], &zeroed), NULL };
+	if (b) {
+		buffers[1] = block_alloc(chunk_bytes, &block_sizes[1], &zeroed);
+	}
+	bool ok = buffers[0] && (!b || buffers[1]);
+	if (!ok) {
+		perror("stream: allocation error\n");
+	}
+	stats_note_alloc(block_sizes[0] + block_sizes[1]);
+	const size_t grain = POOL_MIN_GRAIN / unit ? POOL_MIN_GRAIN / unit : 1;
+	for (size_t first = 0; ok && first < elements && !job->mismatch; first += STREAM_CHUNK_ELEMENTS) {
+		const size_t n = elements - first < STREAM_CHUNK_ELEMENTS ? elements - first : STREAM_CHUNK_ELEMENTS;
+		ok = (!a || read_chunk(a, first, buffers[0], n)) && (!b || read_chunk(b, first, buffers[1], n));
+		if (!ok) {
+			break;
+		}
+		job->dst = buffers[0];
+		job->a = buffers[0];
+		job->b = buffers[1];
+		job->n = n;
+		job->first_block = first / MATRIX_RANDOM_BLOCK;
+		const size_t items = (n + unit - 1) / unit;
+		pool_parallel_for(items, grain, task, job);
+		if (total) {
+			const size_t chunks = pool_chunk_count(items, grain);
+			for (size_t i = 0; i < chunks; ++i) {
+				*total += job->partial[i];
+			}
+		}
+		if (out) {
+			ok = write_chunk(out, first, buffers[0], n);
+		}
+	}
+	for (unsigned int i = 0; i < 2; ++i) {
+		if (buffers[i]) {
+			block_free(buffers[i], block_sizes[i]);
+		}
+	}
+	return ok;
+}// end run_chunks
@@ -0,0 +1,27 @@
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Out-of-core operations on matrix files. Operands stay on disk and are
+ * read, combined and written back STREAM_CHUNK bytes at a time, so memory
+ * use is a few chunks whatever the size of the matrices: files far larger
+ * than RAM can be generated, added, shifted, summed and compared. A chunk
+ * is a whole number of 64 x 64 tiles and of random fill blocks, so tiled
+ * files stream tile by tile and stream_random writes exactly what
+ * random_matrix would. Operands must be plain files from write (read loads
+ * packed and original layout ones); results are written beside the target
+ * and renamed into place, so a result may replace one of its operands.
+ */
+#define STREAM_CHUNK ((size_t)8 << 20)
+
+bool stream_random (const char* path, size_t rows, size_t cols, unsigned int start_range, unsigned int end_range);
+bool stream_add (const char* a_path, const char* b_path, const char* c_path);
+bool stream_shift (const char* path, char direction, unsigned int shift, const char* result_path);
+bool stream_sum (const char* path, uint64_t* sum);
+bool stream_equal (const char* a_path, const char* b_path, bool* equal);
+
+#endif
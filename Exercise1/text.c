@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "text.h"
+
+/* "00" through "99": digit pair i sits at 2 * i */
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/* Byte-parallel tests on 64-bit words: every byte holds 0x01, every byte holds 0x80 */
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+
+/* Words are little-endian in memory, so byte i of the text is bits 8i..8i+7 of the word */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SWAR_WORDS 1
+#else
+#define SWAR_WORDS 0
+#endif
+
+static inline uint64_t load_word (const char* p) {
+	uint64_t word;
+	memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+/*
+ * PURPOSE: Find a byte in a range, eight bytes per step: a byte of the word
+ *      XOR c is zero where the text holds c, and the zero-byte test flags
+ *      the lowest such byte exactly
+ * INPUTS:
+ *      Range to search, p and end
+ *      Byte to find, c
+ * RETURN:
+ *      The first c in the range, or end
+ **/
+const char* text_find_byte (const char* p, const char* end, char c) {
+#if SWAR_WORDS
+	const uint64_t pattern = SWAR_ONES * (unsigned char)c;
+	while (end - p >= 8) {
+		const uint64_t x = load_word(p) ^ pattern;
+		const uint64_t found = (x - SWAR_ONES) & ~x & SWAR_HIGHS;
+		if (found) {
+			return p + (__builtin_ctzll(found) >> 3);
+		}
+		p += 8;
+	}
+#endif
+	while (p < end && *p != c) {
+		++p;
+	}
+	return p;
+}// end text_find_byte
+
+/*
+ * PURPOSE: Read a decimal number. Eight digits at a time are checked and
+ *      converted in one word: each byte minus '0' must be at most 9, and
+ *      three multiplies merge the bytes into pairs, quads and the whole
+ *      eight-digit value.
+ * INPUTS:
+ *      Range holding the number first, p and end
+ *      Destination for the value, value
+ *      Destination flag, set when the value needs more than 64 bits, overflow
+ * RETURN:
+ *      The first byte after the digits, or p when it is not a digit
+ **/
+const char* text_scan_u64 (const char* p, const char* end, uint64_t* value, bool* overflow) {
+	uint64_t v = 0;
+	bool over = false;
+#if SWAR_WORDS
+	while (end - p >= 8) {
+		const uint64_t word = load_word(p);
+		const uint64_t digits = word - SWAR_ONES * '0';
+		/* a byte below '0' borrows into its high bit, and one above '9' reaches 0x10 once 6 is added */
+		if (((digits | (digits + SWAR_ONES * 6)) & (SWAR_ONES * 0xF0)) != 0) {
+			break;
+		}
+		uint64_t eight = (digits * 10 + (digits >> 8)) & 0x00FF00FF00FF00FFULL;
+		eight = (eight * 100 + (eight >> 16)) & 0x0000FFFF0000FFFFULL;
+		eight = (eight * 10000 + (eight >> 32)) & 0xFFFFFFFFULL;
+		over |= __builtin_mul_overflow(v, 100000000ULL, &v) | __builtin_add_overflow(v, eight, &v);
+		p += 8;
+	}
+#endif
+	while (p < end && (unsigned char)(*p - '0') <= 9) {
+		over |= __builtin_mul_overflow(v, 10ULL, &v) | __builtin_add_overflow(v, (uint64_t)(*p - '0'), &v);
+		++p;
+	}
+	*value = v;
+	*overflow = over;
+	return p;
+}// end text_scan_u64
+
+/*
+ * PURPOSE: Count the decimal digits of a value
+ * INPUTS:
+ *      Value, value
+ * RETURN:
+ *      Number of digits, 1 to 20
+ **/
+static size_t decimal_digits (uint64_t value) {
+	size_t digits = 1;
+	for (;;) {
+		if (value < 10) {
+			return digits;
+		}
+		if (value < 100) {
+			return digits + 1;
+		}
+		if (value < 1000) {
+			return digits + 2;
+		}
+		if (value < 10000) {
+			return digits + 3;
+		}
+		value /= 10000;
+		digits += 4;
+	}
+}// end decimal_digits
+
+/*
+ * PURPOSE: Write a value in decimal, without a terminator. The digits are
+ *      filled from the end two at a time, so a 10-digit value takes five
+ *      divisions instead of ten.
+ * INPUTS:
+ *      Destination with room for 20 bytes, dst
+ *      Value, value
+ * RETURN:
+ *      Number of bytes written
+ **/
+size_t text_format_u64 (char* dst, uint64_t value) {
+	const size_t len = decimal_digits(value);
+	char* at = &dst[len];
+	while (value >= 100) {
+		const unsigned int pair = (unsigned int)(value % 100);
+		value /= 100;
+		at -= 2;
+		memcpy(at, &digit_pairs[pair * 2], 2);
+	}
+	if (value >= 10) {
+		memcpy(at - 2, &digit_pairs[value * 2], 2);
+	}
+	else {
+		at[-1] = (char)('0' + value);
+	}
+	return len;
+}// end text_format_u64
+
+/*
+ * PURPOSE: Start a buffered writer on an open descriptor
+ * INPUTS:
+ *      Writer to set up, w
+ *      Descriptor to write to, fd (left open by text_writer_close)
+ * RETURN:
+ *      If the buffer cannot be allocated, return false.
+ *      Else, return true.
+ **/
+bool text_writer_open (Text_writer_t* w, int fd) {
+	if (!w || fd < 0) {
+		perror("text_writer_open: bad input\n");
+		return false;
+	}
+	memset(w, 0, sizeof(Text_writer_t));
+	w->fd = fd;
+	w->buf = malloc(TEXT_BUFFER);
+	if (!w->buf) {
+		perror("text_writer_open: allocation error\n");
+		return false;
+	}
+	return true;
+}// end text_writer_open
+
+/*
+ * PURPOSE: Hand the buffered text to the descriptor in one write, retrying
+ *      short writes and interrupts. After a failure the buffer is still
+ *      emptied, so callers can keep formatting and check once at the end.
+ * INPUTS:
+ *      Writer, w
+ * RETURN:
+ *      If this or an earlier write failed, return false.
+ *      Else, return true.
+ **/
+bool text_flush (Text_writer_t* w) {
+	size_t done = 0;
+	while (!w->failed && done < w->len) {
+		const ssize_t n = write(w->fd, &w->buf[done], w->len - done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			perror("text_flush: write");
+			w->failed = true;
+			break;
+		}
+		done += n;
+	}
+	w->written += done;
+	w->len = 0;
+	return !w->failed;
+}// end text_flush
+
+/*
+ * PURPOSE: Flush what is left and free the buffer
+ * INPUTS:
+ *      Writer, w
+ * RETURN:
+ *      If any write failed, return false.
+ *      Else, return true.
+ **/
+bool text_writer_close (Text_writer_t* w) {
+	const bool ok = text_flush(w);
+	free(w->buf);
+	w->buf = NULL;
+	return ok;
+}// end text_writer_close
+
+/*
+ * PURPOSE: Add a floating point value, as printf's %.*g would print it
+ * INPUTS:
+ *      Writer, w
+ *      Value, value
+ *      Significant digits, precision (at most 17)
+ * RETURN:
+ *      void
+ **/
+void text_put_real (Text_writer_t* w, double value, int precision) {
+	char* at = text_reserve(w);
+	const int n = snprintf(at, TEXT_MAX_ITEM, "%.*g", precision, value);
+	w->len += n > 0 && n < (int)TEXT_MAX_ITEM ? (size_t)n : 0;
+}// end text_put_real
+
+/*
+ * PURPOSE: Add a short string
+ * INPUTS:
+ *      Writer, w
+ *      String of fewer than TEXT_MAX_ITEM bytes, s
+ * RETURN:
+ *      void
+ **/
+void text_put_str (Text_writer_t* w, const char* s) {
+	char* at = text_reserve(w);
+	const size_t n = strnlen(s, TEXT_MAX_ITEM - 1);
+	memcpy(at, s, n);
+	w->len += n;
+}// end text_put_str
@@ -0,0 +1,65 @@
+#ifndef _TEXT_H_
+#define _TEXT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Buffered text output for display and export. Numbers are formatted
+ * straight into a TEXT_BUFFER byte buffer, integers two digits at a time
+ * from a table of digit pairs, and the buffer goes to the descriptor with
+ * one write whenever it fills, so printing a large matrix costs a system
+ * call per megabyte instead of a stdio call per element. A failed write is
+ * remembered and reported by text_writer_close.
+ */
+#define TEXT_BUFFER ((size_t)1 << 20)
+
+/* Longest text a single put may add: a double at 17 significant digits fits easily */
+#define TEXT_MAX_ITEM 32
+
+typedef struct {
+	int fd;
+	char* buf;
+	size_t len;
+	uint64_t written;	/* bytes handed to the descriptor so far */
+	bool failed;
+}Text_writer_t;
+
+/*
+ * Scanning for text input. Both look at eight bytes per step, in a 64-bit
+ * word, and never read at or past end, so they work on mapped files with
+ * no terminator. text_find_byte returns the first c in [p, end), or end.
+ * text_scan_u64 reads the decimal digits starting at p, eight at a time
+ * where it can, and returns the first byte after them (p itself when there
+ * are none); overflow is set when the value does not fit in 64 bits.
+ */
+const char* text_find_byte (const char* p, const char* end, char c);
+const char* text_scan_u64 (const char* p, const char* end, uint64_t* value, bool* overflow);
+
+size_t text_format_u64 (char* dst, uint64_t value);
+bool text_writer_open (Text_writer_t* w, int fd);
+bool text_flush (Text_writer_t* w);
+bool text_writer_close (Text_writer_t* w);
+void text_put_real (Text_writer_t* w, double value, int precision);
+void text_put_str (Text_writer_t* w, const char* s);
+
+/* Makes room for TEXT_MAX_ITEM more bytes, flushing if the buffer is nearly full */
+static inline char* text_reserve (Text_writer_t* w) {
+	if (w->len > TEXT_BUFFER - TEXT_MAX_ITEM) {
+		text_flush(w);
+	}
+	return &w->buf[w->len];
+}
+
+static inline void text_put_u64 (Text_writer_t* w, uint64_t value) {
+	char* at = text_reserve(w);
+	w->len += text_format_u64(at, value);
+}
+
+static inline void text_put_char (Text_writer_t* w, char c) {
+	text_reserve(w);
+	w->buf[w->len++] = c;
+}
+
+#endif
@@ -0,0 +1,525 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "workspace.h"
+
+/*
+ * File layout: superblock slots at offsets 0 and WORKSPACE_PAGE, then
+ * extents from WORKSPACE_DATA_START. The valid superblock with the highest
+ * generation is current; the other is overwritten by the next save.
+ */
+#define WORKSPACE_MAGIC "OSFMWKSP"
+#define WORKSPACE_VERSION 3
+#define WORKSPACE_PAGE 4096
+#define WORKSPACE_DATA_START (2 * WORKSPACE_PAGE)
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;	/* sizeof(Workspace_entry_t) */
+	uint64_t generation;
+	uint64_t directory_offset;
+	uint64_t directory_count;
+	uint64_t directory_checksum;
+	uint64_t checksum;	/* of every byte before it */
+}Workspace_super_t;
+
+/* Directory entry of version 1 workspaces, whose dimensions are 32-bit; widened on open */
+typedef struct {
+	char name[MATRIX_NAME_LEN];
+	uint32_t rows;
+	uint32_t cols;
+	uint32_t format;
+	uint64_t nnz;
+	uint64_t offset;
+	uint64_t bytes;
+}Workspace_entry_v1_t;
+
+/*
+ * PURPOSE: Checksum a byte range (64-bit FNV-1a)
+ * INPUTS:
+ *      Bytes to hash, data and len
+ * RETURN:
+ *      The hash
+ **/
+static uint64_t checksum (const void* data, size_t len) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	const unsigned char* p = data;
+	for (size_t i = 0; i < len; ++i) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}// end checksum
+
+/* Bytes rounded up to whole pages */
+static uint64_t round_pages (uint64_t bytes) {
+	return (bytes + WORKSPACE_PAGE - 1) / WORKSPACE_PAGE * WORKSPACE_PAGE;
+}
+
+static int compare_extents (const void* a, const void* b) {
+	const uint64_t x = ((const Workspace_extent_t*)a)->offset;
+	const uint64_t y = ((const Workspace_extent_t*)b)->offset;
+	return x < y ? -1 : x > y;
+}
+
+static int compare_entries (const void* a, const void* b) {
+	const uint64_t x = ((const Workspace_entry_t*)a)->offset;
+	const uint64_t y = ((const Workspace_entry_t*)b)->offset;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * PURPOSE: Write exactly len bytes at a file offset, resuming after short writes
+ * INPUTS:
+ *      Descriptor, fd
+ *      Bytes to write, buf and len
+ *      File offset, offset
+ * RETURN:
+ *      If a write fails, return false.
+ *      Else, return true.
+ **/
+static bool pwrite_full (int fd, const void* buf, size_t len, uint64_t offset) {
+	const unsigned char* p = buf;
+	while (len > 0) {
+		const ssize_t put = pwrite(fd, p, len, offset);
+		if (put < 0 && errno == EINTR) {
+			continue;
+		}
+		if (put <= 0) {
+			perror("workspace: write");
+			return false;
+		}
+		p += put;
+		len -= put;
+		offset += put;
+	}
+	return true;
+}// end pwrite_full
+
+/*
+ * PURPOSE: Rebuild the free list as the gaps between the used extents
+ * INPUTS:
+ *      Workspace, ws
+ *      Used extents in any order, possibly overlapping; sorted in place, used and count
+ * RETURN:
+ *      If memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool rebuild_free (Workspace_t* ws, Workspace_extent_t* used, size_t count) {
+	qsort(used, count, sizeof(Workspace_extent_t), compare_extents);
+	ws->free_count = 0;
+	uint64_t at = WORKSPACE_DATA_START;
+	for (size_t i = 0; i <= count; ++i) {
+		if (i < count && used[i].length == 0) {
+			continue;
+		}
+		if (i < count && used[i].offset <= at) {
+			const uint64_t end = used[i].offset + used[i].length;
+			at = end > at ? end : at;
+			continue;
+		}
+		if (i == count) {
+			break;
+		}
+		if (ws->free_count == ws->free_capacity) {
+			const size_t capacity = ws->free_capacity ? ws->free_capacity * 2 : 16;
+			Workspace_extent_t* grown = realloc(ws->free, capacity * sizeof(Workspace_extent_t));
+			if (!grown) {
+				perror("workspace: allocation error\n");
+				return false;
+			}
+			ws->free = grown;
+			ws->free_capacity = capacity;
+		}
+		ws->free[ws->free_count++] = (Workspace_extent_t){ .offset = at, .length = used[i].offset - at };
+		at = used[i].offset + used[i].length;
+	}
+	ws->end = at;
+	return true;
+}// end rebuild_free
+
+/*
+ * PURPOSE: Rebuild the free list from the committed directory alone, which
+ *      also gives back extents taken by a save that did not commit
+ * INPUTS:
+ *      Workspace, ws
+ * RETURN:
+ *      If memory is exhausted, return false.
+ *      Else, return true.
+ **/
+static bool free_uncommitted (Workspace_t* ws) {
+	Workspace_extent_t* used = malloc((ws->count + 1) * sizeof(Workspace_extent_t));
+	if (!used) {
+		perror("workspace: allocation error\n");
+		return false;
+	}
+	for (size_t i = 0; i < ws->count; ++i) {
+		used[i] = (Workspace_extent_t){ .offset = ws->entries[i].offset, .length = round_pages(ws->entries[i].bytes) };
+	}
+	used[ws->count] = ws->directory;
+	const bool ok = rebuild_free(ws, used, ws->count + 1);
+	free(used);
+	return ok;
+}// end free_uncommitted
+
+/*
+ * PURPOSE: Take space for an extent, first fit from the free list, else at the end of the file
+ * INPUTS:
+ *      Workspace, ws
+ *      Whole pages wanted, length
+ * RETURN:
+ *      Offset of the extent
+ **/
+static uint64_t allocate_extent (Workspace_t* ws, uint64_t length) {
+	for (size_t i = 0; i < ws->free_count; ++i) {
+		Workspace_extent_t* run = &ws->free[i];
+		if (run->length < length) {
+			continue;
+		}
+		const uint64_t offset = run->offset;
+		run->offset += length;
+		run->length -= length;
+		if (run->length == 0) {
+			memmove(run, run + 1, (ws->free_count - i - 1) * sizeof(Workspace_extent_t));
+			--ws->free_count;
+		}
+		return offset;
+	}
+	const uint64_t offset = ws->end;
+	ws->end += length;
+	return offset;
+}// end allocate_extent
+
+/*
+ * PURPOSE: Read one superblock slot and check it
+ * INPUTS:
+ *      Descriptor, fd
+ *      Slot number, slot (0 or 1)
+ *      Destination for the superblock, super
+ * RETURN:
+ *      If the slot is short, torn or not a workspace superblock, return false.
+ *      Else, return true.
+ **/
+static bool read_super (int fd, unsigned int slot, Workspace_super_t* super) {
+	if (pread(fd, super, sizeof(*super), (off_t)slot * WORKSPACE_PAGE) != sizeof(*super)) {
+		return false;
+	}
+	return memcmp(super->magic, WORKSPACE_MAGIC, sizeof(super->magic)) == 0
+		&& ((super->version >= 2 && super->version <= WORKSPACE_VERSION
+				&& super->entry_size == sizeof(Workspace_entry_t))
+			|| (super->version == 1 && super->entry_size == sizeof(Workspace_entry_v1_t)))
+		&& super->checksum == checksum(super, offsetof(Workspace_super_t, checksum));
+}// end read_super
+
+/*
+ * PURPOSE: Check one directory entry against the file before mapping it
+ * INPUTS:
+ *      Entry, e
+ *      Size of the file, file_len
+ * RETURN:
+ *      If the entry is inconsistent, return false.
+ *      Else, return true.
+ **/
+static bool check_entry (const Workspace_entry_t* e, uint64_t file_len) {
+	Matrix_t shape = { .rows = e->rows, .cols = e->cols, .format = e->format, .type = e->type, .nnz = e->nnz };
+	if (memchr(e->name, '\0', sizeof(e->name)) == NULL || e->name[0] == '\0'
+		|| (e->format != MATRIX_FORMAT_DENSE && e->format != MATRIX_FORMAT_CSR && e->format != MATRIX_FORMAT_TILED)
+		|| e->type >= MATRIX_TYPE_COUNT || (e->type != MATRIX_TYPE_U32 && e->format != MATRIX_FORMAT_DENSE)
+		|| matrix_stored_bytes(&shape) == SIZE_MAX
+		|| (e->format == MATRIX_FORMAT_CSR && e->nnz > (uint64_t)e->rows * e->cols)
+		|| matrix_stored_bytes(&shape) != e->bytes) {
+		return false;
+	}
+	return e->bytes == 0 || (e->offset % WORKSPACE_PAGE == 0 && e->offset >= WORKSPACE_DATA_START
+		&& e->offset <= file_len && e->bytes <= file_len - e->offset);
+}// end check_entry
+
+/*
+ * PURPOSE: Open or create a workspace file and register every matrix in it.
+ *      The file is locked so only one session uses it at a time.
+ * INPUTS:
+ *      Workspace to set up, ws
+ *      Path of the file, path
+ *      Registry receiving the matrices, reg (same names are replaced)
+ * RETURN:
+ *      If the file cannot be opened or is not a valid workspace, return false.
+ *      Else, return true.
+ **/
+bool workspace_open (Workspace_t* ws, const char* path, Registry_t* reg) {
+	if (!ws || !path || !reg) {
+		perror("workspace_open: bad input\n");
+		return false;
+	}
+	memset(ws, 0, sizeof(Workspace_t));
+	ws->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (ws->fd < 0) {
+		perror(path);
+		return false;
+	}
+	if (flock(ws->fd, LOCK_EX | LOCK_NB) != 0) {
+		printf("Workspace %s is in use by another session\n", path);
+		workspace_close(ws);
+		return false;
+	}
+	struct stat st;
+	if (fstat(ws->fd, &st) != 0) {
+		perror(path);
+		workspace_close(ws);
+		return false;
+	}
+
+	Workspace_super_t supers[2];
+	const bool valid[2] = { read_super(ws->fd, 0, &supers[0]), read_super(ws->fd, 1, &supers[1]) };
+	if (!valid[0] && !valid[1]) {
+		if (st.st_size != 0) {
+			printf("%s is not a workspace file\n", path);
+			workspace_close(ws);
+			return false;
+		}
+		/* a new file: the first save goes to slot 0 */
+		ws->slot = 1;
+		if (!free_uncommitted(ws)) {
+			workspace_close(ws);
+			return false;
+		}
+		return true;
+	}
+	const unsigned int slot = valid[0] && (!valid[1] || supers[0].generation > supers[1].generation) ? 0 : 1;
+	const Workspace_super_t* super = &supers[slot];
+	ws->slot = slot;
+	ws->generation = super->generation;
+
+	const uint64_t file_len = st.st_size;
+	const size_t entry_size = super->entry_size;
+	bool ok = super->directory_count <= (file_len / entry_size)
+		&& super->directory_offset % WORKSPACE_PAGE == 0 && super->directory_offset >= WORKSPACE_DATA_START
+		&& super->directory_offset <= file_len
+		&& super->directory_count * entry_size <= file_len - super->directory_offset;
+	const size_t count = ok ? super->directory_count : 0;
+	const size_t dir_bytes = count * entry_size;
+	/* entries are at least as large as version 1 ones, so the raw directory fits before widening */
+	ws->entries = malloc((count ? count : 1) * sizeof(Workspace_entry_t));
+	ok = ok && ws->entries
+		&& (count == 0 || pread(ws->fd, ws->entries, dir_bytes, super->directory_offset) == (ssize_t)dir_bytes)
+		&& checksum(ws->entries, dir_bytes) == super->directory_checksum;
+	if (ok && super->version == 1) {
+		/* back to front, so no entry is overwritten before it is read */
+		for (size_t i = count; i-- > 0;) {
+			Workspace_entry_v1_t old;
+			memcpy(&old, (unsigned char*)ws->entries + i * sizeof(old), sizeof(old));
+			Workspace_entry_t* e = &ws->entries[i];
+			memcpy(e->name, old.name, sizeof(e->name));
+			e->type = MATRIX_TYPE_U32;
+			e->format = old.format;
+			e->rows = old.rows;
+			e->cols = old.cols;
+			e->nnz = old.nnz;
+			e->offset = old.offset;
+			e->bytes = old.bytes;
+		}
+	}
+	/* version 2 entries hold u32 matrices, and their type byte is whatever the padding held */
+	for (size_t i = 0; ok && super->version == 2 && i < count; ++i) {
+		ws->entries[i].type = MATRIX_TYPE_U32;
+	}
+	for (size_t i = 0; ok && i < count; ++i) {
+		ok = check_entry(&ws->entries[i], file_len);
+	}
+	if (!ok) {
+		printf("CORRUPT WORKSPACE DIRECTORY in %s\n", path);
+		workspace_close(ws);
+		return false;
+	}
+	ws->count = count;
+	ws->directory = (Workspace_extent_t){ .offset = super->directory_offset, .length = round_pages(dir_bytes ? dir_bytes : 1) };
+
+	for (size_t i = 0; i < count; ++i) {
+		const Workspace_entry_t* e = &ws->entries[i];
+		Matrix_t shape = { .rows = e->rows, .cols = e->cols, .format = e->format, .type = e->type, .nnz = e->nnz };
+		memcpy(shape.name, e->name, sizeof(shape.name));
+		Matrix_t* m = NULL;
+		if (!map_matrix_region(&m, &shape, ws->fd, e->offset)) {
+			workspace_close(ws);
+			return false;
+		}
+		if (!registry_insert(reg, m)) {
+			destroy_matrix(&m);
+			workspace_close(ws);
+			return false;
+		}
+	}
+	if (!free_uncommitted(ws)) {
+		workspace_close(ws);
+		return false;
+	}
+	return true;
+}// end workspace_open
+
+/*
+ * PURPOSE: Find a committed entry by extent
+ * INPUTS:
+ *      Workspace, ws
+ *      Extent start and data size, offset and bytes
+ * RETURN:
+ *      If a committed entry has that extent, return true.
+ *      Else, return false.
+ **/
+static bool committed_extent (const Workspace_t* ws, uint64_t offset, uint64_t bytes) {
+	const Workspace_entry_t key = { .offset = offset };
+	const Workspace_entry_t* e = bsearch(&key, ws->entries, ws->count, sizeof(Workspace_entry_t), compare_entries);
+	return e && e->bytes == bytes;
+}// end committed_extent
+
+/*
+ * PURPOSE: Save every registered matrix to the workspace. Matrices still
+ *      mapped from a committed extent keep it without being rewritten; the
+ *      rest are written to free space and, once the save commits, read back
+ *      from it. The new directory takes effect when its superblock is
+ *      written, after everything it points at is synced.
+ *      Nothing else may hold workspace-mapped data that is not registered.
+ * INPUTS:
+ *      Workspace, ws
+ *      Registry to save, reg
+ * RETURN:
+ *      If a write or sync fails, return false with the previous save intact.
+ *      Else, return true.
+ **/
+bool workspace_save (Workspace_t* ws, Registry_t* reg) {
+	if (!ws || !reg || ws->fd < 0) {
+		perror("workspace_save: bad input\n");
+		return false;
+	}
+	const size_t count = registry_count(reg);
+	Matrix_t** all = malloc((count ? count : 1) * sizeof(Matrix_t*));
+	Workspace_entry_t* entries = calloc(count ? count : 1, sizeof(Workspace_entry_t));
+	Workspace_extent_t* used = malloc((count + 1) * sizeof(Workspace_extent_t));
+	bool ok = all && entries && used;
+	if (!ok) {
+		perror("workspace_save: allocation error\n");
+	}
+	const size_t n = ok ? registry_snapshot(reg, all, count) : 0;
+
+	for (size_t i = 0; ok && i < n; ++i) {
+		const Matrix_t* m = all[i];
+		Workspace_entry_t* e = &entries[i];
+		memcpy(e->name, m->name, sizeof(e->name));
+		e->rows = m->rows;
+		e->cols = m->cols;
+		e->type = m->type;
+		e->format = m->format;
+		e->nnz = m->format == MATRIX_FORMAT_CSR ? m->nnz : 0;
+		e->bytes = matrix_stored_bytes(m);
+		uint64_t offset = 0;
+		size_t j = 0;
+		if (matrix_is_shared(m)) {
+			/* duplicates sharing a buffer share its extent too */
+			while (j < i && (all[j]->buffer != m->buffer || entries[j].bytes != e->bytes)) {
+				++j;
+			}
+		}
+		if (e->bytes == 0) {
+			e->offset = 0;
+		}
+		else if (matrix_is_shared(m) && j < i) {
+			e->offset = entries[j].offset;
+		}
+		else if (matrix_region(m, &offset) && committed_extent(ws, offset, e->bytes)) {
+			e->offset = offset;
+		}
+		else {
+			e->offset = allocate_extent(ws, round_pages(e->bytes));
+			ok = write_matrix_region(ws->fd, e->offset, m);
+		}
+		used[i] = (Workspace_extent_t){ .offset = e->offset, .length = round_pages(e->bytes) };
+	}
+
+	Workspace_extent_t directory = { 0, 0 };
+	if (ok) {
+		qsort(entries, n, sizeof(Workspace_entry_t), compare_entries);
+		const size_t dir_bytes = n * sizeof(Workspace_entry_t);
+		directory.length = round_pages(dir_bytes ? dir_bytes : 1);
+		directory.offset = allocate_extent(ws, directory.length);
+		used[n] = directory;
+
+		Workspace_super_t super;
+		memset(&super, 0, sizeof(super));
+		memcpy(super.magic, WORKSPACE_MAGIC, sizeof(super.magic));
+		super.version = WORKSPACE_VERSION;
+		super.entry_size = sizeof(Workspace_entry_t);
+		super.generation = ws->generation + 1;
+		super.directory_offset = directory.offset;
+		super.directory_count = n;
+		super.directory_checksum = checksum(entries, dir_bytes);
+		super.checksum = checksum(&super, offsetof(Workspace_super_t, checksum));
+		const unsigned int slot = 1 - ws->slot;
+
+		/* data and directory must be durable before the superblock points at them */
+		ok = pwrite_full(ws->fd, entries, dir_bytes, directory.offset)
+			&& fdatasync(ws->fd) == 0
+			&& pwrite_full(ws->fd, &super, sizeof(super), (uint64_t)slot * WORKSPACE_PAGE)
+			&& fdatasync(ws->fd) == 0;
+		if (ok) {
+			free(ws->entries);
+			ws->entries = entries;
+			ws->count = n;
+			ws->directory = directory;
+			ws->generation = super.generation;
+			ws->slot = slot;
+			entries = NULL;
+			/* freshly written matrices now read from the file, so the next save skips them */
+			for (size_t i = 0; i < n; ++i) {
+				uint64_t offset;
+				if (used[i].length > 0 && !matrix_region(all[i], &offset)) {
+					remap_matrix_region(all[i], ws->fd, used[i].offset);
+				}
+			}
+			ok = rebuild_free(ws, used, n + 1);
+			/* space past the last extent is unused by either superblock's directory once this one commits */
+			if (ok && ftruncate(ws->fd, ws->end) != 0) {
+				perror("workspace: ftruncate");
+			}
+		}
+		else {
+			printf("FAILED TO SAVE WORKSPACE\n");
+		}
+	}
+	if (entries) {
+		free_uncommitted(ws);
+	}
+	free(entries);
+	free(used);
+	free(all);
+	return ok;
+}// end workspace_save
+
+/*
+ * PURPOSE: Close a workspace file, releasing its lock. Matrices mapped from
+ *      it stay readable until destroyed.
+ * INPUTS:
+ *      Workspace, ws
+ * RETURN:
+ *      void
+ **/
+void workspace_close (Workspace_t* ws) {
+	if (!ws) {
+		return;
+	}
+	if (ws->fd >= 0) {
+		close(ws->fd);
+	}
+	free(ws->entries);
+	free(ws->free);
+	memset(ws, 0, sizeof(Workspace_t));
+	ws->fd = -1;
+}// end workspace_close
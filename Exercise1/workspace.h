@@ -0,0 +1,56 @@
+#ifndef _WORKSPACE_H_
+#define _WORKSPACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "matrix.h"
+#include "registry.h"
+
+/*
+ * A workspace file keeps every named matrix of a session. Each matrix's data
+ * sits in its own page-aligned extent; a directory extent lists them, and
+ * one of two superblock pages at the start of the file points at the current
+ * directory. Opening reads the directory and maps each extent read-only, so
+ * startup costs a few system calls per matrix whatever the data size.
+ * Saving writes changed matrices and a new directory into free space only,
+ * syncs, then writes the other superblock with the next generation: a crash
+ * at any point leaves the previous superblock and everything it points at
+ * intact.
+ */
+typedef struct {
+	char name[MATRIX_NAME_LEN];
+	uint8_t type;	/* Matrix_type_t, in what was padding before version 3 */
+	uint32_t format;
+	uint64_t rows;
+	uint64_t cols;
+	uint64_t nnz;
+	uint64_t offset;	/* page aligned; 0 with bytes 0 for a matrix with no data */
+	uint64_t bytes;
+}Workspace_entry_t;
+
+/* A run of file pages, used or free */
+typedef struct {
+	uint64_t offset;
+	uint64_t length;
+}Workspace_extent_t;
+
+typedef struct {
+	int fd;
+	uint64_t generation;	/* of the committed superblock, 0 before the first save */
+	unsigned int slot;	/* superblock page holding it */
+	Workspace_entry_t* entries;	/* committed directory, sorted by offset */
+	size_t count;
+	Workspace_extent_t directory;	/* committed directory extent */
+	Workspace_extent_t* free;	/* free runs between used extents, sorted by offset */
+	size_t free_count;
+	size_t free_capacity;
+	uint64_t end;	/* end of the last used extent, where the file grows from */
+}Workspace_t;
+
+bool workspace_open (Workspace_t* ws, const char* path, Registry_t* reg);
+bool workspace_save (Workspace_t* ws, Registry_t* reg);
+void workspace_close (Workspace_t* ws);
+
+#endif